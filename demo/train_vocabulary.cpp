@@ -0,0 +1,96 @@
+#include "config.hpp"
+#include "frame.hpp"
+#include "feature_detector.hpp"
+#include "feature_alignment.hpp"
+#include "brief.hpp"
+#include "vocabulary.hpp"
+#include "dataset.hpp"
+#include "time_tracing.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    LOG_ASSERT(argc == 5 || argc == 7) << "\n Usage : ./train_vocabulary config_file calib_file dataset_path output_file [k levels]";
+
+    Config::file_name_ = argv[1];
+    const std::string calib_file = argv[2];
+    const int k = argc == 7 ? std::stoi(argv[5]) : 10;
+    const int levels = argc == 7 ? std::stoi(argv[6]) : 5;
+
+    AbstractCamera::Ptr camera;
+    AbstractCamera::Model model = AbstractCamera::checkCameraModel(calib_file);
+    if(AbstractCamera::Model::PINHOLE == model)
+        camera = std::static_pointer_cast<AbstractCamera>(PinholeCamera::create(calib_file));
+    else if(AbstractCamera::Model::ATAN == model)
+        camera = std::static_pointer_cast<AbstractCamera>(AtanCamera::create(calib_file));
+    else
+        LOG(FATAL) << "Error camera model: " << model;
+
+    const int nlevel = Config::imageNLevel();
+    const int width = camera->width();
+    const int height = camera->height();
+    FastDetector::Ptr fast_detector = FastDetector::create(width, height, AlignPatch::Size, nlevel,
+                                                           Config::gridSize(), Config::gridMinSize(),
+                                                           Config::fastMaxThreshold(), Config::fastMinThreshold());
+
+    EuRocDataReader dataset(argv[3]);
+    const size_t N = dataset.leftImageSize();
+
+    //! the same corners and descriptors as the keyframes in the database
+    BRIEF brief;
+    std::vector<cv::Mat> descriptors;
+    size_t total = 0;
+    for(size_t i = 0; i < N; i++)
+    {
+        const EuRocDataReader::Image image_data = dataset.leftImage(i);
+        cv::Mat image = cv::imread(image_data.path, CV_LOAD_IMAGE_UNCHANGED);
+        if(image.empty())
+            continue;
+
+        Frame::Ptr frame = Frame::create(image, image_data.timestamp, camera);
+        Corners corners_new;
+        Corners corners_old;
+        fast_detector->detect(frame->images(), corners_new, corners_old, Config::minCornersPerKeyFrame());
+
+        std::vector<cv::KeyPoint> kps;
+        for(const Corner &corner : corners_new)
+        {
+            const int scale = 1 << corner.level;
+            if(corner.x <= BRIEF::EDGE_THRESHOLD || corner.y <= BRIEF::EDGE_THRESHOLD ||
+                corner.x >= width/scale - BRIEF::EDGE_THRESHOLD || corner.y >= height/scale - BRIEF::EDGE_THRESHOLD)
+                continue;
+
+            kps.emplace_back(cv::KeyPoint(corner.x, corner.y, 31, -1, 0, corner.level));
+        }
+
+        cv::Mat desc;
+        brief.compute(frame->images(), kps, desc);
+        if(desc.empty())
+            continue;
+
+        descriptors.push_back(desc);
+        total += desc.rows;
+        LOG_IF(INFO, i % 100 == 0) << "Image " << i << "/" << N << ", descriptors: " << total;
+    }
+
+    LOG_ASSERT(!descriptors.empty()) << "No descriptors in the dataset: " << argv[3];
+
+    ssvo::Timer<std::milli> timer;
+    timer.start();
+    Vocabulary::Ptr vocabulary = Vocabulary::create(k, levels);
+    vocabulary->train(descriptors);
+    timer.stop();
+
+    LOG_ASSERT(vocabulary->save(argv[4])) << "Can not save the vocabulary: " << argv[4];
+
+    std::cout << "images: " << descriptors.size()
+              << ", descriptors: " << total
+              << ", words: " << vocabulary->size()
+              << ", train time: " << timer.duration() << "ms" << std::endl;
+
+    return 0;
+}
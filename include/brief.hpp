@@ -1,8 +1,16 @@
 #ifndef _SSVO_BRIEF_HPP_
 #define _SSVO_BRIEF_HPP_
 
+#include <cstring>
 #include <opencv2/core.hpp>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SSVO_POPCOUNT64(x) ((int)__popcnt64(x))
+#else
+#define SSVO_POPCOUNT64(x) __builtin_popcountll(x)
+#endif
+
 namespace ssvo
 {
 
@@ -14,18 +22,49 @@ public:
         PATCH_SIZE = 31,
         HALF_PATCH_SIZE = 15,
         EDGE_THRESHOLD = 19,
+        DESCRIPTOR_BYTES = 32,
+        ANGLE_BINS = 72, //!< 5 degrees for each rotated pattern
     };
 
     BRIEF();
 
+    //! the keypoints are in the first level, and their octaves are the levels,
+    //! the angles are quantized to the rotated patterns, and the keypoints are computed in parallel
     void compute(const std::vector<cv::Mat> &images, const std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors);
 
     float IC_Angle(const cv::Mat &image, cv::Point2f pt, const std::vector<int> &u_max);
 
     void compute(const cv::KeyPoint &kpt, const cv::Mat &img, const cv::Point *pattern, uchar *desc);
 
+    //! the pattern before rotated and the bounds of the circular patch, for the single keypoint compute
+    inline const std::vector<cv::Point>& pattern() const { return pattern_; }
+
+    inline const std::vector<int>& umax() const { return umax_; }
+
+    //! Hamming distance by the popcount of 64-bit words, which is the POPCNT instruction when the CPU supports it
+    static inline int distance(const uchar *a, const uchar *b)
+    {
+        uint64_t pa[4], pb[4];
+        std::memcpy(pa, a, DESCRIPTOR_BYTES);
+        std::memcpy(pb, b, DESCRIPTOR_BYTES);
+        return SSVO_POPCOUNT64(pa[0] ^ pb[0]) + SSVO_POPCOUNT64(pa[1] ^ pb[1]) +
+               SSVO_POPCOUNT64(pa[2] ^ pb[2]) + SSVO_POPCOUNT64(pa[3] ^ pb[3]);
+    }
+
+    //! brute-force, the nearest train descriptor of each query within max_distance
+    static void match(const cv::Mat &query, const cv::Mat &train, std::vector<cv::DMatch> &matches, int max_distance = 64);
+
+    //! brute-force, and the nearest should be closer than ratio of the second nearest
+    static void matchRatio(const cv::Mat &query, const cv::Mat &train, std::vector<cv::DMatch> &matches, float ratio = 0.8f, int max_distance = 64);
+
 private:
 
+    //! the pattern is rotated already, so only the lookups are left
+    void compute(const cv::Mat &img, cv::Point2f pt, const cv::Point *pattern, uchar *desc) const;
+
+    //! ANGLE_BINS patterns of 512 points rotated by the angle of each bin, built once for all
+    static const std::vector<cv::Point>& rotatedPatterns();
+
     std::vector<cv::Point> pattern_;
 
     std::vector<int> umax_;
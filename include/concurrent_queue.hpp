@@ -0,0 +1,231 @@
+#ifndef _SSVO_CONCURRENT_QUEUE_HPP_
+#define _SSVO_CONCURRENT_QUEUE_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+#include "global.hpp"
+
+namespace ssvo
+{
+
+//! Wakeup primitive for a single consumer which sleeps until some producer signals it.
+//! The mutex is only touched when the consumer is really going to sleep, so producers
+//! do not contend with each other while the consumer is busy.
+class WakeupEvent : public noncopyable
+{
+public:
+
+    WakeupEvent() : waiting_(false) {}
+
+    //! the fence pairs with the one in wait(), so either the producer sees waiting_
+    //! or the consumer sees the new data in pred(), no wakeup can be lost
+    inline void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!waiting_.load())
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+
+    //! sleep until pred() return true, pred should be cheap and lock-free
+    template<typename Predicate>
+    inline void wait(Predicate pred)
+    {
+        if(pred())
+            return;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiting_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cond_.wait(lock, pred);
+        waiting_.store(false);
+    }
+
+    //! return the result of pred() after waked up or timeout
+    template<typename Predicate, typename Rep, typename Period>
+    inline bool waitFor(Predicate pred, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        if(pred())
+            return true;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiting_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool result = cond_.wait_for(lock, timeout, pred);
+        waiting_.store(false);
+        return result;
+    }
+
+private:
+
+    std::atomic<bool> waiting_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+//! std::mutex which counts the acquisitions of each thread, to measure how many locks are taken per frame.
+//! The counter is thread local, so counting adds no contention between the threads.
+class CountingMutex : public noncopyable
+{
+public:
+
+    inline void lock()
+    {
+        mutex_.lock();
+        counter()++;
+    }
+
+    inline bool try_lock()
+    {
+        if(!mutex_.try_lock())
+            return false;
+
+        counter()++;
+        return true;
+    }
+
+    inline void unlock() { mutex_.unlock(); }
+
+    //! the acquisitions of all the CountingMutex by the calling thread
+    inline static uint64_t acquisitions() { return counter(); }
+
+private:
+
+    inline static uint64_t &counter()
+    {
+        static thread_local uint64_t count = 0;
+        return count;
+    }
+
+    std::mutex mutex_;
+};
+
+//! Lock-free multi-producer single-consumer queue, modified from Dmitry Vyukov's intrusive MPSC node-based queue
+//! http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+//! push() can be called from any thread, while tryPop() should only be called from the consumer thread.
+template<typename T>
+class MPSCQueue : public noncopyable
+{
+    struct Node
+    {
+        std::atomic<Node*> next;
+        T value;
+
+        Node() : next(nullptr) {}
+        explicit Node(const T &v) : next(nullptr), value(v) {}
+    };
+
+public:
+
+    MPSCQueue() : size_(0)
+    {
+        Node* stub = new Node();
+        head_.store(stub);
+        tail_ = stub;
+    }
+
+    ~MPSCQueue()
+    {
+        T value;
+        while(tryPop(value));
+        delete tail_;
+    }
+
+    inline void push(const T &value)
+    {
+        Node* node = new Node(value);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+        size_.fetch_add(1);
+    }
+
+    inline bool tryPop(T &value)
+    {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if(next == nullptr)
+            return false;
+
+        value = std::move(next->value);
+        next->value = T();
+        tail_ = next;
+        delete tail;
+        size_.fetch_sub(1);
+        return true;
+    }
+
+    //! the size is only a hint when the producers are working
+    inline size_t size() const { return size_.load(); }
+
+    inline bool empty() const { return size() == 0; }
+
+private:
+
+    std::atomic<Node*> head_;
+    Node* tail_;
+    std::atomic<size_t> size_;
+};
+
+//! MPSC queue with blocking pop, the idle consumer sleeps without polling
+template<typename T>
+class BlockingQueue : public noncopyable
+{
+public:
+
+    BlockingQueue() : stop_(false) {}
+
+    inline void push(const T &value)
+    {
+        queue_.push(value);
+        event_.notify();
+    }
+
+    inline bool tryPop(T &value) { return queue_.tryPop(value); }
+
+    //! block until a item arrives or stop() is called, return false if stopped with empty queue
+    inline bool waitAndPop(T &value)
+    {
+        while(true)
+        {
+            if(queue_.tryPop(value))
+                return true;
+            if(stop_.load())
+                return false;
+            //! a producer may be in the middle of linking its node, spin a little in this case
+            if(!queue_.empty())
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            event_.wait([this]{ return !queue_.empty() || stop_.load(); });
+        }
+    }
+
+    inline void stop()
+    {
+        stop_.store(true);
+        event_.notify();
+    }
+
+    inline bool isStopped() const { return stop_.load(); }
+
+    inline size_t size() const { return queue_.size(); }
+
+    inline bool empty() const { return queue_.empty(); }
+
+private:
+
+    MPSCQueue<T> queue_;
+    WakeupEvent event_;
+    std::atomic<bool> stop_;
+};
+
+}
+
+#endif //_SSVO_CONCURRENT_QUEUE_HPP_
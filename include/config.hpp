@@ -15,6 +15,14 @@ class Config
 {
 public:
 
+    //! settings of a Ceres solver
+    struct SolverProfile{
+        int num_threads;            //! <= 0 for all the hardware threads
+        std::string linear_solver;  //! auto, dense_schur, sparse_schur, iterative_schur or dense_qr
+        double max_time;            //! in seconds, <= 0 for unlimited
+        int max_iterations;         //! <= 0 for the default of each problem
+    };
+
     static int imageNLevel(){return getInstance().image_nlevel_;}
 
     static double imagePixelSigma(){return getInstance().image_sigma_;}
@@ -49,6 +57,22 @@ public:
 
     static int maxLocalBAKeyFrames(){return getInstance().mapping_max_local_ba_kfs_;}
 
+    static int maxCoalescedKeyFrames(){return getInstance().mapping_max_coalesced_kfs_;}
+
+    static bool abortableLocalBA(){return getInstance().mapping_abortable_ba_;}
+
+    static double cullingRedundantRatio(){return getInstance().mapping_culling_redundant_ratio_;}
+
+    static double mapVoxelSize(){return getInstance().mapping_voxel_size_;}
+
+    static double keyFrameImageMemoryCap(){return getInstance().mapping_image_memory_cap_;}
+
+    static int submapKeyFrames(){return getInstance().mapping_submap_kfs_;}
+
+    static int submapResident(){return getInstance().mapping_submap_resident_;}
+
+    static std::string submapDirectory(){return getInstance().mapping_submap_dir_;}
+
     static int minLocalBAConnectedFts(){return getInstance().mapping_min_local_ba_connected_fts_;}
 
     static int alignTopLevel(){return getInstance().align_top_level_;}
@@ -67,10 +91,41 @@ public:
 
     static int maxPerprocessKeyFrames(){return getInstance().max_perprocess_kfs_;}
 
+    static int maxSeedsPerFrame(){return getInstance().max_seeds_per_frame_;}
+
+    static double maxSeedsTimeUs(){return getInstance().max_seeds_time_us_;}
+
+    static bool kltNative(){return getInstance().klt_native_;}
+
+    static int kltCheck(){return getInstance().klt_check_;}
+
+    static double kltMaxResidual(){return getInstance().klt_max_residual_;}
+
+    static bool optimizerMotionNative(){return getInstance().optimizer_motion_native_;}
+
+    static bool optimizerLocalBANative(){return getInstance().optimizer_local_ba_native_;}
+
+    static bool optimizerLocalBAInvDepth(){return getInstance().optimizer_local_ba_inv_depth_;}
+
+    static bool optimizerLocalBAPersistent(){return getInstance().optimizer_local_ba_persistent_;}
+
+    static const SolverProfile& globalBAProfile(){return getInstance().global_ba_profile_;}
+
+    static const SolverProfile& localBAProfile(){return getInstance().local_ba_profile_;}
+
+    static const SolverProfile& motionBAProfile(){return getInstance().motion_ba_profile_;}
+
+    static int threadPoolSize(){return getInstance().thread_pool_size_;}
+
+    static const std::vector<int>& threadPoolAffinity(){return getInstance().thread_pool_affinity_;}
+
     static string timeTracingDirectory(){return getInstance().time_trace_dir_;}
 
     static std::string DBoWDirectory(){return getInstance().dbow_dir_;}
 
+    //! the binary vocabulary of the built-in place recognition, which is disabled if empty
+    static std::string vocabularyFile(){return getInstance().voc_file_;}
+
 private:
     static Config& getInstance()
     {
@@ -110,6 +165,40 @@ private:
         mapping_max_local_ba_kfs_ = (int)fs["Mapping.max_local_ba_kfs"];
         mapping_min_local_ba_connected_fts_ = (int)fs["Mapping.min_local_ba_connected_fts"];
 
+        //! one local BA for each keyframe and never interrupted by default
+        mapping_max_coalesced_kfs_ = 1;
+        mapping_abortable_ba_ = false;
+        if(!fs["Mapping.max_coalesced_kfs"].empty())
+            mapping_max_coalesced_kfs_ = (int)fs["Mapping.max_coalesced_kfs"];
+        if(!fs["Mapping.abortable_ba"].empty())
+            mapping_abortable_ba_ = (int)fs["Mapping.abortable_ba"];
+
+        //! keyframes are never culled by default
+        mapping_culling_redundant_ratio_ = 0.0;
+        if(!fs["Mapping.culling_redundant_ratio"].empty())
+            mapping_culling_redundant_ratio_ = (double)fs["Mapping.culling_redundant_ratio"];
+
+        //! no voxel index by default
+        mapping_voxel_size_ = 0.0;
+        if(!fs["Mapping.voxel_size"].empty())
+            mapping_voxel_size_ = (double)fs["Mapping.voxel_size"];
+
+        //! the images of keyframes are never compressed by default
+        mapping_image_memory_cap_ = 0.0;
+        if(!fs["Mapping.image_memory_cap"].empty())
+            mapping_image_memory_cap_ = (double)fs["Mapping.image_memory_cap"];
+
+        //! no submap by default
+        mapping_submap_kfs_ = 0;
+        mapping_submap_resident_ = 4;
+        mapping_submap_dir_ = "/tmp";
+        if(!fs["Mapping.submap_kfs"].empty())
+            mapping_submap_kfs_ = (int)fs["Mapping.submap_kfs"];
+        if(!fs["Mapping.submap_resident"].empty())
+            mapping_submap_resident_ = (int)fs["Mapping.submap_resident"];
+        if(!fs["Mapping.submap_dir"].empty())
+            fs["Mapping.submap_dir"] >> mapping_submap_dir_;
+
         //! Align
         align_top_level_ = (int)fs["Align.top_level"];
         align_top_level_ = MIN(align_top_level_, image_nlevel_-1);
@@ -125,6 +214,59 @@ private:
         max_seeds_buffer_ = (int)fs["DepthFilter.max_seeds_buffer"];
         max_perprocess_kfs_ = (int)fs["DepthFilter.max_perprocess_kfs"];
 
+        //! seeds budget for each frame, 0 for unlimited
+        max_seeds_per_frame_ = 0;
+        max_seeds_time_us_ = 0;
+        if(!fs["DepthFilter.max_seeds_per_frame"].empty())
+            max_seeds_per_frame_ = (int)fs["DepthFilter.max_seeds_per_frame"];
+        if(!fs["DepthFilter.max_seeds_time_us"].empty())
+            max_seeds_time_us_ = (double)fs["DepthFilter.max_seeds_time_us"];
+
+        //! KLT, use OpenCV's pyramidal LK with forward-backward check by default
+        klt_native_ = false;
+        klt_check_ = 1;
+        klt_max_residual_ = 10.0;
+        if(!fs["KLT.native"].empty())
+            klt_native_ = (int)fs["KLT.native"];
+        if(!fs["KLT.check"].empty())
+            klt_check_ = (int)fs["KLT.check"];
+        LOG_ASSERT(klt_check_ >= 0 && klt_check_ <= 2) << "Please check the config file! KLT.check should be 0, 1 or 2, but it is " << klt_check_;
+        if(!fs["KLT.max_residual"].empty())
+            klt_max_residual_ = (double)fs["KLT.max_residual"];
+
+        //! Optimizer, use Ceres by default
+        optimizer_motion_native_ = false;
+        if(!fs["Optimizer.motion_native"].empty())
+            optimizer_motion_native_ = (int)fs["Optimizer.motion_native"];
+
+        optimizer_local_ba_native_ = false;
+        if(!fs["Optimizer.local_ba_native"].empty())
+            optimizer_local_ba_native_ = (int)fs["Optimizer.local_ba_native"];
+
+        optimizer_local_ba_inv_depth_ = false;
+        if(!fs["Optimizer.local_ba_inv_depth"].empty())
+            optimizer_local_ba_inv_depth_ = (int)fs["Optimizer.local_ba_inv_depth"];
+
+        optimizer_local_ba_persistent_ = false;
+        if(!fs["Optimizer.local_ba_persistent"].empty())
+            optimizer_local_ba_persistent_ = (int)fs["Optimizer.local_ba_persistent"];
+
+        global_ba_profile_ = readSolverProfile(fs, "Optimizer.global");
+        local_ba_profile_ = readSolverProfile(fs, "Optimizer.local");
+        motion_ba_profile_ = readSolverProfile(fs, "Optimizer.motion");
+
+        //! ThreadPool, num_threads <= 0 means using all the hardware threads
+        thread_pool_size_ = 0;
+        if(!fs["ThreadPool.num_threads"].empty())
+            thread_pool_size_ = (int)fs["ThreadPool.num_threads"];
+
+        cv::FileNode affinity_node = fs["ThreadPool.cpu_affinity"];
+        if(affinity_node.isSeq())
+        {
+            for(cv::FileNodeIterator it = affinity_node.begin(); it != affinity_node.end(); ++it)
+                thread_pool_affinity_.push_back((int)*it);
+        }
+
         //! glog
         if(!fs["Glog.alsologtostderr"].empty())
             fs["Glog.alsologtostderr"] >> FLAGS_alsologtostderr;
@@ -152,9 +294,34 @@ private:
         if(!fs["DBoW.voc_dir"].empty())
             fs["DBoW.voc_dir"] >> dbow_dir_;
 
+        //! BoW
+        if(!fs["BoW.voc_file"].empty())
+            fs["BoW.voc_file"] >> voc_file_;
+
         fs.release();
     }
 
+    //! single thread dense Schur if not set
+    static SolverProfile readSolverProfile(const cv::FileStorage &fs, const std::string &name)
+    {
+        SolverProfile profile;
+        profile.num_threads = 1;
+        profile.linear_solver = "dense_schur";
+        profile.max_time = 0;
+        profile.max_iterations = 0;
+
+        if(!fs[name + ".num_threads"].empty())
+            profile.num_threads = (int)fs[name + ".num_threads"];
+        if(!fs[name + ".linear_solver"].empty())
+            profile.linear_solver = (std::string)fs[name + ".linear_solver"];
+        if(!fs[name + ".max_time"].empty())
+            profile.max_time = (double)fs[name + ".max_time"];
+        if(!fs[name + ".max_iterations"].empty())
+            profile.max_iterations = (int)fs[name + ".max_iterations"];
+
+        return profile;
+    }
+
 public:
     //! config file's name
     static string file_name_;
@@ -187,6 +354,14 @@ private:
     int mapping_min_corners_;
     int mapping_max_reproject_kfs_;
     int mapping_max_local_ba_kfs_;
+    int mapping_max_coalesced_kfs_;
+    bool mapping_abortable_ba_;
+    double mapping_culling_redundant_ratio_;
+    double mapping_voxel_size_;
+    double mapping_image_memory_cap_;
+    int mapping_submap_kfs_;
+    int mapping_submap_resident_;
+    std::string mapping_submap_dir_;
     int mapping_min_local_ba_connected_fts_;
 
     //! Align
@@ -202,12 +377,35 @@ private:
     //! DepthFilter
     int max_seeds_buffer_;
     int max_perprocess_kfs_;
+    int max_seeds_per_frame_;
+    double max_seeds_time_us_;
+
+    //! KLT
+    bool klt_native_;
+    int klt_check_;
+    double klt_max_residual_;
+
+    //! Optimizer
+    bool optimizer_motion_native_;
+    bool optimizer_local_ba_native_;
+    bool optimizer_local_ba_inv_depth_;
+    bool optimizer_local_ba_persistent_;
+    SolverProfile global_ba_profile_;
+    SolverProfile local_ba_profile_;
+    SolverProfile motion_ba_profile_;
+
+    //! ThreadPool
+    int thread_pool_size_;
+    std::vector<int> thread_pool_affinity_;
 
     //! TimeTrace
     string time_trace_dir_;
     
     //! DBoW
     std::string dbow_dir_;
+
+    //! BoW
+    std::string voc_file_;
 };
 
 }
@@ -2,6 +2,7 @@
 #define _SSVO_DEPTH_FILTER_HPP_
 
 #include "global.hpp"
+#include "concurrent_queue.hpp"
 #include "map.hpp"
 #include "seed.hpp"
 #include "feature_detector.hpp"
@@ -34,6 +35,9 @@ public:
 
     void stopMainThread();
 
+    //! block until the frames inserted are all processed by the main thread and the seeds tracking is done
+    void waitForIdle();
+
     void logSeedsInfo();
 
     static Ptr create(const FastDetector::Ptr &fast_detector, const Callback &callback, bool report = false, bool verbose = false)
@@ -65,6 +69,13 @@ private:
 
     int reprojectSeeds(const KeyFrame::Ptr& keyframe, const Frame::Ptr &frame, double epl_err, double px_error, bool created = true);
 
+    int reprojectSeed(const Feature::Ptr &seed_ft, const KeyFrame::Ptr& keyframe, const Frame::Ptr &frame,
+                      const SE3d &T_cur_from_ref, double epl_err, double px_error, bool created);
+
+    void resetSeedsBudget();
+
+    bool consumeSeedsBudget();
+
     bool findEpipolarMatch(const Seed::Ptr &seed, const KeyFrame::Ptr &keyframe, const Frame::Ptr &frame,
                            const SE3d &T_cur_from_ref, Vector2d &px_matched, int &level_matched);
 
@@ -77,15 +88,28 @@ private:
         double max_epl_length;
         double epl_dist2_threshold;
         double klt_epslion;
+        bool klt_native;
+        int klt_check;
+        double klt_max_residual;
         double align_epslion;
         double pixel_error_threshold;
         double min_frame_disparity;
         double min_pixel_disparity;
+        int max_seeds_per_frame; //! budget of seeds update and epipolar search for each frame, <=0 for unlimited
+        double max_seeds_time_us;
     } options_;
 
+    //! budget left for current frame
+    int seeds_budget_count_;
+    int seeds_budget_skipped_;
+    std::chrono::steady_clock::time_point seeds_budget_deadline_;
+
     FastDetector::Ptr fast_detector_;
 
-    std::deque<std::pair<Frame::Ptr, KeyFrame::Ptr> > frames_buffer_;
+    BlockingQueue<std::pair<Frame::Ptr, KeyFrame::Ptr> > frames_buffer_;
+    //! frames inserted but not processed yet, the waiters for idle are woken when it drops
+    std::atomic<int> frames_pending_;
+    WakeupEvent idle_event_;
 //    std::map<uint64_t, std::tuple<int, int> > seeds_convergence_rate_;
 
     const bool report_;
@@ -95,11 +119,8 @@ private:
     std::shared_ptr<std::thread> filter_thread_;
 
     bool track_thread_enabled_;
-    bool stop_require_;
-    std::mutex mutex_stop_;
-    std::mutex mutex_frame_;
+    std::atomic<bool> stop_require_;
     //! track thread
-    std::condition_variable cond_process_main_;
     std::future<int> seeds_track_future_;
 };
 
@@ -6,13 +6,14 @@
 #include <Eigen/Dense>
 
 #include "global.hpp"
+#include "memory_pool.hpp"
 
 namespace ssvo {
 
 class MapPoint;
 class Seed;
 
-class Feature
+class Feature : public ObjectCounter<Feature>
 {
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
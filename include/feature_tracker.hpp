@@ -40,14 +40,15 @@ public:
     static bool trackFeature(const Frame::Ptr &frame_ref, const Frame::Ptr &frame_cur, const Feature::Ptr &ft_ref,
                              Vector2d &px_cur, int &level_cur, const int max_iterations = 30, const double epslion = 0.01, const double threshold = 4.0, bool verbose = false);
 
-    inline static FeatureTracker::Ptr create(int width, int height, int grid_size, int border, bool report = false, bool verbose = false)
-    {return FeatureTracker::Ptr(new FeatureTracker(width, height, grid_size, border, report, verbose));}
+    //! the map points in the frustum are also candidates if the voxel index of the map is enabled
+    inline static FeatureTracker::Ptr create(const Map::Ptr &map, int width, int height, int grid_size, int border, bool report = false, bool verbose = false)
+    {return FeatureTracker::Ptr(new FeatureTracker(map, width, height, grid_size, border, report, verbose));}
 
 private:
 
-    FeatureTracker(int width, int height, int grid_size, int border, bool report = false, bool verbose = false);
+    FeatureTracker(const Map::Ptr &map, int width, int height, int grid_size, int border, bool report = false, bool verbose = false);
 
-    bool reprojectMapPointToCell(const Frame::Ptr &frame, const MapPoint::Ptr &point);
+    bool reprojectMapPointToCell(const Frame::Ptr &frame, const SE3d &Tcw, const MapPoint::Ptr &point, const Vector3d &pose_world);
 
     bool matchMapPointsFromCell(const Frame::Ptr &frame, Grid<Feature::Ptr>::Cell &cell);
 
@@ -62,11 +63,18 @@ private:
         int num_align_iter;
         double max_align_epsilon;
         double max_align_error2;
+        int max_frustum_mpts;
+        double frustum_depth_ratio;
     } options_;
 
+    Map::Ptr map_;
+
     Grid<Feature::Ptr> grid_;
     std::vector<size_t> grid_order_;
 
+    //! reused for every frame
+    std::vector<MapPoint::Ptr> mpts_buffer_;
+
     bool report_;
     bool verbose_;
     int total_project_;
@@ -7,25 +7,40 @@
 #include "map_point.hpp"
 #include "seed.hpp"
 #include "feature_detector.hpp"
+#include "memory_pool.hpp"
 
 namespace ssvo{
 
 class KeyFrame;
+class SubmapFile;
 
-class Frame : public noncopyable
+class Frame : public noncopyable, public ObjectCounter<Frame>
 {
 public:
 
-    virtual ~Frame() {};
+    virtual ~Frame();
 
     typedef std::shared_ptr<Frame> Ptr;
 
+    //! where the image pyramid is kept, raw in memory, compressed in memory, or in the submap file
+    enum ImageTier {
+        IMAGE_RAW,
+        IMAGE_COMPRESSED,
+        IMAGE_OFFLOADED,
+    };
+
+    //! decoded if the images are compressed or offloaded, and kept in a small cache of the recently used pyramids,
+    //! the images stay compressed or offloaded
     const ImgPyr images() const;
 
     const ImgPyr opticalImages() const;
 
+    //! the same as images()[level]
     const cv::Mat getImage(int level) const;
 
+    //! decoded without the cache, for the one-off uses of the images
+    void copyImages(ImgPyr &img_pyr) const;
+
     //! Transform (c)amera from (w)orld
     SE3d Tcw();
 
@@ -58,6 +73,21 @@ public:
 
     std::vector<MapPoint::Ptr> getMapPoints();
 
+    //! the buffers are cleared first, and no allocation once they are large enough
+    void getFeatures(std::vector<Feature::Ptr> &fts);
+
+    void getMapPoints(std::vector<MapPoint::Ptr> &mpts);
+
+    //! visit the features without copying, func(mpt, ft) is called with the features locked,
+    //! so it should not change the features of this frame or read the features of other frames
+    template<typename Func>
+    inline void forEachFeature(Func func)
+    {
+        std::lock_guard<CountingMutex> lock(mutex_feature_);
+        for(const auto &it : mpt_fts_)
+            func(it.first, it.second);
+    }
+
     bool addFeature(const Feature::Ptr &ft);
 
     bool removeFeature(const Feature::Ptr &ft);
@@ -71,6 +101,9 @@ public:
 
     std::vector<Feature::Ptr> getSeeds();
 
+    //! the buffer is cleared first, the same as getFeatures
+    void getSeeds(std::vector<Feature::Ptr> &fts);
+
     bool addSeed(const Feature::Ptr &ft);
 
     bool removeSeed(const Seed::Ptr &seed);
@@ -83,7 +116,8 @@ public:
 
     inline void setRefKeyFrame(const std::shared_ptr<KeyFrame> &kf) {ref_keyframe_ = kf;}
 
-    inline std::shared_ptr<KeyFrame> getRefKeyFrame() const {return ref_keyframe_;}
+    //! null if the reference keyframe has been released
+    inline std::shared_ptr<KeyFrame> getRefKeyFrame() const {return ref_keyframe_.lock();}
 
     inline static Ptr create(const cv::Mat& img, const double timestamp, AbstractCamera::Ptr cam)
     { return Ptr(new Frame(img, timestamp, cam)); }
@@ -119,20 +153,30 @@ protected:
 
     std::unordered_map<Seed::Ptr, Feature::Ptr> seed_fts_;
 
+    //! empty when the images are compressed or offloaded
     ImgPyr img_pyr_;
+    std::vector<std::vector<uchar> > img_compressed_;
+    //! the compressed images are also in the submap file once offloaded, at (offset, size) for each level
+    std::shared_ptr<SubmapFile> img_file_;
+    std::vector<std::pair<size_t, size_t> > img_offsets_;
+    mutable CountingMutex mutex_image_;
 
     SE3d Tcw_;
     SE3d Twc_;
     Vector3d Dw_;
 
-    std::shared_ptr<KeyFrame> ref_keyframe_;
+    //! not owned, the keyframes are kept by the map
+    std::weak_ptr<KeyFrame> ref_keyframe_;
 
-    std::mutex mutex_pose_;
-    std::mutex mutex_feature_;
-    std::mutex mutex_seed_;
+    CountingMutex mutex_pose_;
+    CountingMutex mutex_feature_;
+    CountingMutex mutex_seed_;
 
 private:
 
+    //! called with mutex_image_ locked, the images are not changed
+    void decodeImages(ImgPyr &img_pyr) const;
+
     ImgPyr optical_pyr_;
 };
 
@@ -9,23 +9,50 @@ namespace ssvo
 
 class Map;
 
-class KeyFrame: public Frame, public std::enable_shared_from_this<KeyFrame>
+class KeyFrame: public Frame, public ObjectCounter<KeyFrame>, public std::enable_shared_from_this<KeyFrame>
 {
+    friend class Map;
+
 public:
 
     typedef std::shared_ptr<KeyFrame> Ptr;
 
+    //! count the map points shared with other keyframes again, the weights are also kept by the map points incrementally
     void updateConnections();
 
     void setBad();
 
     bool isBad();
 
-    std::set<KeyFrame::Ptr> getConnectedKeyFrames(int num=-1, int min_fts = 0);
+    //! ordered by weight, from the most shared
+    std::vector<KeyFrame::Ptr> getConnectedKeyFrames(int num=-1, int min_fts = 0);
+
+    //! the neighbours of the connected keyframes, ordered by how many connected keyframes they are linked to,
+    //! and cached until the connections of this keyframe or its neighbours change
+    std::vector<KeyFrame::Ptr> getSubConnectedKeyFrames(int num=-1);
+
+    //! change the weight of the connection with kf, called by the map points as the observations are added or removed
+    void changeConnection(const KeyFrame::Ptr &kf, const int delta);
+
+    //! increased whenever any connection of this keyframe changes
+    inline uint64_t connectionVersion() const { return connection_version_.load(); }
+
+    //! encode the image pyramid to PNG losslessly, it is decoded when the images are used again, but kept compressed.
+    //! The images already held by others are not affected. Return false if they are not raw.
+    //! The ones in the submap file are just dropped from the memory
+    bool compressImages();
+
+    //! append the compressed images to the submap file before it is sealed, done once for each keyframe
+    bool writeImages(const std::shared_ptr<SubmapFile> &file);
 
-    std::set<KeyFrame::Ptr> getSubConnectedKeyFrames(int num=-1);
+    //! drop the images in the memory if they are in a sealed submap file, they are read from the file when used
+    bool dropImages();
 
-    std::set<KeyFrame::Ptr> getOrderedSubConnectedKeyFrames();
+    //! the bytes of the image pyramid in the memory
+    size_t imageBytes(ImageTier &tier);
+
+    //! only the keyframes, while Frame::liveObjects counts the keyframes too
+    using ObjectCounter<KeyFrame>::liveObjects;
 
     const ImgPyr opticalImages() const = delete;    //! disable this function
 
@@ -36,12 +63,16 @@ private:
 
     KeyFrame(const Frame::Ptr frame);
 
-    void addConnection(const KeyFrame::Ptr &kf, const int weight);
+    //! restored by the map from file, with the ids saved
+    KeyFrame(const ImgPyr &img_pyr, const uint64_t id, const uint64_t frame_id, const double timestamp, const AbstractCamera::Ptr &cam);
 
-    void updateOrderedConnections();
+    void setConnection(const KeyFrame::Ptr &kf, const int weight);
 
     void removeConnection(const KeyFrame::Ptr &kf);
 
+    //! called with mutex_connection_ locked
+    void updateOrderedConnections();
+
 public:
 
     static uint64_t next_id_;
@@ -54,13 +85,25 @@ public:
 
 private:
 
-    std::map<KeyFrame::Ptr, int> connectedKeyFrames_;
+    typedef std::vector<std::pair<KeyFrame::Ptr, int> > Connections;
+
+    //! weights of all the keyframes sharing map points, sorted by the id of keyframe
+    Connections connectedKeyFrames_;
 
-    std::multimap<int, KeyFrame::Ptr> orderedConnectedKeyFrames_;
+    //! the connections with enough weight, sorted by weight, rebuilt lazily after the weights changed
+    Connections orderedConnectedKeyFrames_;
+    bool ordered_connections_dirty_;
+    std::atomic<uint64_t> connection_version_;
 
     bool isBad_;
 
-    std::mutex mutex_connection_;
+    //! the second-order neighbours, valid for the sum of connection versions of this keyframe and its neighbours
+    std::vector<KeyFrame::Ptr> sub_connected_cache_;
+    uint64_t sub_connected_signature_;
+    int sub_connected_num_;
+    CountingMutex mutex_sub_connected_;
+
+    CountingMutex mutex_connection_;
 
 };
 
@@ -0,0 +1,82 @@
+#ifndef _SSVO_LOCAL_BA_PROBLEM_HPP_
+#define _SSVO_LOCAL_BA_PROBLEM_HPP_
+
+#include "optimizer.hpp"
+
+namespace ssvo
+{
+
+//! Ceres problem of the sliding window BA kept between keyframes.
+//! Only the blocks entering or leaving the window are added or removed as it slides,
+//! and the cost functions of the removed observations are reused by the new ones.
+class LocalBAProblem : public noncopyable
+{
+public:
+
+    LocalBAProblem();
+
+    void clear();
+
+    //! slide to the window of the keyframe, and reset the parameters to the current poses,
+    //! the keyframes connected to the keyframe are optimized, and the others observing the local map points are fixed
+    void update(const KeyFrame::Ptr &keyframe, int size, int min_shared_fts, double huber);
+
+    inline ceres::Problem &problem() { return *problem_; }
+
+    inline const std::set<KeyFrame::Ptr> &activedKeyFrames() const { return actived_keyframes_; }
+
+    inline const std::set<KeyFrame::Ptr> &fixedKeyFrames() const { return fixed_keyframes_; }
+
+    inline const std::unordered_set<MapPoint::Ptr> &localMapPoints() const { return local_mappoints_; }
+
+    //! the keyframe is held by a pose block, as optimized or fixed
+    inline bool hasKeyFrame(const KeyFrame::Ptr &kf) const { return poses_.count(kf) != 0; }
+
+    //! residual blocks added and removed by the last update
+    inline int addedResiduals() const { return added_residuals_; }
+
+    inline int removedResiduals() const { return removed_residuals_; }
+
+private:
+
+    struct Residual{
+        Feature::Ptr ft;
+        ceres::ResidualBlockId id;
+        ceres_slover::ReprojectionErrorSE3 *cost;
+    };
+
+    typedef std::unordered_map<KeyFrame::Ptr, Residual> Residuals;
+
+    void addPose(const KeyFrame::Ptr &kf, bool fixed);
+
+    void addResidual(const MapPoint::Ptr &mpt, const KeyFrame::Ptr &kf, const Feature::Ptr &ft, Residuals &residuals);
+
+    void removeResidual(Residual &residual);
+
+private:
+
+    //! declared before the problem, which refers to them and is destroyed first
+    std::vector<std::unique_ptr<ceres_slover::ReprojectionErrorSE3> > cost_pool_;
+    std::vector<ceres_slover::ReprojectionErrorSE3*> cost_free_;
+    std::unique_ptr<ceres::LocalParameterization> local_parameterization_;
+    std::unique_ptr<ceres::LossFunction> loss_function_;
+    double huber_;
+
+    std::unique_ptr<ceres::Problem> problem_;
+
+    //! pose blocks with their fixed flags, and the residuals of each point block
+    std::unordered_map<KeyFrame::Ptr, bool> poses_;
+    std::unordered_map<MapPoint::Ptr, Residuals> points_;
+
+    std::set<KeyFrame::Ptr> actived_keyframes_;
+    std::set<KeyFrame::Ptr> fixed_keyframes_;
+    std::unordered_set<MapPoint::Ptr> local_mappoints_;
+    std::vector<MapPoint::Ptr> mpts_buffer_;
+
+    int added_residuals_;
+    int removed_residuals_;
+};
+
+}
+
+#endif //_SSVO_LOCAL_BA_PROBLEM_HPP_
@@ -0,0 +1,129 @@
+#ifndef _SSVO_LOCAL_BA_SOLVER_HPP_
+#define _SSVO_LOCAL_BA_SOLVER_HPP_
+
+#include <atomic>
+#include "global.hpp"
+
+namespace ssvo
+{
+
+//! Levenberg-Marquardt solver for the sliding window BA with SE3 poses and 3D points.
+//! The points are eliminated by the Schur complement, only the pose blocks sharing points are filled,
+//! and both the point elimination and the reduced camera system are built in parallel.
+//! The buffers are kept between problems, so it is cheap to solve a window of similar size again.
+class LocalBASolver : public noncopyable
+{
+public:
+
+    typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+    typedef Eigen::Matrix<double, 6, 1> Vector6d;
+    typedef Eigen::Matrix<double, 2, 6> Matrix26d;
+    typedef Eigen::Matrix<double, 2, 3> Matrix23d;
+    typedef Eigen::Matrix<double, 6, 3> Matrix63d;
+
+    struct Options{
+        int max_iterations;
+        double function_tolerance;
+        double gradient_tolerance;
+        double parameter_tolerance;
+        double initial_lambda;
+        double huber;   //! scale of the Huber loss, the same as ceres::HuberLoss
+        const std::atomic<bool> *abort; //! stop after the current iteration if set, at least one step is taken
+    };
+
+    struct Summary{
+        int iterations;
+        int successful_steps;
+        double initial_cost;
+        double final_cost;
+        bool aborted;
+    };
+
+    LocalBASolver();
+
+    void clear();
+
+    //! the parameters are updated in place after solving
+    int addPose(SE3d *pose, bool fixed);
+
+    int addPoint(Vector3d *point);
+
+    //! observation on the normalized plane
+    void addObservation(int pose, int point, const Vector2d &fn);
+
+    Summary solve(const Options &options, bool verbose = false);
+
+    inline size_t poses() const { return pose_ptrs_.size(); }
+
+    inline size_t points() const { return point_ptrs_.size(); }
+
+    inline size_t observations() const { return observations_.size(); }
+
+private:
+
+    struct Observation{
+        Vector2d fn;
+        int pose;
+        int point;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    void buildStructure();
+
+    double evaluate(const std::vector<SE3d, aligned_allocator<SE3d> > &poses,
+                    const std::vector<Vector3d, aligned_allocator<Vector3d> > &points);
+
+    void linearize(const double huber);
+
+    bool computeStep(const double lambda, double &model_decrease);
+
+private:
+
+    //! problem
+    std::vector<SE3d*> pose_ptrs_;
+    std::vector<int> pose_free_id_;  //! index in the reduced camera system, -1 for the fixed pose
+    std::vector<int> free_poses_;
+    std::vector<Vector3d*> point_ptrs_;
+    std::vector<Observation, aligned_allocator<Observation> > observations_;
+
+    //! observations sorted by points and free poses
+    std::vector<int> point_obs_start_;
+    std::vector<int> point_obs_;
+    std::vector<int> pose_obs_start_;
+    std::vector<int> pose_obs_;
+
+    //! states
+    double huber_;
+    std::vector<SE3d, aligned_allocator<SE3d> > poses_;
+    std::vector<SE3d, aligned_allocator<SE3d> > poses_new_;
+    std::vector<Vector3d, aligned_allocator<Vector3d> > points_;
+    std::vector<Vector3d, aligned_allocator<Vector3d> > points_new_;
+    std::vector<double> costs_;
+
+    //! jacobians and residuals of each observation, weighted by IRLS
+    std::vector<Matrix26d, aligned_allocator<Matrix26d> > Jc_;
+    std::vector<Matrix23d, aligned_allocator<Matrix23d> > Jp_;
+    std::vector<Vector2d, aligned_allocator<Vector2d> > residuals_;
+    std::vector<double> weights_;
+    std::vector<Matrix63d, aligned_allocator<Matrix63d> > W_;
+    std::vector<Matrix63d, aligned_allocator<Matrix63d> > Y_;
+
+    //! point blocks
+    std::vector<Matrix3d, aligned_allocator<Matrix3d> > V_;
+    std::vector<Matrix3d, aligned_allocator<Matrix3d> > V_inv_;
+    std::vector<Vector3d, aligned_allocator<Vector3d> > bp_;
+    std::vector<Vector3d, aligned_allocator<Vector3d> > dp_;
+
+    //! pose blocks and the reduced camera system
+    std::vector<Matrix6d, aligned_allocator<Matrix6d> > U_;
+    std::vector<Vector6d, aligned_allocator<Vector6d> > bc_;
+    Eigen::MatrixXd S_;
+    Eigen::VectorXd rhs_;
+    Eigen::VectorXd dc_;
+    Eigen::LDLT<Eigen::MatrixXd> ldlt_;
+};
+
+}
+
+#endif //_SSVO_LOCAL_BA_SOLVER_HPP_
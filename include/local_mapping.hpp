@@ -4,6 +4,8 @@
 #include <future>
 #include "global.hpp"
 #include "map.hpp"
+#include "concurrent_queue.hpp"
+#include "vocabulary.hpp"
 
 #ifdef SSVO_DBOW_ENABLE
 #include <DBoW3/DBoW3.h>
@@ -25,14 +27,21 @@ public:
 
     void stopMainThread();
 
+    //! block until the keyframes and converged seeds inserted are all processed by the mapping thread
+    void waitForIdle();
+
     void addOptimalizeMapPoint(const MapPoint::Ptr &mpt);
 
     int refineMapPoints(const int max_optimalize_num = -1, const double outlier_thr = 2.0/480.0);
 
-    void createFeatureFromSeed(const Seed::Ptr &seed);
+    //! called by the DepthFilter, the seeds are turned into map points in batch on the mapping thread
+    void insertConvergedSeed(const Seed::Ptr &seed);
 
     KeyFrame::Ptr relocalizeByDBoW(const Frame::Ptr &frame, const Corners &corners);
 
+    //! index the keyframes in the map again, after the map is cleared or loaded
+    void resetDatabase();
+
     static LocalMapper::Ptr create(bool report = false, bool verbose = false)
     { return LocalMapper::Ptr(new LocalMapper(report, verbose));}
 
@@ -46,7 +55,12 @@ private:
 
     bool isRequiredStop();
 
-    KeyFrame::Ptr checkNewKeyFrame();
+    //! pop at most max_coalesced_kfs keyframes, and the time of the oldest one inserted
+    int checkNewKeyFrames(std::vector<KeyFrame::Ptr> &keyframes, std::chrono::steady_clock::time_point &time_oldest);
+
+    int processConvergedSeeds();
+
+    int createFeatureFromSeeds(const std::vector<Seed::Ptr> &seeds);
 
     void finishLastKeyFrame();
 
@@ -54,10 +68,20 @@ private:
 
     int createFeatureFromLocalMap(const KeyFrame::Ptr &keyframe, const int num = 5);
 
+    //! keep the voxel index of the map after the local BA
+    void updateMapPointsVoxel(const KeyFrame::Ptr &keyframe, const int num);
+
     void checkCulling(const KeyFrame::Ptr &keyframe);
 
+    //! offload the images of the inactive submaps, and then compress the images of the oldest keyframes
+    //! out of the tracking window until the cap is met
+    void manageImageMemory(const KeyFrame::Ptr &keyframe);
+
     void addToDatabase(const KeyFrame::Ptr &keyframe);
 
+    //! snapshot the local map around the keyframe for the tracker, only on the mapping thread
+    void publishLocalMap(const KeyFrame::Ptr &keyframe);
+
 public:
 
     Map::Ptr map_;
@@ -75,17 +99,30 @@ private:
         double max_align_epsilon;
         double max_align_error2;
         double min_found_ratio_;
+        int max_coalesced_kfs;
+        bool abortable_ba;
+        double culling_redundant_ratio;
+        double frustum_depth_ratio;
+        int num_track_kfs;
+        size_t image_memory_cap;
     } options_;
 
-    std::deque<KeyFrame::Ptr> keyframes_buffer_;
+    //! the mapping thread sleeps until new keyframes or converged seeds arrive
+    WakeupEvent event_;
+    MPSCQueue<std::pair<KeyFrame::Ptr, std::chrono::steady_clock::time_point> > keyframes_buffer_;
+    MPSCQueue<std::pair<Seed::Ptr, std::chrono::steady_clock::time_point> > seeds_buffer_;
+    //! keyframes and seeds inserted but not processed yet, the waiters for idle are woken when it drops
+    std::atomic<int> items_pending_;
+    WakeupEvent idle_event_;
     KeyFrame::Ptr keyframe_last_;
 
 #ifdef SSVO_DBOW_ENABLE
     DBoW3::Vocabulary vocabulary_;
     DBoW3::Database database_;
-    std::vector<cv::Point2i> border_tl_;
-    std::vector<cv::Point2i> border_br_;
 #endif
+    //! the built-in index, only used without DBoW when the vocabulary file is set
+    Vocabulary::Ptr bow_vocabulary_;
+    BowDatabase::Ptr bow_database_;
 
     const bool report_;
     const bool verbose_;
@@ -94,11 +131,19 @@ private:
 
     std::list<MapPoint::Ptr> optimalize_candidate_mpts_;
 
-    bool stop_require_;
-    std::mutex mutex_stop_;
-    std::mutex mutex_keyframe_;
+    //! reused for each keyframe on the mapping thread
+    std::vector<MapPoint::Ptr> mpts_buffer_;
+
+    //! statistics of converged seeds between two keyframes
+    int seeds_drained_;
+    double seeds_max_latency_;
+    double seeds_time_;
+
+    //! set by new keyframes to interrupt the running local BA
+    std::atomic<bool> abort_ba_;
+
+    std::atomic<bool> stop_require_;
     std::mutex mutex_optimalize_mpts_;
-    std::condition_variable cond_process_;
 
 };
 
@@ -3,6 +3,7 @@
 
 #include "map_point.hpp"
 #include "keyframe.hpp"
+#include "submap.hpp"
 #include "global.hpp"
 
 namespace ssvo{
@@ -18,6 +19,27 @@ class Map: public noncopyable
 public:
     typedef std::shared_ptr<Map> Ptr;
 
+    //! Immutable snapshot of the local map around a keyframe, which is read without any lock.
+    //! The readers pin it by holding the pointer, so the points in it are not released before it is dropped.
+    struct LocalMap
+    {
+        typedef std::shared_ptr<const LocalMap> Ptr;
+
+        KeyFrame::Ptr reference;
+        std::vector<KeyFrame::Ptr> keyframes;
+        std::vector<MapPoint::Ptr> mpts;
+        std::vector<Vector3d> poses;    //!< poses of the mpts when the snapshot is created
+    };
+
+    struct SubmapStatus
+    {
+        size_t resident;
+        size_t offloaded;
+        size_t paged_in;
+        size_t paged_out;
+        size_t file_bytes;
+    };
+
     KeyFrame::Ptr getKeyFrame(uint64_t id);
 
     std::vector<KeyFrame::Ptr> getAllKeyFrames();
@@ -28,19 +50,77 @@ public:
 
     uint64_t MapPointsInMap();
 
-private:
+    MapPoint::Ptr getMapPoint(uint32_t handle);
 
-    void clear();
+    //! mean bytes taken by each map point in the map, including its observations and the slot in the map
+    double bytesPerMapPoint();
 
-    bool insertKeyFrame(const KeyFrame::Ptr &kf);
+    //! map points in the frustum of the frame within max_depth, found by the voxel index,
+    //! stop after max_num points if it is positive, and empty if the index is disabled
+    std::vector<MapPoint::Ptr> getMapPointsInFrustum(const Frame::Ptr &frame, double max_depth, size_t max_num = 0);
 
-    void removeKeyFrame(const KeyFrame::Ptr &kf);
+    //! move the map points to their new voxels after their poses are optimized
+    void updateMapPointsVoxel(const std::vector<MapPoint::Ptr> &mpts);
+
+    inline bool voxelIndexEnabled() const { return voxel_size_ > 0; }
+
+    //! release the removed map points held by nothing else, return the number released
+    size_t reclaimRemovedMapPoints();
+
+    //! the latest local map published by the mapper, null if none
+    LocalMap::Ptr getLocalMap() const;
+
+    //! the reference keyframe, its connected keyframes and then the sub-connected ones, max_kfs in total,
+    //! and the good map points observed by them, traversed with the locks of each keyframe and map point
+    static LocalMap::Ptr createLocalMap(const KeyFrame::Ptr &reference, size_t max_kfs);
+
+    //! write the good keyframes with their poses and image pyramids, the map points observed by them,
+    //! the observations and the covisibility graph in the binary format of MAP_FILE_VERSION
+    bool save(const std::string &path);
+
+    //! replace the map by the one in the file, which is memory-mapped and read in place,
+    //! return false and keep the map untouched if the file is invalid or of another version
+    bool load(const std::string &path, const AbstractCamera::Ptr &cam);
+
+    bool insertKeyFrame(const KeyFrame::Ptr &kf);
 
     void insertMapPoint(const MapPoint::Ptr &mpt);
 
+    inline static Map::Ptr create() {return Map::Ptr(new Map());}
+
+    static const uint32_t MAP_FILE_VERSION;
+
+private:
+
+    Map();
+
+    void clear();
+
+    void removeKeyFrame(const KeyFrame::Ptr &kf);
+
     void removeMapPoint(const MapPoint::Ptr &mpt);
 
-    inline static Map::Ptr create() {return Map::Ptr(new Map());}
+    //! replace the local map, the old one is released when the last reader drops it
+    void publishLocalMap(const LocalMap::Ptr &local_map);
+
+    inline bool submapEnabled() const { return submap_kfs_ > 0; }
+
+    //! the submaps of the keyframes in the window become resident, and the least recently active ones
+    //! are offloaded until at most submap_resident_ others are resident
+    SubmapStatus updateSubmaps(const std::vector<KeyFrame::Ptr> &window);
+
+    uint64_t voxelKey(const Vector3d &pose) const;
+
+    Vector3d voxelCenter(uint64_t key) const;
+
+    void insertToVoxel(const MapPoint::Ptr &mpt, uint64_t key);
+
+    void removeFromVoxel(const MapPoint::Ptr &mpt, uint64_t key);
+
+    bool isVoxelInFrustum(const Vector3d &center, const SE3d &Tcw, const AbstractCamera::Ptr &cam, double max_depth) const;
+
+    //! return false if max_num is reached
+    bool getMapPointsInVoxel(uint64_t key, const Frame::Ptr &frame, const SE3d &Tcw, double max_depth, size_t max_num, std::vector<MapPoint::Ptr> &mpts);
 
 public:
 
@@ -50,10 +130,40 @@ private:
 
     std::unordered_map<uint64_t, KeyFrame::Ptr> kfs_;
 
-    std::unordered_map<uint64_t, MapPoint::Ptr> mpts_;
-
-    std::mutex mutex_kf_;
-    std::mutex mutex_mpt_;
+    //! indexed by the handle of map point, the empty slots are reused by the new ones
+    std::vector<MapPoint::Ptr> mpts_;
+    size_t mpts_count_;
+
+    CountingMutex mutex_kf_;
+    CountingMutex mutex_mpt_;
+
+    //! voxel hash of the map points, the buckets are striped by key so the queries rarely contend,
+    //! and the writers are serialized so the voxel of each point stays consistent
+    static const int VOXEL_STRIPES = 16;
+    const double voxel_size_;
+    std::unordered_map<uint64_t, std::vector<MapPoint::Ptr> > voxels_[VOXEL_STRIPES];
+    CountingMutex mutex_voxels_[VOXEL_STRIPES];
+    CountingMutex mutex_voxel_update_;
+    std::atomic<size_t> voxels_occupied_;
+
+    //! only accessed by std::atomic_load and std::atomic_store
+    LocalMap::Ptr local_map_;
+
+    //! temporal submaps of successive keyframes, the images of the offloaded ones are only in their files
+    struct Submap
+    {
+        std::vector<KeyFrame::Ptr> keyframes;
+        SubmapFile::Ptr file;
+        bool offloaded;
+        uint64_t last_active;
+    };
+
+    const int submap_kfs_;
+    const size_t submap_resident_;
+    const std::string submap_dir_;
+    std::map<uint64_t, Submap> submaps_;
+    uint64_t submap_tick_;
+    CountingMutex mutex_submap_;
 };
 
 }
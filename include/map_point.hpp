@@ -1,7 +1,10 @@
 #ifndef _MAP_POINT_HPP_
 #define _MAP_POINT_HPP_
 
+#include <atomic>
 #include "feature.hpp"
+#include "memory_pool.hpp"
+#include "concurrent_queue.hpp"
 #include "global.hpp"
 
 namespace ssvo {
@@ -10,8 +13,15 @@ class Frame;
 
 class KeyFrame;
 
+class Map;
+
+//! The map points are allocated from a pool, and locked by the stripes shared with others picked by the handle,
+//! so never lock two map points at the same time
 class MapPoint : public std::enable_shared_from_this<MapPoint>
 {
+    friend class Map;
+    template<typename T, typename Tag> friend class PoolAllocator;
+
 public:
 
     enum Type{
@@ -26,6 +36,8 @@ public:
 
     typedef std::shared_ptr<Frame> FramePtr;
 
+    typedef std::vector<std::pair<KeyFramePtr, Feature::Ptr> > Observations;
+
     Type type();
 
     void setBad();
@@ -40,10 +52,28 @@ public:
 
     void addObservation(const KeyFramePtr &kf, const Feature::Ptr &ft);
 
-    int observations();
+    //! lock-free, maintained as the observations are added and removed
+    inline int observations() const { return obs_count_.load(std::memory_order_relaxed); }
 
     std::map<KeyFramePtr, Feature::Ptr> getObservations();
 
+    //! the buffer is cleared first, and no allocation once it is large enough
+    void getObservations(Observations &obs);
+
+    //! visit the observations without copying, func(kf, ft) is called with this map point locked,
+    //! so it should not use other map points or read the features of keyframes
+    template<typename Func>
+    inline void forEachObservation(Func func)
+    {
+        std::lock_guard<CountingMutex> lock(mutexObs());
+        for(const auto &it : obs_)
+        {
+            const KeyFramePtr kf = it.first.lock();
+            if(kf)
+                func(kf, it.second);
+        }
+    }
+
     bool removeObservation(const KeyFramePtr &kf);
 
     Feature::Ptr findObservation(const KeyFramePtr kf);
@@ -81,21 +111,41 @@ public:
 
     inline Vector3d pose() { return pose_; }
 
+    //! bytes of the map point with its control block and observations
+    size_t memoryUsage();
+
+    //! map points alive, including the removed ones still referenced
+    inline static size_t liveObjects() { return PoolUsage<MapPoint>::objects; }
+
     inline static Ptr create(const Vector3d &p)
-    { return Ptr(new MapPoint(p)); }
+    { return std::allocate_shared<MapPoint>(PoolAllocator<MapPoint>(), p); }
+
+    ~MapPoint();
 
 private:
 
+    //! the keyframes own their features and so the map points, and they are only referred weakly here
+    typedef std::vector<std::pair<std::weak_ptr<KeyFrame>, Feature::Ptr> > ObservationLinks;
+
     MapPoint(const Vector3d &p);
 
+    //! restored by the map from file, with the id saved
+    MapPoint(const Vector3d &p, const uint64_t id);
+
     void updateRefKF();
 
+    CountingMutex &mutexObs() const;
+
+    CountingMutex &mutexPose() const;
+
 public:
 
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
     static uint64_t next_id_;
     const uint64_t id_;
+    //! stable while the map point is alive, and reused after it is released
+    const uint32_t handle_;
 
     static const double log_level_factor_;
 
@@ -107,7 +157,9 @@ private:
 
     Vector3d pose_;
 
-    std::unordered_map<KeyFramePtr, Feature::Ptr> obs_;
+    //! only a few observations for each map point, searched linearly
+    ObservationLinks obs_;
+    std::atomic<int> obs_count_; //! size of obs_, read without locking
 
     Type type_;
 
@@ -115,13 +167,14 @@ private:
     double min_distance_;
     double max_distance_;
 
-    KeyFramePtr refKF_;
+    std::weak_ptr<KeyFrame> refKF_;
 
     uint64_t found_cunter_;
     uint64_t visiable_cunter_;
 
-    std::mutex mutex_obs_;
-    std::mutex mutex_pose_;
+    //! the voxel in the index of the map, only changed by the map
+    bool voxel_indexed_;
+    uint64_t voxel_key_;
 
 };
 
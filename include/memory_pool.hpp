@@ -0,0 +1,222 @@
+#ifndef _SSVO_MEMORY_POOL_HPP_
+#define _SSVO_MEMORY_POOL_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <type_traits>
+
+#include "global.hpp"
+
+namespace ssvo
+{
+
+//! Fixed size blocks carved from large chunks, the freed blocks are kept in a list and reused first.
+//! The chunks are never returned, so the objects of one kind stay packed in a few pages
+//! instead of being scattered over the heap with a malloc header each.
+template<size_t BlockSize>
+class BlockPool : public noncopyable
+{
+public:
+
+    //! never destroyed, the objects may be released by other static destructors at exit
+    static BlockPool &instance()
+    {
+        static BlockPool *pool = new BlockPool();
+        return *pool;
+    }
+
+    void *allocate()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(free_ == nullptr)
+            grow();
+
+        Block *block = free_;
+        free_ = block->next;
+        return block;
+    }
+
+    void deallocate(void *p)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Block *block = static_cast<Block*>(p);
+        block->next = free_;
+        free_ = block;
+    }
+
+    size_t reservedBytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return chunks_.size() * BLOCKS_PER_CHUNK * sizeof(Block);
+    }
+
+private:
+
+    BlockPool() : free_(nullptr) {}
+
+    union Block
+    {
+        Block *next;
+        typename std::aligned_storage<BlockSize, alignof(std::max_align_t)>::type storage;
+    };
+
+    void grow()
+    {
+        Block *chunk = new Block[BLOCKS_PER_CHUNK];
+        chunks_.emplace_back(chunk);
+        for(size_t i = 0; i < BLOCKS_PER_CHUNK; ++i)
+        {
+            chunk[i].next = free_;
+            free_ = &chunk[i];
+        }
+    }
+
+    static const size_t BLOCKS_PER_CHUNK = 1024;
+
+    std::mutex mutex_;
+    Block *free_;
+    std::vector<std::unique_ptr<Block[]> > chunks_;
+};
+
+//! live objects allocated by the PoolAllocator with the Tag, and the size of the block of each
+template<typename Tag>
+struct PoolUsage
+{
+    static std::atomic<size_t> objects;
+    static std::atomic<size_t> block_bytes;
+};
+
+template<typename Tag>
+std::atomic<size_t> PoolUsage<Tag>::objects(0);
+
+template<typename Tag>
+std::atomic<size_t> PoolUsage<Tag>::block_bytes(0);
+
+//! Allocator for std::allocate_shared, the object and its control block take one block of the BlockPool.
+//! The Tag is kept by rebind, so the usage is counted for the object no matter which type is really allocated.
+template<typename T, typename Tag = T>
+class PoolAllocator
+{
+public:
+
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind { typedef PoolAllocator<U, Tag> other; };
+
+    PoolAllocator() {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U, Tag> &) {}
+
+    T *allocate(size_t n)
+    {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "The alignment is not supported by the pool!");
+        if(n != 1)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+
+        PoolUsage<Tag>::objects++;
+        PoolUsage<Tag>::block_bytes = sizeof(T);
+        return static_cast<T*>(BlockPool<sizeof(T)>::instance().allocate());
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        if(n != 1)
+            return ::operator delete(p);
+
+        PoolUsage<Tag>::objects--;
+        BlockPool<sizeof(T)>::instance().deallocate(p);
+    }
+
+    //! the class with private constructor should make the PoolAllocator a friend
+    template<typename U, typename... Args>
+    void construct(U *p, Args&&... args)
+    { ::new((void*)p) U(std::forward<Args>(args)...); }
+
+    template<typename U>
+    void destroy(U *p)
+    { p->~U(); }
+};
+
+template<typename T, typename U, typename Tag>
+inline bool operator==(const PoolAllocator<T, Tag> &, const PoolAllocator<U, Tag> &) { return true; }
+
+template<typename T, typename U, typename Tag>
+inline bool operator!=(const PoolAllocator<T, Tag> &, const PoolAllocator<U, Tag> &) { return false; }
+
+//! Count the live objects of T by inheriting it, to check that nothing is leaked over a long run.
+//! The copies are counted too, so the temporaries copied into std::make_shared are balanced.
+template<typename T>
+class ObjectCounter
+{
+public:
+
+    static size_t liveObjects() { return live_.load(); }
+
+protected:
+
+    ObjectCounter() { live_++; }
+
+    ObjectCounter(const ObjectCounter &) { live_++; }
+
+    ObjectCounter &operator=(const ObjectCounter &) { return *this; }
+
+    ~ObjectCounter() { live_--; }
+
+private:
+
+    static std::atomic<size_t> live_;
+};
+
+template<typename T>
+std::atomic<size_t> ObjectCounter<T>::live_(0);
+
+//! 32-bit handles which are stable during the lifetime of the object,
+//! the released ones are reused first so the handles stay dense and can index arrays
+class HandleAllocator : public noncopyable
+{
+public:
+
+    HandleAllocator() : next_(0) {}
+
+    uint32_t acquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!free_.empty())
+        {
+            const uint32_t handle = free_.back();
+            free_.pop_back();
+            return handle;
+        }
+
+        LOG_ASSERT(next_ < std::numeric_limits<uint32_t>::max()) << " Run out of handles!";
+        return next_++;
+    }
+
+    void release(uint32_t handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(handle);
+    }
+
+    //! all the handles are less than it
+    uint32_t bound()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return next_;
+    }
+
+private:
+
+    std::mutex mutex_;
+    std::vector<uint32_t> free_;
+    uint32_t next_;
+};
+
+}
+
+#endif //_SSVO_MEMORY_POOL_HPP_
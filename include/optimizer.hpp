@@ -3,11 +3,13 @@
 
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
+#include <atomic>
 
 #include "map_point.hpp"
 #include "keyframe.hpp"
 #include "map.hpp"
 #include "global.hpp"
+#include "config.hpp"
 
 namespace ssvo {
 
@@ -15,16 +17,56 @@ class Optimizer: public noncopyable
 {
 public:
 
+    //! statistics of the last solve in the calling thread
+    struct SolveInfo{
+        int iterations;
+        double time_ms;
+        double build_ms;    //! time to collect the window and build the problem, only for local BA
+        bool aborted;
+    };
+
+    static const SolveInfo& lastSolveInfo();
+
+    //! the linear solver is chosen by the number of cameras if the profile is set to auto
+    static void setSolverOptions(const Config::SolverProfile &profile, size_t num_cameras, ceres::Solver::Options &options);
+
     static void globleBundleAdjustment(const Map::Ptr &map, int max_iters, bool report=false, bool verbose=false);
 
+    //! call motionOnlyBundleAdjustmentNative if Optimizer.motion_native is set, or motionOnlyBundleAdjustmentCeres
     static void motionOnlyBundleAdjustment(const Frame::Ptr &frame, bool use_seeds, bool reject=false, bool report=false, bool verbose=false);
 
-    static void localBundleAdjustment(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size=10, int min_shared_fts=50, bool report=false, bool verbose=false);
+    //! IRLS Gauss-Newton with analytic Jacobians and fixed-size 6x6 normal equations
+    static void motionOnlyBundleAdjustmentNative(const Frame::Ptr &frame, bool use_seeds, bool reject=false, bool report=false, bool verbose=false);
+
+    static void motionOnlyBundleAdjustmentCeres(const Frame::Ptr &frame, bool use_seeds, bool reject=false, bool report=false, bool verbose=false);
+
+    //! call localBundleAdjustmentWithInvDepth if Optimizer.local_ba_inv_depth is set,
+    //! or localBundleAdjustmentNative if Optimizer.local_ba_native is set,
+    //! or localBundleAdjustmentPersistent if Optimizer.local_ba_persistent is set, or localBundleAdjustmentCeres,
+    //! the solver stops as soon as abort is set, with the result of the last successful step
+    static void localBundleAdjustment(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size=10, int min_shared_fts=50, bool report=false, bool verbose=false, const std::atomic<bool> *abort=nullptr);
+
+    static void localBundleAdjustmentCeres(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size=10, int min_shared_fts=50, bool report=false, bool verbose=false, const std::atomic<bool> *abort=nullptr);
+
+    //! the Ceres problem is kept between calls and updated as the window slides, see LocalBAProblem
+    static void localBundleAdjustmentPersistent(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size=10, int min_shared_fts=50, bool report=false, bool verbose=false, const std::atomic<bool> *abort=nullptr);
 
-//    static void localBundleAdjustmentWithInvDepth(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size=10, bool report=false, bool verbose=false);
+    //! clear the problem kept by localBundleAdjustmentPersistent if the keyframe is in it, or always for nullptr,
+    //! so that the culled keyframes and the cleared map are released
+    static void releaseLocalBAProblem(const KeyFrame::Ptr &keyframe = nullptr);
+
+    //! Levenberg-Marquardt with the Schur complement, see LocalBASolver
+    static void localBundleAdjustmentNative(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size=10, int min_shared_fts=50, bool report=false, bool verbose=false, const std::atomic<bool> *abort=nullptr);
+
+    //! each point is an inverse depth anchored in its reference keyframe, see ReprojectionErrorSE3InvDepth
+    static void localBundleAdjustmentWithInvDepth(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size=10, int min_shared_fts=50, bool report=false, bool verbose=false, const std::atomic<bool> *abort=nullptr);
 
     static void refineMapPoint(const MapPoint::Ptr &mpt, int max_iter, bool report=false, bool verbose=false);
 
+    //! refine the points in batch with the keyframes fixed, each point runs a 3x3 Gauss-Newton with Huber weights in parallel,
+    //! outliers[i] returns the keyframes whose squared error of point i on the normalized plane is not less than outlier_thr
+    static void refineMapPoints(const std::vector<MapPoint::Ptr> &mpts, int max_iter, std::vector<std::vector<KeyFrame::Ptr> > *outliers=nullptr, double outlier_thr=0.0, bool report=false);
+
     template<int nRes>
     static inline Eigen::Matrix<double, nRes, 1> evaluateResidual(const ceres::Problem& problem, ceres::ResidualBlockId id)
     {
@@ -172,6 +214,14 @@ public:
         return (new ReprojectionErrorSE3(observed_x, observed_y, weight));
     }
 
+    //! reset the observation, so the cost function can be reused by another residual block
+    inline void setObservation(const double observed_x, const double observed_y, const double weight = 1.0)
+    {
+        observed_x_ = observed_x;
+        observed_y_ = observed_y;
+        weight_ = weight;
+    }
+
 private:
 
     double observed_x_;
@@ -330,6 +380,26 @@ private:
 };
 
 
+//! stop the solver when the flag is set, the parameters stay at the last successful step
+class AbortCallback : public ceres::IterationCallback
+{
+public:
+
+    explicit AbortCallback(const std::atomic<bool> *abort) : abort_(abort) {}
+
+    virtual ceres::CallbackReturnType operator()(const ceres::IterationSummary &summary)
+    {
+        if(abort_ != nullptr && abort_->load() && summary.iteration > 0)
+            return ceres::SOLVER_TERMINATE_SUCCESSFULLY;
+
+        return ceres::SOLVER_CONTINUE;
+    }
+
+private:
+
+    const std::atomic<bool> *abort_;
+};
+
 }//! namespace ceres
 
 }//! namespace ssvo
@@ -2,6 +2,8 @@
 #define _SSVO_SEED_HPP_
 
 #include "global.hpp"
+#include "memory_pool.hpp"
+#include "concurrent_queue.hpp"
 
 namespace ssvo{
 
@@ -9,13 +11,23 @@ class KeyFrame;
 
 //! modified from SVO, https://github.com/uzh-rpg/rpg_svo/blob/master/svo/include/svo/depth_filter.h#L35
 /// A seed is a probabilistic depth estimate for a single pixel.
-class Seed
+class Seed : public ObjectCounter<Seed>
 {
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
     typedef std::shared_ptr<Seed> Ptr;
 
+    //! the depth estimate, saved and restored by the checkpoint of the system
+    struct State
+    {
+        double a;
+        double b;
+        double mu;
+        double z_range;
+        double sigma2;
+    };
+
     static uint64_t next_id;
     const uint64_t id;
     const std::shared_ptr<KeyFrame> kf;     //!< Reference KeyFrame, where the seed created.
@@ -36,10 +48,16 @@ public:
     double getInvDepth();
     double getVariance();
     double getInfoWeight();
+    double getInfoGain(const double tau2);
+    State getState();
 
     inline static Ptr create(const std::shared_ptr<KeyFrame> &kf, const Vector2d &px, const Vector3d &fn, const int level, double depth_mean, double depth_min)
     {return Ptr(new Seed(kf, px, fn, level, depth_mean, depth_min));}
 
+    //! restored from a checkpoint, with the id and the state saved
+    inline static Ptr create(const std::shared_ptr<KeyFrame> &kf, const uint64_t id, const Vector2d &px, const Vector3d &fn, const int level, const State &state)
+    {return Ptr(new Seed(kf, id, px, fn, level, state));}
+
 private:
     double a;                               //!< a of Beta distribution: When high, probability of inlier is large.
     double b;                               //!< b of Beta distribution: When high, probability of outlier is large.
@@ -48,9 +66,11 @@ private:
     double sigma2;                          //!< Variance of normal distribution.
     Matrix2d patch_cov;                     //!< Patch covariance in reference image.
 
-    std::mutex mutex_seed_;
+    CountingMutex mutex_seed_;
 
     Seed(const std::shared_ptr<KeyFrame> &kf, const Vector2d &px, const Vector3d &fn, const int level, double depth_mean, double depth_min);
+
+    Seed(const std::shared_ptr<KeyFrame> &kf, const uint64_t id, const Vector2d &px, const Vector3d &fn, const int level, const State &state);
 };
 
 typedef std::list<Seed::Ptr> Seeds;
@@ -0,0 +1,58 @@
+#ifndef _SSVO_SUBMAP_HPP_
+#define _SSVO_SUBMAP_HPP_
+
+#include "global.hpp"
+
+namespace ssvo
+{
+
+//! Append-only file of a submap, memory-mapped for reading once all the data are written.
+//! The mapped pages are loaded by the kernel when touched, and dropped again by release(),
+//! so only the data in use is resident. The file is removed when the object is destroyed.
+//! Each file is created with a unique name, so the maps in the same process never share one.
+class SubmapFile : public noncopyable
+{
+public:
+
+    typedef std::shared_ptr<SubmapFile> Ptr;
+
+    ~SubmapFile();
+
+    //! return the offset of the data in the file, only before sealed
+    size_t append(const std::vector<uchar> &data);
+
+    //! map the file read-only, nothing can be appended after it
+    void seal();
+
+    inline bool isSealed() const { return sealed_; }
+
+    //! the data at the offset, only after sealed
+    const uchar *data(size_t offset) const;
+
+    //! drop the pages loaded, they are read from the file again when used
+    void release();
+
+    //! ask the kernel to read the pages ahead
+    void prefetch();
+
+    inline size_t size() const { return size_; }
+
+    inline const std::string &path() const { return path_; }
+
+    //! the file name starts with the prefix and ends with a unique suffix
+    inline static Ptr create(const std::string &prefix) { return Ptr(new SubmapFile(prefix)); }
+
+private:
+
+    SubmapFile(const std::string &prefix);
+
+    std::string path_;
+    int fd_;
+    size_t size_;
+    bool sealed_;
+    uchar *data_;
+};
+
+}
+
+#endif //_SSVO_SUBMAP_HPP_
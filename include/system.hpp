@@ -39,6 +39,17 @@ public:
 
     void process(const cv::Mat& image, const double timestamp);
 
+    //! wait for the depth filter and the mapper to be idle, and write the state of the system with the seeds
+    //! to the file, and the map to "<file_name>.map", so the tracking continues from the next frame after resumed
+    bool checkpoint(const std::string &file_name);
+
+    //! replace the map and the state of the system by the checkpoint, return false if the files are invalid
+    bool resume(const std::string &file_name);
+
+    inline Stage stage() const { return stage_; }
+
+    static const uint32_t CHECKPOINT_VERSION;
+
 private:
 
     void processFrame();
@@ -89,7 +100,6 @@ private:
 
     std::list<double > frame_timestamp_buffer_;
     std::list<Sophus::SE3d> frame_pose_buffer_;
-    std::list<KeyFrame::Ptr> reference_keyframe_buffer_;
 };
 
 }// namespce ssvo
@@ -0,0 +1,131 @@
+#ifndef _SSVO_THREAD_POOL_HPP_
+#define _SSVO_THREAD_POOL_HPP_
+
+#include <atomic>
+#include <deque>
+#include <future>
+#include <functional>
+
+#include "global.hpp"
+
+namespace ssvo
+{
+
+//! Library-level work-stealing task scheduler.
+//! Every worker owns a deque, it pops tasks from the back of its own deque and steals from the front of others'.
+//! Tasks submitted by a worker go to its own deque, others are distributed round-robin.
+class ThreadPool : public noncopyable
+{
+public:
+
+    enum TaskType{
+        TASK_GENERAL = 0,
+        TASK_DEPTH_FILTER,
+        TASK_MAPPING,
+        TASK_TRACKING,
+        TASK_DETECTION,
+        TASK_OPTIMIZATION,
+        TASK_TYPE_SIZE
+    };
+
+    struct TaskStats{
+        uint64_t submitted;
+        uint64_t finished;
+        uint64_t stolen;
+        int64_t queued;
+        int64_t max_queued;
+        double total_wait_ms; //! from submitted to started
+        double total_run_ms;
+    };
+
+    static ThreadPool& getInstance();
+
+    template<typename F>
+    auto submit(TaskType type, F &&func) -> std::future<decltype(func())>;
+
+    //! run func(i) for i in [begin, end), the caller works on it too, so it is safe to be called in a task
+    void parallelFor(TaskType type, int begin, int end, const std::function<void (int)> &func, int grain_size = 1);
+
+    inline size_t size() const { return workers_.size(); }
+
+    TaskStats getStats(TaskType type) const;
+
+    void logStats() const;
+
+    static const char* taskName(TaskType type);
+
+    ~ThreadPool();
+
+private:
+
+    struct Task
+    {
+        std::function<void ()> func;
+        TaskType type;
+        std::chrono::steady_clock::time_point submit_time;
+    };
+
+    struct Worker
+    {
+        std::thread thread;
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct AtomicStats
+    {
+        std::atomic<uint64_t> submitted;
+        std::atomic<uint64_t> finished;
+        std::atomic<uint64_t> stolen;
+        std::atomic<int64_t> queued;
+        std::atomic<int64_t> max_queued;
+        std::atomic<int64_t> total_wait_us;
+        std::atomic<int64_t> total_run_us;
+    };
+
+    ThreadPool(int num_threads, const std::vector<int> &cpu_affinity);
+
+    void enqueue(Task &&task);
+
+    bool popTask(size_t id, Task &task);
+
+    void runTask(Task &task);
+
+    void workerLoop(size_t id);
+
+    static bool setAffinity(std::thread &thread, int cpu);
+
+private:
+
+    std::vector<std::unique_ptr<Worker> > workers_;
+    AtomicStats stats_[TASK_TYPE_SIZE];
+
+    std::atomic<bool> stop_;
+    std::atomic<size_t> next_worker_;
+    std::atomic<int64_t> pending_;
+
+    //! for sleeping workers
+    std::atomic<int> sleeping_;
+    std::mutex mutex_sleep_;
+    std::condition_variable cond_sleep_;
+};
+
+template<typename F>
+auto ThreadPool::submit(TaskType type, F &&func) -> std::future<decltype(func())>
+{
+    typedef decltype(func()) Result;
+    //! std::function need a copyable callable
+    auto packaged = std::make_shared<std::packaged_task<Result ()> >(std::forward<F>(func));
+    std::future<Result> future = packaged->get_future();
+
+    Task task;
+    task.func = [packaged](){ (*packaged)(); };
+    task.type = type;
+    enqueue(std::move(task));
+
+    return future;
+}
+
+}
+
+#endif //_SSVO_THREAD_POOL_HPP_
@@ -316,6 +316,21 @@ void kltTrack(const ImgPyr& imgs_ref, const ImgPyr& imgs_cur, const cv::Size win
               const std::vector<cv::Point2f>& pts_ref, std::vector<cv::Point2f>& pts_cur,
               std::vector<bool> &status, cv::TermCriteria termcrit, bool track_forward = false, bool verbose = false);
 
+//! consistency check for kltTrackIC
+enum KLTCheck{
+    KLT_CHECK_NONE = 0,     //! no check
+    KLT_CHECK_RESIDUAL = 1, //! zero-mean photometric residual of the final iteration, almost free
+    KLT_CHECK_BACKWARD = 2, //! forward-backward tracking, as kltTrack
+};
+
+//! inverse compositional KLT with brightness offset compensation on the pyramid without padding, like Frame::images()
+//! the template gradients and Hessian of each point are computed once per level, points are tracked in parallel
+//! the inputs are the same as kltTrack, return the number of tracked points
+int kltTrackIC(const ImgPyr& imgs_ref, const ImgPyr& imgs_cur, const int win_size,
+               const std::vector<cv::Point2f>& pts_ref, std::vector<cv::Point2f>& pts_cur,
+               std::vector<bool> &status, const int max_iterations = 30, const double epsilon = 0.01,
+               const KLTCheck check = KLT_CHECK_RESIDUAL, const double max_residual = 10.0, bool verbose = false);
+
 bool triangulate(const Matrix3d &R_cr,  const Vector3d &t_cr, const Vector3d &fn_r, const Vector3d &fn_c, double &d_ref);
 
 namespace Fundamental
@@ -0,0 +1,120 @@
+#ifndef _SSVO_VOCABULARY_HPP_
+#define _SSVO_VOCABULARY_HPP_
+
+#include "global.hpp"
+#include "concurrent_queue.hpp"
+#include "brief.hpp"
+
+namespace ssvo
+{
+
+//! sparse bag of words sorted by the word id, the TF-IDF weights are L1 normalized
+typedef std::vector<std::pair<uint32_t, float> > BowVector;
+
+//! Vocabulary tree of the 256-bit BRIEF descriptors, built by hierarchical k-medians with the Hamming distance,
+//! where each center is the bitwise majority of its descriptors. The leaves are the words, weighted by IDF.
+//! The nodes are fixed-size records, saved and loaded as they are in the binary file of FILE_VERSION.
+class Vocabulary : public noncopyable
+{
+public:
+
+    typedef std::shared_ptr<Vocabulary> Ptr;
+
+    enum { DESCRIPTOR_BYTES = BRIEF::DESCRIPTOR_BYTES };
+
+    static const uint32_t FILE_VERSION;
+
+    //! the descriptors of each training image in rows, the tree is built again
+    void train(const std::vector<cv::Mat> &descriptors);
+
+    //! the word of the descriptor by descending the tree
+    uint32_t transform(const uchar *descriptor) const;
+
+    //! the weights of the words are the counts in the descriptors times their IDF
+    void transform(const cv::Mat &descriptors, BowVector &bow) const;
+
+    bool save(const std::string &file_name) const;
+
+    inline size_t size() const { return words_.size(); }
+
+    inline bool empty() const { return words_.empty(); }
+
+    inline int branching() const { return k_; }
+
+    inline int levels() const { return levels_; }
+
+    inline static Ptr create(int k, int levels) { return Ptr(new Vocabulary(k, levels)); }
+
+    //! null if the file is invalid or of another version
+    static Ptr load(const std::string &file_name);
+
+private:
+
+    Vocabulary(int k, int levels);
+
+    //! split the descriptors into at most k_ children of the node, and split the children until the leaf level
+    void cluster(uint32_t parent, const std::vector<const uchar*> &descriptors, int level, std::mt19937 &generator);
+
+    struct Node
+    {
+        uint32_t first_child;   //!< the children are successive
+        uint32_t num_children;  //!< 0 for the leaves
+        uint32_t word;          //!< only for the leaves
+        float weight;           //!< IDF of the word
+        uchar descriptor[DESCRIPTOR_BYTES];
+    };
+
+    int k_;
+    int levels_;
+
+    //! the root is the first one
+    std::vector<Node> nodes_;
+    //! the node of each word
+    std::vector<uint32_t> words_;
+};
+
+//! Inverted file of the bag of words, scored by the L1 distance as DBoW
+class BowDatabase : public noncopyable
+{
+public:
+
+    typedef std::shared_ptr<BowDatabase> Ptr;
+
+    struct Result
+    {
+        uint64_t id;
+        float score;    //!< 1 for the same bag of words, 0 for nothing shared
+    };
+
+    //! replace the entry with the same id
+    void add(uint64_t id, const BowVector &bow);
+
+    void erase(uint64_t id);
+
+    //! erase all the entries
+    void clear();
+
+    //! the entries sharing words with the bow, at most max_results, from the best
+    void query(const BowVector &bow, std::vector<Result> &results, size_t max_results);
+
+    size_t size();
+
+    inline static Ptr create(const Vocabulary::Ptr &vocabulary) { return Ptr(new BowDatabase(vocabulary)); }
+
+private:
+
+    BowDatabase(const Vocabulary::Ptr &vocabulary);
+
+    //! the entries of each word with their weights
+    std::vector<std::vector<std::pair<uint64_t, float> > > inverted_;
+    std::unordered_map<uint64_t, BowVector> entries_;
+
+    //! reused by each query
+    std::unordered_map<uint64_t, float> scores_;
+
+    CountingMutex mutex_;
+};
+
+}
+
+#endif //_SSVO_VOCABULARY_HPP_
@@ -1,6 +1,7 @@
 #include <iterator>
 #include <opencv2/imgproc.hpp>
 #include "brief.hpp"
+#include "thread_pool.hpp"
 
 namespace ssvo{
 
@@ -290,6 +291,29 @@ BRIEF::BRIEF()
     }
 }
 
+const std::vector<cv::Point>& BRIEF::rotatedPatterns()
+{
+    static const std::vector<cv::Point> patterns = []{
+        const int npoints = 512;
+        const cv::Point* pattern0 = (const cv::Point*)bit_pattern_31_;
+        std::vector<cv::Point> rotated(ANGLE_BINS * npoints);
+        for(int n = 0; n < ANGLE_BINS; ++n)
+        {
+            const double angle = n * 2 * CV_PI / ANGLE_BINS;
+            const double a = cos(angle), b = sin(angle);
+            //! the same rounding as the per-keypoint compute
+            for(int i = 0; i < npoints; ++i)
+            {
+                const cv::Point &p = pattern0[i];
+                rotated[n * npoints + i] = cv::Point(cvRound(p.x*a - p.y*b), cvRound(p.x*b + p.y*a));
+            }
+        }
+        return rotated;
+    }();
+
+    return patterns;
+}
+
 float BRIEF::IC_Angle(const cv::Mat& image, cv::Point2f pt,  const std::vector<int> & u_max)
 {
     int m_01 = 0, m_10 = 0;
@@ -361,35 +385,105 @@ void BRIEF::compute(const cv::KeyPoint& kpt, const cv::Mat& img, const cv::Point
 }
 
 
+void BRIEF::compute(const cv::Mat& img, cv::Point2f pt, const cv::Point* pattern, uchar* desc) const
+{
+    const uchar* center = &img.at<uchar>(cvRound(pt.y), cvRound(pt.x));
+    const int step = (int)img.step;
+
+#define GET_VALUE(idx) center[pattern[idx].y*step + pattern[idx].x]
+
+    for (int i = 0; i < 32; ++i, pattern += 16)
+    {
+        int t0, t1, val;
+        t0 = GET_VALUE(0); t1 = GET_VALUE(1);
+        val = t0 < t1;
+        t0 = GET_VALUE(2); t1 = GET_VALUE(3);
+        val |= (t0 < t1) << 1;
+        t0 = GET_VALUE(4); t1 = GET_VALUE(5);
+        val |= (t0 < t1) << 2;
+        t0 = GET_VALUE(6); t1 = GET_VALUE(7);
+        val |= (t0 < t1) << 3;
+        t0 = GET_VALUE(8); t1 = GET_VALUE(9);
+        val |= (t0 < t1) << 4;
+        t0 = GET_VALUE(10); t1 = GET_VALUE(11);
+        val |= (t0 < t1) << 5;
+        t0 = GET_VALUE(12); t1 = GET_VALUE(13);
+        val |= (t0 < t1) << 6;
+        t0 = GET_VALUE(14); t1 = GET_VALUE(15);
+        val |= (t0 < t1) << 7;
+
+        desc[i] = (uchar)val;
+    }
+
+#undef GET_VALUE
+}
+
 void BRIEF::compute(const std::vector<cv::Mat> &images, const std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors)
 {
-    const size_t nlevels = images.size();
+    const int nlevels = (int)images.size();
     std::vector<cv::Mat> image_pyramid_border(nlevels);
     std::vector<cv::Mat> image_pyramid_border_gauss(nlevels);
-    for(size_t i = 0; i < nlevels; ++i)
-    {
+    ThreadPool::getInstance().parallelFor(ThreadPool::TASK_DETECTION, 0, nlevels, [&](int i){
         cv::Mat image_border;
         cv::copyMakeBorder(images[i], image_border, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, cv::BORDER_REFLECT_101);
         image_pyramid_border[i] = image_border(cv::Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, images[i].cols, images[i].rows));
 
         // preprocess the resized image
         cv::GaussianBlur(image_pyramid_border[i], image_pyramid_border_gauss[i], cv::Size(7, 7), 2, 2, cv::BORDER_REFLECT_101);
-    }
+    });
 
-    int size = (int)keypoints.size();
-    descriptors = cv::Mat::zeros(size, 32, CV_8UC1);
-    for(int i = 0; i < size; i++)
-    {
-        cv::KeyPoint keypoint = keypoints[i];
-        keypoint.pt /= (1 << keypoint.octave);
-        keypoint.angle = IC_Angle(image_pyramid_border[keypoint.octave], keypoint.pt, umax_);
+    const std::vector<cv::Point> &rotated_patterns = rotatedPatterns();
+    const int size = (int)keypoints.size();
+    descriptors = cv::Mat::zeros(size, DESCRIPTOR_BYTES, CV_8UC1);
+    ThreadPool::getInstance().parallelFor(ThreadPool::TASK_DETECTION, 0, size, [&](int i){
+        const cv::KeyPoint &keypoint = keypoints[i];
+        const cv::Point2f pt = keypoint.pt / (float)(1 << keypoint.octave);
+        const float angle = IC_Angle(image_pyramid_border[keypoint.octave], pt, umax_);
+        const int bin = cvRound(angle * ANGLE_BINS / 360.f) % ANGLE_BINS;
 
-        compute(keypoint, image_pyramid_border_gauss[keypoint.octave], &pattern_[0], descriptors.ptr((int)i));
-    }
+        compute(image_pyramid_border_gauss[keypoint.octave], pt, &rotated_patterns[bin * pattern_.size()], descriptors.ptr(i));
+    }, 32);
 }
 
+void BRIEF::match(const cv::Mat &query, const cv::Mat &train, std::vector<cv::DMatch> &matches, int max_distance)
+{
+    matchRatio(query, train, matches, 1.0f, max_distance);
+}
 
+void BRIEF::matchRatio(const cv::Mat &query, const cv::Mat &train, std::vector<cv::DMatch> &matches, float ratio, int max_distance)
+{
+    matches.clear();
+    if(query.empty() || train.empty())
+        return;
 
-}
+    CV_Assert(query.type() == CV_8UC1 && query.cols == DESCRIPTOR_BYTES);
+    CV_Assert(train.type() == CV_8UC1 && train.cols == DESCRIPTOR_BYTES);
 
+    matches.reserve(query.rows);
+    for(int i = 0; i < query.rows; ++i)
+    {
+        const uchar *desc = query.ptr<uchar>(i);
+        int best_distance = DESCRIPTOR_BYTES * 8 + 1;
+        int second_distance = best_distance;
+        int best_idx = -1;
+        for(int j = 0; j < train.rows; ++j)
+        {
+            const int d = distance(desc, train.ptr<uchar>(j));
+            if(d < best_distance)
+            {
+                second_distance = best_distance;
+                best_distance = d;
+                best_idx = j;
+            }
+            else if(d < second_distance)
+                second_distance = d;
+        }
+
+        if(best_idx < 0 || best_distance > max_distance || best_distance > ratio * second_distance)
+            continue;
+
+        matches.emplace_back(cv::DMatch(i, best_idx, (float)best_distance));
+    }
+}
 
+}
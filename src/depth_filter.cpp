@@ -5,6 +5,7 @@
 #include "feature_alignment.hpp"
 #include "image_alignment.hpp"
 #include "time_tracing.hpp"
+#include "thread_pool.hpp"
 
 namespace ssvo{
 
@@ -111,7 +112,7 @@ TimeTracing::Ptr dfltTrace = nullptr;
 
 //! DepthFilter
 DepthFilter::DepthFilter(const FastDetector::Ptr &fast_detector, const Callback &callback, bool report, bool verbose) :
-    seed_coverged_callback_(callback), fast_detector_(fast_detector),
+    seed_coverged_callback_(callback), fast_detector_(fast_detector), frames_pending_(0),
     report_(report), verbose_(report&&verbose), filter_thread_(nullptr), track_thread_enabled_(true), stop_require_(false)
 {
     options_.max_kfs = 5;
@@ -119,11 +120,17 @@ DepthFilter::DepthFilter(const FastDetector::Ptr &fast_detector, const Callback
     options_.max_epl_length = 1000;
     options_.epl_dist2_threshold = 16;
     options_.klt_epslion = 0.0001;
+    options_.klt_native = Config::kltNative();
+    options_.klt_check = Config::kltCheck();
+    options_.klt_max_residual = Config::kltMaxResidual();
     options_.align_epslion = 0.0001;
     options_.max_perprocess_kfs = Config::maxPerprocessKeyFrames();
     options_.pixel_error_threshold = 1;
     options_.min_frame_disparity = 0.0;//2.0;
     options_.min_pixel_disparity = 4.5;
+    options_.max_seeds_per_frame = Config::maxSeedsPerFrame();
+    options_.max_seeds_time_us = Config::maxSeedsTimeUs();
+    resetSeedsBudget();
 
     //! LOG and timer for system;
     TimeTracing::TraceNames time_names;
@@ -138,6 +145,7 @@ DepthFilter::DepthFilter(const FastDetector::Ptr &fast_detector, const Callback
     log_names.push_back("num_tracked");
     log_names.push_back("num_updated");
     log_names.push_back("num_repoj");
+    log_names.push_back("num_budget_skipped");
 
     string trace_dir = Config::timeTracingDirectory();
     dfltTrace.reset(new TimeTracing("ssvo_trace_filter", trace_dir, time_names, log_names));
@@ -172,13 +180,12 @@ void DepthFilter::stopMainThread()
 
 void DepthFilter::setStop()
 {
-    std::unique_lock<std::mutex> lock(mutex_stop_);
     stop_require_ = true;
+    frames_buffer_.stop();
 }
 
 bool DepthFilter::isRequiredStop()
 {
-    std::unique_lock<std::mutex> lock(mutex_stop_);
     return stop_require_;
 }
 
@@ -197,6 +204,7 @@ void DepthFilter::run()
             int project_count = 0;
             if(checkDisparity(frame))
             {
+                resetSeedsBudget();
                 dfltTrace->startTimer("update_seeds");
                 updated_count = updateSeeds(frame);
                 dfltTrace->stopTimer("update_seeds");
@@ -224,11 +232,25 @@ void DepthFilter::run()
             LOG_IF(WARNING, report_) << "[Filter][2] Frame: " << frame->id_
                                      << ", Seeds after updated: " << updated_count
                                      << ", new reprojected: " << project_count;
+
+            frames_pending_--;
+            idle_event_.notify();
         }
 
     }
 }
 
+void DepthFilter::waitForIdle()
+{
+    if(seeds_track_future_.valid())
+        seeds_track_future_.wait();
+
+    if(filter_thread_ == nullptr)
+        return;
+
+    idle_event_.wait([this]{ return frames_pending_.load() == 0; });
+}
+
 //void DepthFilter::logSeedsInfo()
 //{
 //    std::unique_lock<std::mutex> lock(mutex_seeds_);
@@ -263,15 +285,13 @@ void DepthFilter::run()
 
 bool DepthFilter::checkNewFrame(Frame::Ptr &frame, KeyFrame::Ptr &keyframe)
 {
-    std::unique_lock<std::mutex> lock(mutex_frame_);
-    cond_process_main_.wait_for(lock, std::chrono::microseconds(5));
-
-    if(frames_buffer_.empty())
+    //! sleep until a new frame arrives or stop is required
+    std::pair<Frame::Ptr, KeyFrame::Ptr> item;
+    if(!frames_buffer_.waitAndPop(item))
         return false;
 
-    frame = frames_buffer_.front().first;
-    keyframe = frames_buffer_.front().second;
-    frames_buffer_.pop_front();
+    frame = item.first;
+    keyframe = item.second;
 
     return frame != nullptr;
 }
@@ -283,7 +303,9 @@ bool DepthFilter::checkDisparity(const Frame::Ptr &frame)
     if(frame == nullptr)
         return false;
 
-    if(frame_ref != nullptr && frame_ref->getRefKeyFrame()->id_ == frame->getRefKeyFrame()->id_)
+    const KeyFrame::Ptr keyframe_ref = frame_ref ? frame_ref->getRefKeyFrame() : nullptr;
+    const KeyFrame::Ptr keyframe_cur = frame->getRefKeyFrame();
+    if(keyframe_ref != nullptr && keyframe_cur != nullptr && keyframe_ref->id_ == keyframe_cur->id_)
     {
         const double disparity = frame->disparity_ - frame_ref->disparity_;
         if(std::abs(disparity) < options_.min_frame_disparity)
@@ -303,7 +325,8 @@ void DepthFilter::trackFrame(const Frame::Ptr &frame_last, const Frame::Ptr &fra
     dfltTrace->log("frame_id", frame_cur->id_);
     if(track_thread_enabled_)
     {
-        seeds_track_future_ = std::async(std::launch::async, &DepthFilter::trackSeeds, this, frame_last, frame_cur);
+        seeds_track_future_ = ThreadPool::getInstance().submit(ThreadPool::TASK_DEPTH_FILTER,
+            std::bind(&DepthFilter::trackSeeds, this, frame_last, frame_cur));
     }
     else
     {
@@ -332,6 +355,7 @@ void DepthFilter::insertFrame(const Frame::Ptr &frame, const KeyFrame::Ptr keyfr
         int project_count = 0;
         if(checkDisparity(frame))
         {
+            resetSeedsBudget();
             dfltTrace->startTimer("update_seeds");
             updated_count = updateSeeds(frame);
             dfltTrace->stopTimer("update_seeds");
@@ -362,9 +386,8 @@ void DepthFilter::insertFrame(const Frame::Ptr &frame, const KeyFrame::Ptr keyfr
     }
     else
     {
-        std::unique_lock<std::mutex> lock(mutex_frame_);
-        frames_buffer_.emplace_back(frame, keyframe);
-        cond_process_main_.notify_one();
+        frames_pending_++;
+        frames_buffer_.push(std::make_pair(frame, keyframe));
     }
 }
 
@@ -477,12 +500,12 @@ int DepthFilter::updateByConnectedKeyFrames(const KeyFrame::Ptr &keyframe, int n
     const double px_threshold = options_.pixel_error_threshold*pixel_usigma;
 
     KeyFrame::Ptr reference_keyframe = keyframe->getRefKeyFrame();
-    std::set<KeyFrame::Ptr> connect_keyframes = reference_keyframe->getConnectedKeyFrames(num);
-    connect_keyframes.insert(reference_keyframe);
-
-    if(connect_keyframes.empty())
+    if(reference_keyframe == nullptr)
         return 0;
 
+    std::vector<KeyFrame::Ptr> connect_keyframes = reference_keyframe->getConnectedKeyFrames(num);
+    connect_keyframes.insert(connect_keyframes.begin(), reference_keyframe);
+
     int matched_count = 0;
     for(const KeyFrame::Ptr &kf : connect_keyframes)
     {
@@ -518,9 +541,18 @@ int DepthFilter::trackSeeds(const Frame::Ptr &frame_last, const Frame::Ptr &fram
 
     std::vector<cv::Point2f> pts_tracked = pts_to_track;
     std::vector<bool> status;
-    static cv::TermCriteria termcrit(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, options_.klt_epslion);
-    utils::kltTrack(frame_last->opticalImages(), frame_cur->opticalImages(), Frame::optical_win_size_,
-                    pts_to_track, pts_tracked, status, termcrit, true, verbose_);
+    if(options_.klt_native)
+    {
+        utils::kltTrackIC(frame_last->images(), frame_cur->images(), Frame::optical_win_size_.width,
+                          pts_to_track, pts_tracked, status, 30, options_.klt_epslion,
+                          (utils::KLTCheck) options_.klt_check, options_.klt_max_residual, verbose_);
+    }
+    else
+    {
+        static cv::TermCriteria termcrit(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, options_.klt_epslion);
+        utils::kltTrack(frame_last->opticalImages(), frame_cur->opticalImages(), Frame::optical_win_size_,
+                        pts_to_track, pts_tracked, status, termcrit, true, verbose_);
+    }
 
     //! erase untracked seeds
     int tracked_count = 0;
@@ -565,7 +597,11 @@ int DepthFilter::updateSeeds(const Frame::Ptr &frame)
     const double pixel_usigma = Config::imagePixelSigma()/focus_length;
     const double epl_threshold = options_.epl_dist2_threshold*pixel_usigma*pixel_usigma;
     const double px_threshold = options_.pixel_error_threshold*pixel_usigma;
-    int updated_count = 0;
+    const double px_error = options_.klt_epslion*px_threshold;
+    //! [gain, feature, fn_cur, T_cur_from_ref]
+    typedef std::tuple<double, Feature::Ptr, Vector3d, SE3d> UpdateCandidate;
+    std::vector<UpdateCandidate, aligned_allocator<UpdateCandidate> > candidates;
+    candidates.reserve(seed_fts.size());
     for(const auto &seed_map : seeds_map)
     {
         KeyFrame::Ptr kf = seed_map.first;
@@ -591,27 +627,51 @@ int DepthFilter::updateSeeds(const Frame::Ptr &frame)
                 continue;
             }
 
-            //! update
-            double depth = -1;
-            if(utils::triangulate(T_cur_from_ref.rotationMatrix(), T_cur_from_ref.translation(), seed->fn_ref, fn_cur, depth))
+            //! expected gain with the measurement variance at current estimated depth
+            const double tau = seed->computeVar(T_cur_from_ref, 1.0/seed->getInvDepth(), px_error);
+            candidates.emplace_back(seed->getInfoGain(tau*tau), ft, fn_cur, T_cur_from_ref);
+        }
+    }
+
+    //! the most valuable seeds first
+    std::sort(candidates.begin(), candidates.end(), [](const UpdateCandidate &c1, const UpdateCandidate &c2){
+        return std::get<0>(c1) > std::get<0>(c2);
+    });
+
+    int updated_count = 0;
+    for(const UpdateCandidate &candidate : candidates)
+    {
+        if(!consumeSeedsBudget())
+        {
+            seeds_budget_skipped_++;
+            continue;
+        }
+
+        const Feature::Ptr &ft = std::get<1>(candidate);
+        const Vector3d &fn_cur = std::get<2>(candidate);
+        const SE3d &T_cur_from_ref = std::get<3>(candidate);
+        const Seed::Ptr &seed = ft->seed_;
+
+        //! update
+        double depth = -1;
+        if(utils::triangulate(T_cur_from_ref.rotationMatrix(), T_cur_from_ref.translation(), seed->fn_ref, fn_cur, depth))
+        {
+//            double tau = seed->computeTau(T_ref_from_cur, seed->fn_ref, depth, px_error_angle);
+            double tau = seed->computeVar(T_cur_from_ref, depth, px_error);
+//            tau = tau + Config::pixelUnSigma();
+            seed->update(1.0/depth, tau*tau);
+
+            //! check converge
+            if(seed->checkConvergence())
             {
-//                double tau = seed->computeTau(T_ref_from_cur, seed->fn_ref, depth, px_error_angle);
-                double tau = seed->computeVar(T_cur_from_ref, depth, options_.klt_epslion*px_threshold);
-//                tau = tau + Config::pixelUnSigma();
-                seed->update(1.0/depth, tau*tau);
-
-                //! check converge
-                if(seed->checkConvergence())
-                {
-                    seed_coverged_callback_(seed);
-                    kf->removeSeed(seed);
-                    frame->removeSeed(seed);
-                    continue;
-                }
+                seed_coverged_callback_(seed);
+                seed->kf->removeSeed(seed);
+                frame->removeSeed(seed);
+                continue;
             }
-
-            updated_count++;
         }
+
+        updated_count++;
     }
 
     return updated_count;
@@ -623,67 +683,99 @@ int DepthFilter::reprojectSeeds(const KeyFrame::Ptr &keyframe, const Frame::Ptr
 
     SE3d T_cur_from_ref = frame->Tcw() * keyframe->pose();
 
-    int project_count = 0;
     int matched_count = 0;
-    Vector2d px_matched;
-    int level_matched;
     for(const Feature::Ptr &ft : seed_fts)
     {
-        const Seed::Ptr &seed = ft->seed_;
-        if(frame->hasSeed(seed))
+        if(frame->hasSeed(ft->seed_))
             continue;
 
-        project_count++;
-        bool matched = findEpipolarMatch(seed, keyframe, frame, T_cur_from_ref, px_matched, level_matched);
-        if(!matched)
-            continue;
+        if(reprojectSeed(ft, keyframe, frame, T_cur_from_ref, epl_threshold, pixel_error, created) > 0)
+            matched_count++;
+    }
 
-        //! check distance to epl, incase of the aligen draft
-        Vector2d fn_matched = frame->cam_->lift(px_matched).head<2>();
-        double dist2 = utils::Fundamental::computeErrorSquared(keyframe->pose().translation(), seed->fn_ref/seed->getInvDepth(), T_cur_from_ref, fn_matched);
-        if(dist2 > epl_threshold)
-            continue;
+    return matched_count;
+}
 
-        double pixel_disparity = (seed->px_ref - px_matched).norm() / (1 << level_matched);//seed->level_ref);
-        if(pixel_disparity < options_.min_pixel_disparity)
+//! return 1 if the seed is matched and updated, 0 if matched but not updated, -1 if failed
+int DepthFilter::reprojectSeed(const Feature::Ptr &seed_ft, const KeyFrame::Ptr& keyframe, const Frame::Ptr &frame,
+                               const SE3d &T_cur_from_ref, double epl_threshold, double pixel_error, bool created)
+{
+    const Seed::Ptr &seed = seed_ft->seed_;
+    Vector2d px_matched;
+    int level_matched;
+    bool matched = findEpipolarMatch(seed, keyframe, frame, T_cur_from_ref, px_matched, level_matched);
+    if(!matched)
+        return -1;
+
+    //! check distance to epl, incase of the aligen draft
+    Vector2d fn_matched = frame->cam_->lift(px_matched).head<2>();
+    double dist2 = utils::Fundamental::computeErrorSquared(keyframe->pose().translation(), seed->fn_ref/seed->getInvDepth(), T_cur_from_ref, fn_matched);
+    if(dist2 > epl_threshold)
+        return -1;
+
+    double pixel_disparity = (seed->px_ref - px_matched).norm() / (1 << level_matched);//seed->level_ref);
+    if(pixel_disparity < options_.min_pixel_disparity)
+    {
+        if(created)
         {
-            if(created)
-            {
-                Feature::Ptr new_ft = Feature::create(px_matched, level_matched, seed);
-                frame->addSeed(new_ft);
-            }
-            continue;
+            Feature::Ptr new_ft = Feature::create(px_matched, level_matched, seed);
+            frame->addSeed(new_ft);
         }
+        return 0;
+    }
 
-        double depth = -1;
-        const Vector3d fn_cur = frame->cam_->lift(px_matched);
-        bool succeed = utils::triangulate(T_cur_from_ref.rotationMatrix(), T_cur_from_ref.translation(), seed->fn_ref, fn_cur, depth);
-        if(!succeed)
-            continue;
+    double depth = -1;
+    const Vector3d fn_cur = frame->cam_->lift(px_matched);
+    bool succeed = utils::triangulate(T_cur_from_ref.rotationMatrix(), T_cur_from_ref.translation(), seed->fn_ref, fn_cur, depth);
+    if(!succeed)
+        return -1;
 
-//            double tau = seed->computeTau(T_ref_from_cur, seed->fn_ref, depth, px_error_angle);
-        double tau = seed->computeVar(T_cur_from_ref, depth, pixel_error);
-//            tau = tau + Config::pixelUnSigma();
-        seed->update(1.0/depth, tau*tau);
+//    double tau = seed->computeTau(T_ref_from_cur, seed->fn_ref, depth, px_error_angle);
+    double tau = seed->computeVar(T_cur_from_ref, depth, pixel_error);
+//    tau = tau + Config::pixelUnSigma();
+    seed->update(1.0/depth, tau*tau);
 
-        //! check converge
-        if(seed->checkConvergence())
-        {
-            seed_coverged_callback_(seed);
-            keyframe->removeSeed(seed);
-            continue;
-        }
+    //! check converge
+    if(seed->checkConvergence())
+    {
+        seed_coverged_callback_(seed);
+        keyframe->removeSeed(seed);
+        return -1;
+    }
 
-        //! update px
-        if(created)
-        {
-            Feature::Ptr new_ft = Feature::create(px_matched, level_matched, seed);
-            frame->addSeed(new_ft);
-        }
-        matched_count++;
+    //! update px
+    if(created)
+    {
+        Feature::Ptr new_ft = Feature::create(px_matched, level_matched, seed);
+        frame->addSeed(new_ft);
     }
 
-    return matched_count;
+    return 1;
+}
+
+void DepthFilter::resetSeedsBudget()
+{
+    seeds_budget_skipped_ = 0;
+    seeds_budget_count_ = options_.max_seeds_per_frame > 0 ? options_.max_seeds_per_frame : std::numeric_limits<int>::max();
+    if(options_.max_seeds_time_us > 0)
+        seeds_budget_deadline_ = std::chrono::steady_clock::now() + std::chrono::microseconds((int64_t)options_.max_seeds_time_us);
+    else
+        seeds_budget_deadline_ = std::chrono::steady_clock::time_point::max();
+}
+
+bool DepthFilter::consumeSeedsBudget()
+{
+    if(seeds_budget_count_ <= 0)
+        return false;
+
+    if(options_.max_seeds_time_us > 0 && std::chrono::steady_clock::now() > seeds_budget_deadline_)
+    {
+        seeds_budget_count_ = 0;
+        return false;
+    }
+
+    seeds_budget_count_--;
+    return true;
 }
 
 int DepthFilter::reprojectAllSeeds(const Frame::Ptr &frame)
@@ -693,17 +785,51 @@ int DepthFilter::reprojectAllSeeds(const Frame::Ptr &frame)
     static double epl_threshold = options_.epl_dist2_threshold*pixel_usigma*pixel_usigma;
     static double px_threshold = options_.pixel_error_threshold*pixel_usigma;
     //! get new seeds for track
-    std::set<KeyFrame::Ptr> candidate_keyframes = frame->getRefKeyFrame()->getConnectedKeyFrames(options_.max_kfs);
-    candidate_keyframes.insert(frame->getRefKeyFrame());
+    const KeyFrame::Ptr reference_keyframe = frame->getRefKeyFrame();
+    if(reference_keyframe == nullptr)
+        return 0;
 
-    std::vector<Feature::Ptr> seed_fts = frame->getSeeds();
+    std::vector<KeyFrame::Ptr> candidate_keyframes = reference_keyframe->getConnectedKeyFrames(options_.max_kfs);
+    candidate_keyframes.push_back(reference_keyframe);
 
-    int matched_count = 0;
+    //! rank all the seeds not tracked in current frame by information gain
+    //! [gain, feature, keyframe, T_cur_from_ref]
+    typedef std::tuple<double, Feature::Ptr, KeyFrame::Ptr, SE3d> SearchCandidate;
+    std::vector<SearchCandidate, aligned_allocator<SearchCandidate> > candidates;
     for(const KeyFrame::Ptr &kf : candidate_keyframes)
     {
-        matched_count += reprojectSeeds(kf, frame, epl_threshold, px_threshold);
+        const SE3d T_cur_from_ref = frame->Tcw() * kf->pose();
+        std::vector<Feature::Ptr> seed_fts = kf->getSeeds();
+        for(const Feature::Ptr &ft : seed_fts)
+        {
+            const Seed::Ptr &seed = ft->seed_;
+            if(frame->hasSeed(seed))
+                continue;
+
+            const double tau = seed->computeVar(T_cur_from_ref, 1.0/seed->getInvDepth(), px_threshold);
+            candidates.emplace_back(seed->getInfoGain(tau*tau), ft, kf, T_cur_from_ref);
+        }
     }
 
+    std::sort(candidates.begin(), candidates.end(), [](const SearchCandidate &c1, const SearchCandidate &c2){
+        return std::get<0>(c1) > std::get<0>(c2);
+    });
+
+    int matched_count = 0;
+    for(const SearchCandidate &candidate : candidates)
+    {
+        if(!consumeSeedsBudget())
+        {
+            seeds_budget_skipped_++;
+            continue;
+        }
+
+        if(reprojectSeed(std::get<1>(candidate), std::get<2>(candidate), frame, std::get<3>(candidate), epl_threshold, px_threshold, true) > 0)
+            matched_count++;
+    }
+
+    dfltTrace->log("num_budget_skipped", seeds_budget_skipped_);
+
     return matched_count;
 }
 
@@ -1,6 +1,7 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/opencv.hpp>
 #include "feature_detector.hpp"
+#include "thread_pool.hpp"
 
 namespace ssvo{
 
@@ -105,10 +106,9 @@ size_t FastDetector::detect(const ImgPyr &img_pyr, Corners &new_corners, const C
     //! 1. Corners detect in all levels
     for(Corners &cs : corners_in_levels_) { cs.clear(); }
     
-    size_t new_coners = corners_in_levels_[0].size();
-    for(int level = 0; level < nlevels_; level++)
-    {
-        new_coners += detectInLevel(img_pyr[level], detect_grids_[level], corners_in_levels_[level], eigen_threshold, border_);
+    //! every level has its own grid and corners, so they can be detected in parallel
+    ThreadPool::getInstance().parallelFor(ThreadPool::TASK_DETECTION, 0, nlevels_, [&](int level){
+        detectInLevel(img_pyr[level], detect_grids_[level], corners_in_levels_[level], eigen_threshold, border_);
 
         const int scale = 1 << level;
         for(Corner &corner : corners_in_levels_[level])
@@ -117,7 +117,7 @@ size_t FastDetector::detect(const ImgPyr &img_pyr, Corners &new_corners, const C
             corner.x *= scale;
             corner.y *= scale;
         }
-    }
+    });
 
     //! 2. Get corners from grid
     setCorners(grid_filter_, exist_corners);
@@ -1,6 +1,7 @@
 #include "feature_tracker.hpp"
 #include "feature_alignment.hpp"
 #include "image_alignment.hpp"
+#include "thread_pool.hpp"
 #include <numeric>
 
 namespace ssvo{
@@ -13,8 +14,8 @@ inline size_t Grid<Feature::Ptr>::getIndex(const Feature::Ptr &element)
         + static_cast<size_t>(px[0]/grid_size_);
 }
 
-FeatureTracker::FeatureTracker(int width, int height, int grid_size, int border, bool report, bool verbose) :
-    grid_(width, height, grid_size), report_(report), verbose_(report&&verbose)
+FeatureTracker::FeatureTracker(const Map::Ptr &map, int width, int height, int grid_size, int border, bool report, bool verbose) :
+    map_(map), grid_(width, height, grid_size), report_(report), verbose_(report&&verbose)
 {
     options_.border = border;
     options_.max_matches = 200;
@@ -22,6 +23,8 @@ FeatureTracker::FeatureTracker(int width, int height, int grid_size, int border,
     options_.num_align_iter = 30;
     options_.max_align_epsilon = 0.01;
     options_.max_align_error2 = 3.0;
+    options_.max_frustum_mpts = 1000;
+    options_.frustum_depth_ratio = 3.0;
 
     //! initialize grid
     grid_order_.resize(grid_.nCells());
@@ -41,43 +44,51 @@ int FeatureTracker::reprojectLoaclMap(const Frame::Ptr &frame)
     if(frame_last)
     {
         matches_from_frame = matchMapPointsFromLastFrame(frame, frame_last);
-        std::vector<MapPoint::Ptr> last_mpts_list = frame_last->getMapPoints();
-        for(const MapPoint::Ptr &mpt : last_mpts_list)
+        frame_last->forEachFeature([&last_mpts_set](const MapPoint::Ptr &mpt, const Feature::Ptr &){
             last_mpts_set.insert(mpt);
+        });
     }
 
-    std::set<KeyFrame::Ptr> local_keyframes = frame->getRefKeyFrame()->getConnectedKeyFrames(options_.max_track_kfs);
-    local_keyframes.insert(frame->getRefKeyFrame());
+    //! kept alive by the system while tracking
+    const KeyFrame::Ptr reference_keyframe = frame->getRefKeyFrame();
+    LOG_ASSERT(reference_keyframe) << " No reference keyframe for frame " << frame->id_;
 
-    if(local_keyframes.size() < options_.max_track_kfs)
-    {
-        std::set<KeyFrame::Ptr> sub_connected_keyframes = frame->getRefKeyFrame()->getSubConnectedKeyFrames(options_.max_track_kfs-local_keyframes.size());
-        for(const KeyFrame::Ptr &kf : sub_connected_keyframes)
-        {
-            local_keyframes.insert(kf);
-        }
-    }
+    //! the snapshot published by the mapper is read without locks if it is around the same keyframe,
+    //! otherwise the local map is traversed with the locks of each keyframe and map point
+    Map::LocalMap::Ptr local_map = map_ ? map_->getLocalMap() : nullptr;
+    const bool use_snapshot = local_map && local_map->reference == reference_keyframe;
+    if(!use_snapshot)
+        local_map = Map::createLocalMap(reference_keyframe, options_.max_track_kfs);
 
     double t1 = (double)cv::getTickCount();
 
+    //! the points culled after the snapshot are rejected by reprojectMapPoint
+    const SE3d Tcw = frame->Tcw();
     std::unordered_set<MapPoint::Ptr> local_mpts;
-    for(const KeyFrame::Ptr &kf : local_keyframes)
+    for(size_t i = 0; i < local_map->mpts.size(); ++i)
     {
-        std::vector<MapPoint::Ptr> mpts = kf->getMapPoints();
+        const MapPoint::Ptr &mpt = local_map->mpts[i];
+        if(last_mpts_set.count(mpt))
+            continue;
+
+        local_mpts.insert(mpt);
+        reprojectMapPointToCell(frame, Tcw, mpt, local_map->poses[i]);
+    }
+
+    //! the points out of the covisibility, such as the revisited ones, are found by the voxel index
+    int frustum_mpts = 0;
+    double depth_mean, depth_min;
+    if(map_ && map_->voxelIndexEnabled() && reference_keyframe->getSceneDepth(depth_mean, depth_min))
+    {
+        const std::vector<MapPoint::Ptr> mpts = map_->getMapPointsInFrustum(frame, depth_mean * options_.frustum_depth_ratio, options_.max_frustum_mpts);
         for(const MapPoint::Ptr &mpt : mpts)
         {
-            if(local_mpts.count(mpt) || last_mpts_set.count(mpt))
+            if(local_mpts.count(mpt) || last_mpts_set.count(mpt) || mpt->isBad())
                 continue;
 
             local_mpts.insert(mpt);
-
-            if(mpt->isBad()) //! should not happen
-            {
-                kf->removeMapPoint(mpt);
-                continue;
-            }
-
-            reprojectMapPointToCell(frame, mpt);
+            if(reprojectMapPointToCell(frame, Tcw, mpt, mpt->pose()))
+                frustum_mpts++;
         }
     }
 
@@ -104,7 +115,8 @@ int FeatureTracker::reprojectLoaclMap(const Frame::Ptr &frame)
                            << (t1-t0)/cv::getTickFrequency() << " "
                            << (t2-t1)/cv::getTickFrequency() << " "
                            << (t3-t2)/cv::getTickFrequency() << " "
-                           << ", match points " << matches_from_frame << "+" << matches_from_cell << "(" << total_project_ << ", " << local_mpts.size() << ")";
+                           << ", match points " << matches_from_frame << "+" << matches_from_cell << "(" << total_project_ << ", " << local_mpts.size() << ", frustum " << frustum_mpts << ")"
+                           << ", local map " << (use_snapshot ? "snapshot" : "locked");
 
     //! update last frame
     frame_last = frame;
@@ -112,9 +124,9 @@ int FeatureTracker::reprojectLoaclMap(const Frame::Ptr &frame)
     return matches_from_frame + matches_from_cell;
 }
 
-bool FeatureTracker::reprojectMapPointToCell(const Frame::Ptr &frame, const MapPoint::Ptr &point)
+bool FeatureTracker::reprojectMapPointToCell(const Frame::Ptr &frame, const SE3d &Tcw, const MapPoint::Ptr &point, const Vector3d &pose_world)
 {
-    Vector3d pose(frame->Tcw() * point->pose());
+    Vector3d pose(Tcw * pose_world);
     if(pose[2] < 0.0f)
         return false;
 
@@ -160,31 +172,45 @@ int FeatureTracker::matchMapPointsFromLastFrame(const Frame::Ptr &frame_cur, con
     if(frame_last == nullptr || frame_cur == nullptr)
         return 0;
 
-    std::vector<MapPoint::Ptr> mpts = frame_last->getMapPoints();
+    std::vector<MapPoint::Ptr> &mpts = mpts_buffer_;
+    frame_last->getMapPoints(mpts);
+
+    //! align all the points in parallel, then add features in order
+    const int N = (int) mpts.size();
+    std::vector<Vector2d, aligned_allocator<Vector2d> > pxs_cur(N);
+    std::vector<int> levels_cur(N, 0);
+    std::vector<int> results(N, -2);
+    const SE3d T_cur_from_world = frame_cur->Tcw();
+    ThreadPool::getInstance().parallelFor(ThreadPool::TASK_TRACKING, 0, N, [&](int i){
+        const Vector3d mpt_cur = T_cur_from_world * mpts[i]->pose();
+        if(mpt_cur[2] < 0.0f)
+            return;
+
+        pxs_cur[i] = frame_cur->cam_->project(mpt_cur);
+        if(!frame_cur->cam_->isInFrame(pxs_cur[i].cast<int>(), options_.border))
+            return;
+
+        results[i] = reprojectMapPoint(frame_cur, mpts[i], pxs_cur[i], levels_cur[i], options_.num_align_iter, options_.max_align_epsilon, options_.max_align_error2, verbose_);
+    }, 8);
 
     int matches_count = 0;
-    for(const MapPoint::Ptr &mpt : mpts)
+    for(int i = 0; i < N; i++)
     {
-        const Vector3d mpt_cur = frame_cur->Tcw() * mpt->pose();
-        if(mpt_cur[2] < 0.0f)
-            continue;
-
-        Vector2d px_cur(frame_cur->cam_->project(mpt_cur));
-        if(!frame_cur->cam_->isInFrame(px_cur.cast<int>(), options_.border))
+        //! not projected
+        if(results[i] == -2)
             continue;
 
         total_project_++;
 
-        int level_cur = 0;
-        int result = reprojectMapPoint(frame_cur, mpt, px_cur, level_cur, options_.num_align_iter, options_.max_align_epsilon, options_.max_align_error2, verbose_);
+        const MapPoint::Ptr &mpt = mpts[i];
+        mpt->increaseVisible(results[i]+1);
 
-        mpt->increaseVisible(result+1);
-
-        if(result != 1)
+        if(results[i] != 1)
             continue;
 
+        const Vector2d &px_cur = pxs_cur[i];
         Vector3d ft_cur = frame_cur->cam_->lift(px_cur);
-        Feature::Ptr new_feature = Feature::create(px_cur, ft_cur, level_cur, mpt);
+        Feature::Ptr new_feature = Feature::create(px_cur, ft_cur, levels_cur[i], mpt);
         frame_cur->addFeature(new_feature);
         mpt->increaseFound(2);
 
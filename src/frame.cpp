@@ -1,10 +1,12 @@
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
 #include <include/config.hpp>
 
 #include "frame.hpp"
 #include "keyframe.hpp"
 #include "utils.hpp"
+#include "submap.hpp"
 
 namespace ssvo {
 
@@ -36,9 +38,76 @@ Frame::Frame(const ImgPyr &img_pyr, const uint64_t id, const double timestamp, c
     Tcw_(SE3d(Matrix3d::Identity(), Vector3d::Zero())), Twc_(Tcw_.inverse())
 {}
 
+//! the pyramids decoded from the compressed or offloaded images, the most recently used first.
+//! The old keyframes are used in bursts, by the patch warps of a keyframe or a relocalization,
+//! so a few of them are enough, and they are never encoded again
+class DecodedImageCache
+{
+public:
+
+    static DecodedImageCache& getInstance()
+    {
+        static DecodedImageCache instance;
+        return instance;
+    }
+
+    bool get(const Frame *frame, ImgPyr &img_pyr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto it = entries_.begin(); it != entries_.end(); ++it)
+        {
+            if(it->first != frame)
+                continue;
+
+            img_pyr = it->second;
+            entries_.splice(entries_.begin(), entries_, it);
+            return true;
+        }
+        return false;
+    }
+
+    void put(const Frame *frame, const ImgPyr &img_pyr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.emplace_front(frame, img_pyr);
+        if(entries_.size() > CAPACITY)
+            entries_.pop_back();
+    }
+
+    void erase(const Frame *frame)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.remove_if([frame](const std::pair<const Frame*, ImgPyr> &entry){ return entry.first == frame; });
+    }
+
+private:
+
+    static const size_t CAPACITY = 8;
+
+    std::mutex mutex_;
+    std::list<std::pair<const Frame*, ImgPyr> > entries_;
+};
+
+Frame::~Frame()
+{
+    //! only the compressed or offloaded frames are in the cache
+    if(img_pyr_.empty())
+        DecodedImageCache::getInstance().erase(this);
+}
+
 const ImgPyr Frame::images() const
 {
-    return img_pyr_;
+    std::lock_guard<CountingMutex> lock(mutex_image_);
+    if(!img_pyr_.empty())
+        return img_pyr_;
+
+    ImgPyr img_pyr;
+    if(!DecodedImageCache::getInstance().get(this, img_pyr))
+    {
+        decodeImages(img_pyr);
+        DecodedImageCache::getInstance().put(this, img_pyr);
+    }
+    return img_pyr;
 }
 
 const ImgPyr Frame::opticalImages() const
@@ -48,37 +117,81 @@ const ImgPyr Frame::opticalImages() const
 
 const cv::Mat Frame::getImage(int level) const
 {
-    LOG_ASSERT(level < (int) img_pyr_.size()) << "Error level: " << level;
-    return img_pyr_[level];
+    {
+        //! the raw images are returned directly, only the compressed or offloaded ones go through the cache
+        std::lock_guard<CountingMutex> lock(mutex_image_);
+        if(!img_pyr_.empty())
+        {
+            LOG_ASSERT(level < (int) img_pyr_.size()) << "Error level: " << level;
+            return img_pyr_[level];
+        }
+    }
+
+    const ImgPyr img_pyr = images();
+    LOG_ASSERT(level < (int) img_pyr.size()) << "Error level: " << level;
+    return img_pyr[level];
+}
+
+void Frame::copyImages(ImgPyr &img_pyr) const
+{
+    std::lock_guard<CountingMutex> lock(mutex_image_);
+    if(!img_pyr_.empty())
+        img_pyr = img_pyr_;
+    else
+        decodeImages(img_pyr);
+}
+
+void Frame::decodeImages(ImgPyr &img_pyr) const
+{
+    if(!img_compressed_.empty())
+    {
+        img_pyr.resize(img_compressed_.size());
+        for(size_t i = 0; i < img_compressed_.size(); i++)
+            img_pyr[i] = cv::imdecode(img_compressed_[i], cv::IMREAD_UNCHANGED);
+    }
+    else
+    {
+        LOG_ASSERT(img_file_) << "No image in frame " << id_;
+        //! decoded from the mapped file directly, the pages are loaded by the kernel
+        img_pyr.resize(img_offsets_.size());
+        for(size_t i = 0; i < img_offsets_.size(); i++)
+        {
+            const cv::Mat buffer(1, (int)img_offsets_[i].second, CV_8UC1, (void*)img_file_->data(img_offsets_[i].first));
+            img_pyr[i] = cv::imdecode(buffer, cv::IMREAD_UNCHANGED);
+        }
+    }
+
+    for(size_t i = 0; i < img_pyr.size(); i++)
+        LOG_ASSERT(!img_pyr[i].empty()) << "Failed to decompress the image of frame " << id_ << " in level " << i;
 }
 
 SE3d Frame::Tcw()
 {
-    std::lock_guard<std::mutex> lock(mutex_pose_);
+    std::lock_guard<CountingMutex> lock(mutex_pose_);
     return Tcw_;
 }
 
 SE3d Frame::Twc()
 {
-    std::lock_guard<std::mutex> lock(mutex_pose_);
+    std::lock_guard<CountingMutex> lock(mutex_pose_);
     return Twc_;
 }
 
 SE3d Frame::pose()
 {
-    std::lock_guard<std::mutex> lock(mutex_pose_);
+    std::lock_guard<CountingMutex> lock(mutex_pose_);
     return Twc_;
 }
 
 Vector3d Frame::ray()
 {
-    std::lock_guard<std::mutex> lock(mutex_pose_);
+    std::lock_guard<CountingMutex> lock(mutex_pose_);
     return Dw_;
 }
 
 void Frame::setPose(const SE3d& pose)
 {
-    std::lock_guard<std::mutex> lock(mutex_pose_);
+    std::lock_guard<CountingMutex> lock(mutex_pose_);
     Twc_ = pose;
     Tcw_ = Twc_.inverse();
     Dw_ = Tcw_.rotationMatrix().determinant() * Tcw_.rotationMatrix().col(2);
@@ -86,7 +199,7 @@ void Frame::setPose(const SE3d& pose)
 
 void Frame::setPose(const Matrix3d& R, const Vector3d& t)
 {
-    std::lock_guard<std::mutex> lock(mutex_pose_);
+    std::lock_guard<CountingMutex> lock(mutex_pose_);
     Twc_ = SE3d(R, t);
     Tcw_ = Twc_.inverse();
     Dw_ = Tcw_.rotationMatrix().determinant() * Tcw_.rotationMatrix().col(2);
@@ -94,7 +207,7 @@ void Frame::setPose(const Matrix3d& R, const Vector3d& t)
 
 void Frame::setTcw(const SE3d &Tcw)
 {
-    std::lock_guard<std::mutex> lock(mutex_pose_);
+    std::lock_guard<CountingMutex> lock(mutex_pose_);
     Tcw_ = Tcw;
     Twc_ = Tcw_.inverse();
     Dw_ = Tcw_.rotationMatrix().determinant() * Tcw_.rotationMatrix().col(2);
@@ -105,7 +218,7 @@ bool Frame::isVisiable(const Vector3d &xyz_w, const int border)
 {
     SE3d Tcw;
     {
-        std::lock_guard<std::mutex> lock(mutex_pose_);
+        std::lock_guard<CountingMutex> lock(mutex_pose_);
         Tcw = Tcw_;
     }
     const Vector3d xyz_c = Tcw * xyz_w;
@@ -118,19 +231,19 @@ bool Frame::isVisiable(const Vector3d &xyz_w, const int border)
 
 std::unordered_map<MapPoint::Ptr, Feature::Ptr> Frame::features()
 {
-    std::lock_guard<std::mutex> lock(mutex_feature_);
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
     return mpt_fts_;
 }
 
 int Frame::featureNumber()
 {
-    std::lock_guard<std::mutex> lock(mutex_feature_);
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
     return (int)mpt_fts_.size();
 }
 
 std::vector<Feature::Ptr> Frame::getFeatures()
 {
-    std::lock_guard<std::mutex> lock(mutex_feature_);
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
     std::vector<Feature::Ptr> fts;
     fts.reserve(mpt_fts_.size());
     for(const auto &it : mpt_fts_)
@@ -141,7 +254,7 @@ std::vector<Feature::Ptr> Frame::getFeatures()
 
 std::vector<MapPoint::Ptr> Frame::getMapPoints()
 {
-    std::lock_guard<std::mutex> lock(mutex_feature_);
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
     std::vector<MapPoint::Ptr> mpts;
     mpts.reserve(mpt_fts_.size());
     for(const auto &it : mpt_fts_)
@@ -150,10 +263,28 @@ std::vector<MapPoint::Ptr> Frame::getMapPoints()
     return mpts;
 }
 
+void Frame::getFeatures(std::vector<Feature::Ptr> &fts)
+{
+    fts.clear();
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
+    fts.reserve(mpt_fts_.size());
+    for(const auto &it : mpt_fts_)
+        fts.push_back(it.second);
+}
+
+void Frame::getMapPoints(std::vector<MapPoint::Ptr> &mpts)
+{
+    mpts.clear();
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
+    mpts.reserve(mpt_fts_.size());
+    for(const auto &it : mpt_fts_)
+        mpts.push_back(it.first);
+}
+
 bool Frame::addFeature(const Feature::Ptr &ft)
 {
     LOG_ASSERT(ft->mpt_ != nullptr) << " The feature is invalid with empty mappoint!";
-    std::lock_guard<std::mutex> lock(mutex_feature_);
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
     if(mpt_fts_.count(ft->mpt_))
     {
         LOG(ERROR) << " The mappoint is already be observed! Frame: " << id_ << " Mpt: " << ft->mpt_->id_
@@ -168,19 +299,19 @@ bool Frame::addFeature(const Feature::Ptr &ft)
 
 bool Frame::removeFeature(const Feature::Ptr &ft)
 {
-    std::lock_guard<std::mutex> lock(mutex_feature_);
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
     return (bool)mpt_fts_.erase(ft->mpt_);
 }
 
 bool Frame::removeMapPoint(const MapPoint::Ptr &mpt)
 {
-    std::lock_guard<std::mutex> lock(mutex_feature_);
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
     return (bool)mpt_fts_.erase(mpt);
 }
 
 Feature::Ptr Frame::getFeatureByMapPoint(const MapPoint::Ptr &mpt)
 {
-    std::lock_guard<std::mutex> lock(mutex_feature_);
+    std::lock_guard<CountingMutex> lock(mutex_feature_);
     const auto it = mpt_fts_.find(mpt);
     if(it != mpt_fts_.end())
         return it->second;
@@ -190,13 +321,13 @@ Feature::Ptr Frame::getFeatureByMapPoint(const MapPoint::Ptr &mpt)
 
 int Frame::seedNumber()
 {
-    std::lock_guard<std::mutex> lock(mutex_seed_);
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
     return (int)seed_fts_.size();
 }
 
 std::vector<Feature::Ptr> Frame::getSeeds()
 {
-    std::lock_guard<std::mutex> lock(mutex_seed_);
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
     std::vector<Feature::Ptr> fts;
     fts.reserve(seed_fts_.size());
     for(const auto &it : seed_fts_)
@@ -205,12 +336,21 @@ std::vector<Feature::Ptr> Frame::getSeeds()
     return fts;
 }
 
+void Frame::getSeeds(std::vector<Feature::Ptr> &fts)
+{
+    fts.clear();
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
+    fts.reserve(seed_fts_.size());
+    for(const auto &it : seed_fts_)
+        fts.push_back(it.second);
+}
+
 bool Frame::addSeed(const Feature::Ptr &ft)
 {
     LOG_ASSERT(ft->seed_ != nullptr) << " The feature is invalid with empty mappoint!";
 
     {
-        std::lock_guard<std::mutex> lock(mutex_seed_);
+        std::lock_guard<CountingMutex> lock(mutex_seed_);
         if(seed_fts_.count(ft->seed_))
         {
             LOG(ERROR) << " The seed is already exited ! Frame: " << id_ << " Seed: " << ft->seed_->id;
@@ -225,13 +365,13 @@ bool Frame::addSeed(const Feature::Ptr &ft)
 
 bool Frame::removeSeed(const Seed::Ptr &seed)
 {
-    std::lock_guard<std::mutex> lock(mutex_seed_);
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
     return (bool) seed_fts_.erase(seed);
 }
 
 bool Frame::hasSeed(const Seed::Ptr &seed)
 {
-    std::lock_guard<std::mutex> lock(mutex_seed_);
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
     return (bool) seed_fts_.count(seed);
 }
 
@@ -239,12 +379,12 @@ bool Frame::getSceneDepth(double &depth_mean, double &depth_min)
 {
     SE3d Tcw;
     {
-        std::lock_guard<std::mutex> lock(mutex_pose_);
+        std::lock_guard<CountingMutex> lock(mutex_pose_);
         Tcw = Tcw_;
     }
     Features fts;
     {
-        std::lock_guard<std::mutex> lock(mutex_feature_);
+        std::lock_guard<CountingMutex> lock(mutex_feature_);
         for(const auto &it : mpt_fts_)
             fts.push_back(it.second);
     }
@@ -272,22 +412,13 @@ bool Frame::getSceneDepth(double &depth_mean, double &depth_min)
 
 std::map<KeyFrame::Ptr, int> Frame::getOverLapKeyFrames()
 {
-    std::vector<MapPoint::Ptr> mpts = getMapPoints();
-
     std::map<KeyFrame::Ptr, int> overlap_kfs;
 
-    for(const MapPoint::Ptr &mpt : mpts)
-    {
-        const std::map<KeyFrame::Ptr, Feature::Ptr> obs = mpt->getObservations();
-        for(const auto &item : obs)
-        {
-            auto it = overlap_kfs.find(item.first);
-            if(it != overlap_kfs.end())
-                it->second++;
-            else
-                overlap_kfs.insert(std::make_pair(item.first, 1));
-        }
-    }
+    forEachFeature([&overlap_kfs](const MapPoint::Ptr &mpt, const Feature::Ptr &){
+        mpt->forEachObservation([&overlap_kfs](const KeyFrame::Ptr &kf, const Feature::Ptr &){
+            overlap_kfs[kf]++;
+        });
+    });
 
     return overlap_kfs;
 }
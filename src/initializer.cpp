@@ -246,9 +246,18 @@ Initializer::Result Initializer::addImage(Frame::Ptr frame_cur)
     //! [1] KLT tracking
     const bool backward_check = true;
     cand_cur_->getInliers(inliers_);
-    static cv::TermCriteria termcrit(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.001);
-    utils::kltTrack(cand_last_->frame->opticalImages(), cand_cur_->frame->opticalImages(), Frame::optical_win_size_,
-                    cand_last_->pts, cand_cur_->pts, inliers_, termcrit, backward_check, true);
+    if(Config::kltNative())
+    {
+        utils::kltTrackIC(cand_last_->frame->images(), cand_cur_->frame->images(), Frame::optical_win_size_.width,
+                          cand_last_->pts, cand_cur_->pts, inliers_, 30, 0.001,
+                          backward_check ? (utils::KLTCheck) Config::kltCheck() : utils::KLT_CHECK_NONE, Config::kltMaxResidual(), verbose_);
+    }
+    else
+    {
+        static cv::TermCriteria termcrit(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.001);
+        utils::kltTrack(cand_last_->frame->opticalImages(), cand_cur_->frame->opticalImages(), Frame::optical_win_size_,
+                        cand_last_->pts, cand_cur_->pts, inliers_, termcrit, backward_check, true);
+    }
     cand_cur_->updateInliers(inliers_);
     //! if track too little corners in reference, then change reference
     const int offset = cand_cur_->checkTracking(cand_ref_->frame->id_, cand_cur_->frame->id_, Config::initMinTracked());
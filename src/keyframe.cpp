@@ -1,18 +1,44 @@
+#include <opencv2/imgcodecs.hpp>
 #include "config.hpp"
 #include "map.hpp"
 #include "keyframe.hpp"
+#include "submap.hpp"
 
 namespace ssvo{
 
 uint64_t KeyFrame::next_id_ = 0;
 
+//! lossless, with the fastest level of zlib, the higher ones take several times longer for a few percent
+static void encodeImages(uint64_t id, const ImgPyr &images, std::vector<std::vector<uchar> > &compressed)
+{
+    static const std::vector<int> params = {cv::IMWRITE_PNG_COMPRESSION, 1};
+    compressed.resize(images.size());
+    for(size_t i = 0; i < images.size(); i++)
+    {
+        const bool succeed = cv::imencode(".png", images[i], compressed[i], params);
+        LOG_ASSERT(succeed) << "Failed to compress the image of keyframe " << id << " in level " << i;
+    }
+}
+
 KeyFrame::KeyFrame(const Frame::Ptr frame):
-    Frame(frame->images(), next_id_++, frame->timestamp_, frame->cam_), frame_id_(frame->id_), isBad_(false)
+    Frame(frame->images(), next_id_++, frame->timestamp_, frame->cam_), frame_id_(frame->id_),
+    ordered_connections_dirty_(false), connection_version_(0), isBad_(false), sub_connected_signature_(0), sub_connected_num_(0)
 {
     mpt_fts_ = frame->features();
     setRefKeyFrame(frame->getRefKeyFrame());
     setPose(frame->pose());
 }
+
+KeyFrame::KeyFrame(const ImgPyr &img_pyr, const uint64_t id, const uint64_t frame_id, const double timestamp, const AbstractCamera::Ptr &cam):
+    Frame(img_pyr, id, timestamp, cam), frame_id_(frame_id),
+    ordered_connections_dirty_(false), connection_version_(0), isBad_(false), sub_connected_signature_(0), sub_connected_num_(0)
+{}
+
+static inline bool compareKeyFrameId(const std::pair<KeyFrame::Ptr, int> &a, const std::pair<KeyFrame::Ptr, int> &b)
+{
+    return a.first->id_ < b.first->id_;
+}
+
 void KeyFrame::updateConnections()
 {
     if(isBad())
@@ -20,13 +46,14 @@ void KeyFrame::updateConnections()
 
     Features fts;
     {
-        std::lock_guard<std::mutex> lock(mutex_feature_);
+        std::lock_guard<CountingMutex> lock(mutex_feature_);
         for(const auto &it : mpt_fts_)
             fts.push_back(it.second);
     }
 
-    std::map<KeyFrame::Ptr, int> connection_counter;
-
+    //! the keyframes are counted by sorting, each appears once for each shared map point
+    std::vector<KeyFrame::Ptr> observers;
+    observers.reserve(fts.size() * 4);
     for(const Feature::Ptr &ft : fts)
     {
         const MapPoint::Ptr &mpt = ft->mpt_;
@@ -37,140 +64,130 @@ void KeyFrame::updateConnections()
             continue;
         }
 
-        const std::map<KeyFrame::Ptr, Feature::Ptr> observations = mpt->getObservations();
-        for(const auto &obs : observations)
-        {
-            if(obs.first->id_ == id_)
-                continue;
-            connection_counter[obs.first]++;
-        }
+        mpt->forEachObservation([this, &observers](const KeyFrame::Ptr &kf, const Feature::Ptr &){
+            if(kf->id_ != id_)
+                observers.push_back(kf);
+        });
     }
 
-    if(connection_counter.empty())
-    {
-        setBad();
-        return;
-    }
+    std::sort(observers.begin(), observers.end(),
+              [](const KeyFrame::Ptr &a, const KeyFrame::Ptr &b){ return a->id_ < b->id_; });
 
-    // TODO how to select proper connections
-    int connection_threshold = Config::minConnectionObservations();
-
-    KeyFrame::Ptr best_unfit_keyframe;
-    int best_unfit_connections = 0;
-    std::vector<std::pair<int, KeyFrame::Ptr> > weight_connections;
-    for(const auto &obs : connection_counter)
+    Connections connections;
+    for(const KeyFrame::Ptr &kf : observers)
     {
-        if(obs.second < connection_threshold)
-        {
-            best_unfit_keyframe = obs.first;
-            best_unfit_connections = obs.second;
-        }
+        if(!connections.empty() && connections.back().first == kf)
+            connections.back().second++;
         else
-        {
-            obs.first->addConnection(shared_from_this(), obs.second);
-            weight_connections.emplace_back(std::make_pair(obs.second, obs.first));
-        }
+            connections.emplace_back(kf, 1);
     }
 
-    if(weight_connections.empty())
+    if(connections.empty())
     {
-        best_unfit_keyframe->addConnection(shared_from_this(), best_unfit_connections);
-        weight_connections.emplace_back(std::make_pair(best_unfit_connections, best_unfit_keyframe));
+        setBad();
+        return;
     }
 
-    //! sort by weight
-    std::sort(weight_connections.begin(), weight_connections.end(),
-              [](const std::pair<int, KeyFrame::Ptr> &a, const std::pair<int, KeyFrame::Ptr> &b){ return a.first > b.first; });
-
-    //! update
     {
-        std::lock_guard<std::mutex> lock(mutex_connection_);
-
-        connectedKeyFrames_.clear();
-        for(const auto &item : weight_connections)
-        {
-            connectedKeyFrames_.insert(std::make_pair(item.second, item.first));
-        }
-
-        orderedConnectedKeyFrames_ =
-            std::multimap<int, KeyFrame::Ptr>(weight_connections.begin(), weight_connections.end());
+        std::lock_guard<CountingMutex> lock(mutex_connection_);
+        connectedKeyFrames_ = connections;
+        ordered_connections_dirty_ = true;
+        connection_version_++;
     }
+
+    const KeyFrame::Ptr keyframe = shared_from_this();
+    for(const auto &item : connections)
+        item.first->setConnection(keyframe, item.second);
 }
 
-std::set<KeyFrame::Ptr> KeyFrame::getConnectedKeyFrames(int num, int min_fts)
+std::vector<KeyFrame::Ptr> KeyFrame::getConnectedKeyFrames(int num, int min_fts)
 {
-    std::lock_guard<std::mutex> lock(mutex_connection_);
+    std::lock_guard<CountingMutex> lock(mutex_connection_);
+    if(ordered_connections_dirty_)
+        updateOrderedConnections();
 
-    std::set<KeyFrame::Ptr> connected_keyframes;
+    std::vector<KeyFrame::Ptr> connected_keyframes;
     if(num == -1) num = (int) orderedConnectedKeyFrames_.size();
 
-    int count = 0;
-    const auto end = orderedConnectedKeyFrames_.rend();
-    for(auto it = orderedConnectedKeyFrames_.rbegin(); it != end && it->first >= min_fts && count < num; it++, count++)
+    connected_keyframes.reserve(MIN(num, (int) orderedConnectedKeyFrames_.size()));
+    for(const auto &item : orderedConnectedKeyFrames_)
     {
-        connected_keyframes.insert(it->second);
+        if(item.second < min_fts || (int) connected_keyframes.size() >= num)
+            break;
+        connected_keyframes.push_back(item.first);
     }
 
     return connected_keyframes;
 }
 
-std::set<KeyFrame::Ptr> KeyFrame::getSubConnectedKeyFrames(int num)
+std::vector<KeyFrame::Ptr> KeyFrame::getSubConnectedKeyFrames(int num)
 {
-    std::set<KeyFrame::Ptr> connected_keyframes = getConnectedKeyFrames();
+    const std::vector<KeyFrame::Ptr> connected_keyframes = getConnectedKeyFrames();
 
-    std::map<KeyFrame::Ptr, int> candidate_keyframes;
+    //! the versions only increase, so the sum changes if any of them changes
+    uint64_t signature = connectionVersion();
+    for(const KeyFrame::Ptr &kf : connected_keyframes)
+        signature += kf->connectionVersion();
+
+    std::lock_guard<CountingMutex> lock(mutex_sub_connected_);
+    if(signature == sub_connected_signature_ && num == sub_connected_num_)
+        return sub_connected_cache_;
+
+    std::vector<const KeyFrame*> excluded;
+    excluded.reserve(connected_keyframes.size() + 1);
+    excluded.push_back(this);
+    for(const KeyFrame::Ptr &kf : connected_keyframes)
+        excluded.push_back(kf.get());
+    std::sort(excluded.begin(), excluded.end());
+
+    std::vector<KeyFrame::Ptr> candidates;
     for(const KeyFrame::Ptr &kf : connected_keyframes)
     {
-        std::set<KeyFrame::Ptr> sub_connected_keyframe = kf->getConnectedKeyFrames();
+        const std::vector<KeyFrame::Ptr> sub_connected_keyframe = kf->getConnectedKeyFrames();
         for(const KeyFrame::Ptr &sub_kf : sub_connected_keyframe)
         {
-            if(connected_keyframes.count(sub_kf) || sub_kf == shared_from_this())
-                continue;
-
-            if(candidate_keyframes.count(sub_kf))
-                candidate_keyframes.find(sub_kf)->second++;
-            else
-                candidate_keyframes.emplace(sub_kf, 1);
+            if(!std::binary_search(excluded.begin(), excluded.end(), sub_kf.get()))
+                candidates.push_back(sub_kf);
         }
     }
 
-    std::set<KeyFrame::Ptr> sub_connected_keyframes;
-    if(num == -1)
-    {
-        for(const auto &item : candidate_keyframes)
-            sub_connected_keyframes.insert(item.first);
-
-        return sub_connected_keyframes;
-    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const KeyFrame::Ptr &a, const KeyFrame::Ptr &b){ return a->id_ < b->id_; });
 
-    //! stort by order
-    std::map<int, KeyFrame::Ptr, std::greater<int> > ordered_candidate_keyframes;
-    for(const auto &item : candidate_keyframes)
+    Connections candidate_keyframes;
+    for(const KeyFrame::Ptr &kf : candidates)
     {
-        ordered_candidate_keyframes.emplace(item.second, item.first);
+        if(!candidate_keyframes.empty() && candidate_keyframes.back().first == kf)
+            candidate_keyframes.back().second++;
+        else
+            candidate_keyframes.emplace_back(kf, 1);
     }
 
+    //! sort by order
+    std::stable_sort(candidate_keyframes.begin(), candidate_keyframes.end(),
+                     [](const std::pair<KeyFrame::Ptr, int> &a, const std::pair<KeyFrame::Ptr, int> &b){ return a.second > b.second; });
+
     //! get best (num) keyframes
-    for(const auto &item : ordered_candidate_keyframes)
-    {
-        sub_connected_keyframes.insert(item.second);
-        if(sub_connected_keyframes.size() >= num)
-            break;
-    }
+    if(num != -1 && (int) candidate_keyframes.size() > num)
+        candidate_keyframes.resize(num);
 
-    return sub_connected_keyframes;
+    sub_connected_cache_.clear();
+    for(const auto &item : candidate_keyframes)
+        sub_connected_cache_.push_back(item.first);
+    sub_connected_signature_ = signature;
+    sub_connected_num_ = num;
+
+    return sub_connected_cache_;
 }
 
 void KeyFrame::setBad()
 {
-    if(id_ == 0)
+    if(id_ == 0 || isBad())
         return;
 
-    std::cout << "The keyframe " << id_ << " was set to be earased." << std::endl;
-
     std::unordered_map<MapPoint::Ptr, Feature::Ptr> mpt_fts;
     {
-        std::lock_guard<std::mutex> lock(mutex_feature_);
+        std::lock_guard<CountingMutex> lock(mutex_feature_);
         mpt_fts = mpt_fts_;
     }
 
@@ -179,68 +196,198 @@ void KeyFrame::setBad()
         it.first->removeObservation(shared_from_this());
     }
 
+    Connections connections;
     {
-        std::lock_guard<std::mutex> lock(mutex_connection_);
+        std::lock_guard<CountingMutex> lock(mutex_connection_);
 
         isBad_ = true;
 
-        for(const auto &connect : connectedKeyFrames_)
-        {
-            connect.first->removeConnection(shared_from_this());
-        }
-
-        connectedKeyFrames_.clear();
+        connections.swap(connectedKeyFrames_);
         orderedConnectedKeyFrames_.clear();
+        ordered_connections_dirty_ = false;
+        connection_version_++;
+    }
+
+    //! without locking this one, the neighbours may lock theirs and then this one
+    for(const auto &connect : connections)
+    {
+        connect.first->removeConnection(shared_from_this());
+    }
+
+    {
+        std::lock_guard<CountingMutex> lock(mutex_feature_);
         mpt_fts_.clear();
+    }
+
+    {
+        std::lock_guard<CountingMutex> lock(mutex_seed_);
         seed_fts_.clear();
     }
-    // TODO change refKF
+
+    //! the cached neighbours may hold this keyframe in their caches too
+    {
+        std::lock_guard<CountingMutex> lock(mutex_sub_connected_);
+        sub_connected_cache_.clear();
+    }
+
+    setRefKeyFrame(nullptr);
+}
+
+bool KeyFrame::compressImages()
+{
+    std::lock_guard<CountingMutex> lock(mutex_image_);
+    if(img_pyr_.empty())
+        return false;
+
+    //! the copy in the submap file is used instead
+    if(img_file_ && img_file_->isSealed())
+    {
+        img_pyr_.clear();
+        return true;
+    }
+
+    encodeImages(id_, img_pyr_, img_compressed_);
+    img_pyr_.clear();
+    return true;
+}
+
+bool KeyFrame::writeImages(const std::shared_ptr<SubmapFile> &file)
+{
+    std::lock_guard<CountingMutex> lock(mutex_image_);
+    if(img_file_)
+        return true;
+
+    if(file->isSealed())
+        return false;
+
+    std::vector<std::vector<uchar> > compressed;
+    if(img_compressed_.empty())
+        encodeImages(id_, img_pyr_, compressed);
+    const std::vector<std::vector<uchar> > &buffers = img_compressed_.empty() ? compressed : img_compressed_;
+
+    img_offsets_.clear();
+    for(const std::vector<uchar> &buffer : buffers)
+        img_offsets_.emplace_back(file->append(buffer), buffer.size());
+    img_file_ = file;
+    return true;
+}
+
+bool KeyFrame::dropImages()
+{
+    std::lock_guard<CountingMutex> lock(mutex_image_);
+    if(!img_file_ || !img_file_->isSealed())
+        return false;
+
+    img_pyr_.clear();
+    img_compressed_.clear();
+    return true;
+}
+
+size_t KeyFrame::imageBytes(ImageTier &tier)
+{
+    std::lock_guard<CountingMutex> lock(mutex_image_);
+    if(!img_pyr_.empty())
+        tier = IMAGE_RAW;
+    else if(!img_compressed_.empty())
+        tier = IMAGE_COMPRESSED;
+    else
+        tier = IMAGE_OFFLOADED;
+
+    size_t bytes = 0;
+    for(const cv::Mat &img : img_pyr_)
+        bytes += img.total() * img.elemSize();
+    for(const std::vector<uchar> &buffer : img_compressed_)
+        bytes += buffer.size();
+    return bytes;
 }
 
 bool KeyFrame::isBad()
 {
-    std::lock_guard<std::mutex> lock(mutex_connection_);
+    std::lock_guard<CountingMutex> lock(mutex_connection_);
     return isBad_;
 }
 
-void KeyFrame::addConnection(const KeyFrame::Ptr &kf, const int weight)
+void KeyFrame::changeConnection(const KeyFrame::Ptr &kf, const int delta)
 {
+    if(kf.get() == this || kf->isBad())
+        return;
+
+    std::lock_guard<CountingMutex> lock(mutex_connection_);
+    if(isBad_)
+        return;
+
+    const auto it = std::lower_bound(connectedKeyFrames_.begin(), connectedKeyFrames_.end(), std::make_pair(kf, 0), compareKeyFrameId);
+    if(it != connectedKeyFrames_.end() && it->first == kf)
     {
-        std::lock_guard<std::mutex> lock(mutex_connection_);
+        it->second += delta;
+        if(it->second <= 0)
+            connectedKeyFrames_.erase(it);
+    }
+    else if(delta > 0)
+        connectedKeyFrames_.insert(it, std::make_pair(kf, delta));
+    else
+        return;
 
-        if(!connectedKeyFrames_.count(kf))
-            connectedKeyFrames_[kf] = weight;
-        else if(connectedKeyFrames_[kf] != weight)
-            connectedKeyFrames_[kf] = weight;
-        else
+    ordered_connections_dirty_ = true;
+    connection_version_++;
+}
+
+void KeyFrame::setConnection(const KeyFrame::Ptr &kf, const int weight)
+{
+    std::lock_guard<CountingMutex> lock(mutex_connection_);
+    if(isBad_)
+        return;
+
+    const auto it = std::lower_bound(connectedKeyFrames_.begin(), connectedKeyFrames_.end(), std::make_pair(kf, 0), compareKeyFrameId);
+    if(it != connectedKeyFrames_.end() && it->first == kf)
+    {
+        if(it->second == weight)
             return;
+        it->second = weight;
     }
+    else
+        connectedKeyFrames_.insert(it, std::make_pair(kf, weight));
 
-    updateOrderedConnections();
+    ordered_connections_dirty_ = true;
+    connection_version_++;
 }
 
 void KeyFrame::updateOrderedConnections()
 {
-    std::lock_guard<std::mutex> lock(mutex_connection_);
+    // TODO how to select proper connections
+    const int connection_threshold = Config::minConnectionObservations();
+
+    //! keep the best one if none is fit
     orderedConnectedKeyFrames_.clear();
+    const std::pair<KeyFrame::Ptr, int> *best_unfit = nullptr;
     for(const auto &connect : connectedKeyFrames_)
     {
-        auto it = orderedConnectedKeyFrames_.lower_bound(connect.second);
-        orderedConnectedKeyFrames_.insert(it, std::pair<int, KeyFrame::Ptr>(connect.second, connect.first));
+        if(connect.second >= connection_threshold)
+            orderedConnectedKeyFrames_.push_back(connect);
+        else if(best_unfit == nullptr || connect.second > best_unfit->second)
+            best_unfit = &connect;
     }
+
+    if(orderedConnectedKeyFrames_.empty() && best_unfit != nullptr)
+        orderedConnectedKeyFrames_.push_back(*best_unfit);
+
+    //! sort by weight, and by id for the same weight
+    std::stable_sort(orderedConnectedKeyFrames_.begin(), orderedConnectedKeyFrames_.end(),
+                     [](const std::pair<KeyFrame::Ptr, int> &a, const std::pair<KeyFrame::Ptr, int> &b){ return a.second > b.second; });
+
+    ordered_connections_dirty_ = false;
 }
 
 void KeyFrame::removeConnection(const KeyFrame::Ptr &kf)
 {
-    {
-        std::lock_guard<std::mutex> lock(mutex_connection_);
-        if(connectedKeyFrames_.count(kf))
-        {
-            connectedKeyFrames_.erase(kf);
-        }
-    }
+    std::lock_guard<CountingMutex> lock(mutex_connection_);
+    const auto it = std::lower_bound(connectedKeyFrames_.begin(), connectedKeyFrames_.end(), std::make_pair(kf, 0), compareKeyFrameId);
+    if(it == connectedKeyFrames_.end() || it->first != kf)
+        return;
 
-    updateOrderedConnections();
+    connectedKeyFrames_.erase(it);
+    ordered_connections_dirty_ = true;
+    connection_version_++;
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "local_ba_problem.hpp"
+
+namespace ssvo{
+
+static ceres::Problem::Options problemOptions()
+{
+    //! the blocks are removed as the window slides, and the cost functions are owned by the pool
+    ceres::Problem::Options options;
+    options.enable_fast_removal = true;
+    options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    return options;
+}
+
+LocalBAProblem::LocalBAProblem() :
+    local_parameterization_(new ceres_slover::SE3Parameterization()), huber_(-1.0),
+    problem_(new ceres::Problem(problemOptions())), added_residuals_(0), removed_residuals_(0)
+{}
+
+void LocalBAProblem::clear()
+{
+    problem_.reset(new ceres::Problem(problemOptions()));
+
+    cost_free_.clear();
+    for(const auto &cost : cost_pool_)
+        cost_free_.push_back(cost.get());
+
+    poses_.clear();
+    points_.clear();
+    actived_keyframes_.clear();
+    fixed_keyframes_.clear();
+    local_mappoints_.clear();
+    mpts_buffer_.clear();
+}
+
+void LocalBAProblem::update(const KeyFrame::Ptr &keyframe, int size, int min_shared_fts, double huber)
+{
+    if(huber != huber_)
+    {
+        clear();
+        loss_function_.reset(new ceres::HuberLoss(huber));
+        huber_ = huber;
+    }
+
+    added_residuals_ = 0;
+    removed_residuals_ = 0;
+
+    //! collect the window, and the observations of each point are copied only once
+    size = size > 0 ? size-1 : 0;
+    const std::vector<KeyFrame::Ptr> connected_keyframes = keyframe->getConnectedKeyFrames(size, min_shared_fts);
+    actived_keyframes_ = std::set<KeyFrame::Ptr>(connected_keyframes.begin(), connected_keyframes.end());
+    actived_keyframes_.insert(keyframe);
+    fixed_keyframes_.clear();
+    local_mappoints_.clear();
+
+    std::unordered_map<MapPoint::Ptr, MapPoint::Observations> observations;
+    for(const KeyFrame::Ptr &kf : actived_keyframes_)
+    {
+        kf->getMapPoints(mpts_buffer_);
+        for(const MapPoint::Ptr &mpt : mpts_buffer_)
+        {
+            if(local_mappoints_.count(mpt))
+                continue;
+
+            MapPoint::Observations obs;
+            mpt->getObservations(obs);
+            if(obs.empty())
+                continue;
+
+            for(const auto &item : obs)
+            {
+                if(!actived_keyframes_.count(item.first))
+                    fixed_keyframes_.insert(item.first);
+            }
+
+            local_mappoints_.insert(mpt);
+            observations.emplace(mpt, std::move(obs));
+        }
+    }
+
+    //! remove the points leaving the window, and the observations removed or replaced since the last update
+    for(auto itr = points_.begin(); itr != points_.end();)
+    {
+        Residuals &residuals = itr->second;
+        const auto obs_itr = observations.find(itr->first);
+        if(obs_itr == observations.end())
+        {
+            for(auto &item : residuals)
+                removeResidual(item.second);
+
+            problem_->RemoveParameterBlock(itr->first->optimal_pose_.data());
+            itr = points_.erase(itr);
+            continue;
+        }
+
+        const MapPoint::Observations &obs = obs_itr->second;
+        for(auto res_itr = residuals.begin(); res_itr != residuals.end();)
+        {
+            const KeyFrame::Ptr &kf = res_itr->first;
+            const auto ft_itr = std::find_if(obs.begin(), obs.end(), [&kf](const std::pair<KeyFrame::Ptr, Feature::Ptr> &item){ return item.first == kf; });
+            if(ft_itr != obs.end() && ft_itr->second == res_itr->second.ft)
+            {
+                res_itr++;
+                continue;
+            }
+
+            removeResidual(res_itr->second);
+            res_itr = residuals.erase(res_itr);
+        }
+
+        itr++;
+    }
+
+    //! no residual refers to the keyframes leaving the window now
+    for(auto itr = poses_.begin(); itr != poses_.end();)
+    {
+        if(actived_keyframes_.count(itr->first) || fixed_keyframes_.count(itr->first))
+        {
+            itr++;
+            continue;
+        }
+
+        problem_->RemoveParameterBlock(itr->first->optimal_Tcw_.data());
+        itr = poses_.erase(itr);
+    }
+
+    for(const KeyFrame::Ptr &kf : fixed_keyframes_)
+        addPose(kf, true);
+
+    for(const KeyFrame::Ptr &kf : actived_keyframes_)
+        addPose(kf, kf->id_ <= 1);
+
+    for(const auto &item : observations)
+    {
+        const MapPoint::Ptr &mpt = item.first;
+        mpt->optimal_pose_ = mpt->pose();
+
+        auto itr = points_.find(mpt);
+        if(itr == points_.end())
+        {
+            problem_->AddParameterBlock(mpt->optimal_pose_.data(), 3);
+            itr = points_.emplace(mpt, Residuals()).first;
+        }
+
+        Residuals &residuals = itr->second;
+        for(const auto &obs : item.second)
+        {
+            if(!residuals.count(obs.first))
+                addResidual(mpt, obs.first, obs.second, residuals);
+        }
+    }
+}
+
+void LocalBAProblem::addPose(const KeyFrame::Ptr &kf, bool fixed)
+{
+    kf->optimal_Tcw_ = kf->Tcw();
+
+    auto itr = poses_.find(kf);
+    if(itr == poses_.end())
+    {
+        problem_->AddParameterBlock(kf->optimal_Tcw_.data(), SE3d::num_parameters, local_parameterization_.get());
+        if(fixed)
+            problem_->SetParameterBlockConstant(kf->optimal_Tcw_.data());
+        poses_.emplace(kf, fixed);
+    }
+    else if(itr->second != fixed)
+    {
+        if(fixed)
+            problem_->SetParameterBlockConstant(kf->optimal_Tcw_.data());
+        else
+            problem_->SetParameterBlockVariable(kf->optimal_Tcw_.data());
+        itr->second = fixed;
+    }
+}
+
+void LocalBAProblem::addResidual(const MapPoint::Ptr &mpt, const KeyFrame::Ptr &kf, const Feature::Ptr &ft, Residuals &residuals)
+{
+    ceres_slover::ReprojectionErrorSE3 *cost;
+    if(cost_free_.empty())
+    {
+        cost = new ceres_slover::ReprojectionErrorSE3(0.0, 0.0, 1.0);
+        cost_pool_.emplace_back(cost);
+    }
+    else
+    {
+        cost = cost_free_.back();
+        cost_free_.pop_back();
+    }
+
+    cost->setObservation(ft->fn_[0]/ft->fn_[2], ft->fn_[1]/ft->fn_[2]);
+    ceres::ResidualBlockId id = problem_->AddResidualBlock(cost, loss_function_.get(), kf->optimal_Tcw_.data(), mpt->optimal_pose_.data());
+    residuals.emplace(kf, Residual{ft, id, cost});
+    added_residuals_++;
+}
+
+void LocalBAProblem::removeResidual(Residual &residual)
+{
+    problem_->RemoveResidualBlock(residual.id);
+    cost_free_.push_back(residual.cost);
+    removed_residuals_++;
+}
+
+}
@@ -0,0 +1,440 @@
+#include "local_ba_solver.hpp"
+#include "thread_pool.hpp"
+
+namespace ssvo{
+
+//! the same bounds of the diagonal as Ceres' Levenberg-Marquardt
+static const double MIN_DIAGONAL = 1e-6;
+static const double MAX_DIAGONAL = 1e32;
+static const double MAX_LAMBDA = 1e16;
+
+static inline double huberCost(const double error, const double huber)
+{
+    return error <= huber ? error * error : 2.0 * huber * error - huber * huber;
+}
+
+LocalBASolver::LocalBASolver() :
+    huber_(1.0)
+{}
+
+void LocalBASolver::clear()
+{
+    pose_ptrs_.clear();
+    pose_free_id_.clear();
+    free_poses_.clear();
+    point_ptrs_.clear();
+    observations_.clear();
+}
+
+int LocalBASolver::addPose(SE3d *pose, bool fixed)
+{
+    pose_ptrs_.push_back(pose);
+    if(fixed)
+        pose_free_id_.push_back(-1);
+    else
+    {
+        pose_free_id_.push_back((int)free_poses_.size());
+        free_poses_.push_back((int)pose_ptrs_.size() - 1);
+    }
+    return (int)pose_ptrs_.size() - 1;
+}
+
+int LocalBASolver::addPoint(Vector3d *point)
+{
+    point_ptrs_.push_back(point);
+    return (int)point_ptrs_.size() - 1;
+}
+
+void LocalBASolver::addObservation(int pose, int point, const Vector2d &fn)
+{
+    LOG_ASSERT(pose >= 0 && pose < (int)pose_ptrs_.size() && point >= 0 && point < (int)point_ptrs_.size())
+        << "[LocalBASolver] Invalid observation of pose " << pose << " and point " << point;
+
+    Observation ob;
+    ob.fn = fn;
+    ob.pose = pose;
+    ob.point = point;
+    observations_.push_back(ob);
+}
+
+void LocalBASolver::buildStructure()
+{
+    const int num_poses = (int)free_poses_.size();
+    const int num_points = (int)point_ptrs_.size();
+    const int num_obs = (int)observations_.size();
+
+    //! counting sort by points
+    point_obs_start_.assign(num_points + 1, 0);
+    for(const Observation &ob : observations_)
+        point_obs_start_[ob.point + 1]++;
+    for(int j = 0; j < num_points; ++j)
+        point_obs_start_[j + 1] += point_obs_start_[j];
+
+    point_obs_.resize(num_obs);
+    std::vector<int> point_next(point_obs_start_.begin(), point_obs_start_.end() - 1);
+    for(int k = 0; k < num_obs; ++k)
+        point_obs_[point_next[observations_[k].point]++] = k;
+
+    //! counting sort by free poses
+    pose_obs_start_.assign(num_poses + 1, 0);
+    for(const Observation &ob : observations_)
+    {
+        const int id = pose_free_id_[ob.pose];
+        if(id >= 0)
+            pose_obs_start_[id + 1]++;
+    }
+    for(int i = 0; i < num_poses; ++i)
+        pose_obs_start_[i + 1] += pose_obs_start_[i];
+
+    std::vector<int> pose_next(pose_obs_start_.begin(), pose_obs_start_.end() - 1);
+    pose_obs_.resize(pose_obs_start_.back());
+    for(int k = 0; k < num_obs; ++k)
+    {
+        const int id = pose_free_id_[observations_[k].pose];
+        if(id >= 0)
+            pose_obs_[pose_next[id]++] = k;
+    }
+
+    //! resize buffers, the memory is kept for the next problem
+    poses_.resize(pose_ptrs_.size());
+    poses_new_.resize(pose_ptrs_.size());
+    points_.resize(num_points);
+    points_new_.resize(num_points);
+    costs_.resize(num_points);
+
+    Jc_.resize(num_obs);
+    Jp_.resize(num_obs);
+    residuals_.resize(num_obs);
+    weights_.resize(num_obs);
+    W_.resize(num_obs);
+    Y_.resize(num_obs);
+
+    V_.resize(num_points);
+    V_inv_.resize(num_points);
+    bp_.resize(num_points);
+    dp_.resize(num_points);
+
+    U_.resize(num_poses);
+    bc_.resize(num_poses);
+    S_.resize(6 * num_poses, 6 * num_poses);
+    rhs_.resize(6 * num_poses);
+    dc_.resize(6 * num_poses);
+}
+
+double LocalBASolver::evaluate(const std::vector<SE3d, aligned_allocator<SE3d> > &poses,
+                               const std::vector<Vector3d, aligned_allocator<Vector3d> > &points)
+{
+    const int num_points = (int)point_ptrs_.size();
+    ThreadPool::getInstance().parallelFor(ThreadPool::TASK_OPTIMIZATION, 0, num_points, [&](int j){
+        double cost = 0;
+        for(int n = point_obs_start_[j]; n < point_obs_start_[j + 1]; ++n)
+        {
+            const Observation &ob = observations_[point_obs_[n]];
+            const Vector3d p(poses[ob.pose] * points[j]);
+            if(p[2] <= 0)
+                continue;
+
+            cost += huberCost((p.head<2>() / p[2] - ob.fn).norm(), huber_);
+        }
+        costs_[j] = cost;
+    }, 32);
+
+    double cost = 0;
+    for(int j = 0; j < num_points; ++j)
+        cost += costs_[j];
+
+    return cost;
+}
+
+void LocalBASolver::linearize(const double huber)
+{
+    const int num_points = (int)point_ptrs_.size();
+    const int num_poses = (int)free_poses_.size();
+
+    ThreadPool &pool = ThreadPool::getInstance();
+
+    //! point blocks and the off-diagonal blocks W = Jc^T * Jp
+    pool.parallelFor(ThreadPool::TASK_OPTIMIZATION, 0, num_points, [&](int j){
+        Matrix3d &V = V_[j];
+        Vector3d &bp = bp_[j];
+        V.setZero();
+        bp.setZero();
+        for(int n = point_obs_start_[j]; n < point_obs_start_[j + 1]; ++n)
+        {
+            const int k = point_obs_[n];
+            const Observation &ob = observations_[k];
+            const SE3d &T = poses_[ob.pose];
+            const Vector3d p(T * points_[j]);
+
+            //! points behind the camera make no contribution
+            if(p[2] <= 0)
+            {
+                weights_[k] = 0;
+                Jc_[k].setZero();
+                Jp_[k].setZero();
+                residuals_[k].setZero();
+                W_[k].setZero();
+                continue;
+            }
+
+            const double z_inv = 1.0 / p[2];
+            const double z_inv2 = z_inv * z_inv;
+            Matrix23d Jproj;
+            Jproj << z_inv, 0.0, -p[0]*z_inv2,
+                     0.0, z_inv, -p[1]*z_inv2;
+
+            const Vector2d residual(p.head<2>() * z_inv - ob.fn);
+            const double error = residual.norm();
+            const double weight = error <= huber ? 1.0 : huber / error;
+
+            residuals_[k] = residual;
+            weights_[k] = weight;
+            Jp_[k].noalias() = Jproj * T.rotationMatrix();
+            Jc_[k].leftCols<3>() = Jproj;
+            Jc_[k].rightCols<3>().noalias() = Jproj * Sophus::SO3d::hat(-p);
+
+            V.noalias() += weight * Jp_[k].transpose() * Jp_[k];
+            bp.noalias() -= weight * Jp_[k].transpose() * residual;
+            if(pose_free_id_[ob.pose] >= 0)
+                W_[k].noalias() = weight * Jc_[k].transpose() * Jp_[k];
+        }
+    }, 32);
+
+    //! pose blocks
+    pool.parallelFor(ThreadPool::TASK_OPTIMIZATION, 0, num_poses, [&](int i){
+        Matrix6d &U = U_[i];
+        Vector6d &bc = bc_[i];
+        U.setZero();
+        bc.setZero();
+        for(int n = pose_obs_start_[i]; n < pose_obs_start_[i + 1]; ++n)
+        {
+            const int k = pose_obs_[n];
+            U.noalias() += weights_[k] * Jc_[k].transpose() * Jc_[k];
+            bc.noalias() -= weights_[k] * Jc_[k].transpose() * residuals_[k];
+        }
+    });
+}
+
+bool LocalBASolver::computeStep(const double lambda, double &model_decrease)
+{
+    const int num_points = (int)point_ptrs_.size();
+    const int num_poses = (int)free_poses_.size();
+
+    ThreadPool &pool = ThreadPool::getInstance();
+
+    //! eliminate points, Y = W * V^-1
+    pool.parallelFor(ThreadPool::TASK_OPTIMIZATION, 0, num_points, [&](int j){
+        Matrix3d V = V_[j];
+        for(int d = 0; d < 3; ++d)
+            V(d, d) += lambda * std::min(std::max(V_[j](d, d), MIN_DIAGONAL), MAX_DIAGONAL);
+
+        V_inv_[j] = V.inverse();
+        for(int n = point_obs_start_[j]; n < point_obs_start_[j + 1]; ++n)
+        {
+            const int k = point_obs_[n];
+            if(pose_free_id_[observations_[k].pose] >= 0)
+                Y_[k].noalias() = W_[k] * V_inv_[j];
+        }
+    }, 32);
+
+    //! reduced camera system, S = U - sum(Y * W^T), each task fills a block row
+    pool.parallelFor(ThreadPool::TASK_OPTIMIZATION, 0, num_poses, [&](int i){
+        const int row = 6 * i;
+        S_.middleRows<6>(row).setZero();
+        S_.block<6, 6>(row, row) = U_[i];
+        for(int d = 0; d < 6; ++d)
+            S_(row + d, row + d) += lambda * std::min(std::max(U_[i](d, d), MIN_DIAGONAL), MAX_DIAGONAL);
+
+        Vector6d rhs = bc_[i];
+        for(int n = pose_obs_start_[i]; n < pose_obs_start_[i + 1]; ++n)
+        {
+            const int k = pose_obs_[n];
+            const int j = observations_[k].point;
+            const Matrix63d &Y = Y_[k];
+            rhs.noalias() -= Y * bp_[j];
+
+            for(int m = point_obs_start_[j]; m < point_obs_start_[j + 1]; ++m)
+            {
+                const int l = point_obs_[m];
+                const int col = pose_free_id_[observations_[l].pose];
+                if(col < 0)
+                    continue;
+
+                S_.block<6, 6>(row, 6 * col).noalias() -= Y * W_[l].transpose();
+            }
+        }
+        rhs_.segment<6>(row) = rhs;
+    });
+
+    if(num_poses > 0)
+    {
+        ldlt_.compute(S_);
+        if(ldlt_.info() != Eigen::Success)
+            return false;
+
+        dc_ = ldlt_.solve(rhs_);
+        if(!dc_.allFinite())
+            return false;
+    }
+
+    //! back substitution, dp = V^-1 * (bp - sum(W^T * dc))
+    pool.parallelFor(ThreadPool::TASK_OPTIMIZATION, 0, num_points, [&](int j){
+        Vector3d b = bp_[j];
+        for(int n = point_obs_start_[j]; n < point_obs_start_[j + 1]; ++n)
+        {
+            const int k = point_obs_[n];
+            const int id = pose_free_id_[observations_[k].pose];
+            if(id >= 0)
+                b.noalias() -= W_[k].transpose() * dc_.segment<6>(6 * id);
+        }
+        dp_[j].noalias() = V_inv_[j] * b;
+    }, 32);
+
+    //! decrease of the linearized cost: dx^T * (g + lambda * D * dx)
+    model_decrease = 0;
+    for(int i = 0; i < num_poses; ++i)
+    {
+        const Vector6d dc = dc_.segment<6>(6 * i);
+        Vector6d damping;
+        for(int d = 0; d < 6; ++d)
+            damping[d] = lambda * std::min(std::max(U_[i](d, d), MIN_DIAGONAL), MAX_DIAGONAL) * dc[d];
+        model_decrease += dc.dot(bc_[i] + damping);
+    }
+
+    for(int j = 0; j < num_points; ++j)
+    {
+        if(!dp_[j].allFinite())
+            return false;
+
+        Vector3d damping;
+        for(int d = 0; d < 3; ++d)
+            damping[d] = lambda * std::min(std::max(V_[j](d, d), MIN_DIAGONAL), MAX_DIAGONAL) * dp_[j][d];
+        model_decrease += dp_[j].dot(bp_[j] + damping);
+    }
+
+    return true;
+}
+
+LocalBASolver::Summary LocalBASolver::solve(const Options &options, bool verbose)
+{
+    buildStructure();
+
+    huber_ = options.huber;
+    const size_t num_poses = pose_ptrs_.size();
+    const size_t num_points = point_ptrs_.size();
+    for(size_t i = 0; i < num_poses; ++i)
+        poses_[i] = *pose_ptrs_[i];
+    for(size_t j = 0; j < num_points; ++j)
+        points_[j] = *point_ptrs_[j];
+
+    Summary summary;
+    summary.iterations = 0;
+    summary.successful_steps = 0;
+    summary.aborted = false;
+    summary.initial_cost = evaluate(poses_, points_);
+    summary.final_cost = summary.initial_cost;
+
+    if(observations_.empty())
+        return summary;
+
+    double cost = summary.initial_cost;
+    double lambda = options.initial_lambda;
+    double nu = 2.0;
+    bool relinearize = true;
+    for(; summary.iterations < options.max_iterations; summary.iterations++)
+    {
+        if(options.abort != nullptr && options.abort->load() && summary.successful_steps > 0)
+        {
+            LOG_IF(INFO, verbose) << "[LocalBASolver] Aborted after " << summary.iterations << " iterations";
+            summary.aborted = true;
+            break;
+        }
+
+        if(relinearize)
+        {
+            linearize(huber_);
+            relinearize = false;
+
+            double max_gradient = 0;
+            for(const Vector6d &bc : bc_)
+                max_gradient = std::max(max_gradient, bc.cwiseAbs().maxCoeff());
+            for(const Vector3d &bp : bp_)
+                max_gradient = std::max(max_gradient, bp.cwiseAbs().maxCoeff());
+            if(max_gradient <= options.gradient_tolerance)
+            {
+                LOG_IF(INFO, verbose) << "[LocalBASolver] Converged by gradient: " << max_gradient;
+                break;
+            }
+        }
+
+        double model_decrease = 0;
+        if(!computeStep(lambda, model_decrease) || model_decrease <= 0)
+        {
+            lambda *= nu;
+            nu *= 2.0;
+            if(lambda > MAX_LAMBDA)
+                break;
+            continue;
+        }
+
+        //! candidate
+        double step_norm2 = dc_.squaredNorm();
+        for(size_t i = 0; i < num_poses; ++i)
+        {
+            const int id = pose_free_id_[i];
+            poses_new_[i] = id < 0 ? poses_[i] : SE3d::exp(dc_.segment<6>(6 * id)) * poses_[i];
+        }
+        for(size_t j = 0; j < num_points; ++j)
+        {
+            points_new_[j] = points_[j] + dp_[j];
+            step_norm2 += dp_[j].squaredNorm();
+        }
+
+        const double new_cost = evaluate(poses_new_, points_new_);
+        const double rho = (cost - new_cost) / model_decrease;
+
+        LOG_IF(INFO, verbose) << "[LocalBASolver] iter " << std::setw(2) << summary.iterations
+                              << ", cost: " << std::scientific << std::setprecision(6) << new_cost
+                              << ", rho: " << rho << ", lambda: " << lambda << ", step: " << std::sqrt(step_norm2);
+
+        if(rho > 1e-3)
+        {
+            std::swap(poses_, poses_new_);
+            std::swap(points_, points_new_);
+
+            const double cost_change = cost - new_cost;
+            cost = new_cost;
+            summary.successful_steps++;
+            lambda *= std::max(1.0/3.0, 1.0 - std::pow(2.0 * rho - 1.0, 3));
+            nu = 2.0;
+            relinearize = true;
+
+            if(cost_change <= options.function_tolerance * cost || std::sqrt(step_norm2) <= options.parameter_tolerance)
+            {
+                summary.iterations++;
+                break;
+            }
+        }
+        else
+        {
+            lambda *= nu;
+            nu *= 2.0;
+            if(lambda > MAX_LAMBDA)
+                break;
+        }
+    }
+
+    summary.final_cost = cost;
+
+    for(size_t i = 0; i < num_poses; ++i)
+    {
+        if(pose_free_id_[i] >= 0)
+            *pose_ptrs_[i] = poses_[i];
+    }
+    for(size_t j = 0; j < num_points; ++j)
+        *point_ptrs_[j] = points_[j];
+
+    return summary;
+}
+
+}
@@ -6,6 +6,7 @@
 #include "image_alignment.hpp"
 #include "optimizer.hpp"
 #include "time_tracing.hpp"
+#include "thread_pool.hpp"
 #include "brief.hpp"
 
 #ifdef SSVO_DBOW_ENABLE
@@ -30,8 +31,8 @@ TimeTracing::Ptr mapTrace = nullptr;
 
 //! LocalMapper
 LocalMapper::LocalMapper(bool report, bool verbose) :
-    report_(report), verbose_(report&&verbose),
-    mapping_thread_(nullptr), stop_require_(false)
+    items_pending_(0), report_(report), verbose_(report&&verbose),
+    mapping_thread_(nullptr), seeds_drained_(0), seeds_max_latency_(0), seeds_time_(0), abort_ba_(false), stop_require_(false)
 {
     map_ = Map::create();
 
@@ -45,6 +46,12 @@ LocalMapper::LocalMapper(bool report, bool verbose) :
     options_.max_align_epsilon = 0.01;
     options_.max_align_error2 = 3.0;
     options_.min_found_ratio_ = 0.15;
+    options_.max_coalesced_kfs = MAX(Config::maxCoalescedKeyFrames(), 1);
+    options_.abortable_ba = Config::abortableLocalBA();
+    options_.culling_redundant_ratio = Config::cullingRedundantRatio();
+    options_.frustum_depth_ratio = 3.0;
+    options_.num_track_kfs = Config::maxTrackKeyFrames();
+    options_.image_memory_cap = (size_t)(Config::keyFrameImageMemoryCap() * 1024 * 1024);
 
     //! LOG and timer for system;
     TimeTracing::TraceNames time_names;
@@ -60,6 +67,31 @@ LocalMapper::LocalMapper(bool report, bool verbose) :
     log_names.push_back("num_reproj_mpts");
     log_names.push_back("num_matched");
     log_names.push_back("num_fusion");
+    log_names.push_back("seeds_batch");
+    log_names.push_back("seeds_latency_ms");
+    log_names.push_back("seeds_time_ms");
+    log_names.push_back("local_ba_iters");
+    log_names.push_back("local_ba_solve_ms");
+    log_names.push_back("local_ba_build_ms");
+    log_names.push_back("local_ba_aborted");
+    log_names.push_back("local_ba_kfs");
+    log_names.push_back("local_ba_latency_ms");
+    log_names.push_back("mpts_in_map");
+    log_names.push_back("mpts_alive");
+    log_names.push_back("mpt_bytes");
+    log_names.push_back("mpts_reclaimed");
+    log_names.push_back("kfs_alive");
+    log_names.push_back("frames_alive");
+    log_names.push_back("features_alive");
+    log_names.push_back("seeds_alive");
+    log_names.push_back("img_raw_kfs");
+    log_names.push_back("img_raw_mb");
+    log_names.push_back("img_compressed_kfs");
+    log_names.push_back("img_compressed_mb");
+    log_names.push_back("img_offloaded_kfs");
+    log_names.push_back("submaps_resident");
+    log_names.push_back("submaps_offloaded");
+    log_names.push_back("submap_file_mb");
 
 
     string trace_dir = Config::timeTracingDirectory();
@@ -72,21 +104,14 @@ LocalMapper::LocalMapper(bool report, bool verbose) :
     vocabulary_ = DBoW3::Vocabulary(voc_dir);
     LOG_ASSERT(!vocabulary_.empty()) << "Please check the config file! The Voc is empty!";
     database_ = DBoW3::Database(vocabulary_, true, 4);
-
-    const int nlevel = Config::imageTopLevel() + 1;
-    const int cols = Config::imageWidth();
-    const int rows = Config::imageHeight();
-    border_tl_.resize(nlevel);
-    border_br_.resize(nlevel);
-
-    for(int i = 0; i < nlevel; i++)
+#else
+    const std::string voc_file = Config::vocabularyFile();
+    if(!voc_file.empty())
     {
-        border_tl_[i].x = BRIEF::EDGE_THRESHOLD;
-        border_tl_[i].y = BRIEF::EDGE_THRESHOLD;
-        border_br_[i].x = cols/(1<<i) - BRIEF::EDGE_THRESHOLD;
-        border_br_[i].y = rows/(1<<i) - BRIEF::EDGE_THRESHOLD;
+        bow_vocabulary_ = Vocabulary::load(voc_file);
+        LOG_ASSERT(bow_vocabulary_ && !bow_vocabulary_->empty()) << "Please check the config file! Can not load the vocabulary: " << voc_file;
+        bow_database_ = BowDatabase::create(bow_vocabulary_);
     }
-
 #endif
 
 }
@@ -94,6 +119,8 @@ LocalMapper::LocalMapper(bool report, bool verbose) :
 void LocalMapper::createInitalMap(const Frame::Ptr &frame_ref, const Frame::Ptr &frame_cur)
 {
     map_->clear();
+    Optimizer::releaseLocalBAProblem();
+    resetDatabase();
 
     //! create Key Frame
     KeyFrame::Ptr keyframe_ref = KeyFrame::create(frame_ref);
@@ -148,12 +175,12 @@ void LocalMapper::stopMainThread()
 
 void LocalMapper::setStop()
 {
-        std::unique_lock<std::mutex> lock(mutex_stop_);
-        stop_require_ = true;
+    stop_require_ = true;
+    event_.notify();
 }
+
 bool LocalMapper::isRequiredStop()
 {
-    std::unique_lock<std::mutex> lock(mutex_stop_);
     return stop_require_;
 }
 
@@ -161,9 +188,22 @@ void LocalMapper::run()
 {
     while(!isRequiredStop())
     {
-        KeyFrame::Ptr keyframe_cur = checkNewKeyFrame();
-        if(keyframe_cur)
+        //! sleep until new keyframes or converged seeds arrive
+        event_.wait([this]{ return !keyframes_buffer_.empty() || !seeds_buffer_.empty() || stop_require_.load(); });
+
+        //! the new map points should be seen by the tracker
+        const int seeds_before = seeds_drained_;
+        if(processConvergedSeeds() > 0)
+            publishLocalMap(keyframe_last_);
+        int items_done = seeds_drained_ - seeds_before;
+
+        //! reset before draining the buffer, so that any keyframe arriving later interrupts the local BA
+        abort_ba_ = false;
+        std::vector<KeyFrame::Ptr> keyframes;
+        std::chrono::steady_clock::time_point time_oldest;
+        if(checkNewKeyFrames(keyframes, time_oldest))
         {
+            KeyFrame::Ptr keyframe_cur = keyframes.back();
             mapTrace->startTimer("total");
             std::list<MapPoint::Ptr> bad_mpts;
             int new_seed_features = 0;
@@ -172,46 +212,103 @@ void LocalMapper::run()
             {
 //                new_seed_features = createFeatureFromSeedFeature(keyframe_cur);
                 mapTrace->startTimer("reproj");
-                new_local_features = createFeatureFromLocalMap(keyframe_cur, options_.num_reproject_kfs);
+                for(const KeyFrame::Ptr &kf : keyframes)
+                    new_local_features += createFeatureFromLocalMap(kf, options_.num_reproject_kfs);
                 mapTrace->stopTimer("reproj");
                 LOG_IF(INFO, report_) << "[Mapper] create " << new_seed_features << " features from seeds and " << new_local_features << " from local map.";
 
+                //! one local BA for all the coalesced keyframes, with the window enlarged to cover them
+                const int ba_size = options_.num_local_ba_kfs + (int)keyframes.size() - 1;
                 mapTrace->startTimer("local_ba");
-                Optimizer::localBundleAdjustment(keyframe_cur, bad_mpts, options_.num_local_ba_kfs, options_.min_local_ba_connected_fts, report_, verbose_);
+                Optimizer::localBundleAdjustment(keyframe_cur, bad_mpts, ba_size, options_.min_local_ba_connected_fts, report_, verbose_,
+                                                 options_.abortable_ba ? &abort_ba_ : nullptr);
+                updateMapPointsVoxel(keyframe_cur, ba_size);
                 mapTrace->stopTimer("local_ba");
+                mapTrace->log("local_ba_iters", Optimizer::lastSolveInfo().iterations);
+                mapTrace->log("local_ba_solve_ms", Optimizer::lastSolveInfo().time_ms);
+                mapTrace->log("local_ba_build_ms", Optimizer::lastSolveInfo().build_ms);
+                mapTrace->log("local_ba_aborted", Optimizer::lastSolveInfo().aborted);
             }
 
+            const double ba_latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - time_oldest).count();
+            mapTrace->log("local_ba_kfs", keyframes.size());
+            mapTrace->log("local_ba_latency_ms", ba_latency);
+            LOG_IF(INFO, report_) << "[Mapper] Local BA for " << keyframes.size() << " keyframes, latency: " << ba_latency << "ms"
+                                  << (Optimizer::lastSolveInfo().aborted ? ", aborted" : "");
+
             for(const MapPoint::Ptr &mpt : bad_mpts)
             {
                 map_->removeMapPoint(mpt);
             }
 
-            checkCulling(keyframe_cur);
+            for(const KeyFrame::Ptr &kf : keyframes)
+                checkCulling(kf);
+
+            manageImageMemory(keyframe_cur);
 
             mapTrace->startTimer("dbow");
-            addToDatabase(keyframe_cur);
+            for(const KeyFrame::Ptr &kf : keyframes)
+                addToDatabase(kf);
             mapTrace->stopTimer("dbow");
 
             mapTrace->stopTimer("total");
+
+            mapTrace->log("seeds_batch", seeds_drained_);
+            mapTrace->log("seeds_latency_ms", seeds_max_latency_);
+            mapTrace->log("seeds_time_ms", seeds_time_);
+            //! the removed map points are released here, once the tracker and the optimizer have dropped them
+            const size_t mpts_reclaimed = map_->reclaimRemovedMapPoints();
+            const double mpt_bytes = map_->bytesPerMapPoint();
+            mapTrace->log("mpts_in_map", map_->MapPointsInMap());
+            mapTrace->log("mpts_alive", MapPoint::liveObjects());
+            mapTrace->log("mpt_bytes", mpt_bytes);
+            LOG_IF(INFO, report_) << "[Mapper] Map points: " << map_->MapPointsInMap() << " in map, " << MapPoint::liveObjects()
+                                  << " alive, " << mpt_bytes << " bytes for each, " << mpts_reclaimed << " reclaimed";
+            mapTrace->log("mpts_reclaimed", mpts_reclaimed);
+            mapTrace->log("kfs_alive", KeyFrame::liveObjects());
+            mapTrace->log("frames_alive", Frame::liveObjects());
+            mapTrace->log("features_alive", Feature::liveObjects());
+            mapTrace->log("seeds_alive", Seed::liveObjects());
+            LOG_IF(INFO, report_) << "[Mapper] Alive objects, keyframes: " << KeyFrame::liveObjects() << ", frames: " << Frame::liveObjects()
+                                  << ", features: " << Feature::liveObjects() << ", seeds: " << Seed::liveObjects();
+            seeds_drained_ = 0;
+            seeds_max_latency_ = 0;
+            seeds_time_ = 0;
+
             mapTrace->writeToFile();
 
+            publishLocalMap(keyframe_cur);
             keyframe_last_ = keyframe_cur;
         }
+
+        items_done += (int)keyframes.size();
+        if(items_done > 0)
+        {
+            items_pending_ -= items_done;
+            idle_event_.notify();
+        }
     }
 }
 
-KeyFrame::Ptr LocalMapper::checkNewKeyFrame()
+void LocalMapper::waitForIdle()
 {
-    std::unique_lock<std::mutex> lock(mutex_keyframe_);
-    cond_process_.wait_for(lock, std::chrono::microseconds(5));
+    if(mapping_thread_ == nullptr)
+        return;
 
-    if(keyframes_buffer_.empty())
-        return nullptr;
+    idle_event_.wait([this]{ return items_pending_.load() == 0; });
+}
 
-    KeyFrame::Ptr keyframe = keyframes_buffer_.front();
-    keyframes_buffer_.pop_front();
+int LocalMapper::checkNewKeyFrames(std::vector<KeyFrame::Ptr> &keyframes, std::chrono::steady_clock::time_point &time_oldest)
+{
+    std::pair<KeyFrame::Ptr, std::chrono::steady_clock::time_point> item;
+    while((int)keyframes.size() < options_.max_coalesced_kfs && keyframes_buffer_.tryPop(item))
+    {
+        if(keyframes.empty())
+            time_oldest = item.second;
+        keyframes.push_back(item.first);
+    }
 
-    return keyframe;
+    return (int)keyframes.size();
 }
 
 void LocalMapper::insertKeyFrame(const KeyFrame::Ptr &keyframe)
@@ -224,9 +321,10 @@ void LocalMapper::insertKeyFrame(const KeyFrame::Ptr &keyframe)
     mapTrace->log("keyframe_id", keyframe->id_);
     if(mapping_thread_ != nullptr)
     {
-        std::unique_lock<std::mutex> lock(mutex_keyframe_);
-        keyframes_buffer_.push_back(keyframe);
-        cond_process_.notify_one();
+        items_pending_++;
+        keyframes_buffer_.push(std::make_pair(keyframe, std::chrono::steady_clock::now()));
+        abort_ba_ = true;
+        event_.notify();
     }
     else
     {
@@ -244,7 +342,11 @@ void LocalMapper::insertKeyFrame(const KeyFrame::Ptr &keyframe)
 
             mapTrace->startTimer("local_ba");
             Optimizer::localBundleAdjustment(keyframe, bad_mpts, options_.num_local_ba_kfs, options_.min_local_ba_connected_fts, report_, verbose_);
+            updateMapPointsVoxel(keyframe, options_.num_local_ba_kfs);
             mapTrace->stopTimer("local_ba");
+            mapTrace->log("local_ba_iters", Optimizer::lastSolveInfo().iterations);
+            mapTrace->log("local_ba_solve_ms", Optimizer::lastSolveInfo().time_ms);
+            mapTrace->log("local_ba_build_ms", Optimizer::lastSolveInfo().build_ms);
         }
 
         for(const MapPoint::Ptr &mpt : bad_mpts)
@@ -254,6 +356,8 @@ void LocalMapper::insertKeyFrame(const KeyFrame::Ptr &keyframe)
 
         checkCulling(keyframe);
 
+        manageImageMemory(keyframe);
+
         addToDatabase(keyframe);
 
         mapTrace->stopTimer("total");
@@ -268,49 +372,146 @@ void LocalMapper::finishLastKeyFrame()
 //    DepthFilter::updateByConnectedKeyFrames(keyframe_last_, 3);
 }
 
-void LocalMapper::createFeatureFromSeed(const Seed::Ptr &seed)
+void LocalMapper::insertConvergedSeed(const Seed::Ptr &seed)
 {
-    //! create new feature
-    MapPoint::Ptr mpt = MapPoint::create(seed->kf->Twc() * (seed->fn_ref/seed->getInvDepth()));
-    Feature::Ptr ft = Feature::create(seed->px_ref, seed->fn_ref, seed->level_ref, mpt);
-    seed->kf->addFeature(ft);
-    map_->insertMapPoint(mpt);
-    mpt->addObservation(seed->kf, ft);
-    mpt->updateViewAndDepth();
+    if(mapping_thread_ != nullptr)
+    {
+        items_pending_++;
+        seeds_buffer_.push(std::make_pair(seed, std::chrono::steady_clock::now()));
+        event_.notify();
+    }
+    else
+    {
+        createFeatureFromSeeds(std::vector<Seed::Ptr>(1, seed));
+    }
+}
+
+void LocalMapper::publishLocalMap(const KeyFrame::Ptr &keyframe)
+{
+    if(keyframe == nullptr || keyframe->isBad())
+        return;
 
-    std::set<KeyFrame::Ptr> local_keyframes = seed->kf->getConnectedKeyFrames(10);
+    map_->publishLocalMap(Map::createLocalMap(keyframe, options_.num_track_kfs));
+}
 
-    for(const KeyFrame::Ptr &kf : local_keyframes)
+int LocalMapper::processConvergedSeeds()
+{
+    std::vector<Seed::Ptr> seeds;
+    double max_latency = 0;
+    const auto now = std::chrono::steady_clock::now();
+    std::pair<Seed::Ptr, std::chrono::steady_clock::time_point> item;
+    while(seeds_buffer_.tryPop(item))
     {
-        Vector3d xyz_cur(kf->Tcw() * mpt->pose());
-        if(xyz_cur[2] < 0.0f)
-            continue;
+        seeds.push_back(item.first);
+        const double latency = std::chrono::duration<double, std::milli>(now - item.second).count();
+        max_latency = MAX(max_latency, latency);
+    }
 
-        Vector2d px_cur(kf->cam_->project(xyz_cur));
-        if(!kf->cam_->isInFrame(px_cur.cast<int>(), 8))
-            continue;
+    if(seeds.empty())
+        return 0;
 
-        int level_cur = 0;
-        const Vector2d px_cur_last = px_cur;
-        int result = FeatureTracker::reprojectMapPoint(kf, mpt, px_cur, level_cur, options_.num_align_iter, options_.max_align_epsilon, options_.max_align_error2);
-        if(result != 1)
-            continue;
+    MillisecondTimer timer;
+    timer.start();
+    const int created_count = createFeatureFromSeeds(seeds);
+    const double time = timer.stop();
 
-        double error = (px_cur_last-px_cur).norm();
-        if(error > 2.0)
-            continue;
+    seeds_drained_ += seeds.size();
+    seeds_max_latency_ = MAX(seeds_max_latency_, max_latency);
+    seeds_time_ += time;
+
+    LOG_IF(INFO, report_) << "[Mapper][*] Create " << created_count << " map points from " << seeds.size()
+                          << " converged seeds, latency: " << max_latency << "ms, time: " << time << "ms";
 
-        Vector3d ft_cur = kf->cam_->lift(px_cur);
-        Feature::Ptr new_feature = Feature::create(px_cur, ft_cur, level_cur, mpt);
-        kf->addFeature(new_feature);
+    return created_count;
+}
 
-        mpt->addObservation(kf, new_feature);
+int LocalMapper::createFeatureFromSeeds(const std::vector<Seed::Ptr> &converged_seeds)
+{
+    //! the reference keyframe may be culled while the converged seeds wait in the buffer
+    std::vector<Seed::Ptr> seeds;
+    seeds.reserve(converged_seeds.size());
+    for(const Seed::Ptr &seed : converged_seeds)
+    {
+        if(!seed->kf->isBad())
+            seeds.push_back(seed);
     }
 
-    mpt->updateViewAndDepth();
+    const int N = (int) seeds.size();
 
-    if(mpt->observations() > 1)
-        Optimizer::refineMapPoint(mpt, 10, true);
+    //! create new features, and find the local keyframes only once for each reference keyframe
+    std::vector<MapPoint::Ptr> mpts(N);
+    std::unordered_map<KeyFrame::Ptr, std::vector<KeyFrame::Ptr> > local_keyframes;
+    for(int i = 0; i < N; i++)
+    {
+        const Seed::Ptr &seed = seeds[i];
+        MapPoint::Ptr mpt = MapPoint::create(seed->kf->Twc() * (seed->fn_ref/seed->getInvDepth()));
+        Feature::Ptr ft = Feature::create(seed->px_ref, seed->fn_ref, seed->level_ref, mpt);
+        seed->kf->addFeature(ft);
+        map_->insertMapPoint(mpt);
+        mpt->addObservation(seed->kf, ft);
+        mpt->updateViewAndDepth();
+        mpts[i] = mpt;
+
+        if(!local_keyframes.count(seed->kf))
+        {
+            local_keyframes.emplace(seed->kf, seed->kf->getConnectedKeyFrames(10));
+        }
+    }
+
+    //! match the new map points in local keyframes in parallel
+    std::vector<std::vector<std::pair<KeyFrame::Ptr, Feature::Ptr> > > matches(N);
+    ThreadPool::getInstance().parallelFor(ThreadPool::TASK_MAPPING, 0, N, [&](int i){
+        const MapPoint::Ptr &mpt = mpts[i];
+        for(const KeyFrame::Ptr &kf : local_keyframes.at(seeds[i]->kf))
+        {
+            if(kf->isBad())
+                continue;
+
+            Vector3d xyz_cur(kf->Tcw() * mpt->pose());
+            if(xyz_cur[2] < 0.0f)
+                continue;
+
+            Vector2d px_cur(kf->cam_->project(xyz_cur));
+            if(!kf->cam_->isInFrame(px_cur.cast<int>(), 8))
+                continue;
+
+            int level_cur = 0;
+            const Vector2d px_cur_last = px_cur;
+            int result = FeatureTracker::reprojectMapPoint(kf, mpt, px_cur, level_cur, options_.num_align_iter, options_.max_align_epsilon, options_.max_align_error2);
+            if(result != 1)
+                continue;
+
+            double error = (px_cur_last-px_cur).norm();
+            if(error > 2.0)
+                continue;
+
+            Vector3d ft_cur = kf->cam_->lift(px_cur);
+            matches[i].emplace_back(kf, Feature::create(px_cur, ft_cur, level_cur, mpt));
+        }
+    }, 4);
+
+    for(int i = 0; i < N; i++)
+    {
+        for(const auto &match : matches[i])
+        {
+            match.first->addFeature(match.second);
+            mpts[i]->addObservation(match.first, match.second);
+        }
+    }
+
+    //! refine all the new map points in batch
+    std::vector<MapPoint::Ptr> mpts_to_refine;
+    mpts_to_refine.reserve(N);
+    for(const MapPoint::Ptr &mpt : mpts)
+    {
+        mpt->updateViewAndDepth();
+        if(mpt->observations() > 1)
+            mpts_to_refine.push_back(mpt);
+    }
+    Optimizer::refineMapPoints(mpts_to_refine, 10, nullptr, 0.0, verbose_);
+    map_->updateMapPointsVoxel(mpts_to_refine);
+
+    return N;
 }
 
 int LocalMapper::createFeatureFromSeedFeature(const KeyFrame::Ptr &keyframe)
@@ -341,7 +542,7 @@ int LocalMapper::createFeatureFromSeedFeature(const KeyFrame::Ptr &keyframe)
 
 int LocalMapper::createFeatureFromLocalMap(const KeyFrame::Ptr &keyframe, const int num)
 {
-    std::set<KeyFrame::Ptr> local_keyframes = keyframe->getConnectedKeyFrames(num);
+    const std::vector<KeyFrame::Ptr> local_keyframes = keyframe->getConnectedKeyFrames(num);
 
     std::unordered_set<MapPoint::Ptr> local_mpts;
     std::vector<MapPoint::Ptr> mpts_cur = keyframe->getMapPoints();
@@ -353,8 +554,8 @@ int LocalMapper::createFeatureFromLocalMap(const KeyFrame::Ptr &keyframe, const
     std::unordered_set<MapPoint::Ptr> candidate_mpts;
     for(const KeyFrame::Ptr &kf : local_keyframes)
     {
-        std::vector<MapPoint::Ptr> mpts = kf->getMapPoints();
-        for(const MapPoint::Ptr &mpt : mpts)
+        kf->getMapPoints(mpts_buffer_);
+        for(const MapPoint::Ptr &mpt : mpts_buffer_)
         {
             if(local_mpts.count(mpt) || candidate_mpts.count(mpt))
                 continue;
@@ -376,29 +577,55 @@ int LocalMapper::createFeatureFromLocalMap(const KeyFrame::Ptr &keyframe, const
         }
     }
 
+    //! the points out of the covisibility are found by the voxel index
+    double depth_mean, depth_min;
+    if(map_->voxelIndexEnabled() && keyframe->getSceneDepth(depth_mean, depth_min))
+    {
+        const std::vector<MapPoint::Ptr> mpts = map_->getMapPointsInFrustum(keyframe, depth_mean * options_.frustum_depth_ratio, options_.max_features);
+        for(const MapPoint::Ptr &mpt : mpts)
+        {
+            if(local_mpts.count(mpt) || candidate_mpts.count(mpt) || mpt->isBad())
+                continue;
+
+            candidate_mpts.insert(mpt);
+        }
+    }
+
     const size_t max_new_count = options_.max_features * 1.5 - mpts_cur.size();
     //! match the mappoints from nearby keyframes
+    //! the alignments are independent, run them in parallel
+    const std::vector<MapPoint::Ptr> candidate_list(candidate_mpts.begin(), candidate_mpts.end());
+    const int N = (int) candidate_list.size();
+    std::vector<Vector2d, aligned_allocator<Vector2d> > pxs_cur(N);
+    std::vector<int> levels_cur(N, 0);
+    std::vector<int> results(N, -2);
+    const SE3d T_cur_from_world = keyframe->Tcw();
+    ThreadPool::getInstance().parallelFor(ThreadPool::TASK_MAPPING, 0, N, [&](int i){
+        Vector3d xyz_cur(T_cur_from_world * candidate_list[i]->pose());
+        if(xyz_cur[2] < 0.0f)
+            return;
+
+        pxs_cur[i] = keyframe->cam_->project(xyz_cur);
+        if(!keyframe->cam_->isInFrame(pxs_cur[i].cast<int>(), 8))
+            return;
+
+        results[i] = FeatureTracker::reprojectMapPoint(keyframe, candidate_list[i], pxs_cur[i], levels_cur[i], options_.num_align_iter, options_.max_align_epsilon, options_.max_align_error2);
+    }, 8);
+
     int project_count = 0;
     std::list<Feature::Ptr> new_fts;
-    for(const MapPoint::Ptr &mpt : candidate_mpts)
+    for(int i = 0; i < N; i++)
     {
-        Vector3d xyz_cur(keyframe->Tcw() * mpt->pose());
-        if(xyz_cur[2] < 0.0f)
-            continue;
-
-        Vector2d px_cur(keyframe->cam_->project(xyz_cur));
-        if(!keyframe->cam_->isInFrame(px_cur.cast<int>(), 8))
+        if(results[i] == -2)
             continue;
 
         project_count++;
 
-        int level_cur = 0;
-        int result = FeatureTracker::reprojectMapPoint(keyframe, mpt, px_cur, level_cur, options_.num_align_iter, options_.max_align_epsilon, options_.max_align_error2);
-        if(result != 1)
+        if(results[i] != 1)
             continue;
 
-        Vector3d ft_cur = keyframe->cam_->lift(px_cur);
-        Feature::Ptr new_feature = Feature::create(px_cur, ft_cur, level_cur, mpt);
+        Vector3d ft_cur = keyframe->cam_->lift(pxs_cur[i]);
+        Feature::Ptr new_feature = Feature::create(pxs_cur[i], ft_cur, levels_cur[i], candidate_list[i]);
         new_fts.push_back(new_feature);
 
         if(new_fts.size() > max_new_count)
@@ -722,20 +949,19 @@ int LocalMapper::refineMapPoints(const int max_optimalize_num, const double outl
         remain_num = (int)optimalize_candidate_mpts_.size();
     }
 
-    std::set<KeyFrame::Ptr> changed_keyframes;
-    for(const MapPoint::Ptr &mpt:mpts_for_optimizing)
-    {
-        Optimizer::refineMapPoint(mpt, 10);
+    //! the outliers are classified in the same pass as the refinement
+    const std::vector<MapPoint::Ptr> mpts(mpts_for_optimizing.begin(), mpts_for_optimizing.end());
+    std::vector<std::vector<KeyFrame::Ptr> > outliers;
+    Optimizer::refineMapPoints(mpts, 10, &outliers, outlier_thr);
+    map_->updateMapPointsVoxel(mpts);
 
-        const std::map<KeyFrame::Ptr, Feature::Ptr> obs = mpt->getObservations();
-        for(const auto &item : obs)
+    //! the connections of keyframes are changed along with the observations
+    for(size_t i = 0; i < mpts.size(); ++i)
+    {
+        const MapPoint::Ptr &mpt = mpts[i];
+        for(const KeyFrame::Ptr &kf : outliers[i])
         {
-            double residual = utils::reprojectError(item.second->fn_.head<2>(), item.first->Tcw(), mpt->pose());
-            if(residual < outlier_thr)
-                continue;
-
-            mpt->removeObservation(item.first);
-            changed_keyframes.insert(item.first);
+            mpt->removeObservation(kf);
 
             if(mpt->type() == MapPoint::BAD)
                 map_->removeMapPoint(mpt);
@@ -748,11 +974,6 @@ int LocalMapper::refineMapPoints(const int max_optimalize_num, const double outl
 
     optimal_time++;
 
-    for(const KeyFrame::Ptr &kf : changed_keyframes)
-    {
-        kf->updateConnections();
-    }
-
     double t1 = (double)cv::getTickCount();
     LOG_IF(WARNING, report_) << "[Mapper][2] Refine MapPoint Time: " << (t1-t0)*1000/cv::getTickFrequency()
                              << "ms, mpts: " << mpts_for_optimizing.size() << ", remained: " << remain_num;
@@ -760,60 +981,173 @@ int LocalMapper::refineMapPoints(const int max_optimalize_num, const double outl
     return (int)mpts_for_optimizing.size();
 }
 
-void LocalMapper::checkCulling(const KeyFrame::Ptr &keyframe)
+void LocalMapper::updateMapPointsVoxel(const KeyFrame::Ptr &keyframe, const int num)
 {
+    if(!map_->voxelIndexEnabled())
+        return;
+
+    std::vector<KeyFrame::Ptr> local_keyframes = keyframe->getConnectedKeyFrames(num);
+    local_keyframes.push_back(keyframe);
+
+    std::unordered_set<MapPoint::Ptr> local_mpts;
+    for(const KeyFrame::Ptr &kf : local_keyframes)
+    {
+        kf->forEachFeature([&local_mpts](const MapPoint::Ptr &mpt, const Feature::Ptr &){
+            local_mpts.insert(mpt);
+        });
+    }
 
-    return;
+    map_->updateMapPointsVoxel(std::vector<MapPoint::Ptr>(local_mpts.begin(), local_mpts.end()));
+}
 
-    const std::set<KeyFrame::Ptr> connected_keyframes = keyframe->getConnectedKeyFrames();
+void LocalMapper::manageImageMemory(const KeyFrame::Ptr &keyframe)
+{
+    //! the keyframes may be used by the tracker for the whole patches
+    const std::vector<KeyFrame::Ptr> window = keyframe->getConnectedKeyFrames(options_.num_track_kfs);
+    std::unordered_set<KeyFrame::Ptr> window_set(window.begin(), window.end());
+    window_set.insert(keyframe);
 
-    int count = 0;
-    for(const KeyFrame::Ptr &kf : connected_keyframes)
+    //! offload the images of the inactive submaps first
+    if(map_->submapEnabled())
     {
-        if(kf->id_ == 0 || kf->isBad())
-            continue;
+        std::vector<KeyFrame::Ptr> window_kfs(window);
+        window_kfs.push_back(keyframe);
+        const Map::SubmapStatus status = map_->updateSubmaps(window_kfs);
+        mapTrace->log("submaps_resident", status.resident);
+        mapTrace->log("submaps_offloaded", status.offloaded);
+        mapTrace->log("submap_file_mb", status.file_bytes / 1048576.0);
+        LOG_IF(INFO, report_) << "[Mapper] Submaps, resident: " << status.resident << ", offloaded: " << status.offloaded
+                              << ", paged in: " << status.paged_in << ", paged out: " << status.paged_out
+                              << ", file: " << status.file_bytes / 1048576.0 << "MB";
+    }
 
-        const int observations_threshold = 3;
-        int redundant_observations = 0;
-        std::vector<MapPoint::Ptr> mpts = kf->getMapPoints();
-        //std::cout << "mpt obs: [";
-        for(const MapPoint::Ptr &mpt : mpts)
+    //! ordered by id, the oldest first
+    std::vector<KeyFrame::Ptr> keyframes = map_->getAllKeyFrames();
+    std::sort(keyframes.begin(), keyframes.end(), [](const KeyFrame::Ptr &kf1, const KeyFrame::Ptr &kf2){ return kf1->id_ < kf2->id_; });
+
+    size_t raw_kfs = 0;
+    size_t raw_bytes = 0;
+    size_t compressed_kfs = 0;
+    size_t compressed_bytes = 0;
+    size_t offloaded_kfs = 0;
+    std::vector<std::pair<KeyFrame::Ptr, size_t> > candidates;
+    for(const KeyFrame::Ptr &kf : keyframes)
+    {
+        Frame::ImageTier tier;
+        const size_t bytes = kf->imageBytes(tier);
+        if(tier == Frame::IMAGE_OFFLOADED)
         {
-            std::map<KeyFrame::Ptr, Feature::Ptr> obs = mpt->getObservations();
-            //std::cout << obs.size() << ",";
-            if(obs.size() > observations_threshold)
-            {
-                int observations = 0;
-//                const Feature::Ptr &ft = obs[kf];
-                for(const auto &it : obs)
-                {
-                    if(it.first == kf)
-                        continue;
+            offloaded_kfs++;
+            continue;
+        }
+        else if(tier == Frame::IMAGE_COMPRESSED)
+        {
+            compressed_kfs++;
+            compressed_bytes += bytes;
+            continue;
+        }
 
-                    //if(it.second->level_ <= ft->level_+1)
-                    {
-                        observations++;
-                        if(observations >= options_.min_redundant_observations)
-                            break;
-                    }
-                }
+        raw_kfs++;
+        raw_bytes += bytes;
+        if(!window_set.count(kf))
+            candidates.emplace_back(kf, bytes);
+    }
 
-                if(observations >= options_.min_redundant_observations)
-                    redundant_observations++;
-            }
+    int compressed_count = 0;
+    if(options_.image_memory_cap > 0)
+    {
+        for(const auto &candidate : candidates)
+        {
+            if(raw_bytes + compressed_bytes <= options_.image_memory_cap)
+                break;
 
-            if(redundant_observations > mpts.size() * 0.8)
+            if(!candidate.first->compressImages())
+                continue;
+
+            Frame::ImageTier tier;
+            const size_t bytes = candidate.first->imageBytes(tier);
+            raw_kfs--;
+            raw_bytes -= candidate.second;
+            if(tier == Frame::IMAGE_OFFLOADED)
+                offloaded_kfs++;
+            else
             {
-                kf->setBad();
-                map_->removeKeyFrame(kf);
-                count++;
+                compressed_kfs++;
+                compressed_bytes += bytes;
             }
+            compressed_count++;
         }
-        //std::cout << "]" <<std::endl;
 
-       // std::cout <<"redundant_observations: " << redundant_observations << " mpts: " << mpts.size() << std::endl;
+        LOG_IF(WARNING, report_ && raw_bytes + compressed_bytes > options_.image_memory_cap)
+            << "[Mapper] The keyframe images exceed the memory cap, " << (raw_bytes + compressed_bytes) / 1048576.0 << "MB";
+    }
+
+    mapTrace->log("img_raw_kfs", raw_kfs);
+    mapTrace->log("img_raw_mb", raw_bytes / 1048576.0);
+    mapTrace->log("img_compressed_kfs", compressed_kfs);
+    mapTrace->log("img_compressed_mb", compressed_bytes / 1048576.0);
+    mapTrace->log("img_offloaded_kfs", offloaded_kfs);
+    LOG_IF(INFO, report_) << "[Mapper] Keyframe images, raw: " << raw_kfs << " kfs " << raw_bytes / 1048576.0 << "MB"
+                          << ", compressed: " << compressed_kfs << " kfs " << compressed_bytes / 1048576.0 << "MB"
+                          << ", offloaded: " << offloaded_kfs << " kfs"
+                          << ", " << compressed_count << " compressed now";
+}
+
+void LocalMapper::checkCulling(const KeyFrame::Ptr &keyframe)
+{
+    if(options_.culling_redundant_ratio <= 0)
+        return;
+
+    double t0 = (double)cv::getTickCount();
+    const std::vector<KeyFrame::Ptr> connected_keyframes = keyframe->getConnectedKeyFrames();
+
+    int count = 0;
+    for(const KeyFrame::Ptr &kf : connected_keyframes)
+    {
+        //! the keyframes newer than this one may still be in the queue or used by the tracker,
+        //! and the seeds of the depth filter refer to their keyframes
+        if(kf->id_ == 0 || kf->id_ >= keyframe->id_ || kf->isBad() || kf->seedNumber() > 0)
+            continue;
+
+        //! the observations are counted by the map points, so it costs O(features)
+        int redundant_observations = 0;
+        int mpts_count = 0;
+        kf->forEachFeature([&](const MapPoint::Ptr &mpt, const Feature::Ptr &){
+            mpts_count++;
+            if(mpt->observations() - 1 >= options_.min_redundant_observations)
+                redundant_observations++;
+        });
+
+        if(mpts_count == 0 || redundant_observations <= mpts_count * options_.culling_redundant_ratio)
+            continue;
+
+        const std::vector<MapPoint::Ptr> mpts = kf->getMapPoints();
 
+        //! the keyframe is released when the last reference held by other threads is dropped
+        kf->setBad();
+        map_->removeKeyFrame(kf);
+        Optimizer::releaseLocalBAProblem(kf);
+        if(bow_database_)
+            bow_database_->erase(kf->id_);
+        count++;
+
+        for(const MapPoint::Ptr &mpt : mpts)
+        {
+            if(mpt->isBad())
+                map_->removeMapPoint(mpt);
+        }
     }
+
+    double t1 = (double)cv::getTickCount();
+    LOG_IF(INFO, report_ && count) << "[Mapper] Cull " << count << " keyframes connected to KF " << keyframe->id_
+                                   << ", time: " << (t1-t0)*1000/cv::getTickFrequency() << "ms";
+}
+
+//! the BRIEF pattern should be inside the image of the level
+inline bool insideBRIEFBorder(float x, float y, int level, int cols, int rows)
+{
+    return x > BRIEF::EDGE_THRESHOLD && y > BRIEF::EDGE_THRESHOLD &&
+        x < cols/(1<<level) - BRIEF::EDGE_THRESHOLD && y < rows/(1<<level) - BRIEF::EDGE_THRESHOLD;
 }
 
 template <>
@@ -826,7 +1160,11 @@ inline size_t Grid<Feature::Ptr>::getIndex(const Feature::Ptr &element)
 
 void LocalMapper::addToDatabase(const KeyFrame::Ptr &keyframe)
 {
-#ifdef SSVO_DBOW_ENABLE
+#ifndef SSVO_DBOW_ENABLE
+    if(!bow_database_)
+        return;
+#endif
+
     keyframe->getFeatures(keyframe->dbow_fts_);
 
     const int cols = keyframe->cam_->width();
@@ -836,10 +1174,7 @@ void LocalMapper::addToDatabase(const KeyFrame::Ptr &keyframe)
 
     for(const Feature::Ptr &ft : keyframe->dbow_fts_)
     {
-        if(ft->px_[0] <= border_tl_[ft->level_].x ||
-            ft->px_[1] <= border_tl_[ft->level_].y ||
-            ft->px_[0] >= border_br_[ft->level_].x ||
-            ft->px_[1] >= border_br_[ft->level_].y)
+        if(!insideBRIEFBorder(ft->px_[0], ft->px_[1], ft->level_, cols, rows))
             continue;
 
         grid.insert(ft);
@@ -857,10 +1192,31 @@ void LocalMapper::addToDatabase(const KeyFrame::Ptr &keyframe)
     BRIEF brief;
     brief.compute(keyframe->images(), kps, keyframe->descriptors_);
 
+#ifdef SSVO_DBOW_ENABLE
     keyframe->dbow_Id_ = database_.add(keyframe->descriptors_, nullptr, nullptr);
 
     LOG_ASSERT(keyframe->dbow_Id_ == keyframe->id_) << "DBoW Id(" << keyframe->dbow_Id_ << ") is not match the keyframe's Id(" << keyframe->id_ << ")!";
+#else
+    BowVector bow;
+    bow_vocabulary_->transform(keyframe->descriptors_, bow);
+    bow_database_->add(keyframe->id_, bow);
+    keyframe->dbow_Id_ = keyframe->id_;
+#endif
+}
+
+void LocalMapper::resetDatabase()
+{
+    //! the DBoW database numbers the keyframes by itself, so only the built-in index is reset
+#ifndef SSVO_DBOW_ENABLE
+    if(!bow_database_)
+        return;
+
+    bow_database_->clear();
+    const std::vector<KeyFrame::Ptr> kfs = map_->getAllKeyFrames();
+    for(const KeyFrame::Ptr &kf : kfs)
+        addToDatabase(kf);
 
+    LOG_IF(INFO, report_ && !kfs.empty()) << "[Mapper] Add " << kfs.size() << " keyframes to the database";
 #endif
 }
 
@@ -868,15 +1224,17 @@ KeyFrame::Ptr LocalMapper::relocalizeByDBoW(const Frame::Ptr &frame, const Corne
 {
     KeyFrame::Ptr reference = nullptr;
 
-#ifdef SSVO_DBOW_ENABLE
+#ifndef SSVO_DBOW_ENABLE
+    if(!bow_database_)
+        return nullptr;
+#endif
 
+    const int cols = frame->cam_->width();
+    const int rows = frame->cam_->height();
     std::vector<cv::KeyPoint> kps;
     for(const Corner & corner : corners)
     {
-        if(corner.x <= border_tl_[corner.level].x ||
-            corner.y <= border_tl_[corner.level].y ||
-            corner.x >= border_br_[corner.level].x ||
-            corner.y >= border_br_[corner.level].y)
+        if(!insideBRIEFBorder(corner.x, corner.y, corner.level, cols, rows))
             continue;
 
         kps.emplace_back(cv::KeyPoint(corner.x, corner.y, 31, -1, 0, corner.level));
@@ -885,6 +1243,8 @@ KeyFrame::Ptr LocalMapper::relocalizeByDBoW(const Frame::Ptr &frame, const Corne
     BRIEF brief;
     cv::Mat _descriptors;
     brief.compute(frame->images(), kps, _descriptors);
+
+#ifdef SSVO_DBOW_ENABLE
     std::vector<cv::Mat> descriptors;
     descriptors.reserve(_descriptors.rows);
     for(int i = 0; i < _descriptors.rows; i++)
@@ -904,6 +1264,29 @@ KeyFrame::Ptr LocalMapper::relocalizeByDBoW(const Frame::Ptr &frame, const Corne
 
     reference = map_->getKeyFrame(result.Id);
 
+#else
+    BowVector bow;
+    bow_vocabulary_->transform(_descriptors, bow);
+
+    //! the culled keyframes are erased from the database, but may be still in the map until released,
+    //! and the candidate with the most matched descriptors is taken
+    std::vector<BowDatabase::Result> results;
+    bow_database_->query(bow, results, 5);
+    size_t max_matches = 0;
+    std::vector<cv::DMatch> matches;
+    for(const BowDatabase::Result &result : results)
+    {
+        KeyFrame::Ptr candidate = map_->getKeyFrame(result.id);
+        if(candidate == nullptr || candidate->isBad())
+            continue;
+
+        BRIEF::matchRatio(_descriptors, candidate->descriptors_, matches);
+        if(matches.size() <= max_matches)
+            continue;
+
+        max_matches = matches.size();
+        reference = candidate;
+    }
 #endif
 
     // TODO 如果有关键帧剔除，则数据库索引存在问题。
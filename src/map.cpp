@@ -1,37 +1,251 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <cstring>
 #include "map.hpp"
+#include "config.hpp"
 
 namespace ssvo{
 
+//! 21 bits for each axis
+static const int VOXEL_BITS = 21;
+static const int64_t VOXEL_OFFSET = 1 << (VOXEL_BITS - 1);
+static const uint64_t VOXEL_MASK = (1ull << VOXEL_BITS) - 1;
+
+static inline int voxelStripe(uint64_t key)
+{
+    return (int)((key * 0x9E3779B97F4A7C15ull) >> 60);
+}
+
+Map::Map() :
+    mpts_count_(0), voxel_size_(Config::mapVoxelSize()), voxels_occupied_(0),
+    submap_kfs_(Config::submapKeyFrames()), submap_resident_(MAX(Config::submapResident(), 0)),
+    submap_dir_(Config::submapDirectory()), submap_tick_(0)
+{}
+
 void Map::clear()
 {
-    std::lock_guard<std::mutex> lock_kf(mutex_kf_);
-    std::lock_guard<std::mutex> lock_mpt(mutex_mpt_);
-    kfs_.clear();
-    mpts_.clear();
+    std::unordered_map<uint64_t, KeyFrame::Ptr> kfs;
+    std::vector<MapPoint::Ptr> mpts;
+    {
+        std::lock_guard<CountingMutex> lock_kf(mutex_kf_);
+        std::lock_guard<CountingMutex> lock_mpt(mutex_mpt_);
+        kfs.swap(kfs_);
+        mpts.swap(mpts_);
+        mpts_count_ = 0;
+        removed_mpts_.clear();
+    }
+
+    publishLocalMap(nullptr);
+
+    {
+        std::lock_guard<CountingMutex> lock(mutex_submap_);
+        submaps_.clear();
+    }
+
+    //! the map points and their features hold each other, and so do the keyframes and their seeds,
+    //! unlink them so the old map is released
+    for(const MapPoint::Ptr &mpt : mpts)
+    {
+        if(mpt)
+            mpt->setBad();
+    }
+
+    for(const auto &kf : kfs)
+        kf.second->setBad();
+
+    std::lock_guard<CountingMutex> lock_update(mutex_voxel_update_);
+    for(int i = 0; i < VOXEL_STRIPES; ++i)
+    {
+        std::lock_guard<CountingMutex> lock(mutex_voxels_[i]);
+        for(auto &voxel : voxels_[i])
+        {
+            for(const MapPoint::Ptr &mpt : voxel.second)
+                mpt->voxel_indexed_ = false;
+        }
+        voxels_[i].clear();
+    }
+    voxels_occupied_ = 0;
 }
 
 bool Map::insertKeyFrame(const KeyFrame::Ptr &kf)
 {
-    std::lock_guard<std::mutex> lock(mutex_kf_);
-    return kfs_.emplace(kf->id_, kf).second;
+    {
+        std::lock_guard<CountingMutex> lock(mutex_kf_);
+        if(!kfs_.emplace(kf->id_, kf).second)
+            return false;
+    }
+
+    if(submapEnabled())
+    {
+        std::lock_guard<CountingMutex> lock(mutex_submap_);
+        auto it = submaps_.find(kf->id_ / submap_kfs_);
+        if(it == submaps_.end())
+        {
+            Submap submap;
+            submap.offloaded = false;
+            submap.last_active = submap_tick_;
+            it = submaps_.emplace(kf->id_ / submap_kfs_, submap).first;
+        }
+        it->second.keyframes.push_back(kf);
+    }
+
+    return true;
 }
 
 void Map::removeKeyFrame(const KeyFrame::Ptr &kf)
 {
-    std::lock_guard<std::mutex> lock(mutex_kf_);
-    kfs_.erase(kf->id_);
+    {
+        std::lock_guard<CountingMutex> lock(mutex_kf_);
+        kfs_.erase(kf->id_);
+    }
+
+    if(submapEnabled())
+    {
+        std::lock_guard<CountingMutex> lock(mutex_submap_);
+        auto it = submaps_.find(kf->id_ / submap_kfs_);
+        if(it != submaps_.end())
+        {
+            std::vector<KeyFrame::Ptr> &keyframes = it->second.keyframes;
+            keyframes.erase(std::remove(keyframes.begin(), keyframes.end(), kf), keyframes.end());
+        }
+    }
+}
+
+Map::SubmapStatus Map::updateSubmaps(const std::vector<KeyFrame::Ptr> &window)
+{
+    SubmapStatus status = {0, 0, 0, 0, 0};
+    if(!submapEnabled())
+        return status;
+
+    std::set<uint64_t> active;
+    for(const KeyFrame::Ptr &kf : window)
+        active.insert(kf->id_ / submap_kfs_);
+
+    //! [id, keyframes, file] of the submaps to offload
+    std::vector<std::tuple<uint64_t, std::vector<KeyFrame::Ptr>, SubmapFile::Ptr> > offloading;
+    {
+        std::lock_guard<CountingMutex> lock(mutex_submap_);
+        submap_tick_++;
+        for(const uint64_t id : active)
+        {
+            const auto it = submaps_.find(id);
+            if(it == submaps_.end())
+                continue;
+
+            it->second.last_active = submap_tick_;
+            if(!it->second.offloaded)
+                continue;
+
+            //! the images are read from the file when used, hint the kernel to load them ahead
+            it->second.offloaded = false;
+            if(it->second.file)
+                it->second.file->prefetch();
+            status.paged_in++;
+        }
+
+        std::vector<std::pair<uint64_t, uint64_t> > resident;
+        for(const auto &item : submaps_)
+        {
+            if(!item.second.offloaded && !active.count(item.first))
+                resident.emplace_back(item.second.last_active, item.first);
+        }
+
+        std::sort(resident.begin(), resident.end());
+        for(size_t i = 0; i + submap_resident_ < resident.size(); ++i)
+        {
+            const Submap &submap = submaps_[resident[i].second];
+            offloading.emplace_back(resident[i].second, submap.keyframes, submap.file);
+        }
+    }
+
+    //! without the lock, writing the file may take a while
+    for(auto &item : offloading)
+    {
+        const std::vector<KeyFrame::Ptr> &keyframes = std::get<1>(item);
+        SubmapFile::Ptr &file = std::get<2>(item);
+        //! the images never change, so each submap is written only once
+        if(file == nullptr)
+        {
+            file = SubmapFile::create(submap_dir_ + "/ssvo_submap_" + std::to_string(getpid()) + "_" + std::to_string(std::get<0>(item)) + "_");
+            for(const KeyFrame::Ptr &kf : keyframes)
+                kf->writeImages(file);
+            file->seal();
+        }
+
+        for(const KeyFrame::Ptr &kf : keyframes)
+            kf->dropImages();
+        file->release();
+        status.paged_out++;
+
+        std::lock_guard<CountingMutex> lock(mutex_submap_);
+        const auto it = submaps_.find(std::get<0>(item));
+        if(it == submaps_.end())
+            continue;
+
+        it->second.file = file;
+        it->second.offloaded = true;
+    }
+
+    std::lock_guard<CountingMutex> lock(mutex_submap_);
+    for(const auto &item : submaps_)
+    {
+        if(item.second.offloaded)
+            status.offloaded++;
+        else
+            status.resident++;
+
+        if(item.second.file)
+            status.file_bytes += item.second.file->size();
+    }
+
+    return status;
 }
 
 void Map::insertMapPoint(const MapPoint::Ptr &mpt)
 {
-    std::lock_guard<std::mutex> lock(mutex_mpt_);
-    mpts_.emplace(mpt->id_, mpt);
+    {
+        std::lock_guard<CountingMutex> lock(mutex_mpt_);
+        if(mpt->handle_ >= mpts_.size())
+            mpts_.resize(mpt->handle_ + 1);
+        MapPoint::Ptr &slot = mpts_[mpt->handle_];
+        if(slot == nullptr)
+            mpts_count_++;
+        slot = mpt;
+    }
+
+    if(!voxelIndexEnabled())
+        return;
+
+    std::lock_guard<CountingMutex> lock(mutex_voxel_update_);
+    if(mpt->voxel_indexed_)
+        return;
+
+    mpt->voxel_key_ = voxelKey(mpt->pose());
+    mpt->voxel_indexed_ = true;
+    insertToVoxel(mpt, mpt->voxel_key_);
 }
 
 void Map::removeMapPoint(const MapPoint::Ptr &mpt)
 {
-    std::lock_guard<std::mutex> lock(mutex_mpt_);
-    mpts_.erase(mpt->id_);
+    if(voxelIndexEnabled())
+    {
+        std::lock_guard<CountingMutex> lock(mutex_voxel_update_);
+        if(mpt->voxel_indexed_)
+        {
+            removeFromVoxel(mpt, mpt->voxel_key_);
+            mpt->voxel_indexed_ = false;
+        }
+    }
+
+    std::lock_guard<CountingMutex> lock(mutex_mpt_);
+    if(mpt->handle_ < mpts_.size() && mpts_[mpt->handle_] == mpt)
+    {
+        mpts_[mpt->handle_].reset();
+        mpts_count_--;
+    }
     removed_mpts_.insert(mpt);
 //    std::string log;
 //    log += "removed mpts: [ ";
@@ -43,9 +257,78 @@ void Map::removeMapPoint(const MapPoint::Ptr &mpt)
 //    LOG(INFO) << log;
 }
 
+size_t Map::reclaimRemovedMapPoints()
+{
+    std::lock_guard<CountingMutex> lock(mutex_mpt_);
+    size_t reclaimed = 0;
+    for(auto it = removed_mpts_.begin(); it != removed_mpts_.end();)
+    {
+        //! still used by the tracking or the optimization, try again next time
+        if(it->use_count() > 1)
+        {
+            ++it;
+            continue;
+        }
+
+        it = removed_mpts_.erase(it);
+        reclaimed++;
+    }
+
+    return reclaimed;
+}
+
+Map::LocalMap::Ptr Map::getLocalMap() const
+{
+    return std::atomic_load(&local_map_);
+}
+
+void Map::publishLocalMap(const LocalMap::Ptr &local_map)
+{
+    std::atomic_store(&local_map_, local_map);
+}
+
+Map::LocalMap::Ptr Map::createLocalMap(const KeyFrame::Ptr &reference, size_t max_kfs)
+{
+    std::shared_ptr<LocalMap> local_map = std::make_shared<LocalMap>();
+    local_map->reference = reference;
+
+    std::vector<KeyFrame::Ptr> &keyframes = local_map->keyframes;
+    keyframes = reference->getConnectedKeyFrames(max_kfs);
+    keyframes.push_back(reference);
+
+    if(keyframes.size() < max_kfs)
+    {
+        const std::vector<KeyFrame::Ptr> sub_connected_keyframes = reference->getSubConnectedKeyFrames(max_kfs - keyframes.size());
+        keyframes.insert(keyframes.end(), sub_connected_keyframes.begin(), sub_connected_keyframes.end());
+    }
+
+    std::unordered_set<MapPoint::Ptr> mpts_set;
+    std::vector<MapPoint::Ptr> mpts;
+    for(const KeyFrame::Ptr &kf : keyframes)
+    {
+        kf->getMapPoints(mpts);
+        for(const MapPoint::Ptr &mpt : mpts)
+        {
+            if(!mpts_set.insert(mpt).second)
+                continue;
+
+            if(mpt->isBad()) //! should not happen
+            {
+                kf->removeMapPoint(mpt);
+                continue;
+            }
+
+            local_map->mpts.push_back(mpt);
+            local_map->poses.push_back(mpt->pose());
+        }
+    }
+
+    return local_map;
+}
+
 std::vector<KeyFrame::Ptr> Map::getAllKeyFrames()
 {
-    std::lock_guard<std::mutex> lock(mutex_kf_);
+    std::lock_guard<CountingMutex> lock(mutex_kf_);
     std::vector<KeyFrame::Ptr> kfs;
     kfs.reserve(kfs_.size());
     for(const auto &kf : kfs_)
@@ -56,7 +339,7 @@ std::vector<KeyFrame::Ptr> Map::getAllKeyFrames()
 
 KeyFrame::Ptr Map::getKeyFrame(uint64_t id)
 {
-    std::lock_guard<std::mutex> lock(mutex_kf_);
+    std::lock_guard<CountingMutex> lock(mutex_kf_);
     if(kfs_.count(id))
         return kfs_[id];
     else
@@ -65,25 +348,767 @@ KeyFrame::Ptr Map::getKeyFrame(uint64_t id)
 
 std::vector<MapPoint::Ptr> Map::getAllMapPoints()
 {
-    std::lock_guard<std::mutex> lock(mutex_mpt_);
+    std::lock_guard<CountingMutex> lock(mutex_mpt_);
     std::vector<MapPoint::Ptr> mpts;
-    mpts.reserve(mpts_.size());
-    for(const auto &mpt : mpts_)
-        mpts.push_back(mpt.second);
+    mpts.reserve(mpts_count_);
+    for(const MapPoint::Ptr &mpt : mpts_)
+    {
+        if(mpt)
+            mpts.push_back(mpt);
+    }
 
     return mpts;
 }
 
 uint64_t Map::KeyFramesInMap()
 {
-    std::lock_guard<std::mutex> lock(mutex_kf_);
+    std::lock_guard<CountingMutex> lock(mutex_kf_);
     return kfs_.size();
 }
 
 uint64_t Map::MapPointsInMap()
 {
-    std::lock_guard<std::mutex> lock(mutex_mpt_);
-    return mpts_.size();
+    std::lock_guard<CountingMutex> lock(mutex_mpt_);
+    return mpts_count_;
+}
+
+MapPoint::Ptr Map::getMapPoint(uint32_t handle)
+{
+    std::lock_guard<CountingMutex> lock(mutex_mpt_);
+    if(handle < mpts_.size())
+        return mpts_[handle];
+    else
+        return nullptr;
+}
+
+double Map::bytesPerMapPoint()
+{
+    std::lock_guard<CountingMutex> lock(mutex_mpt_);
+    if(mpts_count_ == 0)
+        return 0;
+
+    size_t bytes = mpts_.capacity() * sizeof(MapPoint::Ptr);
+    for(const MapPoint::Ptr &mpt : mpts_)
+    {
+        if(mpt)
+            bytes += mpt->memoryUsage();
+    }
+
+    return (double)bytes / mpts_count_;
+}
+
+void Map::updateMapPointsVoxel(const std::vector<MapPoint::Ptr> &mpts)
+{
+    if(!voxelIndexEnabled())
+        return;
+
+    std::lock_guard<CountingMutex> lock(mutex_voxel_update_);
+    for(const MapPoint::Ptr &mpt : mpts)
+    {
+        if(!mpt->voxel_indexed_)
+            continue;
+
+        const uint64_t key = voxelKey(mpt->pose());
+        if(key == mpt->voxel_key_)
+            continue;
+
+        removeFromVoxel(mpt, mpt->voxel_key_);
+        insertToVoxel(mpt, key);
+        mpt->voxel_key_ = key;
+    }
+}
+
+std::vector<MapPoint::Ptr> Map::getMapPointsInFrustum(const Frame::Ptr &frame, double max_depth, size_t max_num)
+{
+    std::vector<MapPoint::Ptr> mpts;
+    if(!voxelIndexEnabled())
+        return mpts;
+
+    const SE3d Tcw = frame->Tcw();
+    const SE3d Twc = Tcw.inverse();
+    const AbstractCamera::Ptr &cam = frame->cam_;
+
+    //! bounding box of the frustum
+    Vector3d box_min = Twc.translation();
+    Vector3d box_max = Twc.translation();
+    const Vector2d corners[4] = {Vector2d(0, 0), Vector2d(cam->width(), 0),
+                                 Vector2d(0, cam->height()), Vector2d(cam->width(), cam->height())};
+    for(const Vector2d &px : corners)
+    {
+        const Vector3d fn = cam->lift(px);
+        const Vector3d corner = Twc * (fn / fn[2] * max_depth);
+        box_min = box_min.cwiseMin(corner);
+        box_max = box_max.cwiseMax(corner);
+    }
+
+    const Eigen::Vector3i idx_min = (box_min / voxel_size_).array().floor().cast<int>();
+    const Eigen::Vector3i idx_max = (box_max / voxel_size_).array().floor().cast<int>();
+    const Eigen::Vector3i range = idx_max - idx_min + Eigen::Vector3i::Ones();
+    const double box_voxels = (double)range[0] * range[1] * range[2];
+
+    //! visit the voxels in the box, or all the occupied voxels if there are fewer, so the cost is bounded by the map
+    if(box_voxels <= (double)voxels_occupied_)
+    {
+        for(int x = idx_min[0]; x <= idx_max[0]; ++x)
+            for(int y = idx_min[1]; y <= idx_max[1]; ++y)
+                for(int z = idx_min[2]; z <= idx_max[2]; ++z)
+                {
+                    const uint64_t key = ((uint64_t)(x + VOXEL_OFFSET) & VOXEL_MASK) << (2 * VOXEL_BITS)
+                                       | ((uint64_t)(y + VOXEL_OFFSET) & VOXEL_MASK) << VOXEL_BITS
+                                       | ((uint64_t)(z + VOXEL_OFFSET) & VOXEL_MASK);
+                    if(!isVoxelInFrustum(voxelCenter(key), Tcw, cam, max_depth))
+                        continue;
+
+                    if(!getMapPointsInVoxel(key, frame, Tcw, max_depth, max_num, mpts))
+                        return mpts;
+                }
+    }
+    else
+    {
+        std::vector<uint64_t> keys;
+        for(int i = 0; i < VOXEL_STRIPES; ++i)
+        {
+            std::lock_guard<CountingMutex> lock(mutex_voxels_[i]);
+            for(const auto &voxel : voxels_[i])
+                keys.push_back(voxel.first);
+        }
+
+        for(const uint64_t key : keys)
+        {
+            if(!isVoxelInFrustum(voxelCenter(key), Tcw, cam, max_depth))
+                continue;
+
+            if(!getMapPointsInVoxel(key, frame, Tcw, max_depth, max_num, mpts))
+                return mpts;
+        }
+    }
+
+    return mpts;
+}
+
+uint64_t Map::voxelKey(const Vector3d &pose) const
+{
+    const int64_t x = (int64_t)std::floor(pose[0] / voxel_size_) + VOXEL_OFFSET;
+    const int64_t y = (int64_t)std::floor(pose[1] / voxel_size_) + VOXEL_OFFSET;
+    const int64_t z = (int64_t)std::floor(pose[2] / voxel_size_) + VOXEL_OFFSET;
+    return ((uint64_t)x & VOXEL_MASK) << (2 * VOXEL_BITS) | ((uint64_t)y & VOXEL_MASK) << VOXEL_BITS | ((uint64_t)z & VOXEL_MASK);
+}
+
+Vector3d Map::voxelCenter(uint64_t key) const
+{
+    const int64_t x = (int64_t)((key >> (2 * VOXEL_BITS)) & VOXEL_MASK) - VOXEL_OFFSET;
+    const int64_t y = (int64_t)((key >> VOXEL_BITS) & VOXEL_MASK) - VOXEL_OFFSET;
+    const int64_t z = (int64_t)(key & VOXEL_MASK) - VOXEL_OFFSET;
+    return (Vector3d(x, y, z) + Vector3d(0.5, 0.5, 0.5)) * voxel_size_;
+}
+
+void Map::insertToVoxel(const MapPoint::Ptr &mpt, uint64_t key)
+{
+    const int stripe = voxelStripe(key);
+    std::lock_guard<CountingMutex> lock(mutex_voxels_[stripe]);
+    std::vector<MapPoint::Ptr> &voxel = voxels_[stripe][key];
+    if(voxel.empty())
+        voxels_occupied_++;
+    voxel.push_back(mpt);
+}
+
+void Map::removeFromVoxel(const MapPoint::Ptr &mpt, uint64_t key)
+{
+    const int stripe = voxelStripe(key);
+    std::lock_guard<CountingMutex> lock(mutex_voxels_[stripe]);
+    auto itr = voxels_[stripe].find(key);
+    if(itr == voxels_[stripe].end())
+        return;
+
+    std::vector<MapPoint::Ptr> &voxel = itr->second;
+    auto mpt_itr = std::find(voxel.begin(), voxel.end(), mpt);
+    if(mpt_itr == voxel.end())
+        return;
+
+    *mpt_itr = voxel.back();
+    voxel.pop_back();
+    if(voxel.empty())
+    {
+        voxels_[stripe].erase(itr);
+        voxels_occupied_--;
+    }
+}
+
+bool Map::isVoxelInFrustum(const Vector3d &center, const SE3d &Tcw, const AbstractCamera::Ptr &cam, double max_depth) const
+{
+    //! radius of the sphere bounding the voxel
+    const double radius = 0.8660254 * voxel_size_;
+    const Vector3d pc = Tcw * center;
+    if(pc[2] < -radius || pc[2] - radius > max_depth)
+        return false;
+
+    if(pc[2] <= radius)
+        return true;
+
+    const Vector2d px = cam->project(pc);
+    const double margin = radius / pc[2] * MAX(cam->fx(), cam->fy());
+    return px[0] >= -margin && px[0] <= cam->width() + margin && px[1] >= -margin && px[1] <= cam->height() + margin;
+}
+
+bool Map::getMapPointsInVoxel(uint64_t key, const Frame::Ptr &frame, const SE3d &Tcw, double max_depth, size_t max_num, std::vector<MapPoint::Ptr> &mpts)
+{
+    const int stripe = voxelStripe(key);
+    std::lock_guard<CountingMutex> lock(mutex_voxels_[stripe]);
+    const auto itr = voxels_[stripe].find(key);
+    if(itr == voxels_[stripe].end())
+        return true;
+
+    for(const MapPoint::Ptr &mpt : itr->second)
+    {
+        const Vector3d pc = Tcw * mpt->pose();
+        if(pc[2] <= 0 || pc[2] > max_depth)
+            continue;
+
+        const Vector2d px = frame->cam_->project(pc);
+        if(!frame->cam_->isInFrame(px.cast<int>()))
+            continue;
+
+        mpts.push_back(mpt);
+        if(max_num > 0 && mpts.size() >= max_num)
+            return false;
+    }
+
+    return true;
+}
+
+//! The map file is in the byte order of the host. All the sections are arrays of fixed-size records
+//! found by the offsets in the header, so the file is used in place once it is mapped,
+//! and the keyframes and map points are referred by their indices in the file.
+//!   | header | keyframes | levels | features | map points | connections | pixels |
+//! The pixels of each image level start at a 64-byte boundary.
+const uint32_t Map::MAP_FILE_VERSION = 1;
+
+static const char MAP_FILE_MAGIC[8] = {'S', 'S', 'V', 'O', 'M', 'A', 'P', '\0'};
+static const uint64_t MAP_FILE_ALIGN = 64;
+static const uint32_t MAP_FILE_NONE = 0xFFFFFFFF;
+
+enum MapFileSection{
+    SECTION_KEYFRAMES = 0,
+    SECTION_LEVELS,
+    SECTION_FEATURES,
+    SECTION_MAPPOINTS,
+    SECTION_CONNECTIONS,
+    SECTION_PIXELS,
+    SECTION_NUM,
+};
+
+struct MapFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t file_size;
+    uint64_t next_kf_id;
+    uint64_t next_frame_id;
+    uint64_t next_mpt_id;
+    uint64_t offsets[SECTION_NUM];
+    uint64_t counts[SECTION_NUM];   //!< records in each section, and bytes of the pixels
+};
+
+struct KeyFrameRecord
+{
+    uint64_t id;
+    uint64_t frame_id;
+    double timestamp;
+    double rotation[4];     //!< quaternion of Tcw, in the order of x, y, z, w
+    double translation[3];
+    uint64_t first_level;
+    uint64_t first_feature;
+    uint64_t first_connection;
+    uint32_t num_levels;
+    uint32_t num_features;
+    uint32_t num_connections;
+    uint32_t reserved;
+};
+
+struct LevelRecord
+{
+    uint64_t offset;        //!< from the start of the pixels
+    uint32_t rows;
+    uint32_t cols;
+    int32_t type;
+    uint32_t step;
+};
+
+struct FeatureRecord
+{
+    double px[2];
+    double fn[3];
+    int32_t level;
+    uint32_t mpt;
+};
+
+struct MapPointRecord
+{
+    uint64_t id;
+    double pose[3];
+    double obs_dir[3];
+    double min_distance;
+    double max_distance;
+    uint64_t found;
+    uint64_t visible;
+    uint32_t type;
+    uint32_t reference;     //!< MAP_FILE_NONE if the reference keyframe is not saved
+};
+
+struct ConnectionRecord
+{
+    uint32_t keyframe;
+    int32_t weight;
+};
+
+static const size_t MAP_FILE_RECORD_SIZES[SECTION_NUM] = {sizeof(KeyFrameRecord), sizeof(LevelRecord),
+    sizeof(FeatureRecord), sizeof(MapPointRecord), sizeof(ConnectionRecord), 1};
+
+static_assert(sizeof(MapFileHeader) % 8 == 0 && sizeof(KeyFrameRecord) % 8 == 0 && sizeof(LevelRecord) % 8 == 0 &&
+              sizeof(FeatureRecord) % 8 == 0 && sizeof(MapPointRecord) % 8 == 0 && sizeof(ConnectionRecord) % 8 == 0,
+              "The records of the map file should be aligned to 8 bytes");
+
+static inline uint64_t alignMapFile(uint64_t size, uint64_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+//! the image size of the level in the pyramid of the camera, halved by cv::pyrDown for each level
+static cv::Size mapFileLevelSize(const AbstractCamera::Ptr &cam, int level)
+{
+    cv::Size size(cam->width(), cam->height());
+    for(int l = 0; l < level; ++l)
+        size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+    return size;
+}
+
+//! pad with zeros to the offset, and then write the data
+static void writeMapFile(std::ofstream &file, uint64_t offset, const void *data, size_t bytes)
+{
+    static const char zeros[MAP_FILE_ALIGN] = {0};
+    if(!file)
+        return;
+
+    const uint64_t pos = (uint64_t) file.tellp();
+    LOG_ASSERT(pos <= offset && offset - pos < MAP_FILE_ALIGN) << "Wrong offset " << offset << " in the map file at " << pos;
+    file.write(zeros, offset - pos);
+    file.write(static_cast<const char*>(data), bytes);
+}
+
+bool Map::save(const std::string &path)
+{
+    std::vector<KeyFrame::Ptr> kfs = getAllKeyFrames();
+    kfs.erase(std::remove_if(kfs.begin(), kfs.end(), [](const KeyFrame::Ptr &kf){ return kf->isBad(); }), kfs.end());
+    std::sort(kfs.begin(), kfs.end(), [](const KeyFrame::Ptr &a, const KeyFrame::Ptr &b){ return a->id_ < b->id_; });
+
+    std::unordered_map<KeyFrame::Ptr, uint32_t> kf_indices;
+    for(size_t i = 0; i < kfs.size(); ++i)
+        kf_indices.emplace(kfs[i], (uint32_t) i);
+
+    std::vector<KeyFrameRecord> kf_records(kfs.size());
+    std::vector<LevelRecord> level_records;
+    std::vector<FeatureRecord> ft_records;
+    std::vector<ConnectionRecord> connection_records;
+    std::vector<MapPoint::Ptr> mpts;
+    std::unordered_map<MapPoint::Ptr, uint32_t> mpt_indices;
+    std::vector<Feature::Ptr> fts;
+    uint64_t pixel_bytes = 0;
+
+    for(size_t i = 0; i < kfs.size(); ++i)
+    {
+        const KeyFrame::Ptr &kf = kfs[i];
+        KeyFrameRecord &record = kf_records[i];
+        std::memset(&record, 0, sizeof(record));
+        record.id = kf->id_;
+        record.frame_id = kf->frame_id_;
+        record.timestamp = kf->timestamp_;
+
+        const SE3d Tcw = kf->Tcw();
+        const Quaterniond q = Tcw.unit_quaternion();
+        record.rotation[0] = q.x();
+        record.rotation[1] = q.y();
+        record.rotation[2] = q.z();
+        record.rotation[3] = q.w();
+        for(int k = 0; k < 3; ++k)
+            record.translation[k] = Tcw.translation()[k];
+
+        //! the pixels are packed row by row, and the sizes are known from the camera,
+        //! so the images are decoded only when they are written
+        record.first_level = level_records.size();
+        record.num_levels = (uint32_t) (kf->max_level_ + 1);
+        for(uint32_t l = 0; l < record.num_levels; ++l)
+        {
+            const cv::Size size = mapFileLevelSize(kf->cam_, l);
+            LevelRecord level;
+            level.offset = pixel_bytes;
+            level.rows = (uint32_t) size.height;
+            level.cols = (uint32_t) size.width;
+            level.type = CV_8UC1;
+            level.step = (uint32_t) size.width;
+            level_records.push_back(level);
+            pixel_bytes += alignMapFile((uint64_t) level.rows * level.step, MAP_FILE_ALIGN);
+        }
+
+        kf->getFeatures(fts);
+        record.first_feature = ft_records.size();
+        for(const Feature::Ptr &ft : fts)
+        {
+            if(!ft->mpt_ || ft->mpt_->isBad())
+                continue;
+
+            const auto it = mpt_indices.emplace(ft->mpt_, (uint32_t) mpts.size());
+            if(it.second)
+                mpts.push_back(ft->mpt_);
+
+            FeatureRecord ft_record;
+            std::memset(&ft_record, 0, sizeof(ft_record));
+            ft_record.px[0] = ft->px_[0];
+            ft_record.px[1] = ft->px_[1];
+            for(int k = 0; k < 3; ++k)
+                ft_record.fn[k] = ft->fn_[k];
+            ft_record.level = ft->level_;
+            ft_record.mpt = it.first->second;
+            ft_records.push_back(ft_record);
+        }
+        record.num_features = (uint32_t) (ft_records.size() - record.first_feature);
+
+        //! the weights are kept as they are, not counted again on loading
+        record.first_connection = connection_records.size();
+        {
+            std::lock_guard<CountingMutex> lock(kf->mutex_connection_);
+            for(const auto &connection : kf->connectedKeyFrames_)
+            {
+                const auto it = kf_indices.find(connection.first);
+                if(it == kf_indices.end())
+                    continue;
+
+                ConnectionRecord connection_record;
+                connection_record.keyframe = it->second;
+                connection_record.weight = connection.second;
+                connection_records.push_back(connection_record);
+            }
+        }
+        record.num_connections = (uint32_t) (connection_records.size() - record.first_connection);
+    }
+
+    std::vector<MapPointRecord> mpt_records(mpts.size());
+    for(size_t j = 0; j < mpts.size(); ++j)
+    {
+        const MapPoint::Ptr &mpt = mpts[j];
+        MapPointRecord &record = mpt_records[j];
+        std::memset(&record, 0, sizeof(record));
+        record.id = mpt->id_;
+        const Vector3d pose = mpt->pose();
+        for(int k = 0; k < 3; ++k)
+            record.pose[k] = pose[k];
+        record.found = mpt->getFound();
+        record.visible = mpt->getVisible();
+
+        KeyFrame::Ptr reference;
+        {
+            std::lock_guard<CountingMutex> lock(mpt->mutexObs());
+            record.type = (uint32_t) mpt->type_;
+            for(int k = 0; k < 3; ++k)
+                record.obs_dir[k] = mpt->obs_dir_[k];
+            reference = mpt->refKF_.lock();
+        }
+
+        {
+            std::lock_guard<CountingMutex> lock(mpt->mutexPose());
+            record.min_distance = mpt->min_distance_;
+            record.max_distance = mpt->max_distance_;
+        }
+
+        const auto it = kf_indices.find(reference);
+        record.reference = it == kf_indices.end() ? MAP_FILE_NONE : it->second;
+    }
+
+    MapFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = MAP_FILE_VERSION;
+    header.header_size = sizeof(MapFileHeader);
+    header.next_kf_id = KeyFrame::next_id_;
+    header.next_frame_id = Frame::next_id_;
+    header.next_mpt_id = MapPoint::next_id_;
+    header.counts[SECTION_KEYFRAMES] = kf_records.size();
+    header.counts[SECTION_LEVELS] = level_records.size();
+    header.counts[SECTION_FEATURES] = ft_records.size();
+    header.counts[SECTION_MAPPOINTS] = mpt_records.size();
+    header.counts[SECTION_CONNECTIONS] = connection_records.size();
+    header.counts[SECTION_PIXELS] = pixel_bytes;
+
+    uint64_t offset = sizeof(MapFileHeader);
+    for(int s = 0; s < SECTION_NUM; ++s)
+    {
+        if(s == SECTION_PIXELS)
+            offset = alignMapFile(offset, MAP_FILE_ALIGN);
+        header.offsets[s] = offset;
+        offset += alignMapFile(header.counts[s] * MAP_FILE_RECORD_SIZES[s], 8);
+    }
+    header.file_size = header.offsets[SECTION_PIXELS] + pixel_bytes;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+    {
+        LOG(ERROR) << "Can not create the map file: " << path;
+        return false;
+    }
+
+    writeMapFile(file, 0, &header, sizeof(header));
+    writeMapFile(file, header.offsets[SECTION_KEYFRAMES], kf_records.data(), kf_records.size() * sizeof(KeyFrameRecord));
+    writeMapFile(file, header.offsets[SECTION_LEVELS], level_records.data(), level_records.size() * sizeof(LevelRecord));
+    writeMapFile(file, header.offsets[SECTION_FEATURES], ft_records.data(), ft_records.size() * sizeof(FeatureRecord));
+    writeMapFile(file, header.offsets[SECTION_MAPPOINTS], mpt_records.data(), mpt_records.size() * sizeof(MapPointRecord));
+    writeMapFile(file, header.offsets[SECTION_CONNECTIONS], connection_records.data(), connection_records.size() * sizeof(ConnectionRecord));
+
+    //! one pyramid at a time, and the compressed or offloaded images stay as they are
+    ImgPyr img_pyr;
+    for(size_t i = 0; i < kfs.size(); ++i)
+    {
+        const KeyFrameRecord &record = kf_records[i];
+        kfs[i]->copyImages(img_pyr);
+        if(img_pyr.size() != record.num_levels)
+        {
+            LOG(ERROR) << "Wrong levels " << img_pyr.size() << " of keyframe " << kfs[i]->id_ << " for the map file: " << path;
+            return false;
+        }
+
+        for(uint32_t l = 0; l < record.num_levels; ++l)
+        {
+            const cv::Mat &img = img_pyr[l];
+            const LevelRecord &level = level_records[record.first_level + l];
+            if(img.type() != level.type || img.rows != (int) level.rows || img.cols != (int) level.cols)
+            {
+                LOG(ERROR) << "Wrong image of keyframe " << kfs[i]->id_ << " in level " << l << " for the map file: " << path;
+                return false;
+            }
+
+            for(int r = 0; r < img.rows; ++r)
+                writeMapFile(file, header.offsets[SECTION_PIXELS] + level.offset + (uint64_t) r * level.step, img.ptr<uchar>(r), level.step);
+        }
+    }
+    img_pyr.clear();
+    writeMapFile(file, header.file_size, nullptr, 0);
+
+    file.close();
+    if(!file)
+    {
+        LOG(ERROR) << "Failed to write the map file: " << path;
+        return false;
+    }
+
+    return true;
+}
+
+//! check the ranges of all the records, so nothing out of the file is read on loading,
+//! the ranges are compared by subtraction, which never wraps around
+static bool checkMapFile(const uchar *base, size_t size, const AbstractCamera::Ptr &cam)
+{
+    if(size < sizeof(MapFileHeader))
+        return false;
+
+    const MapFileHeader &header = *reinterpret_cast<const MapFileHeader*>(base);
+    if(std::memcmp(header.magic, MAP_FILE_MAGIC, sizeof(header.magic)) != 0 || header.file_size != size)
+        return false;
+
+    if(header.version != Map::MAP_FILE_VERSION || header.header_size != sizeof(MapFileHeader))
+        return false;
+
+    for(int s = 0; s < SECTION_NUM; ++s)
+    {
+        if(header.offsets[s] % 8 != 0 || header.offsets[s] > size ||
+            header.counts[s] > (size - header.offsets[s]) / MAP_FILE_RECORD_SIZES[s])
+            return false;
+    }
+
+    const uint64_t num_kfs = header.counts[SECTION_KEYFRAMES];
+    const uint64_t num_mpts = header.counts[SECTION_MAPPOINTS];
+    const uint64_t num_levels = header.counts[SECTION_LEVELS];
+    const uint64_t num_fts = header.counts[SECTION_FEATURES];
+    const uint64_t num_connections = header.counts[SECTION_CONNECTIONS];
+    const uint64_t pixel_bytes = header.counts[SECTION_PIXELS];
+
+    const LevelRecord *level_records = reinterpret_cast<const LevelRecord*>(base + header.offsets[SECTION_LEVELS]);
+    for(uint64_t i = 0; i < num_levels; ++i)
+    {
+        const LevelRecord &level = level_records[i];
+        if(level.rows == 0 || level.cols == 0 || CV_MAT_CN(level.type) != 1 || CV_MAT_DEPTH(level.type) != CV_8U ||
+            level.step < level.cols || level.offset > pixel_bytes || (uint64_t) level.rows * level.step > pixel_bytes - level.offset)
+            return false;
+    }
+
+    //! the ids are the keys in the map, so each one is only once
+    std::unordered_set<uint64_t> ids;
+    const KeyFrameRecord *kf_records = reinterpret_cast<const KeyFrameRecord*>(base + header.offsets[SECTION_KEYFRAMES]);
+    for(uint64_t i = 0; i < num_kfs; ++i)
+    {
+        const KeyFrameRecord &record = kf_records[i];
+        if(record.num_levels != (uint32_t) Config::imageNLevel() ||
+            record.first_level > num_levels || record.num_levels > num_levels - record.first_level ||
+            record.first_feature > num_fts || record.num_features > num_fts - record.first_feature ||
+            record.first_connection > num_connections || record.num_connections > num_connections - record.first_connection ||
+            !ids.insert(record.id).second)
+            return false;
+
+        //! the same pyramid as the frames of the camera
+        for(uint32_t l = 0; l < record.num_levels; ++l)
+        {
+            const LevelRecord &level = level_records[record.first_level + l];
+            const cv::Size level_size = mapFileLevelSize(cam, l);
+            if(level.rows != (uint32_t) level_size.height || level.cols != (uint32_t) level_size.width)
+                return false;
+        }
+    }
+
+    const FeatureRecord *ft_records = reinterpret_cast<const FeatureRecord*>(base + header.offsets[SECTION_FEATURES]);
+    for(uint64_t i = 0; i < num_fts; ++i)
+    {
+        if(ft_records[i].mpt >= num_mpts || ft_records[i].level < 0 || ft_records[i].level >= Config::imageNLevel())
+            return false;
+    }
+
+    ids.clear();
+    const MapPointRecord *mpt_records = reinterpret_cast<const MapPointRecord*>(base + header.offsets[SECTION_MAPPOINTS]);
+    for(uint64_t j = 0; j < num_mpts; ++j)
+    {
+        if(mpt_records[j].type > MapPoint::BAD || (mpt_records[j].reference != MAP_FILE_NONE && mpt_records[j].reference >= num_kfs) ||
+            !ids.insert(mpt_records[j].id).second)
+            return false;
+    }
+
+    const ConnectionRecord *connection_records = reinterpret_cast<const ConnectionRecord*>(base + header.offsets[SECTION_CONNECTIONS]);
+    for(uint64_t i = 0; i < num_connections; ++i)
+    {
+        if(connection_records[i].keyframe >= num_kfs)
+            return false;
+    }
+
+    return true;
+}
+
+bool Map::load(const std::string &path, const AbstractCamera::Ptr &cam)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        LOG(ERROR) << "Can not open the map file: " << path;
+        return false;
+    }
+
+    struct stat file_stat;
+    void *data = MAP_FAILED;
+    if(::fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+        data = ::mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if(data == MAP_FAILED)
+    {
+        LOG(ERROR) << "Can not map the map file: " << path;
+        return false;
+    }
+
+    const size_t size = file_stat.st_size;
+    std::shared_ptr<void> mapping(data, [size](void *ptr){ ::munmap(ptr, size); });
+    const uchar *base = static_cast<const uchar*>(data);
+
+    if(!checkMapFile(base, size, cam))
+    {
+        const MapFileHeader *header = size >= sizeof(MapFileHeader) ? reinterpret_cast<const MapFileHeader*>(base) : nullptr;
+        if(header && std::memcmp(header->magic, MAP_FILE_MAGIC, sizeof(header->magic)) == 0 && header->version != MAP_FILE_VERSION)
+            LOG(ERROR) << "The version of the map file is " << header->version << ", but " << MAP_FILE_VERSION << " is supported: " << path;
+        else
+            LOG(ERROR) << "Invalid map file: " << path;
+        return false;
+    }
+
+    const MapFileHeader &header = *reinterpret_cast<const MapFileHeader*>(base);
+    const KeyFrameRecord *kf_records = reinterpret_cast<const KeyFrameRecord*>(base + header.offsets[SECTION_KEYFRAMES]);
+    const LevelRecord *level_records = reinterpret_cast<const LevelRecord*>(base + header.offsets[SECTION_LEVELS]);
+    const FeatureRecord *ft_records = reinterpret_cast<const FeatureRecord*>(base + header.offsets[SECTION_FEATURES]);
+    const MapPointRecord *mpt_records = reinterpret_cast<const MapPointRecord*>(base + header.offsets[SECTION_MAPPOINTS]);
+    const ConnectionRecord *connection_records = reinterpret_cast<const ConnectionRecord*>(base + header.offsets[SECTION_CONNECTIONS]);
+    const uchar *pixels = base + header.offsets[SECTION_PIXELS];
+
+    clear();
+
+    //! the images are copied out of the mapping, which is released after loading
+    std::vector<KeyFrame::Ptr> kfs(header.counts[SECTION_KEYFRAMES]);
+    for(size_t i = 0; i < kfs.size(); ++i)
+    {
+        const KeyFrameRecord &record = kf_records[i];
+        ImgPyr img_pyr(record.num_levels);
+        for(uint32_t l = 0; l < record.num_levels; ++l)
+        {
+            const LevelRecord &level = level_records[record.first_level + l];
+            img_pyr[l] = cv::Mat(level.rows, level.cols, level.type, const_cast<uchar*>(pixels + level.offset), level.step).clone();
+        }
+
+        kfs[i] = KeyFrame::Ptr(new KeyFrame(img_pyr, record.id, record.frame_id, record.timestamp, cam));
+        const Quaterniond q(record.rotation[3], record.rotation[0], record.rotation[1], record.rotation[2]);
+        kfs[i]->setTcw(SE3d(q.normalized(), Vector3d(record.translation[0], record.translation[1], record.translation[2])));
+    }
+
+    //! nothing else sees the new keyframes and map points yet, so they are filled without the locks
+    std::vector<MapPoint::Ptr> mpts(header.counts[SECTION_MAPPOINTS]);
+    for(size_t j = 0; j < mpts.size(); ++j)
+    {
+        const MapPointRecord &record = mpt_records[j];
+        const Vector3d pose(record.pose[0], record.pose[1], record.pose[2]);
+        MapPoint::Ptr mpt = std::allocate_shared<MapPoint>(PoolAllocator<MapPoint>(), pose, record.id);
+        mpt->type_ = (MapPoint::Type) record.type;
+        mpt->obs_dir_ = Vector3d(record.obs_dir[0], record.obs_dir[1], record.obs_dir[2]);
+        mpt->min_distance_ = record.min_distance;
+        mpt->max_distance_ = record.max_distance;
+        mpt->found_cunter_ = record.found;
+        mpt->visiable_cunter_ = record.visible;
+        if(record.reference != MAP_FILE_NONE)
+            mpt->refKF_ = kfs[record.reference];
+        mpts[j] = mpt;
+    }
+
+    for(size_t i = 0; i < kfs.size(); ++i)
+    {
+        const KeyFrameRecord &record = kf_records[i];
+        const KeyFrame::Ptr &kf = kfs[i];
+        for(uint32_t f = 0; f < record.num_features; ++f)
+        {
+            const FeatureRecord &ft_record = ft_records[record.first_feature + f];
+            const MapPoint::Ptr &mpt = mpts[ft_record.mpt];
+            const Vector2d px(ft_record.px[0], ft_record.px[1]);
+            const Vector3d fn(ft_record.fn[0], ft_record.fn[1], ft_record.fn[2]);
+            Feature::Ptr ft = Feature::create(px, fn, ft_record.level, mpt);
+            kf->addFeature(ft);
+            mpt->obs_.emplace_back(kf, ft);
+        }
+
+        for(uint32_t c = 0; c < record.num_connections; ++c)
+        {
+            const ConnectionRecord &connection = connection_records[record.first_connection + c];
+            kf->setConnection(kfs[connection.keyframe], connection.weight);
+        }
+    }
+
+    for(const MapPoint::Ptr &mpt : mpts)
+    {
+        mpt->obs_count_ = (int) mpt->obs_.size();
+        if(mpt->refKF_.expired() && !mpt->obs_.empty())
+            mpt->refKF_ = mpt->obs_.front().first;
+    }
+
+    //! the new objects never take the ids in the file
+    KeyFrame::next_id_ = MAX(KeyFrame::next_id_, header.next_kf_id);
+    Frame::next_id_ = MAX(Frame::next_id_, header.next_frame_id);
+    MapPoint::next_id_ = MAX(MapPoint::next_id_, header.next_mpt_id);
+
+    for(const KeyFrame::Ptr &kf : kfs)
+        insertKeyFrame(kf);
+
+    for(const MapPoint::Ptr &mpt : mpts)
+        insertMapPoint(mpt);
+
+    return true;
 }
 
 }
\ No newline at end of file
@@ -7,87 +7,193 @@ namespace ssvo
 uint64_t MapPoint::next_id_ = 0;
 const double MapPoint::log_level_factor_ = log(2.0f);
 
+//! never destroyed, the map points may be released by other static destructors at exit
+static HandleAllocator &handleAllocator()
+{
+    static HandleAllocator *handles = new HandleAllocator();
+    return *handles;
+}
+
+static const uint32_t LOCK_STRIPES = 256;
+static CountingMutex mutex_obs_stripes[LOCK_STRIPES];
+static CountingMutex mutex_pose_stripes[LOCK_STRIPES];
+
+typedef MapPoint::Observations Observations;
+
+//! compared without locking the weak pointers
+template<typename Links>
+static inline typename Links::iterator findKeyFrame(Links &links, const KeyFrame::Ptr &kf)
+{
+    return std::find_if(links.begin(), links.end(), [&kf](const typename Links::value_type &item){
+        return !item.first.owner_before(kf) && !kf.owner_before(item.first);
+    });
+}
+
+//! append the observations whose keyframes are still alive
+template<typename Links>
+static inline void lockObservations(const Links &links, Observations &obs)
+{
+    obs.reserve(obs.size() + links.size());
+    for(const auto &item : links)
+    {
+        KeyFrame::Ptr kf = item.first.lock();
+        if(kf)
+            obs.emplace_back(std::move(kf), item.second);
+    }
+}
+
+//! the weight of connection between two keyframes is the number of map points observed by both
+static void changeConnections(const KeyFrame::Ptr &kf, const Observations &obs, const int delta)
+{
+    for(const auto &item : obs)
+    {
+        if(item.first == kf)
+            continue;
+
+        item.first->changeConnection(kf, delta);
+        kf->changeConnection(item.first, delta);
+    }
+}
+
 MapPoint::MapPoint(const Vector3d &p) :
-        id_(next_id_++), last_structure_optimal_(0), pose_(p), type_(SEED),
-        min_distance_(0.0), max_distance_(0.0), refKF_(nullptr), found_cunter_(1), visiable_cunter_(1)
+        id_(next_id_++), handle_(handleAllocator().acquire()), last_structure_optimal_(0), pose_(p), obs_count_(0), type_(SEED),
+        min_distance_(0.0), max_distance_(0.0), found_cunter_(1), visiable_cunter_(1),
+        voxel_indexed_(false), voxel_key_(0)
+{
+}
+
+MapPoint::MapPoint(const Vector3d &p, const uint64_t id) :
+        id_(id), handle_(handleAllocator().acquire()), last_structure_optimal_(0), pose_(p), obs_count_(0), type_(SEED),
+        min_distance_(0.0), max_distance_(0.0), found_cunter_(1), visiable_cunter_(1),
+        voxel_indexed_(false), voxel_key_(0)
+{
+}
+
+MapPoint::~MapPoint()
 {
+    handleAllocator().release(handle_);
+}
+
+CountingMutex &MapPoint::mutexObs() const
+{
+    return mutex_obs_stripes[handle_ % LOCK_STRIPES];
+}
+
+CountingMutex &MapPoint::mutexPose() const
+{
+    return mutex_pose_stripes[handle_ % LOCK_STRIPES];
+}
+
+size_t MapPoint::memoryUsage()
+{
+    std::lock_guard<CountingMutex> lock(mutexObs());
+    return PoolUsage<MapPoint>::block_bytes + obs_.capacity() * sizeof(ObservationLinks::value_type);
 }
 
 MapPoint::Type MapPoint::type()
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
+    std::lock_guard<CountingMutex> lock(mutexObs());
     return type_;
 }
 
 void MapPoint::resetType(MapPoint::Type type)
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
+    std::lock_guard<CountingMutex> lock(mutexObs());
     type_ = type;
 }
 
 void MapPoint::setBad()
 {
-    std::unordered_map<KeyFramePtr, Feature::Ptr> obs;
+    ObservationLinks links;
     {
-        std::lock_guard<std::mutex> lock(mutex_obs_);
+        std::lock_guard<CountingMutex> lock(mutexObs());
         type_ = BAD;
-        obs = obs_;
+        links.swap(obs_);
+        obs_count_ = 0;
     }
 
-    for(const auto &it : obs)
-        it.first->removeFeature(it.second);
+    Observations obs;
+    lockObservations(links, obs);
 
     for(const auto &it : obs)
-        it.first->updateConnections();
+        it.first->removeFeature(it.second);
 
+    for(size_t i = 0; i < obs.size(); ++i)
     {
-        std::lock_guard<std::mutex> lock(mutex_obs_);
-        obs_.clear();
+        for(size_t j = i + 1; j < obs.size(); ++j)
+        {
+            obs[i].first->changeConnection(obs[j].first, -1);
+            obs[j].first->changeConnection(obs[i].first, -1);
+        }
     }
 }
 
 bool MapPoint::isBad()
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
+    std::lock_guard<CountingMutex> lock(mutexObs());
     return type_ == BAD;
 }
 
 KeyFrame::Ptr MapPoint::getReferenceKeyFrame()
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
-    return refKF_;
+    std::lock_guard<CountingMutex> lock(mutexObs());
+    return refKF_.lock();
 }
 
 void MapPoint::addObservation(const KeyFrame::Ptr &kf, const Feature::Ptr &ft)
 {
     LOG_ASSERT(kf && kf) << " Error input kf: " << kf << ", or ft: " << ft;
 
-    std::lock_guard<std::mutex> lock(mutex_obs_);
-    LOG_ASSERT(type_ != BAD) << " Error to use a BAD MapPoint!";
+    Observations others;
+    {
+        std::lock_guard<CountingMutex> lock(mutexObs());
+        LOG_ASSERT(type_ != BAD) << " Error to use a BAD MapPoint!";
+
+        if(refKF_.expired())
+            refKF_ = kf;
+        if(findKeyFrame(obs_, kf) != obs_.end())
+            return;
 
-    if(refKF_ == nullptr)
-        refKF_ = kf;
-    obs_.emplace(kf, ft);
+        lockObservations(obs_, others);
+        obs_.emplace_back(kf, ft);
+        obs_count_ = (int)obs_.size();
+    }
+
+    changeConnections(kf, others, 1);
 }
 
-//! it do not change the connections of keyframe
 bool MapPoint::fusion(const MapPoint::Ptr &mpt)
 {
+    //! read the other one before locking, they may share the same stripe
     const auto obs = mpt->getObservations();
+    const uint64_t found = mpt->getFound();
+    const uint64_t visible = mpt->getVisible();
     bool update = false;
+    Observations observers;
+    Observations added;
     {
-        std::lock_guard<std::mutex> lock(mutex_obs_);
-        found_cunter_ += mpt->getFound();
-        visiable_cunter_ += mpt->getVisible();
+        std::lock_guard<CountingMutex> lock(mutexObs());
+        found_cunter_ += found;
+        visiable_cunter_ += visible;
 
+        lockObservations(obs_, observers);
         for(const auto &it : obs)
         {
-            if(obs_.count(it.first) == 0)
+            if(findKeyFrame(obs_, it.first) == obs_.end())
             {
-                obs_.insert(it);
+                obs_.emplace_back(it.first, it.second);
+                added.emplace_back(it.first, it.second);
                 update = true;
             }
         }
+        obs_count_ = (int)obs_.size();
+    }
+
+    //! the connections through the other one are removed when it is set bad
+    for(const auto &it : added)
+    {
+        changeConnections(it.first, observers, 1);
+        observers.push_back(it);
     }
 
     mpt->setBad();
@@ -98,39 +204,35 @@ bool MapPoint::fusion(const MapPoint::Ptr &mpt)
     return true;
 }
 
-int MapPoint::observations()
-{
-    std::lock_guard<std::mutex> lock(mutex_obs_);
-    return (int)obs_.size();
-}
-
-//! should update connections for keyframe
 bool MapPoint::removeObservation(const KeyFramePtr &kf)
 {
+    Feature::Ptr ft;
+    KeyFrame::Ptr ref_kf;
+    Observations others;
+    bool empty;
     {
-        std::lock_guard<std::mutex> lock(mutex_obs_);
-        const auto it = obs_.find(kf);
+        std::lock_guard<CountingMutex> lock(mutexObs());
+        const auto it = findKeyFrame(obs_, kf);
         if(it == obs_.end())
             return false;
 
 //        LOG(INFO) << " Remove obs, mpt: " << id_ << " kf: " << kf->id_ << " size: " << obs_.size();
 
-        const Feature::Ptr &ft = it->second;
-        kf->removeFeature(ft);
-        obs_.erase(kf);
-        if(obs_.empty())
-        {
+        ft = it->second;
+        *it = obs_.back();
+        obs_.pop_back();
+        obs_count_ = (int)obs_.size();
+        empty = obs_.empty();
+        if(empty)
             type_ = BAD;
-            return true;
-        }
-
+        ref_kf = refKF_.lock();
+        lockObservations(obs_, others);
     }
 
-    KeyFrame::Ptr ref_kf;
-    {
-        std::lock_guard<std::mutex> lock(mutex_pose_);
-        ref_kf = refKF_;
-    }
+    kf->removeFeature(ft);
+    changeConnections(kf, others, -1);
+    if(empty)
+        return true;
 
     if(kf == ref_kf)
         updateRefKF();
@@ -144,34 +246,43 @@ void MapPoint::updateRefKF()
 {
     uint64_t min_id = std::numeric_limits<uint64_t>::max();
     KeyFrame::Ptr ref_kf;
+    std::lock_guard<CountingMutex> lock(mutexObs());
+    for(const auto &item : obs_)
     {
-        std::lock_guard<std::mutex> lock(mutex_obs_);
-        for(const auto &item : obs_)
+        const KeyFrame::Ptr kf = item.first.lock();
+        if(kf && kf->id_ < min_id)
         {
-            if(item.first->id_ < min_id)
-            {
-                min_id = item.first->id_;
-                ref_kf = item.first;
-            }
+            min_id = kf->id_;
+            ref_kf = kf;
         }
     }
+    refKF_ = ref_kf;
+}
 
+std::map<KeyFrame::Ptr, Feature::Ptr> MapPoint::getObservations()
+{
+    std::lock_guard<CountingMutex> lock(mutexObs());
+    std::map<KeyFrame::Ptr, Feature::Ptr> obs;
+    for(const auto &item : obs_)
     {
-        std::lock_guard<std::mutex> lock(mutex_pose_);
-        refKF_ = ref_kf;
+        KeyFrame::Ptr kf = item.first.lock();
+        if(kf)
+            obs.emplace(std::move(kf), item.second);
     }
+    return obs;
 }
 
-std::map<KeyFrame::Ptr, Feature::Ptr> MapPoint::getObservations()
+void MapPoint::getObservations(Observations &obs)
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
-    return std::map<KeyFrame::Ptr, Feature::Ptr>(obs_.begin(), obs_.end());
+    obs.clear();
+    std::lock_guard<CountingMutex> lock(mutexObs());
+    lockObservations(obs_, obs);
 }
 
 Feature::Ptr MapPoint::findObservation(const KeyFrame::Ptr kf)
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
-    const auto it = obs_.find(kf);
+    std::lock_guard<CountingMutex> lock(mutexObs());
+    const auto it = findKeyFrame(obs_, kf);
     if(it != obs_.end())
         return it->second;
     else
@@ -180,17 +291,27 @@ Feature::Ptr MapPoint::findObservation(const KeyFrame::Ptr kf)
 
 void MapPoint::updateViewAndDepth()
 {
+    KeyFrame::Ptr ref_kf;
+    Feature::Ptr ref_ft;
     {
-        std::lock_guard<std::mutex> lock(mutex_obs_);
+        std::lock_guard<CountingMutex> lock(mutexObs());
 
         if(obs_.empty())
             return;
 
+        ref_kf = refKF_.lock();
+        const auto it = findKeyFrame(obs_, ref_kf);
+        LOG_ASSERT(ref_kf && it != obs_.end()) << " The reference keyframe is not observed!";
+        ref_ft = it->second;
+
         Vector3d normal = Vector3d::Zero();
         int n = 0;
         for(const auto &obs : obs_)
         {
-            Vector3d Ow = obs.first->pose().translation();
+            const KeyFrame::Ptr kf = obs.first.lock();
+            if(!kf)
+                continue;
+            Vector3d Ow = kf->pose().translation();
             Vector3d obs_dir((Ow - pose_).normalized());
             normal = normal + obs_dir;
             n++;
@@ -199,13 +320,12 @@ void MapPoint::updateViewAndDepth()
     }
 
     {
-        std::lock_guard<std::mutex> lock(mutex_pose_);
-        Vector3d ref_obs_dir = refKF_->pose().translation() - pose_;
+        std::lock_guard<CountingMutex> lock(mutexPose());
+        Vector3d ref_obs_dir = ref_kf->pose().translation() - pose_;
 
         const double dist = ref_obs_dir.norm();
-        Feature::Ptr ft = findObservation(refKF_);
-        const int level_scale = 1 << ft->level_;
-        const int max_scale = 1 << refKF_->max_level_;
+        const int level_scale = 1 << ref_ft->level_;
+        const int max_scale = 1 << ref_kf->max_level_;
 
         max_distance_ = dist * level_scale; //! regard it is top level, we may obsevere the point if we go closer
         min_distance_ = max_distance_ / max_scale;
@@ -214,13 +334,13 @@ void MapPoint::updateViewAndDepth()
 
 double MapPoint::getMinDistanceInvariance()
 {
-    std::lock_guard<std::mutex> lock(mutex_pose_);
+    std::lock_guard<CountingMutex> lock(mutexPose());
     return 0.8f * min_distance_;
 }
 
 double MapPoint::getMaxDistanceInvariance()
 {
-    std::lock_guard<std::mutex> lock(mutex_pose_);
+    std::lock_guard<CountingMutex> lock(mutexPose());
     return 1.2f * max_distance_;
 }
 
@@ -228,7 +348,7 @@ int MapPoint::predictScale(const double dist, const int max_level)
 {
     double ratio;
     {
-        std::lock_guard<std::mutex> lock(mutex_pose_);
+        std::lock_guard<CountingMutex> lock(mutexPose());
         ratio = max_distance_ / dist;
     }
 
@@ -256,52 +376,52 @@ int MapPoint::predictScale(const double dist_ref, const double dist_cur, const i
 
 void MapPoint::increaseFound(int n)
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
+    std::lock_guard<CountingMutex> lock(mutexObs());
     found_cunter_ += n;
 }
 
 void MapPoint::increaseVisible(int n)
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
+    std::lock_guard<CountingMutex> lock(mutexObs());
     visiable_cunter_ += n;
 }
 
 uint64_t MapPoint::getFound()
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
+    std::lock_guard<CountingMutex> lock(mutexObs());
     return found_cunter_;
 }
 
 uint64_t MapPoint::getVisible()
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
+    std::lock_guard<CountingMutex> lock(mutexObs());
     return visiable_cunter_;
 }
 
 double MapPoint::getFoundRatio()
 {
-    std::lock_guard<std::mutex> lock(mutex_obs_);
+    std::lock_guard<CountingMutex> lock(mutexObs());
     return static_cast<double>(found_cunter_)/visiable_cunter_;
 }
 
 bool MapPoint::getCloseViewObs(const Frame::Ptr &frame, KeyFrame::Ptr &keyframe, int &level)
 {
-    std::unordered_map<KeyFramePtr, Feature::Ptr> obs;
+    Observations obs;
     Vector3d obs_dir;
     {
-        std::lock_guard<std::mutex> lock(mutex_obs_);
+        std::lock_guard<CountingMutex> lock(mutexObs());
         if(type_ == BAD)
             return false;
         // TODO 这里可能还有问题，bad 的 mpt没有被删除？
         LOG_ASSERT(!obs_.empty()) << " Map point is invalid!";
-        obs = obs_;
+        lockObservations(obs_, obs);
         obs_dir = obs_dir_;
     }
 
     //! 1. scale invariance region check
     Vector3d frame_obs_dir;
     {
-        std::lock_guard<std::mutex> lock(mutex_pose_);
+        std::lock_guard<CountingMutex> lock(mutexPose());
         frame_obs_dir = frame->pose().translation() - pose_;
     }
     const double dist = frame_obs_dir.norm();
@@ -2,9 +2,76 @@
 #include "optimizer.hpp"
 #include "config.hpp"
 #include "utils.hpp"
+#include "local_ba_solver.hpp"
+#include "local_ba_problem.hpp"
+#include "thread_pool.hpp"
 
 namespace ssvo{
 
+static thread_local Optimizer::SolveInfo last_solve_info = {0, 0.0, 0.0, false};
+
+//! the problem of localBundleAdjustmentPersistent, created by the first call
+static std::mutex local_problem_mutex;
+static std::unique_ptr<LocalBAProblem> local_problem;
+
+static inline void setLastSolveInfo(const ceres::Solver::Summary &summary)
+{
+    last_solve_info.iterations = summary.num_successful_steps + summary.num_unsuccessful_steps;
+    last_solve_info.time_ms = summary.total_time_in_seconds * 1000;
+    last_solve_info.build_ms = 0.0;
+    last_solve_info.aborted = false;
+}
+
+const Optimizer::SolveInfo& Optimizer::lastSolveInfo()
+{
+    return last_solve_info;
+}
+
+void Optimizer::setSolverOptions(const Config::SolverProfile &profile, size_t num_cameras, ceres::Solver::Options &options)
+{
+    //! dense Schur is the fastest for small problems
+    static const size_t MAX_DENSE_CAMERAS = 50;
+
+    std::string linear_solver = profile.linear_solver;
+    if(linear_solver == "auto")
+    {
+        if(num_cameras <= MAX_DENSE_CAMERAS)
+            linear_solver = "dense_schur";
+        else if(ceres::IsSparseLinearAlgebraLibraryTypeAvailable(options.sparse_linear_algebra_library_type))
+            linear_solver = "sparse_schur";
+        else
+            linear_solver = "iterative_schur";
+    }
+
+    options.trust_region_strategy_type = ceres::DOGLEG;
+    if(linear_solver == "dense_schur")
+        options.linear_solver_type = ceres::DENSE_SCHUR;
+    else if(linear_solver == "sparse_schur")
+        options.linear_solver_type = ceres::SPARSE_SCHUR;
+    else if(linear_solver == "dense_qr")
+        options.linear_solver_type = ceres::DENSE_QR;
+    else if(linear_solver == "iterative_schur")
+    {
+        //! DOGLEG only works with the exact solvers
+        options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+        options.preconditioner_type = ceres::SCHUR_JACOBI;
+        options.trust_region_strategy_type = ceres::LEVENBERG_MARQUARDT;
+    }
+    else
+    {
+        LOG(WARNING) << "[Optimizer] Unknown linear solver: " << linear_solver << ", use dense_schur instead";
+        options.linear_solver_type = ceres::DENSE_SCHUR;
+    }
+
+    options.num_threads = profile.num_threads > 0 ? profile.num_threads : MAX((int)std::thread::hardware_concurrency(), 1);
+
+    if(profile.max_time > 0)
+        options.max_solver_time_in_seconds = profile.max_time;
+
+    if(profile.max_iterations > 0)
+        options.max_num_iterations = profile.max_iterations;
+}
+
 void Optimizer::globleBundleAdjustment(const Map::Ptr &map, int max_iters, bool report, bool verbose)
 {
     if (map->KeyFramesInMap() < 2)
@@ -32,70 +99,239 @@ void Optimizer::globleBundleAdjustment(const Map::Ptr &map, int max_iters, bool
     for (const MapPoint::Ptr &mpt : all_mpts)
     {
         mpt->optimal_pose_ = mpt->pose();
-        const std::map<KeyFrame::Ptr, Feature::Ptr> obs = mpt->getObservations();
-
-        for (const auto &item : obs)
-        {
-            const KeyFrame::Ptr &kf = item.first;
-            const Feature::Ptr &ft = item.second;
+        mpt->forEachObservation([&](const KeyFrame::Ptr &kf, const Feature::Ptr &ft){
             ceres::CostFunction* cost_function1 = ceres_slover::ReprojectionErrorSE3::Create(ft->fn_[0] / ft->fn_[2], ft->fn_[1] / ft->fn_[2]);//, 1.0/(1<<ft->level_));
             problem.AddResidualBlock(cost_function1, lossfunction, kf->optimal_Tcw_.data(), mpt->optimal_pose_.data());
-        }
+        });
     }
 
     ceres::Solver::Options options;
     ceres::Solver::Summary summary;
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-    options.trust_region_strategy_type = ceres::DOGLEG;
     options.minimizer_progress_to_stdout = report & verbose;
     options.max_num_iterations = max_iters;
+    setSolverOptions(Config::globalBAProfile(), all_kfs.size(), options);
 //    options_.gradient_tolerance = 1e-4;
 //    options_.function_tolerance = 1e-4;
-    //options_.max_solver_time_in_seconds = 0.2;
 
     ceres::Solve(options, &problem, &summary);
+    setLastSolveInfo(summary);
 
     //! update pose
     std::for_each(all_kfs.begin(), all_kfs.end(), [](KeyFrame::Ptr kf) {kf->setTcw(kf->optimal_Tcw_); });
     std::for_each(all_mpts.begin(), all_mpts.end(), [](MapPoint::Ptr mpt){mpt->setPose(mpt->optimal_pose_);});
+    map->updateMapPointsVoxel(all_mpts);
 
     //! Report
     reportInfo<2>(problem, summary, report, verbose);
 }
 
-void Optimizer::localBundleAdjustment(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size, int min_shared_fts, bool report, bool verbose)
+//! the keyframes connected to the keyframe are optimized, and the others observing the local map points are fixed
+static void getLocalWindow(const KeyFrame::Ptr &keyframe, int size, int min_shared_fts,
+                           std::set<KeyFrame::Ptr> &actived_keyframes,
+                           std::set<KeyFrame::Ptr> &fixed_keyframe,
+                           std::unordered_set<MapPoint::Ptr> &local_mappoints)
 {
-    static double focus_length = MIN(keyframe->cam_->fx(), keyframe->cam_->fy());
-    static double pixel_usigma = Config::imagePixelSigma()/focus_length;
-
-    double t0 = (double)cv::getTickCount();
     size = size > 0 ? size-1 : 0;
-    std::set<KeyFrame::Ptr> actived_keyframes = keyframe->getConnectedKeyFrames(size, min_shared_fts);
+    const std::vector<KeyFrame::Ptr> connected_keyframes = keyframe->getConnectedKeyFrames(size, min_shared_fts);
+    actived_keyframes = std::set<KeyFrame::Ptr>(connected_keyframes.begin(), connected_keyframes.end());
     actived_keyframes.insert(keyframe);
-    std::unordered_set<MapPoint::Ptr> local_mappoints;
-    std::set<KeyFrame::Ptr> fixed_keyframe;
 
     for(const KeyFrame::Ptr &kf : actived_keyframes)
     {
-        std::vector<MapPoint::Ptr> mpts = kf->getMapPoints();
-        for(const MapPoint::Ptr &mpt : mpts)
-        {
+        kf->forEachFeature([&local_mappoints](const MapPoint::Ptr &mpt, const Feature::Ptr &){
             local_mappoints.insert(mpt);
-        }
+        });
     }
 
     for(const MapPoint::Ptr &mpt : local_mappoints)
     {
-        const std::map<KeyFrame::Ptr, Feature::Ptr> obs = mpt->getObservations();
+        mpt->forEachObservation([&](const KeyFrame::Ptr &kf, const Feature::Ptr &){
+            if(!actived_keyframes.count(kf))
+                fixed_keyframe.insert(kf);
+        });
+    }
+}
+
+//! update the optimized keyframes and map points, and remove the observations with large error
+static void updateLocalWindow(const std::set<KeyFrame::Ptr> &actived_keyframes,
+                              const std::unordered_set<MapPoint::Ptr> &local_mappoints,
+                              const double pixel_usigma,
+                              std::list<MapPoint::Ptr> &bad_mpts)
+{
+    //! update pose
+    for(const KeyFrame::Ptr &kf : actived_keyframes)
+    {
+        kf->setTcw(kf->optimal_Tcw_);
+    }
+
+    //! update mpts & remove mappoint with large error, the connections are changed by the map points
+    const double max_residual = pixel_usigma * pixel_usigma * std::sqrt(3.81);
+    MapPoint::Observations obs;
+    for(const MapPoint::Ptr &mpt : local_mappoints)
+    {
+        mpt->getObservations(obs);
         for(const auto &item : obs)
         {
-            if(actived_keyframes.count(item.first))
+            double residual = utils::reprojectError(item.second->fn_.head<2>(), item.first->Tcw(), mpt->optimal_pose_);
+            if(residual < max_residual)
                 continue;
 
-            fixed_keyframe.insert(item.first);
+            mpt->removeObservation(item.first);
+//            std::cout << " rm outlier: " << mpt->id_ << " " << item.first->id_ << " " << obs.size() << std::endl;
+
+            if(mpt->type() == MapPoint::BAD)
+            {
+                bad_mpts.push_back(mpt);
+            }
         }
+
+        mpt->setPose(mpt->optimal_pose_);
+    }
+}
+
+void Optimizer::localBundleAdjustment(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size, int min_shared_fts, bool report, bool verbose, const std::atomic<bool> *abort)
+{
+    if(Config::optimizerLocalBAInvDepth())
+        localBundleAdjustmentWithInvDepth(keyframe, bad_mpts, size, min_shared_fts, report, verbose, abort);
+    else if(Config::optimizerLocalBANative())
+        localBundleAdjustmentNative(keyframe, bad_mpts, size, min_shared_fts, report, verbose, abort);
+    else if(Config::optimizerLocalBAPersistent())
+        localBundleAdjustmentPersistent(keyframe, bad_mpts, size, min_shared_fts, report, verbose, abort);
+    else
+        localBundleAdjustmentCeres(keyframe, bad_mpts, size, min_shared_fts, report, verbose, abort);
+}
+
+void Optimizer::localBundleAdjustmentCeres(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size, int min_shared_fts, bool report, bool verbose, const std::atomic<bool> *abort)
+{
+    static double focus_length = MIN(keyframe->cam_->fx(), keyframe->cam_->fy());
+    static double pixel_usigma = Config::imagePixelSigma()/focus_length;
+
+    double t0 = (double)cv::getTickCount();
+    std::set<KeyFrame::Ptr> actived_keyframes;
+    std::set<KeyFrame::Ptr> fixed_keyframe;
+    std::unordered_set<MapPoint::Ptr> local_mappoints;
+    getLocalWindow(keyframe, size, min_shared_fts, actived_keyframes, fixed_keyframe, local_mappoints);
+
+    ceres::Problem problem;
+    ceres::LocalParameterization* local_parameterization = new ceres_slover::SE3Parameterization();
+
+    for(const KeyFrame::Ptr &kf : fixed_keyframe)
+    {
+        kf->optimal_Tcw_ = kf->Tcw();
+        problem.AddParameterBlock(kf->optimal_Tcw_.data(), SE3d::num_parameters, local_parameterization);
+        problem.SetParameterBlockConstant(kf->optimal_Tcw_.data());
+    }
+
+    for(const KeyFrame::Ptr &kf : actived_keyframes)
+    {
+        kf->optimal_Tcw_ = kf->Tcw();
+        problem.AddParameterBlock(kf->optimal_Tcw_.data(), SE3d::num_parameters, local_parameterization);
+        if(kf->id_ <= 1)
+            problem.SetParameterBlockConstant(kf->optimal_Tcw_.data());
+    }
+
+    double scale = pixel_usigma * 2;
+    ceres::LossFunction* lossfunction = new ceres::HuberLoss(scale);
+    for(const MapPoint::Ptr &mpt : local_mappoints)
+    {
+        mpt->optimal_pose_ = mpt->pose();
+        mpt->forEachObservation([&](const KeyFrame::Ptr &kf, const Feature::Ptr &ft){
+            ceres::CostFunction* cost_function1 = ceres_slover::ReprojectionErrorSE3::Create(ft->fn_[0]/ft->fn_[2], ft->fn_[1]/ft->fn_[2]);//, 1.0/(1<<ft->level_));
+            problem.AddResidualBlock(cost_function1, lossfunction, kf->optimal_Tcw_.data(), mpt->optimal_pose_.data());
+        });
     }
 
+    ceres::Solver::Options options;
+    ceres::Solver::Summary summary;
+    options.minimizer_progress_to_stdout = report & verbose;
+    setSolverOptions(Config::localBAProfile(), actived_keyframes.size() + fixed_keyframe.size(), options);
+    ceres_slover::AbortCallback abort_callback(abort);
+    options.callbacks.push_back(&abort_callback);
+
+    double t_build = (double)cv::getTickCount();
+    ceres::Solve(options, &problem, &summary);
+    setLastSolveInfo(summary);
+    last_solve_info.build_ms = (t_build-t0)*1000/cv::getTickFrequency();
+    last_solve_info.aborted = summary.termination_type == ceres::USER_SUCCESS;
+
+    updateLocalWindow(actived_keyframes, local_mappoints, pixel_usigma, bad_mpts);
+
+    //! Report
+    double t1 = (double)cv::getTickCount();
+    LOG_IF(INFO, report) << "[Optimizer] Finish local BA for KF: " << keyframe->id_ << "(" << keyframe->frame_id_ << ")"
+                         << ", KFs: " << actived_keyframes.size() << "(+" << fixed_keyframe.size() << ")"
+                         << ", Mpts: " << local_mappoints.size()
+                         << ", remove " << bad_mpts.size() << " bad mpts."
+                         << " (" << (t1-t0)/cv::getTickFrequency() << "ms)";
+
+    reportInfo<2>(problem, summary, report, verbose);
+}
+
+void Optimizer::localBundleAdjustmentPersistent(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size, int min_shared_fts, bool report, bool verbose, const std::atomic<bool> *abort)
+{
+    static double focus_length = MIN(keyframe->cam_->fx(), keyframe->cam_->fy());
+    static double pixel_usigma = Config::imagePixelSigma()/focus_length;
+
+    //! the blocks and the cost functions are reused by the following keyframes
+    std::lock_guard<std::mutex> lock(local_problem_mutex);
+    if(!local_problem)
+        local_problem.reset(new LocalBAProblem());
+
+    double t0 = (double)cv::getTickCount();
+    local_problem->update(keyframe, size, min_shared_fts, pixel_usigma * 2);
+    ceres::Problem &problem = local_problem->problem();
+
+    ceres::Solver::Options options;
+    ceres::Solver::Summary summary;
+    options.minimizer_progress_to_stdout = report & verbose;
+    setSolverOptions(Config::localBAProfile(), local_problem->activedKeyFrames().size() + local_problem->fixedKeyFrames().size(), options);
+    ceres_slover::AbortCallback abort_callback(abort);
+    options.callbacks.push_back(&abort_callback);
+
+    double t_build = (double)cv::getTickCount();
+    ceres::Solve(options, &problem, &summary);
+    setLastSolveInfo(summary);
+    last_solve_info.build_ms = (t_build-t0)*1000/cv::getTickFrequency();
+    last_solve_info.aborted = summary.termination_type == ceres::USER_SUCCESS;
+
+    updateLocalWindow(local_problem->activedKeyFrames(), local_problem->localMapPoints(), pixel_usigma, bad_mpts);
+
+    //! Report
+    double t1 = (double)cv::getTickCount();
+    LOG_IF(INFO, report) << "[Optimizer] Finish local BA(persistent) for KF: " << keyframe->id_ << "(" << keyframe->frame_id_ << ")"
+                         << ", KFs: " << local_problem->activedKeyFrames().size() << "(+" << local_problem->fixedKeyFrames().size() << ")"
+                         << ", Mpts: " << local_problem->localMapPoints().size()
+                         << ", residuals: +" << local_problem->addedResiduals() << "/-" << local_problem->removedResiduals()
+                         << ", remove " << bad_mpts.size() << " bad mpts."
+                         << " (" << (t_build-t0)/cv::getTickFrequency() << "/" << (t1-t_build)/cv::getTickFrequency() << "s)";
+
+    reportInfo<2>(problem, summary, report, verbose);
+}
+
+void Optimizer::releaseLocalBAProblem(const KeyFrame::Ptr &keyframe)
+{
+    std::lock_guard<std::mutex> lock(local_problem_mutex);
+    if(!local_problem)
+        return;
+
+    //! the cost functions are kept for the culled keyframe, but all released for the cleared map
+    if(keyframe == nullptr)
+        local_problem.reset();
+    else if(local_problem->hasKeyFrame(keyframe))
+        local_problem->clear();
+}
+
+void Optimizer::localBundleAdjustmentWithInvDepth(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size, int min_shared_fts, bool report, bool verbose, const std::atomic<bool> *abort)
+{
+    static double focus_length = MIN(keyframe->cam_->fx(), keyframe->cam_->fy());
+    static double pixel_usigma = Config::imagePixelSigma()/focus_length;
+
+    double t0 = (double)cv::getTickCount();
+    std::set<KeyFrame::Ptr> actived_keyframes;
+    std::set<KeyFrame::Ptr> fixed_keyframe;
+    std::unordered_set<MapPoint::Ptr> local_mappoints;
+    getLocalWindow(keyframe, size, min_shared_fts, actived_keyframes, fixed_keyframe, local_mappoints);
+
     ceres::Problem problem;
     ceres::LocalParameterization* local_parameterization = new ceres_slover::SE3Parameterization();
 
@@ -114,78 +350,399 @@ void Optimizer::localBundleAdjustment(const KeyFrame::Ptr &keyframe, std::list<M
             problem.SetParameterBlockConstant(kf->optimal_Tcw_.data());
     }
 
+    //! the point is fn_ref/inv_depth in the reference keyframe
+    struct InvDepthPoint{
+        MapPoint::Ptr mpt;
+        KeyFrame::Ptr kf_ref;
+        Vector3d fn_ref;
+        double inv_depth;
+    };
+
+    std::vector<InvDepthPoint> points;
+    points.reserve(local_mappoints.size());
     double scale = pixel_usigma * 2;
     ceres::LossFunction* lossfunction = new ceres::HuberLoss(scale);
     for(const MapPoint::Ptr &mpt : local_mappoints)
     {
         mpt->optimal_pose_ = mpt->pose();
         const std::map<KeyFrame::Ptr, Feature::Ptr> obs = mpt->getObservations();
+        if(obs.size() < 2)
+            continue;
+
+        auto ref_itr = obs.find(mpt->getReferenceKeyFrame());
+        if(ref_itr == obs.end())
+            ref_itr = obs.begin();
+
+        const KeyFrame::Ptr &kf_ref = ref_itr->first;
+        const Vector3d fn_ref = ref_itr->second->fn_ / ref_itr->second->fn_[2];
+        const double depth = (kf_ref->optimal_Tcw_ * mpt->optimal_pose_)[2];
+        if(depth <= 0)
+            continue;
+
+        //! reserved, so the address of the inverse depth is fixed
+        points.push_back({mpt, kf_ref, fn_ref, 1.0 / depth});
+        InvDepthPoint &point = points.back();
 
         for(const auto &item : obs)
         {
             const KeyFrame::Ptr &kf = item.first;
+            if(kf == kf_ref)
+                continue;
+
             const Feature::Ptr &ft = item.second;
-            ceres::CostFunction* cost_function1 = ceres_slover::ReprojectionErrorSE3::Create(ft->fn_[0]/ft->fn_[2], ft->fn_[1]/ft->fn_[2]);//, 1.0/(1<<ft->level_));
-            problem.AddResidualBlock(cost_function1, lossfunction, kf->optimal_Tcw_.data(), mpt->optimal_pose_.data());
+            ceres::CostFunction* cost_function = ceres_slover::ReprojectionErrorSE3InvDepth::Create(fn_ref[0], fn_ref[1], ft->fn_[0]/ft->fn_[2], ft->fn_[1]/ft->fn_[2]);
+            problem.AddResidualBlock(cost_function, lossfunction, kf_ref->optimal_Tcw_.data(), kf->optimal_Tcw_.data(), &point.inv_depth);
         }
     }
 
     ceres::Solver::Options options;
     ceres::Solver::Summary summary;
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-    options.trust_region_strategy_type = ceres::DOGLEG;
     options.minimizer_progress_to_stdout = report & verbose;
+    setSolverOptions(Config::localBAProfile(), actived_keyframes.size() + fixed_keyframe.size(), options);
+    ceres_slover::AbortCallback abort_callback(abort);
+    options.callbacks.push_back(&abort_callback);
 
+    double t_build = (double)cv::getTickCount();
     ceres::Solve(options, &problem, &summary);
+    setLastSolveInfo(summary);
+    last_solve_info.build_ms = (t_build-t0)*1000/cv::getTickFrequency();
+    last_solve_info.aborted = summary.termination_type == ceres::USER_SUCCESS;
+
+    //! the points pushed behind the reference keyframe are kept unchanged, and rejected by the reprojection error
+    for(const InvDepthPoint &point : points)
+    {
+        if(point.inv_depth <= 0)
+            continue;
+
+        point.mpt->optimal_pose_ = point.kf_ref->optimal_Tcw_.inverse() * (point.fn_ref / point.inv_depth);
+    }
+
+    updateLocalWindow(actived_keyframes, local_mappoints, pixel_usigma, bad_mpts);
+
+    //! Report
+    double t1 = (double)cv::getTickCount();
+    LOG_IF(INFO, report) << "[Optimizer] Finish local BA(inverse depth) for KF: " << keyframe->id_ << "(" << keyframe->frame_id_ << ")"
+                         << ", KFs: " << actived_keyframes.size() << "(+" << fixed_keyframe.size() << ")"
+                         << ", Mpts: " << points.size() << "/" << local_mappoints.size()
+                         << ", remove " << bad_mpts.size() << " bad mpts."
+                         << " (" << (t1-t0)/cv::getTickFrequency() << "ms)";
+
+    reportInfo<2>(problem, summary, report, verbose);
+}
+
+void Optimizer::localBundleAdjustmentNative(const KeyFrame::Ptr &keyframe, std::list<MapPoint::Ptr> &bad_mpts, int size, int min_shared_fts, bool report, bool verbose, const std::atomic<bool> *abort)
+{
+    static double focus_length = MIN(keyframe->cam_->fx(), keyframe->cam_->fy());
+    static double pixel_usigma = Config::imagePixelSigma()/focus_length;
+
+    double t0 = (double)cv::getTickCount();
+    std::set<KeyFrame::Ptr> actived_keyframes;
+    std::set<KeyFrame::Ptr> fixed_keyframe;
+    std::unordered_set<MapPoint::Ptr> local_mappoints;
+    getLocalWindow(keyframe, size, min_shared_fts, actived_keyframes, fixed_keyframe, local_mappoints);
+
+    //! the buffers are reused by the following keyframes
+    static thread_local LocalBASolver solver;
+    solver.clear();
+
+    std::unordered_map<KeyFrame::Ptr, int> pose_ids;
+    for(const KeyFrame::Ptr &kf : fixed_keyframe)
+    {
+        kf->optimal_Tcw_ = kf->Tcw();
+        pose_ids.emplace(kf, solver.addPose(&kf->optimal_Tcw_, true));
+    }
 
-    //! update pose
     for(const KeyFrame::Ptr &kf : actived_keyframes)
     {
-        kf->setTcw(kf->optimal_Tcw_);
+        kf->optimal_Tcw_ = kf->Tcw();
+        pose_ids.emplace(kf, solver.addPose(&kf->optimal_Tcw_, kf->id_ <= 1));
     }
 
-    //! update mpts & remove mappoint with large error
-    std::set<KeyFrame::Ptr> changed_keyframes;
-    static const double max_residual = pixel_usigma * pixel_usigma * std::sqrt(3.81);
     for(const MapPoint::Ptr &mpt : local_mappoints)
     {
-        const std::map<KeyFrame::Ptr, Feature::Ptr> obs = mpt->getObservations();
-        for(const auto &item : obs)
+        mpt->optimal_pose_ = mpt->pose();
+        const int point_id = solver.addPoint(&mpt->optimal_pose_);
+        mpt->forEachObservation([&](const KeyFrame::Ptr &kf, const Feature::Ptr &ft){
+            const auto it = pose_ids.find(kf);
+            if(it == pose_ids.end())
+                return;
+
+            solver.addObservation(it->second, point_id, ft->fn_.head<2>()/ft->fn_[2]);
+        });
+    }
+
+    //! the same as the default settings of Ceres
+    LocalBASolver::Options options;
+    options.max_iterations = 50;
+    options.function_tolerance = 1e-6;
+    options.gradient_tolerance = 1e-10;
+    options.parameter_tolerance = 1e-8;
+    options.initial_lambda = 1e-4;
+    options.huber = pixel_usigma * 2;
+    options.abort = abort;
+
+    double t1 = (double)cv::getTickCount();
+    const LocalBASolver::Summary summary = solver.solve(options, report & verbose);
+    double t2 = (double)cv::getTickCount();
+    last_solve_info.iterations = summary.iterations;
+    last_solve_info.time_ms = (t2-t1)*1000/cv::getTickFrequency();
+    last_solve_info.build_ms = (t1-t0)*1000/cv::getTickFrequency();
+    last_solve_info.aborted = summary.aborted;
+
+    updateLocalWindow(actived_keyframes, local_mappoints, pixel_usigma, bad_mpts);
+
+    //! Report
+    double t3 = (double)cv::getTickCount();
+    LOG_IF(INFO, report) << "[Optimizer] Finish local BA for KF: " << keyframe->id_ << "(" << keyframe->frame_id_ << ")"
+                         << ", KFs: " << actived_keyframes.size() << "(+" << fixed_keyframe.size() << ")"
+                         << ", Mpts: " << local_mappoints.size() << ", Obs: " << solver.observations()
+                         << ", remove " << bad_mpts.size() << " bad mpts."
+                         << " cost: " << std::scientific << summary.initial_cost << " -> " << summary.final_cost << std::fixed
+                         << ", iters: " << summary.iterations << "(" << summary.successful_steps << ")"
+                         << " (" << (t1-t0)/cv::getTickFrequency() << "/" << (t2-t1)/cv::getTickFrequency()
+                         << "/" << (t3-t2)/cv::getTickFrequency() << "s)";
+}
+
+//! observation of a fixed point for motion-only BA
+struct MotionObservation
+{
+    Vector3d pose;
+    Vector2d fn;
+    double weight;
+    double max_error2; //! threshold for rejection, negative for seeds which are never rejected
+    int index;         //! index of the feature in the frame
+    bool inlier;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+typedef std::vector<MotionObservation, aligned_allocator<MotionObservation> > MotionObservations;
+
+//! IRLS Gauss-Newton with Huber weights, the pose is updated by T = exp(dx) * T, dx in the order of Sophus::Tangent
+static int motionOnlyGaussNewton(SE3d &Tcw, const MotionObservations &observations, const double huber, const int max_iter,
+                                 double &init_chi2, double &final_chi2, bool verbose)
+{
+    typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+    typedef Eigen::Matrix<double, 6, 1> Vector6d;
+    typedef Eigen::Matrix<double, 2, 6> Matrix26d;
+
+    const double EPS = 1E-10;
+    const double CHI2_EPS = 1E-6;
+    Matrix6d H;
+    Vector6d g;
+    Matrix26d J;
+    Eigen::Matrix<double, 2, 3> Jproj;
+
+    SE3d T_last = Tcw;
+    double last_chi2 = std::numeric_limits<double>::max();
+    init_chi2 = final_chi2 = 0;
+    int i = 0;
+    for(; i < max_iter; ++i)
+    {
+        H.setZero();
+        g.setZero();
+        double new_chi2 = 0;
+        int count = 0;
+
+        for(const MotionObservation &ob : observations)
         {
-            double residual = utils::reprojectError(item.second->fn_.head<2>(), item.first->Tcw(), mpt->optimal_pose_);
-            if(residual < max_residual)
+            if(!ob.inlier)
                 continue;
 
-            mpt->removeObservation(item.first);
-            changed_keyframes.insert(item.first);
-//            std::cout << " rm outlier: " << mpt->id_ << " " << item.first->id_ << " " << obs.size() << std::endl;
+            const Vector3d p(Tcw * ob.pose);
+            if(p[2] <= 0)
+                continue;
 
-            if(mpt->type() == MapPoint::BAD)
+            const double z_inv = 1.0 / p[2];
+            const double z_inv2 = z_inv * z_inv;
+            const Vector2d residual(ob.weight * (p.head<2>() * z_inv - ob.fn));
+            Jproj << z_inv, 0.0, -p[0]*z_inv2,
+                     0.0, z_inv, -p[1]*z_inv2;
+            Jproj *= ob.weight;
+            J.leftCols<3>() = Jproj;
+            J.rightCols<3>().noalias() = Jproj * Sophus::SO3d::hat(-p);
+
+            //! the same cost as ceres::HuberLoss
+            const double error = residual.norm();
+            double w = 1.0;
+            if(error <= huber)
+                new_chi2 += error * error;
+            else
             {
-                bad_mpts.push_back(mpt);
+                w = huber / error;
+                new_chi2 += 2.0 * huber * error - huber * huber;
             }
+
+            //! only the upper triangle is accumulated
+            H.selfadjointView<Eigen::Upper>().rankUpdate(J.transpose(), w);
+            g.noalias() -= w * J.transpose() * residual;
+            count++;
         }
 
-        mpt->setPose(mpt->optimal_pose_);
+        if(i == 0) init_chi2 = new_chi2;
+
+        if(count < 3)
+        {
+            LOG_IF(INFO, verbose) << "iter " << std::setw(2) << i << ": failure, too few observations: " << count;
+            break;
+        }
+
+        if(last_chi2 < new_chi2)
+        {
+            LOG_IF(INFO, verbose) << "iter " << std::setw(2) << i << ": failure, chi2: " << std::scientific << std::setprecision(6) << new_chi2;
+            Tcw = T_last;
+            break;
+        }
+
+        //! IRLS converges linearly at the end, stop if the cost hardly decreases
+        const bool converged = last_chi2 - new_chi2 < CHI2_EPS * new_chi2;
+        last_chi2 = new_chi2;
+        if(converged)
+            break;
+
+        const Vector6d dx(H.selfadjointView<Eigen::Upper>().ldlt().solve(g));
+        if(!dx.allFinite())
+            break;
+
+        T_last = Tcw;
+        Tcw = SE3d::exp(dx) * Tcw;
+
+        LOG_IF(INFO, verbose) << "iter " << std::setw(2) << i << ": success, chi2: " << std::scientific << std::setprecision(6) << new_chi2 << ", step: " << dx.transpose();
+
+        if(dx.norm() <= EPS)
+            break;
+    }
+
+    final_chi2 = last_chi2 == std::numeric_limits<double>::max() ? init_chi2 : last_chi2;
+    return i;
+}
+
+void Optimizer::motionOnlyBundleAdjustment(const Frame::Ptr &frame, bool use_seeds, bool reject, bool report, bool verbose)
+{
+    if(Config::optimizerMotionNative())
+        motionOnlyBundleAdjustmentNative(frame, use_seeds, reject, report, verbose);
+    else
+        motionOnlyBundleAdjustmentCeres(frame, use_seeds, reject, report, verbose);
+}
+
+void Optimizer::motionOnlyBundleAdjustmentNative(const Frame::Ptr &frame, bool use_seeds, bool reject, bool report, bool verbose)
+{
+    double t0 = (double)cv::getTickCount();
+    const double focus_length = MIN(frame->cam_->fx(), frame->cam_->fy());
+    const double pixel_usigma = Config::imagePixelSigma()/focus_length;
+    const double scale = pixel_usigma * std::sqrt(3.81);
+    const double TH_REPJ = 3.81 * pixel_usigma * pixel_usigma;
+
+    static const size_t OPTIMAL_MPTS = 150;
+    static const int MAX_ITERS = 10;
+
+    //! reuse the buffers between frames
+    static thread_local MotionObservations observations;
+    static thread_local std::vector<Feature::Ptr> fts;
+    static thread_local std::vector<Feature::Ptr> ft_seeds;
+    observations.clear();
+
+    frame->getFeatures(fts);
+    const size_t N = fts.size();
+    observations.reserve(OPTIMAL_MPTS + N);
+    for(size_t i = 0; i < N; ++i)
+    {
+        const Feature::Ptr &ft = fts[i];
+        const MapPoint::Ptr &mpt = ft->mpt_;
+        if(mpt == nullptr)
+            continue;
+
+        MotionObservation ob;
+        ob.pose = mpt->pose();
+        ob.fn = ft->fn_.head<2>() / ft->fn_[2];
+        ob.weight = 1.0;
+        ob.max_error2 = TH_REPJ * (1 << ft->level_);
+        ob.index = (int)i;
+        ob.inlier = true;
+        observations.push_back(ob);
+    }
+
+    //! the same as motionOnlyBundleAdjustmentCeres
+    if(N < OPTIMAL_MPTS)
+    {
+        frame->getSeeds(ft_seeds);
+        const size_t needed = OPTIMAL_MPTS - N;
+        if(ft_seeds.size() > needed)
+        {
+            std::nth_element(ft_seeds.begin(), ft_seeds.begin()+needed, ft_seeds.end(),
+                             [](const Feature::Ptr &a, const Feature::Ptr &b)
+                             {
+                               return a->seed_->getInfoWeight() > b->seed_->getInfoWeight();
+                             });
+
+            ft_seeds.resize(needed);
+        }
+
+        for(const Feature::Ptr &ft : ft_seeds)
+        {
+            const Seed::Ptr &seed = ft->seed_;
+            if(seed == nullptr)
+                continue;
+
+            MotionObservation ob;
+            ob.pose.noalias() = seed->kf->Twc() * (seed->fn_ref / seed->getInvDepth());
+            ob.fn = seed->fn_ref.head<2>() / seed->fn_ref[2];
+            ob.weight = seed->getInfoWeight();
+            ob.max_error2 = -1;
+            ob.index = -1;
+            ob.inlier = true;
+            observations.push_back(ob);
+        }
     }
 
-    for(const KeyFrame::Ptr &kf : changed_keyframes)
+    SE3d Tcw = frame->Tcw();
+    double init_chi2, final_chi2;
+    int iters = motionOnlyGaussNewton(Tcw, observations, scale, MAX_ITERS, init_chi2, final_chi2, report & verbose);
+
+    if(reject)
     {
-        kf->updateConnections();
+        int remove_count = 0;
+        for(MotionObservation &ob : observations)
+        {
+            if(ob.max_error2 < 0)
+                continue;
+
+            const Vector3d p(Tcw * ob.pose);
+            const Vector2d residual(p.head<2>() / p[2] - ob.fn);
+            if(p[2] > 0 && residual.squaredNorm() <= ob.max_error2)
+                continue;
+
+            ob.inlier = false;
+            remove_count++;
+            frame->removeFeature(fts[ob.index]);
+        }
+
+        double chi2_unused;
+        iters += motionOnlyGaussNewton(Tcw, observations, scale, MAX_ITERS, chi2_unused, final_chi2, report & verbose);
+
+        LOG_IF(WARNING, report) << "[Optimizer] Motion-only BA removes " << remove_count << " points";
     }
 
+    //! update pose
+    frame->optimal_Tcw_ = Tcw;
+    frame->setTcw(Tcw);
+
+    //! the capacity is kept, but the features are not held until the next frame
+    fts.clear();
+    ft_seeds.clear();
+
     //! Report
     double t1 = (double)cv::getTickCount();
-    LOG_IF(INFO, report) << "[Optimizer] Finish local BA for KF: " << keyframe->id_ << "(" << keyframe->frame_id_ << ")"
-                         << ", KFs: " << actived_keyframes.size() << "(+" << fixed_keyframe.size() << ")"
-                         << ", Mpts: " << local_mappoints.size()
-                         << ", remove " << bad_mpts.size() << " bad mpts."
-                         << " (" << (t1-t0)/cv::getTickFrequency() << "ms)";
-
-    reportInfo<2>(problem, summary, report, verbose);
+    last_solve_info.iterations = iters;
+    last_solve_info.time_ms = (t1-t0)*1000/cv::getTickFrequency();
+    last_solve_info.build_ms = 0.0;
+    last_solve_info.aborted = false;
+    LOG_IF(INFO, report) << "[Optimizer] Motion-only BA for Frame " << frame->id_ << " with " << observations.size() << " observations"
+                         << ", chi2 changed from " << std::scientific << init_chi2 << " to " << final_chi2
+                         << ", iters: " << iters << ", time: " << std::fixed << (t1-t0)*1000/cv::getTickFrequency() << "ms";
 }
 
-void Optimizer::motionOnlyBundleAdjustment(const Frame::Ptr &frame, bool use_seeds, bool reject, bool report, bool verbose)
+void Optimizer::motionOnlyBundleAdjustmentCeres(const Frame::Ptr &frame, bool use_seeds, bool reject, bool report, bool verbose)
 {
     const double focus_length = MIN(frame->cam_->fx(), frame->cam_->fy());
     const double pixel_usigma = Config::imagePixelSigma()/focus_length;
@@ -253,12 +810,12 @@ void Optimizer::motionOnlyBundleAdjustment(const Frame::Ptr &frame, bool use_see
 
     ceres::Solver::Options options;
     ceres::Solver::Summary summary;
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-    options.trust_region_strategy_type = ceres::DOGLEG;
     options.minimizer_progress_to_stdout = report & verbose;
     options.max_linear_solver_iterations = 20;
+    setSolverOptions(Config::motionBAProfile(), 1, options);
 
     ceres::Solve(options, &problem, &summary);
+    setLastSolveInfo(summary);
 
     if(reject)
     {
@@ -277,6 +834,8 @@ void Optimizer::motionOnlyBundleAdjustment(const Frame::Ptr &frame, bool use_see
         }
 
         ceres::Solve(options, &problem, &summary);
+        last_solve_info.iterations += summary.num_successful_steps + summary.num_unsuccessful_steps;
+        last_solve_info.time_ms += summary.total_time_in_seconds * 1000;
 
         LOG_IF(WARNING, report) << "[Optimizer] Motion-only BA removes " << remove_count << " points";
     }
@@ -405,4 +964,233 @@ void Optimizer::refineMapPoint(const MapPoint::Ptr &mpt, int max_iter, bool repo
 #endif
 }
 
+//! flat arrays of the points to refine, the observations of point i are in [obs_start[i], obs_start[i+1]),
+//! and the poses of the keyframes are gathered once and shared by all the observations
+struct MapPointBatch
+{
+    std::vector<Vector3d, aligned_allocator<Vector3d> > points;
+    std::vector<int> obs_start;
+    std::vector<int> obs_kf;
+    std::vector<Vector2d, aligned_allocator<Vector2d> > obs_fn;
+    std::vector<uint8_t> obs_outlier;
+    std::vector<KeyFrame::Ptr> kfs;
+    std::vector<Matrix3d, aligned_allocator<Matrix3d> > kf_R;
+    std::vector<Vector3d, aligned_allocator<Vector3d> > kf_t;
+    std::vector<int> iterations;
+
+    void clear()
+    {
+        points.clear();
+        obs_start.clear();
+        obs_kf.clear();
+        obs_fn.clear();
+        obs_outlier.clear();
+        kfs.clear();
+        kf_R.clear();
+        kf_t.clear();
+        iterations.clear();
+    }
+};
+
+//! IRLS Gauss-Newton of one point with the 3x3 normal equations accumulated in scalars and solved in closed form,
+//! the observations are classified by the squared error on the normalized plane at the final position
+static int refineMapPointGaussNewton(MapPointBatch &batch, const int i, const double huber, const int max_iter, const double outlier_thr2)
+{
+    const double EPS = 1E-10;
+    const int begin = batch.obs_start[i];
+    const int end = batch.obs_start[i + 1];
+
+    Vector3d pw = batch.points[i];
+    Vector3d pw_last = pw;
+    double last_chi2 = std::numeric_limits<double>::max();
+
+    int iter = 0;
+    for(; iter < max_iter; ++iter)
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+        double b0 = 0, b1 = 0, b2 = 0;
+        double chi2 = 0;
+        for(int n = begin; n < end; ++n)
+        {
+            const Matrix3d &R = batch.kf_R[batch.obs_kf[n]];
+            const Vector3d pc(R * pw + batch.kf_t[batch.obs_kf[n]]);
+            if(pc[2] <= 0)
+                continue;
+
+            const double z_inv = 1.0 / pc[2];
+            const double u = pc[0] * z_inv;
+            const double v = pc[1] * z_inv;
+            const double ex = u - batch.obs_fn[n][0];
+            const double ey = v - batch.obs_fn[n][1];
+            const double e2 = ex * ex + ey * ey;
+
+            double w = 1.0;
+            if(e2 <= huber * huber)
+                chi2 += e2;
+            else
+            {
+                const double e = std::sqrt(e2);
+                w = huber / e;
+                chi2 += 2.0 * huber * e - huber * huber;
+            }
+
+            //! J = [1/z, 0, -x/z^2; 0, 1/z, -y/z^2] * R
+            const double jx0 = z_inv * (R(0,0) - u * R(2,0));
+            const double jx1 = z_inv * (R(0,1) - u * R(2,1));
+            const double jx2 = z_inv * (R(0,2) - u * R(2,2));
+            const double jy0 = z_inv * (R(1,0) - v * R(2,0));
+            const double jy1 = z_inv * (R(1,1) - v * R(2,1));
+            const double jy2 = z_inv * (R(1,2) - v * R(2,2));
+
+            a00 += w * (jx0 * jx0 + jy0 * jy0);
+            a01 += w * (jx0 * jx1 + jy0 * jy1);
+            a02 += w * (jx0 * jx2 + jy0 * jy2);
+            a11 += w * (jx1 * jx1 + jy1 * jy1);
+            a12 += w * (jx1 * jx2 + jy1 * jy2);
+            a22 += w * (jx2 * jx2 + jy2 * jy2);
+            b0 -= w * (jx0 * ex + jy0 * ey);
+            b1 -= w * (jx1 * ex + jy1 * ey);
+            b2 -= w * (jx2 * ex + jy2 * ey);
+        }
+
+        if(last_chi2 < chi2)
+        {
+            pw = pw_last;
+            break;
+        }
+        last_chi2 = chi2;
+
+        //! inverse of the symmetric matrix by the adjugate
+        const double c00 = a11 * a22 - a12 * a12;
+        const double c01 = a02 * a12 - a01 * a22;
+        const double c02 = a01 * a12 - a02 * a11;
+        const double det = a00 * c00 + a01 * c01 + a02 * c02;
+        if(det <= 0)
+            break;
+
+        const double c11 = a00 * a22 - a02 * a02;
+        const double c12 = a01 * a02 - a00 * a12;
+        const double c22 = a00 * a11 - a01 * a01;
+        const double det_inv = 1.0 / det;
+        const Vector3d dp(det_inv * (c00 * b0 + c01 * b1 + c02 * b2),
+                          det_inv * (c01 * b0 + c11 * b1 + c12 * b2),
+                          det_inv * (c02 * b0 + c12 * b1 + c22 * b2));
+
+        pw_last = pw;
+        pw.noalias() += dp;
+
+        if(dp.squaredNorm() <= EPS * EPS)
+        {
+            iter++;
+            break;
+        }
+    }
+
+    batch.points[i] = pw;
+    for(int n = begin; n < end; ++n)
+    {
+        const Vector3d pc(batch.kf_R[batch.obs_kf[n]] * pw + batch.kf_t[batch.obs_kf[n]]);
+        batch.obs_outlier[n] = pc[2] <= 0 || (pc.head<2>() / pc[2] - batch.obs_fn[n]).squaredNorm() >= outlier_thr2;
+    }
+
+    return iter;
+}
+
+void Optimizer::refineMapPoints(const std::vector<MapPoint::Ptr> &mpts, int max_iter, std::vector<std::vector<KeyFrame::Ptr> > *outliers, double outlier_thr, bool report)
+{
+    //! the buffers are kept by the calling thread, and the workers of the pool see them by the reference,
+    //! as a thread_local is never captured by the lambda
+    static thread_local MapPointBatch batch_buffer;
+    MapPointBatch &batch = batch_buffer;
+
+    double t0 = (double)cv::getTickCount();
+    const int N = (int)mpts.size();
+    batch.clear();
+    if(outliers)
+    {
+        outliers->resize(N);
+        for(std::vector<KeyFrame::Ptr> &outliers_i : *outliers)
+            outliers_i.clear();
+    }
+    batch.points.reserve(N);
+    batch.obs_start.reserve(N + 1);
+    batch.obs_start.push_back(0);
+
+    //! gather the points and the keyframes, which are locked only once here
+    std::unordered_map<KeyFrame::Ptr, int> kf_index;
+    MapPoint::Observations obs;
+    for(const MapPoint::Ptr &mpt : mpts)
+    {
+        mpt->getObservations(obs);
+        for(const auto &item : obs)
+        {
+            auto kf_itr = kf_index.find(item.first);
+            if(kf_itr == kf_index.end())
+            {
+                const SE3d Tcw = item.first->Tcw();
+                kf_itr = kf_index.emplace(item.first, (int)batch.kfs.size()).first;
+                batch.kfs.push_back(item.first);
+                batch.kf_R.push_back(Tcw.rotationMatrix());
+                batch.kf_t.push_back(Tcw.translation());
+            }
+
+            batch.obs_kf.push_back(kf_itr->second);
+            batch.obs_fn.push_back(item.second->fn_.head<2>());
+        }
+
+        batch.points.push_back(mpt->pose());
+        batch.obs_start.push_back((int)batch.obs_kf.size());
+    }
+    batch.obs_outlier.resize(batch.obs_kf.size());
+    batch.iterations.resize(N);
+
+    double t1 = (double)cv::getTickCount();
+
+    if(batch.kfs.empty())
+    {
+        batch.clear();
+        return;
+    }
+
+    const double focus_length = MIN(batch.kfs[0]->cam_->fx(), batch.kfs[0]->cam_->fy());
+    const double huber = Config::imagePixelSigma() / focus_length * 2;
+    const double outlier_thr2 = outliers ? outlier_thr : std::numeric_limits<double>::max();
+    ThreadPool::getInstance().parallelFor(ThreadPool::TASK_OPTIMIZATION, 0, N, [&](int i){
+        batch.iterations[i] = refineMapPointGaussNewton(batch, i, huber, max_iter, outlier_thr2);
+    }, 64);
+
+    double t2 = (double)cv::getTickCount();
+
+    if(outliers)
+    {
+        for(int i = 0; i < N; ++i)
+        {
+            std::vector<KeyFrame::Ptr> &outliers_i = (*outliers)[i];
+            for(int n = batch.obs_start[i]; n < batch.obs_start[i + 1]; ++n)
+            {
+                if(batch.obs_outlier[n])
+                    outliers_i.push_back(batch.kfs[batch.obs_kf[n]]);
+            }
+        }
+    }
+
+    int total_iterations = 0;
+    for(int i = 0; i < N; ++i)
+    {
+        mpts[i]->setPose(batch.points[i]);
+        total_iterations += batch.iterations[i];
+    }
+
+    //! the keyframes are not held until the next call
+    const size_t num_obs = batch.obs_kf.size();
+    batch.kfs.clear();
+
+    double t3 = (double)cv::getTickCount();
+    LOG_IF(INFO, report) << "[Optimizer] Refine " << N << " MapPoints with " << num_obs << " observations, "
+                         << "mean iterations: " << (double)total_iterations / MAX(N, 1)
+                         << ", time: " << (t3-t0)*1000/cv::getTickFrequency()
+                         << "ms (gather: " << (t1-t0)*1000/cv::getTickFrequency()
+                         << "ms, solve: " << (t2-t1)*1000/cv::getTickFrequency() << "ms)";
+}
+
 }
\ No newline at end of file
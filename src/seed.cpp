@@ -21,6 +21,17 @@ Seed::Seed(const KeyFrame::Ptr &kf, const Vector2d &px, const Vector3d &fn, cons
     assert(fn_ref[2] == 1);
 }
 
+Seed::Seed(const KeyFrame::Ptr &kf, const uint64_t id, const Vector2d &px, const Vector3d &fn, const int level, const State &state) :
+    id(id), kf(kf), fn_ref(fn), px_ref(px), level_ref(level),
+    a(state.a),
+    b(state.b),
+    mu(state.mu),
+    z_range(state.z_range),
+    sigma2(state.sigma2)
+{
+    assert(fn_ref[2] == 1);
+}
+
 double Seed::computeTau(
     const SE3d& T_ref_cur,
     const Vector3d& f,
@@ -73,7 +84,7 @@ double Seed::computeVar(const SE3d &T_cur_ref, const double z, const double delt
 
 void Seed::update(const double x, const double tau2)
 {
-    std::lock_guard<std::mutex> lock(mutex_seed_);
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
     double norm_scale = sqrt(sigma2 + tau2);
     if(std::isnan(norm_scale))
         return;
@@ -101,26 +112,46 @@ void Seed::update(const double x, const double tau2)
 
 bool Seed::checkConvergence()
 {
-    std::lock_guard<std::mutex> lock(mutex_seed_);
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
     return sigma2 / z_range < convergence_rate;
 }
 
 double Seed::getInvDepth()
 {
-    std::lock_guard<std::mutex> lock(mutex_seed_);
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
     return mu;
 }
 
 double Seed::getVariance()
 {
-    std::lock_guard<std::mutex> lock(mutex_seed_);
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
     return sigma2;
 }
 
+//! expected variance reduction by a new measurement with variance tau2, normalized by the range as convergence
+double Seed::getInfoGain(const double tau2)
+{
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
+    const double gain = sigma2 * sigma2 / (sigma2 + tau2) / z_range;
+    return std::isfinite(gain) ? gain : 0.0;
+}
+
 double Seed::getInfoWeight()
 {
-    std::lock_guard<std::mutex> lock(mutex_seed_);
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
     return MIN(convergence_rate * z_range/sigma2, 1.0);
 }
 
+Seed::State Seed::getState()
+{
+    std::lock_guard<CountingMutex> lock(mutex_seed_);
+    State state;
+    state.a = a;
+    state.b = b;
+    state.mu = mu;
+    state.z_range = z_range;
+    state.sigma2 = sigma2;
+    return state;
+}
+
 }
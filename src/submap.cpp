@@ -0,0 +1,82 @@
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "submap.hpp"
+
+namespace ssvo{
+
+SubmapFile::SubmapFile(const std::string &prefix) :
+    path_(prefix + "XXXXXX"), fd_(-1), size_(0), sealed_(false), data_(nullptr)
+{
+    //! never opens an existing file, which may be still mapped by another one
+    std::vector<char> path(path_.begin(), path_.end());
+    path.push_back('\0');
+    fd_ = ::mkstemp(path.data());
+    LOG_ASSERT(fd_ >= 0) << "Can not create the submap file: " << path_;
+    path_ = path.data();
+}
+
+SubmapFile::~SubmapFile()
+{
+    if(data_ != nullptr)
+        ::munmap(data_, size_);
+
+    if(fd_ >= 0)
+    {
+        ::close(fd_);
+        ::unlink(path_.c_str());
+    }
+}
+
+size_t SubmapFile::append(const std::vector<uchar> &data)
+{
+    LOG_ASSERT(!sealed_) << "The submap file is sealed: " << path_;
+
+    const size_t offset = size_;
+    size_t written = 0;
+    while(written < data.size())
+    {
+        const ssize_t n = ::write(fd_, data.data() + written, data.size() - written);
+        LOG_ASSERT(n > 0) << "Failed to write the submap file: " << path_;
+        written += n;
+    }
+
+    size_ += data.size();
+    return offset;
+}
+
+void SubmapFile::seal()
+{
+    if(sealed_)
+        return;
+
+    sealed_ = true;
+    if(size_ == 0)
+        return;
+
+    void *data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    LOG_ASSERT(data != MAP_FAILED) << "Failed to map the submap file: " << path_;
+    data_ = static_cast<uchar*>(data);
+}
+
+const uchar *SubmapFile::data(size_t offset) const
+{
+    LOG_ASSERT(sealed_ && offset < size_) << "Invalid offset " << offset << " in the submap file: " << path_;
+    return data_ + offset;
+}
+
+void SubmapFile::release()
+{
+    if(data_ != nullptr)
+        ::madvise(data_, size_, MADV_DONTNEED);
+}
+
+void SubmapFile::prefetch()
+{
+    if(data_ != nullptr)
+        ::madvise(data_, size_, MADV_WILLNEED);
+}
+
+}
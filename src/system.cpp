@@ -1,9 +1,12 @@
+#include <fstream>
+#include <cstring>
 #include "config.hpp"
 #include "system.hpp"
 #include "optimizer.hpp"
 #include "image_alignment.hpp"
 #include "feature_alignment.hpp"
 #include "time_tracing.hpp"
+#include "thread_pool.hpp"
 
 namespace ssvo{
 
@@ -49,10 +52,10 @@ System::System(std::string config_file, std::string calib_flie) :
     const int fast_min_threshold = Config::fastMinThreshold();
 
     fast_detector_ = FastDetector::create(width, height, image_border, nlevel, grid_size, grid_min_size, fast_max_threshold, fast_min_threshold);
-    feature_tracker_ = FeatureTracker::create(width, height, 20, image_border, true);
     initializer_ = Initializer::create(fast_detector_, true);
     mapper_ = LocalMapper::create(true, false);
-    DepthFilter::Callback depth_fliter_callback = std::bind(&LocalMapper::createFeatureFromSeed, mapper_, std::placeholders::_1);
+    feature_tracker_ = FeatureTracker::create(mapper_->map_, width, height, 20, image_border, true);
+    DepthFilter::Callback depth_fliter_callback = std::bind(&LocalMapper::insertConvergedSeed, mapper_, std::placeholders::_1);
     depth_filter_ = DepthFilter::create(fast_detector_, depth_fliter_callback, true);
     viewer_ = Viewer::create(mapper_->map_, cv::Size(width, height));
 
@@ -79,7 +82,9 @@ System::System(std::string config_file, std::string calib_flie) :
     TimeTracing::TraceNames log_names;
     log_names.push_back("frame_id");
     log_names.push_back("num_feature_reproj");
+    log_names.push_back("motion_ba_iters");
     log_names.push_back("stage");
+    log_names.push_back("locks");
 
     string trace_dir = Config::timeTracingDirectory();
     sysTrace.reset(new TimeTracing("ssvo_trace_system", trace_dir, time_names, log_names));
@@ -93,6 +98,8 @@ System::~System()
     depth_filter_->stopMainThread();
     mapper_->stopMainThread();
 
+    ThreadPool::getInstance().logStats();
+
     viewer_->waitForFinish();
 }
 
@@ -100,6 +107,7 @@ void System::process(const cv::Mat &image, const double timestamp)
 {
     sysTrace->startTimer("total");
     sysTrace->startTimer("frame_create");
+    const uint64_t locks_before = CountingMutex::acquisitions();
     //! get gray image
     double t0 = (double)cv::getTickCount();
     rgb_ = image;
@@ -128,6 +136,11 @@ void System::process(const cv::Mat &image, const double timestamp)
     }
     sysTrace->stopTimer("processing");
 
+    //! the locks of the frames, keyframes, map points, seeds and the map taken by this thread
+    const uint64_t locks = CountingMutex::acquisitions() - locks_before;
+    sysTrace->log("locks", locks);
+    LOG(WARNING) << "[System] Frame " << current_frame_->id_ << " locks: " << locks;
+
     finishFrame();
 }
 
@@ -169,6 +182,10 @@ System::Status System::initialize()
 
 System::Status System::tracking()
 {
+    //! the reference keyframe may be culled by the mapper, while the last one never is
+    if(reference_keyframe_->isBad())
+        reference_keyframe_ = last_keyframe_;
+
     current_frame_->setRefKeyFrame(reference_keyframe_);
 
     //! track seeds
@@ -197,6 +214,7 @@ System::Status System::tracking()
     sysTrace->startTimer("motion_ba");
     Optimizer::motionOnlyBundleAdjustment(current_frame_, false, false, true);
     sysTrace->stopTimer("motion_ba");
+    sysTrace->log("motion_ba_iters", Optimizer::lastSolveInfo().iterations);
 
     sysTrace->startTimer("per_depth_filter");
     if(createNewKeyFrame())
@@ -216,7 +234,6 @@ System::Status System::tracking()
 
     //！ save frame pose
     frame_timestamp_buffer_.push_back(current_frame_->timestamp_);
-    reference_keyframe_buffer_.push_back(current_frame_->getRefKeyFrame());
     frame_pose_buffer_.push_back(current_frame_->pose());//current_frame_->getRefKeyFrame()->Tcw() * current_frame_->pose());
 
     return STATUS_TRACKING_GOOD;
@@ -362,18 +379,14 @@ bool System::createNewKeyFrame()
 
         std::vector<float> disparity;
         disparity.reserve(ovlp_kf.second);
-        std::vector<MapPoint::Ptr> mpts = ovlp_kf.first->getMapPoints();
-        for(const MapPoint::Ptr &mpt : mpts)
-        {
-            Feature::Ptr ft_ref = mpt->findObservation(ovlp_kf.first);
-            if(ft_ref == nullptr) continue;
-
-            if(!mpt_ft.count(mpt)) continue;
-            Feature::Ptr ft_cur = mpt_ft.find(mpt)->second;
+        ovlp_kf.first->forEachFeature([&](const MapPoint::Ptr &mpt, const Feature::Ptr &ft_ref){
+            const auto it = mpt_ft.find(mpt);
+            if(it == mpt_ft.end()) return;
+            const Feature::Ptr &ft_cur = it->second;
 
             const Vector2d px(ft_ref->px_ - ft_cur->px_);
             disparity.push_back(px.norm());
-        }
+        });
 
         std::sort(disparity.begin(), disparity.end());
         float disp = disparity.at(disparity.size()/2);
@@ -469,6 +482,409 @@ void System::finishFrame()
 
 }
 
+//! The checkpoint file is in the byte order of the host: a header, the trajectory, the seeds of the keyframes,
+//! and then the last frame with its image and features. The map is in the map file beside it.
+const uint32_t System::CHECKPOINT_VERSION = 1;
+
+static const char CHECKPOINT_MAGIC[8] = {'S', 'S', 'V', 'O', 'C', 'K', 'P', '\0'};
+static const uint64_t CHECKPOINT_NONE = std::numeric_limits<uint64_t>::max();
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t stage;
+    int32_t status;
+    float light_affine_a;
+    float light_affine_b;
+    uint32_t has_last_frame;
+    uint64_t next_frame_id;
+    uint64_t next_kf_id;
+    uint64_t next_mpt_id;
+    uint64_t next_seed_id;
+    uint64_t reference_kf;
+    uint64_t last_kf;
+    uint64_t num_poses;
+    uint64_t num_seeds;
+};
+
+struct CheckpointPose
+{
+    double timestamp;
+    double rotation[4];     //!< quaternion in the order of x, y, z, w
+    double translation[3];
+};
+
+struct CheckpointSeed
+{
+    uint64_t id;
+    uint64_t kf;
+    double px[2];
+    double fn[3];
+    int32_t level;
+    uint32_t reserved;
+    Seed::State state;
+};
+
+struct CheckpointFrame
+{
+    uint64_t id;
+    uint64_t ref_kf;
+    double timestamp;
+    double disparity;
+    double rotation[4];     //!< Tcw
+    double translation[3];
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t num_features;
+    uint32_t num_seeds;
+};
+
+//! the feature of the last frame, on the map point or the seed of the id
+struct CheckpointFeature
+{
+    uint64_t id;
+    double px[2];
+    double fn[3];
+    int32_t level;
+    uint32_t reserved;
+};
+
+static inline void poseToCheckpoint(const SE3d &pose, double rotation[4], double translation[3])
+{
+    const Quaterniond q = pose.unit_quaternion();
+    rotation[0] = q.x();
+    rotation[1] = q.y();
+    rotation[2] = q.z();
+    rotation[3] = q.w();
+    for(int k = 0; k < 3; ++k)
+        translation[k] = pose.translation()[k];
+}
+
+static inline SE3d poseFromCheckpoint(const double rotation[4], const double translation[3])
+{
+    const Quaterniond q(rotation[3], rotation[0], rotation[1], rotation[2]);
+    return SE3d(q.normalized(), Vector3d(translation[0], translation[1], translation[2]));
+}
+
+static inline CheckpointFeature featureToCheckpoint(const uint64_t id, const Feature::Ptr &ft)
+{
+    CheckpointFeature record;
+    std::memset(&record, 0, sizeof(record));
+    record.id = id;
+    record.px[0] = ft->px_[0];
+    record.px[1] = ft->px_[1];
+    for(int k = 0; k < 3; ++k)
+        record.fn[k] = ft->fn_[k];
+    record.level = ft->level_;
+    return record;
+}
+
+template<typename T>
+static inline void writeCheckpoint(std::ofstream &file, const T *data, size_t num)
+{
+    file.write(reinterpret_cast<const char*>(data), num * sizeof(T));
+}
+
+template<typename T>
+static inline bool readCheckpoint(std::ifstream &file, T *data, size_t num)
+{
+    return (bool) file.read(reinterpret_cast<char*>(data), num * sizeof(T));
+}
+
+bool System::checkpoint(const std::string &file_name)
+{
+    double t0 = (double)cv::getTickCount();
+    //! no frame is inserted during the checkpoint, so nothing is changed by the threads once they are idle
+    depth_filter_->waitForIdle();
+    mapper_->waitForIdle();
+    double t1 = (double)cv::getTickCount();
+
+    if(!mapper_->map_->save(file_name + ".map"))
+        return false;
+
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.stage = stage_;
+    header.status = status_;
+    header.light_affine_a = Frame::light_affine_a_;
+    header.light_affine_b = Frame::light_affine_b_;
+    header.has_last_frame = last_frame_ != nullptr;
+    header.next_frame_id = Frame::next_id_;
+    header.next_kf_id = KeyFrame::next_id_;
+    header.next_mpt_id = MapPoint::next_id_;
+    header.next_seed_id = Seed::next_id;
+    header.reference_kf = reference_keyframe_ ? reference_keyframe_->id_ : CHECKPOINT_NONE;
+    header.last_kf = last_keyframe_ ? last_keyframe_->id_ : CHECKPOINT_NONE;
+
+    std::vector<CheckpointPose> poses(frame_timestamp_buffer_.size());
+    auto pose_itr = frame_pose_buffer_.begin();
+    auto timestamp_itr = frame_timestamp_buffer_.begin();
+    for(size_t i = 0; i < poses.size(); ++i, ++pose_itr, ++timestamp_itr)
+    {
+        poses[i].timestamp = *timestamp_itr;
+        poseToCheckpoint(*pose_itr, poses[i].rotation, poses[i].translation);
+    }
+    header.num_poses = poses.size();
+
+    //! the seeds are held by their keyframes, only those of the keyframes in the map file are kept
+    std::vector<CheckpointSeed> seeds;
+    std::unordered_set<Seed::Ptr> seeds_saved;
+    for(const KeyFrame::Ptr &kf : mapper_->map_->getAllKeyFrames())
+    {
+        if(kf->isBad())
+            continue;
+
+        for(const Feature::Ptr &ft : kf->getSeeds())
+        {
+            const Seed::Ptr &seed = ft->seed_;
+            if(seed == nullptr || !seeds_saved.insert(seed).second)
+                continue;
+
+            CheckpointSeed record;
+            std::memset(&record, 0, sizeof(record));
+            record.id = seed->id;
+            record.kf = kf->id_;
+            record.px[0] = seed->px_ref[0];
+            record.px[1] = seed->px_ref[1];
+            for(int k = 0; k < 3; ++k)
+                record.fn[k] = seed->fn_ref[k];
+            record.level = seed->level_ref;
+            record.state = seed->getState();
+            seeds.push_back(record);
+        }
+    }
+    header.num_seeds = seeds.size();
+
+    //! the last frame is tracked by the next one, with its features and the seeds tracked on it
+    CheckpointFrame frame_record;
+    std::memset(&frame_record, 0, sizeof(frame_record));
+    std::vector<CheckpointFeature> frame_fts;
+    cv::Mat frame_image;
+    if(last_frame_)
+    {
+        const KeyFrame::Ptr ref_kf = last_frame_->getRefKeyFrame();
+        frame_record.id = last_frame_->id_;
+        frame_record.ref_kf = ref_kf ? ref_kf->id_ : CHECKPOINT_NONE;
+        frame_record.timestamp = last_frame_->timestamp_;
+        frame_record.disparity = last_frame_->disparity_;
+        poseToCheckpoint(last_frame_->Tcw(), frame_record.rotation, frame_record.translation);
+
+        frame_image = last_frame_->getImage(0);
+        if(!frame_image.isContinuous())
+            frame_image = frame_image.clone();
+        frame_record.rows = (uint32_t) frame_image.rows;
+        frame_record.cols = (uint32_t) frame_image.cols;
+
+        for(const Feature::Ptr &ft : last_frame_->getFeatures())
+        {
+            if(ft->mpt_ && !ft->mpt_->isBad())
+                frame_fts.push_back(featureToCheckpoint(ft->mpt_->id_, ft));
+        }
+        frame_record.num_features = (uint32_t) frame_fts.size();
+
+        for(const Feature::Ptr &ft : last_frame_->getSeeds())
+        {
+            if(seeds_saved.count(ft->seed_))
+                frame_fts.push_back(featureToCheckpoint(ft->seed_->id, ft));
+        }
+        frame_record.num_seeds = (uint32_t) frame_fts.size() - frame_record.num_features;
+    }
+
+    std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+    {
+        LOG(ERROR) << "[System] Can not create the checkpoint file: " << file_name;
+        return false;
+    }
+
+    writeCheckpoint(file, &header, 1);
+    writeCheckpoint(file, poses.data(), poses.size());
+    writeCheckpoint(file, seeds.data(), seeds.size());
+    if(last_frame_)
+    {
+        writeCheckpoint(file, &frame_record, 1);
+        writeCheckpoint(file, frame_image.data, frame_image.total() * frame_image.elemSize());
+        writeCheckpoint(file, frame_fts.data(), frame_fts.size());
+    }
+
+    file.close();
+    if(!file)
+    {
+        LOG(ERROR) << "[System] Failed to write the checkpoint file: " << file_name;
+        return false;
+    }
+
+    double t2 = (double)cv::getTickCount();
+    LOG(WARNING) << "[System] Checkpoint " << file_name << " with " << mapper_->map_->KeyFramesInMap() << " keyframes, "
+                 << seeds.size() << " seeds, wait time: " << (t1-t0)/cv::getTickFrequency()
+                 << ", save time: " << (t2-t1)/cv::getTickFrequency();
+
+    return true;
+}
+
+bool System::resume(const std::string &file_name)
+{
+    double t0 = (double)cv::getTickCount();
+    depth_filter_->waitForIdle();
+    mapper_->waitForIdle();
+
+    std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+    if(!file.is_open())
+    {
+        LOG(ERROR) << "[System] Can not open the checkpoint file: " << file_name;
+        return false;
+    }
+    const uint64_t file_size = (uint64_t) file.tellg();
+    file.seekg(0);
+
+    CheckpointHeader header;
+    if(!readCheckpoint(file, &header, 1) || std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0)
+    {
+        LOG(ERROR) << "[System] Invalid checkpoint file: " << file_name;
+        return false;
+    }
+
+    if(header.version != CHECKPOINT_VERSION)
+    {
+        LOG(ERROR) << "[System] The version of the checkpoint file is " << header.version << ", but " << CHECKPOINT_VERSION << " is supported: " << file_name;
+        return false;
+    }
+
+    //! read all the records before anything is changed
+    bool valid = header.stage >= STAGE_INITALIZE && header.stage <= STAGE_RELOCALIZING &&
+        (header.stage == STAGE_INITALIZE || (header.has_last_frame && header.reference_kf != CHECKPOINT_NONE && header.last_kf != CHECKPOINT_NONE)) &&
+        header.num_poses <= file_size / sizeof(CheckpointPose) && header.num_seeds <= file_size / sizeof(CheckpointSeed);
+
+    std::vector<CheckpointPose> poses;
+    std::vector<CheckpointSeed> seeds;
+    if(valid)
+    {
+        poses.resize(header.num_poses);
+        seeds.resize(header.num_seeds);
+        valid = readCheckpoint(file, poses.data(), poses.size()) && readCheckpoint(file, seeds.data(), seeds.size());
+    }
+
+    CheckpointFrame frame_record;
+    cv::Mat frame_image;
+    std::vector<CheckpointFeature> frame_fts;
+    if(valid && header.has_last_frame)
+    {
+        valid = readCheckpoint(file, &frame_record, 1) &&
+            frame_record.rows == (uint32_t) camera_->height() && frame_record.cols == (uint32_t) camera_->width() &&
+            ((uint64_t) frame_record.num_features + frame_record.num_seeds) <= file_size / sizeof(CheckpointFeature);
+        if(valid)
+        {
+            frame_image = cv::Mat(frame_record.rows, frame_record.cols, CV_8UC1);
+            frame_fts.resize((size_t) frame_record.num_features + frame_record.num_seeds);
+            valid = readCheckpoint(file, frame_image.data, frame_image.total()) && readCheckpoint(file, frame_fts.data(), frame_fts.size());
+        }
+    }
+
+    if(!valid)
+    {
+        LOG(ERROR) << "[System] Invalid checkpoint file: " << file_name;
+        return false;
+    }
+
+    const Map::Ptr &map = mapper_->map_;
+    if(!map->load(file_name + ".map", camera_))
+        return false;
+    Optimizer::releaseLocalBAProblem();
+    mapper_->resetDatabase();
+    double t1 = (double)cv::getTickCount();
+
+    std::unordered_map<uint64_t, MapPoint::Ptr> mpts;
+    for(const MapPoint::Ptr &mpt : map->getAllMapPoints())
+        mpts.emplace(mpt->id_, mpt);
+
+    //! the seeds go back to their keyframes, where the depth filter finds them
+    std::unordered_map<uint64_t, Seed::Ptr> seeds_restored;
+    for(const CheckpointSeed &record : seeds)
+    {
+        const KeyFrame::Ptr kf = map->getKeyFrame(record.kf);
+        if(kf == nullptr)
+            continue;
+
+        const Vector2d px(record.px[0], record.px[1]);
+        const Vector3d fn(record.fn[0], record.fn[1], record.fn[2]);
+        Seed::Ptr seed = Seed::create(kf, record.id, px, fn, record.level, record.state);
+        kf->addSeed(Feature::create(px, record.level, seed));
+        seeds_restored.emplace(record.id, seed);
+    }
+
+    frame_timestamp_buffer_.clear();
+    frame_pose_buffer_.clear();
+    for(const CheckpointPose &pose : poses)
+    {
+        frame_timestamp_buffer_.push_back(pose.timestamp);
+        frame_pose_buffer_.push_back(poseFromCheckpoint(pose.rotation, pose.translation));
+    }
+
+    reference_keyframe_ = header.reference_kf == CHECKPOINT_NONE ? nullptr : map->getKeyFrame(header.reference_kf);
+    last_keyframe_ = header.last_kf == CHECKPOINT_NONE ? nullptr : map->getKeyFrame(header.last_kf);
+
+    last_frame_ = nullptr;
+    if(header.has_last_frame)
+    {
+        //! created again with the id saved, and the pyramids are built from the image
+        Frame::next_id_ = frame_record.id;
+        last_frame_ = Frame::create(frame_image, frame_record.timestamp, camera_);
+        last_frame_->setTcw(poseFromCheckpoint(frame_record.rotation, frame_record.translation));
+        last_frame_->disparity_ = frame_record.disparity;
+        if(frame_record.ref_kf != CHECKPOINT_NONE)
+            last_frame_->setRefKeyFrame(map->getKeyFrame(frame_record.ref_kf));
+
+        for(size_t i = 0; i < frame_fts.size(); ++i)
+        {
+            const CheckpointFeature &record = frame_fts[i];
+            const Vector2d px(record.px[0], record.px[1]);
+            if(i < frame_record.num_features)
+            {
+                const auto it = mpts.find(record.id);
+                if(it != mpts.end())
+                    last_frame_->addFeature(Feature::create(px, Vector3d(record.fn[0], record.fn[1], record.fn[2]), record.level, it->second));
+            }
+            else
+            {
+                const auto it = seeds_restored.find(record.id);
+                if(it != seeds_restored.end())
+                    last_frame_->addSeed(Feature::create(px, record.level, it->second));
+            }
+        }
+    }
+    current_frame_ = last_frame_;
+
+    //! the new objects never take the ids in the checkpoint
+    Frame::next_id_ = MAX(Frame::next_id_, header.next_frame_id);
+    KeyFrame::next_id_ = MAX(KeyFrame::next_id_, header.next_kf_id);
+    MapPoint::next_id_ = MAX(MapPoint::next_id_, header.next_mpt_id);
+    Seed::next_id = MAX(Seed::next_id, header.next_seed_id);
+    Frame::light_affine_a_ = header.light_affine_a;
+    Frame::light_affine_b_ = header.light_affine_b;
+
+    stage_ = (Stage) header.stage;
+    status_ = (Status) header.status;
+    initializer_->reset();
+
+    if(stage_ != STAGE_INITALIZE && (reference_keyframe_ == nullptr || last_keyframe_ == nullptr))
+    {
+        LOG(ERROR) << "[System] The keyframes of the checkpoint are not in the map, initialize again";
+        stage_ = STAGE_INITALIZE;
+        status_ = STATUS_INITAL_RESET;
+        return false;
+    }
+
+    double t2 = (double)cv::getTickCount();
+    LOG(WARNING) << "[System] Resume " << file_name << " with " << map->KeyFramesInMap() << " keyframes, "
+                 << seeds_restored.size() << " seeds, stage: " << stage_ << ", map load time: " << (t1-t0)/cv::getTickFrequency()
+                 << ", total time: " << (t2-t0)/cv::getTickFrequency();
+
+    return true;
+}
+
 void System::saveTrajectoryTUM(const std::string &file_name)
 {
     std::ofstream f;
@@ -477,11 +893,10 @@ void System::saveTrajectoryTUM(const std::string &file_name)
 
     std::list<double>::iterator frame_timestamp_ptr = frame_timestamp_buffer_.begin();
     std::list<Sophus::SE3d>::iterator frame_pose_ptr = frame_pose_buffer_.begin();
-    std::list<KeyFrame::Ptr>::iterator reference_keyframe_ptr = reference_keyframe_buffer_.begin();
     const std::list<double>::iterator frame_timestamp = frame_timestamp_buffer_.end();
-    for(; frame_timestamp_ptr!= frame_timestamp; frame_timestamp_ptr++, frame_pose_ptr++, reference_keyframe_ptr++)
+    for(; frame_timestamp_ptr!= frame_timestamp; frame_timestamp_ptr++, frame_pose_ptr++)
     {
-        Sophus::SE3d frame_pose = (*frame_pose_ptr);//(*reference_keyframe_ptr)->Twc() * (*frame_pose_ptr);
+        Sophus::SE3d frame_pose = (*frame_pose_ptr);
         Vector3d t = frame_pose.translation();
         Quaterniond q = frame_pose.unit_quaternion();
 
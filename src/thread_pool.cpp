@@ -0,0 +1,281 @@
+#include "config.hpp"
+#include "thread_pool.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+namespace ssvo{
+
+//! the worker index of current thread, -1 for threads not belong to the pool
+static thread_local int local_worker_id = -1;
+
+ThreadPool& ThreadPool::getInstance()
+{
+    static ThreadPool instance(Config::threadPoolSize(), Config::threadPoolAffinity());
+    return instance;
+}
+
+ThreadPool::ThreadPool(int num_threads, const std::vector<int> &cpu_affinity) :
+    stop_(false), next_worker_(0), pending_(0), sleeping_(0)
+{
+    if(num_threads <= 0)
+        num_threads = MAX((int)std::thread::hardware_concurrency(), 1);
+
+    for(AtomicStats &stats : stats_)
+    {
+        stats.submitted = 0;
+        stats.finished = 0;
+        stats.stolen = 0;
+        stats.queued = 0;
+        stats.max_queued = 0;
+        stats.total_wait_us = 0;
+        stats.total_run_us = 0;
+    }
+
+    workers_.reserve(num_threads);
+    for(int i = 0; i < num_threads; ++i)
+        workers_.emplace_back(new Worker);
+
+    //! start after all the workers created, as they would steal from each other
+    for(int i = 0; i < num_threads; ++i)
+    {
+        workers_[i]->thread = std::thread(&ThreadPool::workerLoop, this, (size_t)i);
+        if(!cpu_affinity.empty())
+        {
+            const int cpu = cpu_affinity[i % cpu_affinity.size()];
+            LOG_IF(WARNING, !setAffinity(workers_[i]->thread, cpu)) << "[Pool] Failed to bind worker " << i << " to cpu " << cpu;
+        }
+    }
+
+    LOG(INFO) << "[Pool] Start thread pool with " << num_threads << " workers";
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop_ = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_sleep_);
+        cond_sleep_.notify_all();
+    }
+
+    for(auto &worker : workers_)
+    {
+        if(worker->thread.joinable())
+            worker->thread.join();
+    }
+}
+
+bool ThreadPool::setAffinity(std::thread &thread, int cpu)
+{
+#ifdef __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return 0 == pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+#else
+    return false;
+#endif
+}
+
+void ThreadPool::enqueue(Task &&task)
+{
+    task.submit_time = std::chrono::steady_clock::now();
+
+    AtomicStats &stats = stats_[task.type];
+    stats.submitted++;
+    const int64_t queued = ++stats.queued;
+    int64_t max_queued = stats.max_queued.load();
+    while(queued > max_queued && !stats.max_queued.compare_exchange_weak(max_queued, queued));
+
+    //! keep the task local if submitted by a worker
+    const size_t id = local_worker_id >= 0 ? (size_t)local_worker_id : next_worker_++ % workers_.size();
+    {
+        Worker &worker = *workers_[id];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    pending_++;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleeping_.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex_sleep_);
+        cond_sleep_.notify_one();
+    }
+}
+
+bool ThreadPool::popTask(size_t id, Task &task)
+{
+    //! LIFO for own tasks
+    {
+        Worker &worker = *workers_[id];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if(!worker.tasks.empty())
+        {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            pending_--;
+            return true;
+        }
+    }
+
+    //! FIFO for stealing
+    const size_t N = workers_.size();
+    for(size_t i = 1; i < N; ++i)
+    {
+        Worker &victim = *workers_[(id + i) % N];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if(!lock.owns_lock() || victim.tasks.empty())
+            continue;
+
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        pending_--;
+        stats_[task.type].stolen++;
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::runTask(Task &task)
+{
+    AtomicStats &stats = stats_[task.type];
+    stats.queued--;
+
+    const auto start = std::chrono::steady_clock::now();
+    task.func();
+    const auto end = std::chrono::steady_clock::now();
+
+    stats.total_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(start - task.submit_time).count();
+    stats.total_run_us += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    stats.finished++;
+}
+
+void ThreadPool::workerLoop(size_t id)
+{
+    local_worker_id = (int)id;
+
+    while(true)
+    {
+        Task task;
+        if(popTask(id, task))
+        {
+            runTask(task);
+            continue;
+        }
+
+        //! all queued tasks are finished before exit
+        if(stop_)
+            break;
+
+        std::unique_lock<std::mutex> lock(mutex_sleep_);
+        sleeping_++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cond_sleep_.wait(lock, [this]{ return pending_.load() > 0 || stop_.load(); });
+        sleeping_--;
+    }
+}
+
+void ThreadPool::parallelFor(TaskType type, int begin, int end, const std::function<void (int)> &func, int grain_size)
+{
+    if(end <= begin)
+        return;
+
+    grain_size = MAX(grain_size, 1);
+    const int chunks = (end - begin + grain_size - 1) / grain_size;
+    const int helpers = MIN(chunks, (int)workers_.size() + 1) - 1;
+    if(helpers <= 0)
+    {
+        for(int i = begin; i < end; ++i)
+            func(i);
+        return;
+    }
+
+    struct Range
+    {
+        std::atomic<int> next;
+        std::atomic<int> done;
+    };
+
+    //! the helpers might start after this function returned, so they should not touch func if no chunk left
+    std::shared_ptr<Range> range = std::make_shared<Range>();
+    range->next = 0;
+    range->done = 0;
+    auto process = [range, chunks, begin, end, grain_size, &func]()
+    {
+        int chunk;
+        while((chunk = range->next++) < chunks)
+        {
+            const int start = begin + chunk * grain_size;
+            const int stop = MIN(start + grain_size, end);
+            for(int i = start; i < stop; ++i)
+                func(i);
+            range->done++;
+        }
+    };
+
+    for(int i = 0; i < helpers; ++i)
+    {
+        Task task;
+        task.func = process;
+        task.type = type;
+        enqueue(std::move(task));
+    }
+
+    process();
+
+    //! the rest chunks are running in other workers
+    while(range->done.load() < chunks)
+        std::this_thread::yield();
+}
+
+ThreadPool::TaskStats ThreadPool::getStats(TaskType type) const
+{
+    const AtomicStats &stats = stats_[type];
+    TaskStats result;
+    result.submitted = stats.submitted.load();
+    result.finished = stats.finished.load();
+    result.stolen = stats.stolen.load();
+    result.queued = stats.queued.load();
+    result.max_queued = stats.max_queued.load();
+    result.total_wait_ms = stats.total_wait_us.load() * 1e-3;
+    result.total_run_ms = stats.total_run_us.load() * 1e-3;
+    return result;
+}
+
+void ThreadPool::logStats() const
+{
+    for(int i = 0; i < TASK_TYPE_SIZE; ++i)
+    {
+        const TaskStats stats = getStats((TaskType)i);
+        if(stats.submitted == 0)
+            continue;
+
+        const double finished = MAX(stats.finished, (uint64_t)1);
+        LOG(WARNING) << "[Pool] " << std::setw(12) << taskName((TaskType)i)
+                     << " submitted: " << stats.submitted
+                     << ", finished: " << stats.finished
+                     << ", stolen: " << stats.stolen
+                     << ", queued: " << stats.queued << "(max " << stats.max_queued << ")"
+                     << ", avg wait: " << stats.total_wait_ms / finished << "ms"
+                     << ", avg run: " << stats.total_run_ms / finished << "ms";
+    }
+}
+
+const char* ThreadPool::taskName(TaskType type)
+{
+    switch(type)
+    {
+    case TASK_GENERAL: return "general";
+    case TASK_DEPTH_FILTER: return "depth_filter";
+    case TASK_MAPPING: return "mapping";
+    case TASK_TRACKING: return "tracking";
+    case TASK_DETECTION: return "detection";
+    case TASK_OPTIMIZATION: return "optimization";
+    default: return "unknown";
+    }
+}
+
+}
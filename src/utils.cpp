@@ -1,5 +1,6 @@
 #include <opencv2/opencv.hpp>
 #include "utils.hpp"
+#include "thread_pool.hpp"
 
 namespace ssvo {
 
@@ -290,6 +291,240 @@ bool Fundamental::runRANSAC(const std::vector<cv::Point2d>& fts_prev, const std:
     return true;
 }
 
+//! bilinear sampling of a size x size patch whose top-left corner is (x, y)
+inline bool samplePatch(const cv::Mat &img, const float x, const float y, const int size, float *patch)
+{
+    const int ix = static_cast<int>(std::floor(x));
+    const int iy = static_cast<int>(std::floor(y));
+    if(ix < 0 || iy < 0 || ix + size >= img.cols || iy + size >= img.rows)
+        return false;
+
+    const float sx = x - ix;
+    const float sy = y - iy;
+    const float w_tl = (1.0f - sx) * (1.0f - sy);
+    const float w_tr = sx * (1.0f - sy);
+    const float w_bl = (1.0f - sx) * sy;
+    const float w_br = sx * sy;
+    const int stride = img.step.p[0];
+    for(int r = 0; r < size; ++r)
+    {
+        const uchar *ptr = img.ptr<uchar>(iy + r) + ix;
+        for(int c = 0; c < size; ++c, ++ptr)
+            *patch++ = w_tl * ptr[0] + w_tr * ptr[1] + w_bl * ptr[stride] + w_br * ptr[stride + 1];
+    }
+
+    return true;
+}
+
+//! track one point from top level to level 0, px_cur is the inital guess in level 0
+//! the residual is the mean absolute zero-mean photometric error in level 0 at the returned px_cur, computed only if it is given
+static bool kltTrackPointIC(const ImgPyr &imgs_ref, const ImgPyr &imgs_cur, const int win_size,
+                     const Vector2f &px_ref, Vector2f &px_cur, const int max_iterations, const float epsilon2, float *residual)
+{
+    const int size = win_size;
+    const int size_with_border = size + 2;
+    const int area = size * size;
+    const float half = 0.5f * (size - 1);
+
+    //! reusable buffers for each thread
+    static thread_local std::vector<float> template_buffer;
+    static thread_local std::vector<float> gradient_buffer;
+    static thread_local std::vector<float> patch_buffer;
+    template_buffer.resize(size_with_border * size_with_border);
+    gradient_buffer.resize(2 * area);
+    patch_buffer.resize(area);
+    float *temp = template_buffer.data();
+    float *grad = gradient_buffer.data();
+    float *patch = patch_buffer.data();
+
+    const int nlevels = (int) MIN(imgs_ref.size(), imgs_cur.size());
+    Vector2f estimate = px_cur / (1 << (nlevels - 1));
+    float last_step2 = 0;
+    for(int level = nlevels - 1; level >= 0; --level)
+    {
+        const float scale = 1.0f / (1 << level);
+        const cv::Mat &img_ref = imgs_ref[level];
+        const cv::Mat &img_cur = imgs_cur[level];
+        const Vector2f ref = px_ref * scale;
+
+        //! the point is near the border in the top levels, try the next level
+        if(!samplePatch(img_ref, ref[0] - half - 1, ref[1] - half - 1, size_with_border, temp))
+        {
+            if(level == 0)
+                return false;
+            estimate *= 2;
+            continue;
+        }
+
+        //! precompute the template gradients and the Hessian, the brightness offset is eliminated by Schur complement
+        Matrix2f H = Matrix2f::Zero();
+        Vector2f g_sum = Vector2f::Zero();
+        for(int r = 0, i = 0; r < size; ++r)
+        {
+            const float *row = temp + (r + 1) * size_with_border + 1;
+            for(int c = 0; c < size; ++c, ++i)
+            {
+                const float gx = 0.5f * (row[c + 1] - row[c - 1]);
+                const float gy = 0.5f * (row[c + size_with_border] - row[c - size_with_border]);
+                grad[2 * i] = gx;
+                grad[2 * i + 1] = gy;
+                H(0, 0) += gx * gx;
+                H(0, 1) += gx * gy;
+                H(1, 1) += gy * gy;
+                g_sum[0] += gx;
+                g_sum[1] += gy;
+            }
+        }
+        H(1, 0) = H(0, 1);
+        H.noalias() -= g_sum * g_sum.transpose() / area;
+
+        const float det = H.determinant();
+        if(det < std::numeric_limits<float>::epsilon() * area * area)
+            return false;
+        const Matrix2f H_inv = H.inverse();
+
+        for(int iter = 0; iter < max_iterations; ++iter)
+        {
+            if(!samplePatch(img_cur, estimate[0] - half, estimate[1] - half, size, patch))
+                return false;
+
+            Vector2f b = Vector2f::Zero();
+            float r_sum = 0;
+            for(int r = 0, i = 0; r < size; ++r)
+            {
+                const float *row = temp + (r + 1) * size_with_border + 1;
+                for(int c = 0; c < size; ++c, ++i)
+                {
+                    const float res = patch[i] - row[c];
+                    b[0] += grad[2 * i] * res;
+                    b[1] += grad[2 * i + 1] * res;
+                    r_sum += res;
+                }
+            }
+            const float r_mean = r_sum / area;
+            b.noalias() -= g_sum * r_mean;
+
+            const Vector2f delta = H_inv * b;
+            estimate -= delta;
+
+            last_step2 = delta.squaredNorm();
+            if(last_step2 < epsilon2)
+                break;
+        }
+
+        if(level > 0)
+            estimate *= 2;
+    }
+
+    px_cur = estimate;
+
+    //! the patch is sampled again after the last update, and the template is still the one of level 0
+    if(residual)
+    {
+        if(!samplePatch(imgs_cur[0], estimate[0] - half, estimate[1] - half, size, patch))
+            return false;
+
+        float r_sum = 0;
+        for(int r = 0, i = 0; r < size; ++r)
+        {
+            const float *row = temp + (r + 1) * size_with_border + 1;
+            for(int c = 0; c < size; ++c, ++i)
+                r_sum += patch[i] - row[c];
+        }
+        const float r_mean = r_sum / area;
+
+        *residual = 0;
+        for(int r = 0, i = 0; r < size; ++r)
+        {
+            const float *row = temp + (r + 1) * size_with_border + 1;
+            for(int c = 0; c < size; ++c, ++i)
+                *residual += std::abs(patch[i] - row[c] - r_mean);
+        }
+        *residual /= area;
+    }
+
+    //! not converged but still oscillating within a small region is acceptable
+    return last_step2 < 0.25f;
+}
+
+int kltTrackIC(const ImgPyr &imgs_ref, const ImgPyr &imgs_cur, const int win_size,
+               const std::vector<cv::Point2f> &pts_ref, std::vector<cv::Point2f> &pts_cur,
+               std::vector<bool> &status, const int max_iterations, const double epsilon,
+               const KLTCheck check, const double max_residual, bool verbose)
+{
+    const size_t total_size = pts_ref.size();
+    const int border = 8;
+    const int x_min = border;
+    const int y_min = border;
+    const int x_max = imgs_ref[0].cols - border;
+    const int y_max = imgs_cur[0].rows - border;
+
+    LOG_ASSERT(pts_cur.size() == total_size) << "Error size of inital flow: " << pts_cur.size() << " != " << total_size;
+    if(status.empty())
+        status.resize(total_size, true);
+    LOG_ASSERT(status.size() == total_size) << "Error size of status: " << status.size() << " != " << total_size;
+
+    std::vector<int> inlier_ids;
+    inlier_ids.reserve(total_size);
+    for(size_t i = 0; i < total_size; ++i)
+    {
+        if(status[i])
+            inlier_ids.push_back(i);
+    }
+
+    const int track_size = inlier_ids.size();
+    LOG_IF(INFO, verbose) << "Points for tracking: " << track_size;
+
+    if(track_size <= 0)
+        return 0;
+
+    const float epsilon2 = epsilon * epsilon;
+    std::vector<uchar> status_tracked(track_size, 0);
+    ThreadPool::getInstance().parallelFor(ThreadPool::TASK_TRACKING, 0, track_size, [&](int i){
+        const int idx = inlier_ids[i];
+        const Vector2f px_ref(pts_ref[idx].x, pts_ref[idx].y);
+        Vector2f px_cur(pts_cur[idx].x, pts_cur[idx].y);
+        float residual = 0;
+        if(!kltTrackPointIC(imgs_ref, imgs_cur, win_size, px_ref, px_cur, max_iterations, epsilon2,
+                            check == KLT_CHECK_RESIDUAL ? &residual : nullptr))
+            return;
+
+        if(px_cur[0] < x_min || px_cur[1] < y_min || px_cur[0] > x_max || px_cur[1] > y_max)
+            return;
+
+        if(check == KLT_CHECK_RESIDUAL && residual > max_residual)
+            return;
+
+        if(check == KLT_CHECK_BACKWARD)
+        {
+            Vector2f px_back = px_ref;
+            if(!kltTrackPointIC(imgs_cur, imgs_ref, win_size, px_cur, px_back, max_iterations, epsilon2, nullptr))
+                return;
+
+            if((px_back - px_ref).squaredNorm() > 2.0f)
+                return;
+        }
+
+        pts_cur[idx] = cv::Point2f(px_cur[0], px_cur[1]);
+        status_tracked[i] = 1;
+    }, 16);
+
+    int tracked_count = 0;
+    for(int i = 0; i < track_size; ++i)
+    {
+        const int idx = inlier_ids[i];
+        status[idx] = status_tracked[i];
+        if(status_tracked[i])
+            tracked_count++;
+        else
+            pts_cur[idx] = cv::Point2f(0, 0);
+    }
+
+    LOG_IF(INFO, verbose) << "Tracked points: " << tracked_count << " final: " << std::count(status.begin(), status.end(), true);
+
+    return tracked_count;
+}
+
 bool triangulate(const Matrix3d& R_cr,  const Vector3d& t_cr, const Vector3d& fn_r, const Vector3d& fn_c, double &d_ref)
 {
     Vector3d R_fn_r(R_cr * fn_r);
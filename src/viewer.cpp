@@ -183,7 +183,8 @@ void Viewer::drawKeyFrames(Map::Ptr &map, KeyFrame::Ptr &reference, bool show_co
     {
         if(reference != nullptr)
         {
-            loacl_kfs = reference->getConnectedKeyFrames();
+            const std::vector<KeyFrame::Ptr> connected_keyframes = reference->getConnectedKeyFrames();
+            loacl_kfs.insert(connected_keyframes.begin(), connected_keyframes.end());
             loacl_kfs.insert(reference);
         }
     }
@@ -207,7 +208,7 @@ void Viewer::drawKeyFrames(Map::Ptr &map, KeyFrame::Ptr &reference, bool show_co
     for(const KeyFrame::Ptr &kf : kfs)
     {
         Vector3f O1 = kf->pose().translation().cast<float>();
-        const std::set<KeyFrame::Ptr> conect_kfs = kf->getConnectedKeyFrames();
+        const std::vector<KeyFrame::Ptr> conect_kfs = kf->getConnectedKeyFrames();
         for(const KeyFrame::Ptr &ckf : conect_kfs)
         {
             if(ckf->id_ < kf->id_)
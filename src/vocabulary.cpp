@@ -0,0 +1,476 @@
+#include <array>
+#include <algorithm>
+#include <fstream>
+#include "vocabulary.hpp"
+
+namespace ssvo{
+
+//! The vocabulary file is in the byte order of the host, a header followed by the nodes.
+//! 2: the descriptors are computed by the patterns of the quantized angles
+const uint32_t Vocabulary::FILE_VERSION = 2;
+
+static const char VOCABULARY_MAGIC[8] = {'S', 'S', 'V', 'O', 'V', 'O', 'C', '\0'};
+static const uint32_t VOCABULARY_NONE = 0xFFFFFFFF;
+static const int KMEDIANS_MAX_ITERS = 10;
+
+struct VocabularyHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t k;
+    int32_t levels;
+    uint32_t num_nodes;
+    uint32_t num_words;
+    uint32_t reserved;
+};
+
+Vocabulary::Vocabulary(int k, int levels) :
+    k_(k), levels_(levels)
+{
+    LOG_ASSERT(k_ > 1 && levels_ > 0) << "Invalid vocabulary with branching " << k_ << " and levels " << levels_;
+}
+
+//! the bitwise majority of the descriptors
+static void majorityDescriptor(const std::vector<const uchar*> &descriptors, uchar *center)
+{
+    int counts[Vocabulary::DESCRIPTOR_BYTES * 8] = {0};
+    for(const uchar *desc : descriptors)
+    {
+        for(int i = 0; i < Vocabulary::DESCRIPTOR_BYTES; ++i)
+        {
+            for(int b = 0; b < 8; ++b)
+                counts[i * 8 + b] += (desc[i] >> b) & 1;
+        }
+    }
+
+    const int num = (int)descriptors.size();
+    for(int i = 0; i < Vocabulary::DESCRIPTOR_BYTES; ++i)
+    {
+        uchar val = 0;
+        for(int b = 0; b < 8; ++b)
+            val |= (counts[i * 8 + b] * 2 > num) << b;
+        center[i] = val;
+    }
+}
+
+void Vocabulary::cluster(uint32_t parent, const std::vector<const uchar*> &descriptors, int level, std::mt19937 &generator)
+{
+    const size_t n = descriptors.size();
+    std::vector<std::vector<const uchar*> > groups;
+    std::vector<std::array<uchar, DESCRIPTOR_BYTES> > centers;
+
+    if(n <= (size_t)k_)
+    {
+        //! each descriptor is a cluster
+        for(const uchar *desc : descriptors)
+        {
+            std::array<uchar, DESCRIPTOR_BYTES> center;
+            std::memcpy(center.data(), desc, DESCRIPTOR_BYTES);
+            centers.push_back(center);
+            groups.push_back(std::vector<const uchar*>(1, desc));
+        }
+    }
+    else
+    {
+        //! k-means++ seeding with the squared Hamming distance
+        std::vector<double> min_dist2(n, std::numeric_limits<double>::max());
+        size_t chosen = std::uniform_int_distribution<size_t>(0, n - 1)(generator);
+        while(true)
+        {
+            std::array<uchar, DESCRIPTOR_BYTES> center;
+            std::memcpy(center.data(), descriptors[chosen], DESCRIPTOR_BYTES);
+            centers.push_back(center);
+            if((int)centers.size() == k_)
+                break;
+
+            double sum = 0;
+            for(size_t i = 0; i < n; ++i)
+            {
+                const double d = BRIEF::distance(descriptors[i], center.data());
+                min_dist2[i] = MIN(min_dist2[i], d * d);
+                sum += min_dist2[i];
+            }
+
+            //! all the rest are the same as the centers
+            if(sum <= 0)
+                break;
+
+            double target = std::uniform_real_distribution<double>(0, sum)(generator);
+            chosen = n - 1;
+            for(size_t i = 0; i < n; ++i)
+            {
+                target -= min_dist2[i];
+                if(target <= 0)
+                {
+                    chosen = i;
+                    break;
+                }
+            }
+        }
+
+        std::vector<int> assignments(n, -1);
+        for(int iter = 0; iter < KMEDIANS_MAX_ITERS; ++iter)
+        {
+            bool changed = false;
+            groups.assign(centers.size(), std::vector<const uchar*>());
+            for(size_t i = 0; i < n; ++i)
+            {
+                int best = 0;
+                int best_dist = std::numeric_limits<int>::max();
+                for(size_t c = 0; c < centers.size(); ++c)
+                {
+                    const int d = BRIEF::distance(descriptors[i], centers[c].data());
+                    if(d < best_dist)
+                    {
+                        best_dist = d;
+                        best = (int)c;
+                    }
+                }
+
+                changed |= assignments[i] != best;
+                assignments[i] = best;
+                groups[best].push_back(descriptors[i]);
+            }
+
+            if(!changed)
+                break;
+
+            for(size_t c = 0; c < centers.size(); ++c)
+            {
+                if(!groups[c].empty())
+                    majorityDescriptor(groups[c], centers[c].data());
+            }
+        }
+
+        //! drop the empty clusters
+        size_t m = 0;
+        for(size_t c = 0; c < centers.size(); ++c)
+        {
+            if(groups[c].empty())
+                continue;
+            centers[m] = centers[c];
+            groups[m].swap(groups[c]);
+            m++;
+        }
+        centers.resize(m);
+        groups.resize(m);
+    }
+
+    const uint32_t first_child = (uint32_t)nodes_.size();
+    nodes_[parent].first_child = first_child;
+    nodes_[parent].num_children = (uint32_t)centers.size();
+    for(const auto &center : centers)
+    {
+        Node node;
+        node.first_child = 0;
+        node.num_children = 0;
+        node.word = VOCABULARY_NONE;
+        node.weight = 0;
+        std::memcpy(node.descriptor, center.data(), DESCRIPTOR_BYTES);
+        nodes_.push_back(node);
+    }
+
+    if(level >= levels_)
+        return;
+
+    for(size_t c = 0; c < groups.size(); ++c)
+    {
+        if(groups[c].size() > 1)
+            cluster(first_child + (uint32_t)c, groups[c], level + 1, generator);
+    }
+}
+
+void Vocabulary::train(const std::vector<cv::Mat> &descriptors)
+{
+    nodes_.clear();
+    words_.clear();
+
+    std::vector<const uchar*> all_descriptors;
+    for(const cv::Mat &desc : descriptors)
+    {
+        LOG_ASSERT(desc.empty() || (desc.type() == CV_8UC1 && desc.cols == DESCRIPTOR_BYTES)) << "The descriptors should be 256-bit BRIEF!";
+        for(int r = 0; r < desc.rows; ++r)
+            all_descriptors.push_back(desc.ptr<uchar>(r));
+    }
+
+    Node root;
+    std::memset(&root, 0, sizeof(root));
+    root.word = VOCABULARY_NONE;
+    nodes_.push_back(root);
+
+    if(all_descriptors.empty())
+        return;
+
+    std::mt19937 generator(0);
+    cluster(0, all_descriptors, 1, generator);
+
+    for(uint32_t i = 0; i < nodes_.size(); ++i)
+    {
+        if(nodes_[i].num_children != 0)
+            continue;
+        nodes_[i].word = (uint32_t)words_.size();
+        words_.push_back(i);
+    }
+
+    //! IDF, log(N/Ni) with the images having the word
+    std::vector<int> images_with_word(words_.size(), 0);
+    std::vector<uint64_t> last_image(words_.size(), std::numeric_limits<uint64_t>::max());
+    for(size_t n = 0; n < descriptors.size(); ++n)
+    {
+        for(int r = 0; r < descriptors[n].rows; ++r)
+        {
+            const uint32_t word = transform(descriptors[n].ptr<uchar>(r));
+            if(last_image[word] == n)
+                continue;
+            last_image[word] = n;
+            images_with_word[word]++;
+        }
+    }
+
+    for(size_t w = 0; w < words_.size(); ++w)
+    {
+        const int count = MAX(images_with_word[w], 1);
+        nodes_[words_[w]].weight = (float)std::log((double)descriptors.size() / count);
+    }
+}
+
+uint32_t Vocabulary::transform(const uchar *descriptor) const
+{
+    LOG_ASSERT(!empty()) << "The vocabulary is empty!";
+
+    uint32_t node = 0;
+    while(nodes_[node].num_children != 0)
+    {
+        const Node &parent = nodes_[node];
+        uint32_t best = parent.first_child;
+        int best_dist = std::numeric_limits<int>::max();
+        for(uint32_t c = parent.first_child; c < parent.first_child + parent.num_children; ++c)
+        {
+            const int d = BRIEF::distance(descriptor, nodes_[c].descriptor);
+            if(d < best_dist)
+            {
+                best_dist = d;
+                best = c;
+            }
+        }
+        node = best;
+    }
+
+    return nodes_[node].word;
+}
+
+void Vocabulary::transform(const cv::Mat &descriptors, BowVector &bow) const
+{
+    bow.clear();
+    if(descriptors.empty())
+        return;
+
+    LOG_ASSERT(descriptors.type() == CV_8UC1 && descriptors.cols == DESCRIPTOR_BYTES) << "The descriptors should be 256-bit BRIEF!";
+
+    bow.reserve(descriptors.rows);
+    for(int r = 0; r < descriptors.rows; ++r)
+    {
+        const uint32_t word = transform(descriptors.ptr<uchar>(r));
+        const float weight = nodes_[words_[word]].weight;
+        if(weight > 0)
+            bow.emplace_back(word, weight);
+    }
+
+    //! merge the same words, and normalize
+    std::sort(bow.begin(), bow.end());
+    size_t m = 0;
+    double sum = 0;
+    for(size_t i = 0; i < bow.size(); ++i)
+    {
+        sum += bow[i].second;
+        if(m > 0 && bow[m-1].first == bow[i].first)
+            bow[m-1].second += bow[i].second;
+        else
+            bow[m++] = bow[i];
+    }
+    bow.resize(m);
+
+    for(auto &item : bow)
+        item.second = (float)(item.second / sum);
+}
+
+bool Vocabulary::save(const std::string &file_name) const
+{
+    std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+    {
+        LOG(ERROR) << "Can not create the vocabulary file: " << file_name;
+        return false;
+    }
+
+    VocabularyHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, VOCABULARY_MAGIC, sizeof(header.magic));
+    header.version = FILE_VERSION;
+    header.k = k_;
+    header.levels = levels_;
+    header.num_nodes = (uint32_t)nodes_.size();
+    header.num_words = (uint32_t)words_.size();
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(nodes_.data()), nodes_.size() * sizeof(Node));
+    file.close();
+    if(!file)
+    {
+        LOG(ERROR) << "Failed to write the vocabulary file: " << file_name;
+        return false;
+    }
+
+    return true;
+}
+
+Vocabulary::Ptr Vocabulary::load(const std::string &file_name)
+{
+    std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+    if(!file.is_open())
+    {
+        LOG(ERROR) << "Can not open the vocabulary file: " << file_name;
+        return nullptr;
+    }
+    const uint64_t file_size = (uint64_t)file.tellg();
+    file.seekg(0);
+
+    VocabularyHeader header;
+    if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, VOCABULARY_MAGIC, sizeof(header.magic)) != 0 ||
+        header.k <= 1 || header.levels <= 0 || header.num_nodes == 0 ||
+        file_size != sizeof(header) + (uint64_t)header.num_nodes * sizeof(Node))
+    {
+        LOG(ERROR) << "Invalid vocabulary file: " << file_name;
+        return nullptr;
+    }
+
+    if(header.version != FILE_VERSION)
+    {
+        LOG(ERROR) << "The version of the vocabulary file is " << header.version << ", but " << FILE_VERSION << " is supported: " << file_name;
+        return nullptr;
+    }
+
+    Vocabulary::Ptr vocabulary = create(header.k, header.levels);
+    vocabulary->nodes_.resize(header.num_nodes);
+    if(!file.read(reinterpret_cast<char*>(vocabulary->nodes_.data()), header.num_nodes * sizeof(Node)))
+    {
+        LOG(ERROR) << "Invalid vocabulary file: " << file_name;
+        return nullptr;
+    }
+
+    //! the children are after their parents, so the tree has no loop
+    vocabulary->words_.resize(header.num_words, VOCABULARY_NONE);
+    for(uint32_t i = 0; i < header.num_nodes; ++i)
+    {
+        const Node &node = vocabulary->nodes_[i];
+        const bool valid = node.num_children == 0 ?
+            (node.word < header.num_words && vocabulary->words_[node.word] == VOCABULARY_NONE) :
+            (node.first_child > i && node.num_children <= (uint32_t)header.k && node.first_child + (uint64_t)node.num_children <= header.num_nodes);
+        if(!valid)
+        {
+            LOG(ERROR) << "Invalid node " << i << " in the vocabulary file: " << file_name;
+            return nullptr;
+        }
+
+        if(node.num_children == 0)
+            vocabulary->words_[node.word] = i;
+    }
+
+    if(std::count(vocabulary->words_.begin(), vocabulary->words_.end(), VOCABULARY_NONE) != 0)
+    {
+        LOG(ERROR) << "Words missing in the vocabulary file: " << file_name;
+        return nullptr;
+    }
+
+    return vocabulary;
+}
+
+//! =================================================================================================
+//! BowDatabase
+BowDatabase::BowDatabase(const Vocabulary::Ptr &vocabulary) :
+    inverted_(vocabulary->size())
+{}
+
+void BowDatabase::add(uint64_t id, const BowVector &bow)
+{
+    std::lock_guard<CountingMutex> lock(mutex_);
+    const auto it = entries_.find(id);
+    if(it != entries_.end())
+    {
+        for(const auto &item : it->second)
+        {
+            auto &entries = inverted_[item.first];
+            entries.erase(std::find_if(entries.begin(), entries.end(), [id](const std::pair<uint64_t, float> &e){ return e.first == id; }));
+        }
+    }
+
+    entries_[id] = bow;
+    for(const auto &item : bow)
+    {
+        LOG_ASSERT(item.first < inverted_.size()) << "Word " << item.first << " is out of the vocabulary!";
+        inverted_[item.first].emplace_back(id, item.second);
+    }
+}
+
+void BowDatabase::erase(uint64_t id)
+{
+    std::lock_guard<CountingMutex> lock(mutex_);
+    const auto it = entries_.find(id);
+    if(it == entries_.end())
+        return;
+
+    for(const auto &item : it->second)
+    {
+        auto &entries = inverted_[item.first];
+        entries.erase(std::find_if(entries.begin(), entries.end(), [id](const std::pair<uint64_t, float> &e){ return e.first == id; }));
+    }
+    entries_.erase(it);
+}
+
+void BowDatabase::query(const BowVector &bow, std::vector<Result> &results, size_t max_results)
+{
+    results.clear();
+    std::lock_guard<CountingMutex> lock(mutex_);
+
+    //! with the L1 normalized vectors, |v-w|_1 = 2 - sum(|v_i| + |w_i| - |v_i - w_i|) over the shared words
+    scores_.clear();
+    for(const auto &item : bow)
+    {
+        if(item.first >= inverted_.size())
+            continue;
+
+        const float v = item.second;
+        for(const auto &entry : inverted_[item.first])
+        {
+            const float w = entry.second;
+            scores_[entry.first] += v + w - std::abs(v - w);
+        }
+    }
+
+    results.reserve(scores_.size());
+    for(const auto &score : scores_)
+        results.push_back(Result{score.first, 0.5f * score.second});
+
+    const size_t num = MIN(max_results, results.size());
+    std::partial_sort(results.begin(), results.begin() + num, results.end(), [](const Result &a, const Result &b){
+        return a.score > b.score || (a.score == b.score && a.id < b.id);
+    });
+    results.resize(num);
+}
+
+void BowDatabase::clear()
+{
+    std::lock_guard<CountingMutex> lock(mutex_);
+    for(auto &entries : inverted_)
+        entries.clear();
+    entries_.clear();
+}
+
+size_t BowDatabase::size()
+{
+    std::lock_guard<CountingMutex> lock(mutex_);
+    return entries_.size();
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef _SSVO_TEST_SYNTHETIC_MAP_HPP_
+#define _SSVO_TEST_SYNTHETIC_MAP_HPP_
+
+#include <random>
+#include "keyframe.hpp"
+
+namespace ssvo
+{
+
+//! the synthetic map shared by the tests of the map, the features are at random pixels,
+//! so only the structure of the map is meaningful, not the geometry
+struct SyntheticMap
+{
+    std::vector<KeyFrame::Ptr> keyframes;
+    std::vector<MapPoint::Ptr> mpts;
+};
+
+//! keyframes of the same image along the x axis, and each point is observed by num_obs successive keyframes,
+//! then the views of the points and the connections of the keyframes are updated
+inline SyntheticMap createSyntheticMap(const AbstractCamera::Ptr &cam, const cv::Mat &img, std::mt19937 &generator,
+                                       int num_keyframes, int num_points, int num_obs = 5)
+{
+    LOG_ASSERT(num_obs <= num_keyframes) << " Too few keyframes for " << num_obs << " observations: " << num_keyframes;
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    SyntheticMap scene;
+    for(int i = 0; i < num_keyframes; ++i)
+    {
+        KeyFrame::Ptr kf = KeyFrame::create(Frame::create(img, i, cam));
+        kf->setTcw(SE3d(Matrix3d::Identity(), Vector3d(-0.1 * i, 0, 0)));
+        scene.keyframes.push_back(kf);
+    }
+
+    for(int j = 0; j < num_points; ++j)
+    {
+        MapPoint::Ptr mpt = MapPoint::create(Vector3d(uniform(generator), uniform(generator), 5.0));
+        const int first = j % (num_keyframes - num_obs + 1);
+        for(int i = first; i < first + num_obs; ++i)
+        {
+            const Vector2d px(uniform(generator) * cam->width(), uniform(generator) * cam->height());
+            Feature::Ptr ft = Feature::create(px, cam->lift(px), 0, mpt);
+            scene.keyframes[i]->addFeature(ft);
+            mpt->addObservation(scene.keyframes[i], ft);
+        }
+        mpt->updateViewAndDepth();
+        scene.mpts.push_back(mpt);
+    }
+
+    for(const KeyFrame::Ptr &kf : scene.keyframes)
+        kf->updateConnections();
+
+    return scene;
+}
+
+}
+
+#endif //_SSVO_TEST_SYNTHETIC_MAP_HPP_
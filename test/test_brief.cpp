@@ -0,0 +1,185 @@
+#include <iostream>
+#include <string>
+#include <random>
+#include <opencv2/opencv.hpp>
+#include "config.hpp"
+#include "brief.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+//! keypoints of all levels inside the border, in the coordinates of the first level
+std::vector<cv::KeyPoint> createKeyPoints(const std::vector<cv::Mat> &images, int num_keypoints, std::mt19937 &generator)
+{
+    std::vector<cv::KeyPoint> keypoints;
+    for(int i = 0; i < num_keypoints; ++i)
+    {
+        const int level = i % (int)images.size();
+        std::uniform_int_distribution<int> uniform_x(BRIEF::EDGE_THRESHOLD + 1, images[level].cols - BRIEF::EDGE_THRESHOLD - 1);
+        std::uniform_int_distribution<int> uniform_y(BRIEF::EDGE_THRESHOLD + 1, images[level].rows - BRIEF::EDGE_THRESHOLD - 1);
+        keypoints.emplace_back(cv::KeyPoint((float)(uniform_x(generator) << level), (float)(uniform_y(generator) << level), 31, -1, 0, level));
+    }
+    return keypoints;
+}
+
+//! the exact angle rotates the pattern of each keypoint, on the same blurred image as the batch compute
+cv::Mat computeOneByOne(BRIEF &brief, const cv::Mat &img, const std::vector<cv::KeyPoint> &keypoints)
+{
+    cv::Mat border;
+    cv::copyMakeBorder(img, border, BRIEF::EDGE_THRESHOLD, BRIEF::EDGE_THRESHOLD, BRIEF::EDGE_THRESHOLD, BRIEF::EDGE_THRESHOLD, cv::BORDER_REFLECT_101);
+    const cv::Mat image_border = border(cv::Rect(BRIEF::EDGE_THRESHOLD, BRIEF::EDGE_THRESHOLD, img.cols, img.rows));
+    cv::Mat image_gauss;
+    cv::GaussianBlur(image_border, image_gauss, cv::Size(7, 7), 2, 2, cv::BORDER_REFLECT_101);
+
+    cv::Mat descriptors = cv::Mat::zeros((int)keypoints.size(), BRIEF::DESCRIPTOR_BYTES, CV_8UC1);
+    for(size_t i = 0; i < keypoints.size(); ++i)
+    {
+        cv::KeyPoint kpt = keypoints[i];
+        kpt.angle = brief.IC_Angle(image_border, kpt.pt, brief.umax());
+        brief.compute(kpt, image_gauss, brief.pattern().data(), descriptors.ptr<uchar>((int)i));
+    }
+    return descriptors;
+}
+
+//! the ratio of the keypoints matched to themselves in the other image
+double matchRate(const cv::Mat &query, const cv::Mat &train)
+{
+    std::vector<cv::DMatch> matches;
+    BRIEF::match(query, train, matches, BRIEF::DESCRIPTOR_BYTES * 8);
+    int correct = 0;
+    for(const cv::DMatch &match : matches)
+    {
+        if(match.queryIdx == match.trainIdx)
+            correct++;
+    }
+    return (double)correct / query.rows;
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 3)
+    {
+        std::cout << "Usage: ./test_brief image config_file" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+    Config::file_name_ = std::string(argv[2]);
+
+    cv::Mat img = cv::imread(argv[1], cv::IMREAD_GRAYSCALE);
+    LOG_ASSERT(!img.empty()) << "Can not open image: " << argv[1];
+
+    std::vector<cv::Mat> images;
+    cv::buildPyramid(img, images, Config::imageNLevel() - 1);
+
+    const int num_keypoints = 1000;
+    std::mt19937 generator(0);
+    const std::vector<cv::KeyPoint> keypoints = createKeyPoints(images, num_keypoints, generator);
+
+    BRIEF brief;
+    cv::Mat descriptors;
+    double t0 = (double)cv::getTickCount();
+    brief.compute(images, keypoints, descriptors);
+    double t1 = (double)cv::getTickCount();
+    LOG_ASSERT(descriptors.rows == num_keypoints && descriptors.cols == BRIEF::DESCRIPTOR_BYTES) << " Wrong descriptors: " << descriptors.size();
+
+    //! computed in parallel, but the same as computed one by one
+    for(int i = 0; i < num_keypoints; i += 97)
+    {
+        cv::Mat descriptor;
+        brief.compute(images, std::vector<cv::KeyPoint>(1, keypoints[i]), descriptor);
+        LOG_ASSERT(BRIEF::distance(descriptor.ptr<uchar>(0), descriptors.ptr<uchar>(i)) == 0) << " Different descriptor of keypoint " << i;
+    }
+
+    std::cout << "keypoints: " << num_keypoints
+              << ", compute time: " << (t1-t0)*1000/cv::getTickFrequency() << "ms" << std::endl;
+
+    //! the distances are the same as the OpenCV norm
+    cv::Mat train;
+    brief.compute(images, createKeyPoints(images, num_keypoints, generator), train);
+    for(int i = 0; i < num_keypoints; i += 13)
+    {
+        const int d = BRIEF::distance(descriptors.ptr<uchar>(i), train.ptr<uchar>(i));
+        const double d_cv = cv::norm(descriptors.row(i), train.row(i), cv::NORM_HAMMING);
+        LOG_ASSERT(d == (int)d_cv) << " Wrong distance: " << d << " != " << d_cv;
+    }
+
+    const int max_distance = BRIEF::DESCRIPTOR_BYTES * 8;
+    std::vector<cv::DMatch> matches;
+    t0 = (double)cv::getTickCount();
+    BRIEF::match(descriptors, train, matches, max_distance);
+    t1 = (double)cv::getTickCount();
+    const double match_time = (t1-t0)*1000/cv::getTickFrequency();
+
+    std::vector<cv::DMatch> matches_cv;
+    cv::BFMatcher matcher(cv::NORM_HAMMING);
+    double t2 = (double)cv::getTickCount();
+    matcher.match(descriptors, train, matches_cv);
+    double t3 = (double)cv::getTickCount();
+
+    LOG_ASSERT(matches.size() == matches_cv.size()) << " Wrong matches: " << matches.size() << " != " << matches_cv.size();
+    for(size_t i = 0; i < matches.size(); ++i)
+        LOG_ASSERT(matches[i].distance == matches_cv[i].distance) << " Wrong match of query " << i;
+
+    std::vector<cv::DMatch> matches_ratio;
+    t0 = (double)cv::getTickCount();
+    BRIEF::matchRatio(descriptors, train, matches_ratio, 0.8f, max_distance);
+    double t4 = (double)cv::getTickCount();
+
+    std::vector<std::vector<cv::DMatch> > knn_matches_cv;
+    double t5 = (double)cv::getTickCount();
+    matcher.knnMatch(descriptors, train, knn_matches_cv, 2);
+    size_t ratio_cv = 0;
+    for(const std::vector<cv::DMatch> &knn : knn_matches_cv)
+    {
+        if(knn.size() == 2 && knn[0].distance <= 0.8f * knn[1].distance)
+            ratio_cv++;
+    }
+    double t6 = (double)cv::getTickCount();
+
+    LOG_ASSERT(matches_ratio.size() == ratio_cv) << " Wrong ratio matches: " << matches_ratio.size() << " != " << ratio_cv;
+
+    std::cout << "match time: " << match_time << "ms"
+              << ", OpenCV: " << (t3-t2)*1000/cv::getTickFrequency() << "ms" << std::endl;
+    std::cout << "ratio matches: " << matches_ratio.size()
+              << ", time: " << (t4-t0)*1000/cv::getTickFrequency() << "ms"
+              << ", OpenCV: " << (t6-t5)*1000/cv::getTickFrequency() << "ms" << std::endl;
+
+    //! the quantized angles match the rotated image almost as well as the exact angles
+    const double rotation = 30;
+    const cv::Point2f center(img.cols * 0.5f, img.rows * 0.5f);
+    const cv::Mat R = cv::getRotationMatrix2D(center, rotation, 1.0);
+    cv::Mat img_rotated;
+    cv::warpAffine(img, img_rotated, R, img.size(), cv::INTER_LINEAR, cv::BORDER_REFLECT_101);
+
+    //! inside the circle, the patches are in both images
+    const float radius = std::min(img.cols, img.rows) * 0.5f - BRIEF::EDGE_THRESHOLD - 1;
+    std::vector<cv::KeyPoint> keypoints_ref;
+    std::vector<cv::KeyPoint> keypoints_rotated;
+    for(const cv::KeyPoint &keypoint : createKeyPoints(std::vector<cv::Mat>(1, img), num_keypoints, generator))
+    {
+        const cv::Point2f pt = keypoint.pt;
+        const cv::Point2f d = pt - center;
+        if(d.dot(d) > radius * radius)
+            continue;
+
+        const cv::Point2f pt_rotated((float)(R.at<double>(0, 0) * pt.x + R.at<double>(0, 1) * pt.y + R.at<double>(0, 2)),
+                                     (float)(R.at<double>(1, 0) * pt.x + R.at<double>(1, 1) * pt.y + R.at<double>(1, 2)));
+        keypoints_ref.push_back(keypoint);
+        keypoints_rotated.emplace_back(cv::KeyPoint(pt_rotated, 31, -1, 0, 0));
+    }
+    LOG_ASSERT(!keypoints_ref.empty()) << " No keypoints inside the image!";
+
+    cv::Mat desc_ref, desc_rotated;
+    brief.compute(std::vector<cv::Mat>(1, img), keypoints_ref, desc_ref);
+    brief.compute(std::vector<cv::Mat>(1, img_rotated), keypoints_rotated, desc_rotated);
+    const double rate = matchRate(desc_ref, desc_rotated);
+    const double rate_one = matchRate(computeOneByOne(brief, img, keypoints_ref), computeOneByOne(brief, img_rotated, keypoints_rotated));
+    LOG_ASSERT(rate > rate_one - 0.05) << " The quantized angles lose too many matches: " << rate << " < " << rate_one;
+
+    std::cout << "rotated " << rotation << "deg, keypoints: " << keypoints_ref.size()
+              << ", match rate: " << rate << ", exact angles: " << rate_one << std::endl;
+
+    return 0;
+}
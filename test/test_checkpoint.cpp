@@ -0,0 +1,126 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <opencv2/opencv.hpp>
+#include "system.hpp"
+#include "dataset.hpp"
+
+using namespace ssvo;
+
+//! the System defines Config::file_name_
+
+bool processImage(System &vo, const EuRocDataReader &dataset, size_t i)
+{
+    const EuRocDataReader::Image image_data = dataset.leftImage(i);
+    cv::Mat image = cv::imread(image_data.path, CV_LOAD_IMAGE_UNCHANGED);
+    if(image.empty())
+        return false;
+
+    vo.process(image, image_data.timestamp);
+    return true;
+}
+
+//! the last pose in the TUM trajectory file, as timestamp tx ty tz qx qy qz qw
+bool loadLastPose(const std::string &file_name, double &timestamp, Vector3d &t, Quaterniond &q)
+{
+    std::ifstream f(file_name.c_str());
+    std::string line;
+    std::string last;
+    while(std::getline(f, line))
+    {
+        if(!line.empty())
+            last = line;
+    }
+
+    std::istringstream stream(last);
+    return (bool)(stream >> timestamp >> t[0] >> t[1] >> t[2] >> q.x() >> q.y() >> q.z() >> q.w());
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 4 && argc != 5)
+    {
+        std::cout << "Usage: ./test_checkpoint config_file calib_file dataset_path [frames_before_checkpoint]" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+
+    EuRocDataReader dataset(argv[3]);
+    const size_t N = dataset.leftImageSize();
+    const size_t frames_before = argc == 5 ? std::stoul(argv[4]) : 200;
+    const size_t frames_after = 100;
+    LOG_ASSERT(N > frames_before) << " Too few images in the dataset: " << N;
+
+    const std::string file_name = "/tmp/ssvo_test_checkpoint.bin";
+    const std::string trajectory_file = "/tmp/ssvo_test_checkpoint_trajectory.txt";
+    double checkpoint_time = 0;
+    double saved_timestamp = 0;
+    Vector3d saved_t;
+    Quaterniond saved_q;
+    {
+        System vo(argv[1], argv[2]);
+        for(size_t i = 0; i < frames_before; ++i)
+            processImage(vo, dataset, i);
+
+        LOG_ASSERT(vo.stage() != System::STAGE_INITALIZE) << " Not initialized in " << frames_before << " frames!";
+
+        double t0 = (double)cv::getTickCount();
+        LOG_ASSERT(vo.checkpoint(file_name)) << " Failed to checkpoint!";
+        double t1 = (double)cv::getTickCount();
+        checkpoint_time = (t1-t0)*1000/cv::getTickFrequency();
+
+        vo.saveTrajectoryTUM(trajectory_file);
+        LOG_ASSERT(loadLastPose(trajectory_file, saved_timestamp, saved_t, saved_q)) << " No trajectory before checkpoint!";
+    }
+
+    //! as a new process, continue from the next frame without initialization
+    System vo(argv[1], argv[2]);
+    double t0 = (double)cv::getTickCount();
+    LOG_ASSERT(vo.resume(file_name)) << " Failed to resume!";
+    double t1 = (double)cv::getTickCount();
+    const double resume_time = (t1-t0)*1000/cv::getTickFrequency();
+    LOG_ASSERT(vo.stage() != System::STAGE_INITALIZE) << " The stage is not resumed!";
+
+    size_t tracked = 0;
+    bool first_tracked = true;
+    for(size_t i = frames_before; i < N && i < frames_before + frames_after; ++i)
+    {
+        if(!processImage(vo, dataset, i))
+            continue;
+
+        LOG_ASSERT(vo.stage() != System::STAGE_INITALIZE) << " Initialized again at image " << i;
+        if(vo.stage() != System::STAGE_NORMAL_FRAME)
+            continue;
+
+        tracked++;
+        if(!first_tracked)
+            continue;
+
+        //! the first pose after resumed continues the saved trajectory
+        first_tracked = false;
+        double timestamp = 0;
+        Vector3d t;
+        Quaterniond q;
+        vo.saveTrajectoryTUM(trajectory_file);
+        LOG_ASSERT(loadLastPose(trajectory_file, timestamp, t, q)) << " No trajectory after resumed!";
+        LOG_ASSERT(timestamp > saved_timestamp) << " No new pose after resumed!";
+        const double dt = (t - saved_t).norm();
+        const double dq = saved_q.angularDistance(q) * 180 / M_PI;
+        LOG_ASSERT(dt < 0.1 && dq < 5.0) << " The first pose after resumed is far from the saved one, translation: " << dt << ", rotation: " << dq << "deg";
+    }
+
+    LOG_ASSERT(tracked > 0) << " Not tracked after resumed!";
+
+    std::cout << "checkpoint time: " << checkpoint_time << "ms"
+              << ", resume time: " << resume_time << "ms"
+              << ", tracked after resumed: " << tracked << "/" << MIN(frames_after, N - frames_before) << std::endl;
+
+    std::remove(file_name.c_str());
+    std::remove((file_name + ".map").c_str());
+    std::remove(trajectory_file.c_str());
+
+    return 0;
+}
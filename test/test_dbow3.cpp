@@ -2,6 +2,7 @@
 #include <DBoW3/Vocabulary.h>
 #include <DBoW3/Database.h>
 #include <DBoW3/DescManip.h>
+#include "config.hpp"
 #include "brief.hpp"
 
 std::vector<std::string> readImagePaths(int argc,char **argv,int start){
@@ -33,14 +34,17 @@ std::string to_binary(const cv::Mat &desp)
 int main(int argc, char *argv[])
 {
 
-    if(argc<=3){
-        std::cerr<<"Usage: ./test_dbow3 voc_file image1 image2 ..."<< std::endl;
+    if(argc<=4){
+        std::cerr<<"Usage: ./test_dbow3 config_file voc_file image1 image2 ..."<< std::endl;
         return -1;
     }
 
-    std::vector<std::string> img_path = readImagePaths(argc, argv, 2);
+    //! the BRIEF runs on the thread pool configured by the file
+    ssvo::Config::file_name_ = argv[1];
 
-    DBoW3::Vocabulary voc(argv[1]);
+    std::vector<std::string> img_path = readImagePaths(argc, argv, 3);
+
+    DBoW3::Vocabulary voc(argv[2]);
     DBoW3::Database db(voc, true, 4);
     std::cout << "=========" << std::endl;
     std::cout << "Voc and DB info:" << std::endl;
@@ -0,0 +1,77 @@
+#include <iostream>
+#include <string>
+#include <opencv2/opencv.hpp>
+#include "config.hpp"
+#include "keyframe.hpp"
+#include "submap.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 3)
+    {
+        std::cout << "Usage: ./test_keyframe_images image config_file" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+    Config::file_name_ = std::string(argv[2]);
+
+    cv::Mat img = cv::imread(argv[1], cv::IMREAD_GRAYSCALE);
+    LOG_ASSERT(!img.empty()) << "Can not open image: " << argv[1];
+
+    AbstractCamera::Ptr cam = std::static_pointer_cast<AbstractCamera>(PinholeCamera::create(img.cols, img.rows, 458.654, 457.296, 367.215, 248.375));
+    KeyFrame::Ptr keyframe = KeyFrame::create(Frame::create(img, 0, cam));
+    const ImgPyr images = keyframe->images();
+
+    Frame::ImageTier tier;
+    const size_t raw_bytes = keyframe->imageBytes(tier);
+    LOG_ASSERT(tier == Frame::IMAGE_RAW) << " The images should not be compressed!";
+
+    double t0 = (double)cv::getTickCount();
+    LOG_ASSERT(keyframe->compressImages()) << " Failed to compress the images!";
+    double t1 = (double)cv::getTickCount();
+    const size_t compressed_bytes = keyframe->imageBytes(tier);
+    LOG_ASSERT(tier == Frame::IMAGE_COMPRESSED) << " The images should be compressed!";
+
+    //! decoded by the first use, and still compressed
+    const cv::Mat restored = keyframe->getImage(0);
+    double t2 = (double)cv::getTickCount();
+    LOG_ASSERT(keyframe->imageBytes(tier) == compressed_bytes && tier == Frame::IMAGE_COMPRESSED) << " The images should stay compressed after used!";
+
+    const ImgPyr restored_images = keyframe->images();
+    LOG_ASSERT(restored_images.size() == images.size()) << " Wrong levels: " << restored_images.size() << " != " << images.size();
+    for(size_t i = 0; i < images.size(); ++i)
+        LOG_ASSERT(cv::norm(images[i], restored_images[i], cv::NORM_INF) == 0) << " The image in level " << i << " is changed!";
+
+    std::cout << "raw: " << raw_bytes / 1024.0 << "KB"
+              << ", compressed: " << compressed_bytes / 1024.0 << "KB"
+              << ", ratio: " << (double)compressed_bytes / raw_bytes
+              << ", compress time: " << (t1-t0)*1000/cv::getTickFrequency() << "ms"
+              << ", restore time: " << (t2-t1)*1000/cv::getTickFrequency() << "ms" << std::endl;
+
+    //! offloaded to the submap file, and read back from the mapped file
+    SubmapFile::Ptr file = SubmapFile::create("/tmp/ssvo_test_submap_");
+    LOG_ASSERT(keyframe->writeImages(file)) << " Failed to write the images!";
+    LOG_ASSERT(!keyframe->dropImages()) << " The images should not be dropped before the file is sealed!";
+    file->seal();
+    LOG_ASSERT(keyframe->dropImages()) << " Failed to drop the images!";
+    file->release();
+
+    const size_t offloaded_bytes = keyframe->imageBytes(tier);
+    LOG_ASSERT(tier == Frame::IMAGE_OFFLOADED && offloaded_bytes == 0) << " The images should be offloaded!";
+
+    t0 = (double)cv::getTickCount();
+    const ImgPyr loaded_images = keyframe->images();
+    t1 = (double)cv::getTickCount();
+    for(size_t i = 0; i < images.size(); ++i)
+        LOG_ASSERT(cv::norm(images[i], loaded_images[i], cv::NORM_INF) == 0) << " The image in level " << i << " is changed!";
+
+    std::cout << "file: " << file->size() / 1024.0 << "KB"
+              << ", load time: " << (t1-t0)*1000/cv::getTickFrequency() << "ms" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <iostream>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+#include "config.hpp"
+#include "utils.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+void createPyramids(const cv::Mat &image, const int nlevels, const cv::Size &win_size, ImgPyr &img_pyr, ImgPyr &optical_pyr)
+{
+    //! the same as Frame
+    cv::buildOpticalFlowPyramid(image, optical_pyr, win_size, nlevels-1, false);
+    img_pyr.resize(optical_pyr.size());
+    for(size_t i = 0; i < optical_pyr.size(); i++)
+        optical_pyr[i].copyTo(img_pyr[i]);
+}
+
+//! the number of inliers within 1 pixel of the flow, and their mean error
+std::pair<int, double> evaluate(const std::string &name, const std::vector<cv::Point2f> &pts_ref, const std::vector<cv::Point2f> &pts_cur,
+              const std::vector<bool> &status, const cv::Point2f &flow, double time)
+{
+    int tracked = 0;
+    int inliers = 0;
+    double error = 0;
+    for(size_t i = 0; i < status.size(); i++)
+    {
+        if(!status[i])
+            continue;
+
+        tracked++;
+        const cv::Point2f delta = pts_cur[i] - pts_ref[i] - flow;
+        const double dist = std::sqrt(delta.x*delta.x + delta.y*delta.y);
+        if(dist > 1.0)
+            continue;
+
+        inliers++;
+        error += dist;
+    }
+
+    std::cout << "[" << name << "] tracked: " << tracked << "/" << status.size()
+              << ", inliers(<1px): " << inliers << ", mean error: " << error/MAX(inliers, 1)
+              << ", time: " << time*1000 << "ms" << std::endl;
+
+    return std::make_pair(inliers, error/MAX(inliers, 1));
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 4)
+    {
+        std::cout << "Usge: ./test_klt config_file image0 image1" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+
+    Config::file_name_ = std::string(argv[1]);
+    const int nlevels = Config::imageNLevel();
+    const cv::Size win_size(21, 21);
+    const int n_trials = 100;
+
+    cv::Mat image0 = cv::imread(argv[2], CV_LOAD_IMAGE_GRAYSCALE);
+    cv::Mat image1 = cv::imread(argv[3], CV_LOAD_IMAGE_GRAYSCALE);
+    LOG_ASSERT(!image0.empty() && !image1.empty()) << "Could not open images: " << argv[2] << ", " << argv[3];
+
+    std::vector<cv::Point2f> pts_ref;
+    cv::goodFeaturesToTrack(image0, pts_ref, 500, 0.01, 10, cv::noArray(), 3, false);
+    std::cout << "Corners to track: " << pts_ref.size() << std::endl;
+
+    //! synthetic shift with brightness change, the ground truth flow is known
+    const cv::Point2f flow(5.37f, -3.61f);
+    cv::Mat warp = (cv::Mat_<double>(2, 3) << 1, 0, flow.x, 0, 1, flow.y);
+    cv::Mat image_shift;
+    cv::warpAffine(image0, image_shift, warp, image0.size(), cv::INTER_LINEAR, cv::BORDER_REFLECT_101);
+    image_shift.convertTo(image_shift, CV_8UC1, 1.0, 8.0);
+
+    ImgPyr img_pyr0, img_pyr1, img_pyr_shift;
+    ImgPyr optical_pyr0, optical_pyr1, optical_pyr_shift;
+    createPyramids(image0, nlevels, win_size, img_pyr0, optical_pyr0);
+    createPyramids(image1, nlevels, win_size, img_pyr1, optical_pyr1);
+    createPyramids(image_shift, nlevels, win_size, img_pyr_shift, optical_pyr_shift);
+
+    cv::TermCriteria termcrit(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.0001);
+
+    struct Method
+    {
+        std::string name;
+        std::function<void (const ImgPyr&, const ImgPyr&, const ImgPyr&, const ImgPyr&, std::vector<cv::Point2f>&, std::vector<bool>&)> track;
+    };
+
+    std::vector<Method> methods;
+    methods.push_back({"opencv fb", [&](const ImgPyr &opt0, const ImgPyr &opt1, const ImgPyr &, const ImgPyr &,
+                                        std::vector<cv::Point2f> &pts_cur, std::vector<bool> &status){
+        utils::kltTrack(opt0, opt1, win_size, pts_ref, pts_cur, status, termcrit, true);
+    }});
+    methods.push_back({"native none", [&](const ImgPyr &, const ImgPyr &, const ImgPyr &img0, const ImgPyr &img1,
+                                          std::vector<cv::Point2f> &pts_cur, std::vector<bool> &status){
+        utils::kltTrackIC(img0, img1, win_size.width, pts_ref, pts_cur, status, 30, 0.0001, utils::KLT_CHECK_NONE);
+    }});
+    methods.push_back({"native residual", [&](const ImgPyr &, const ImgPyr &, const ImgPyr &img0, const ImgPyr &img1,
+                                              std::vector<cv::Point2f> &pts_cur, std::vector<bool> &status){
+        utils::kltTrackIC(img0, img1, win_size.width, pts_ref, pts_cur, status, 30, 0.0001, utils::KLT_CHECK_RESIDUAL, Config::kltMaxResidual());
+    }});
+    methods.push_back({"native fb", [&](const ImgPyr &, const ImgPyr &, const ImgPyr &img0, const ImgPyr &img1,
+                                        std::vector<cv::Point2f> &pts_cur, std::vector<bool> &status){
+        utils::kltTrackIC(img0, img1, win_size.width, pts_ref, pts_cur, status, 30, 0.0001, utils::KLT_CHECK_BACKWARD);
+    }});
+
+    std::cout << "=== Synthetic shift (" << flow.x << ", " << flow.y << ") with brightness offset ===" << std::endl;
+    for(const Method &method : methods)
+    {
+        std::vector<cv::Point2f> pts_cur;
+        std::vector<bool> status;
+        double t0 = (double)cv::getTickCount();
+        for(int i = 0; i < n_trials; i++)
+        {
+            pts_cur = pts_ref;
+            status.clear();
+            method.track(optical_pyr0, optical_pyr_shift, img_pyr0, img_pyr_shift, pts_cur, status);
+        }
+        double t1 = (double)cv::getTickCount();
+        const std::pair<int, double> result = evaluate(method.name, pts_ref, pts_cur, status, flow, (t1-t0)/cv::getTickFrequency()/n_trials);
+
+        //! the native KLT is invariant to the brightness offset, so most of the corners follow the known shift
+        if(method.name.compare(0, 6, "native") == 0)
+        {
+            LOG_ASSERT(result.first >= 0.7 * pts_ref.size()) << " [" << method.name << "] Too few inliers: " << result.first << "/" << pts_ref.size();
+            LOG_ASSERT(result.second < 0.1) << " [" << method.name << "] The mean error is too large: " << result.second;
+        }
+    }
+
+    std::cout << "=== Real images, compared with OpenCV forward-backward ===" << std::endl;
+    std::vector<cv::Point2f> pts_opencv = pts_ref;
+    std::vector<bool> status_opencv;
+    methods[0].track(optical_pyr0, optical_pyr1, img_pyr0, img_pyr1, pts_opencv, status_opencv);
+    for(const Method &method : methods)
+    {
+        std::vector<cv::Point2f> pts_cur;
+        std::vector<bool> status;
+        double t0 = (double)cv::getTickCount();
+        for(int i = 0; i < n_trials; i++)
+        {
+            pts_cur = pts_ref;
+            status.clear();
+            method.track(optical_pyr0, optical_pyr1, img_pyr0, img_pyr1, pts_cur, status);
+        }
+        double t1 = (double)cv::getTickCount();
+
+        int tracked = std::count(status.begin(), status.end(), true);
+        int common = 0;
+        double diff = 0;
+        for(size_t i = 0; i < status.size(); i++)
+        {
+            if(!status[i] || !status_opencv[i])
+                continue;
+            const cv::Point2f delta = pts_cur[i] - pts_opencv[i];
+            diff += std::sqrt(delta.x*delta.x + delta.y*delta.y);
+            common++;
+        }
+
+        std::cout << "[" << method.name << "] tracked: " << tracked << "/" << pts_ref.size()
+                  << ", common with opencv: " << common << ", mean diff: " << diff/MAX(common, 1)
+                  << ", time: " << (t1-t0)/cv::getTickFrequency()/n_trials*1000 << "ms" << std::endl;
+
+        //! the points tracked by both agree with OpenCV
+        const int tracked_opencv = std::count(status_opencv.begin(), status_opencv.end(), true);
+        LOG_ASSERT(common >= 0.5 * tracked_opencv) << " [" << method.name << "] Too few points tracked with opencv: " << common << "/" << tracked_opencv;
+        LOG_ASSERT(diff/MAX(common, 1) < 0.5) << " [" << method.name << "] Different from opencv: " << diff/MAX(common, 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <iostream>
+#include <string>
+#include <random>
+#include <opencv2/opencv.hpp>
+#include "config.hpp"
+#include "optimizer.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+struct Scene
+{
+    std::vector<KeyFrame::Ptr> keyframes;
+    std::vector<MapPoint::Ptr> mpts;
+    std::vector<SE3d> poses_true;
+    std::vector<Vector3d> points_true;
+};
+
+//! the last (window) keyframes observe all the points, and the first two observe half of them,
+//! so the first two are out of the window and fixed in the local BA
+Scene createScene(const AbstractCamera::Ptr &cam, const cv::Mat &img, int window, int num_points, double pixel_noise)
+{
+    std::mt19937 generator(window);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::normal_distribution<double> noise(0.0, pixel_noise);
+
+    Scene scene;
+    const int N = window + 2;
+    for(int i = 0; i < N; ++i)
+    {
+        const SE3d Tcw(Sophus::SO3d::exp(Vector3d(0.0, 0.01 * i, 0.0)), Vector3d(-0.05 * i, 0.01 * uniform(generator), 0.0));
+        KeyFrame::Ptr kf = KeyFrame::create(Frame::create(img, i, cam));
+        scene.poses_true.push_back(Tcw);
+        scene.keyframes.push_back(kf);
+    }
+
+    for(int j = 0; j < num_points; ++j)
+    {
+        const Vector3d pose(3.0 * uniform(generator), 2.0 * uniform(generator), 6.0 + 2.0 * uniform(generator));
+        MapPoint::Ptr mpt = MapPoint::create(pose);
+        for(int i = 0; i < N; ++i)
+        {
+            if(i < 2 && pose[0] > 0)
+                continue;
+
+            const Vector3d pc = scene.poses_true[i] * pose;
+            const Vector2d px = cam->project(pc) + Vector2d(noise(generator), noise(generator));
+            if(!cam->isInFrame(px.cast<int>()))
+                continue;
+
+            Feature::Ptr ft = Feature::create(px, cam->lift(px), 0, mpt);
+            scene.keyframes[i]->addFeature(ft);
+            mpt->addObservation(scene.keyframes[i], ft);
+        }
+
+        scene.mpts.push_back(mpt);
+        scene.points_true.push_back(pose);
+    }
+
+    for(const KeyFrame::Ptr &kf : scene.keyframes)
+        kf->updateConnections();
+
+    //! noise on the window
+    for(int i = 0; i < N; ++i)
+    {
+        Sophus::Vector6d delta = Sophus::Vector6d::Zero();
+        if(i >= 2)
+        {
+            for(int d = 0; d < 6; ++d)
+                delta[d] = 0.005 * uniform(generator);
+        }
+        scene.keyframes[i]->setTcw(SE3d::exp(delta) * scene.poses_true[i]);
+    }
+
+    for(const MapPoint::Ptr &mpt : scene.mpts)
+        mpt->setPose(mpt->pose() + Vector3d(uniform(generator), uniform(generator), uniform(generator)) * 0.05);
+
+    return scene;
+}
+
+double reprojectRMSE(const AbstractCamera::Ptr &cam, const Scene &scene)
+{
+    double error = 0;
+    int count = 0;
+    for(const MapPoint::Ptr &mpt : scene.mpts)
+    {
+        const std::map<KeyFrame::Ptr, Feature::Ptr> obs = mpt->getObservations();
+        for(const auto &item : obs)
+        {
+            const Vector2d px = cam->project(item.first->Tcw() * mpt->pose());
+            error += (px - item.second->px_).squaredNorm();
+            count++;
+        }
+    }
+    return std::sqrt(error / MAX(count, 1));
+}
+
+double poseError(const Scene &scene)
+{
+    double error = 0;
+    for(size_t i = 0; i < scene.keyframes.size(); ++i)
+        error += (scene.keyframes[i]->Tcw() * scene.poses_true[i].inverse()).translation().norm();
+    return error / scene.keyframes.size();
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 2)
+    {
+        std::cout << "Usage: ./test_local_ba config_file" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+    Config::file_name_ = std::string(argv[1]);
+
+    AbstractCamera::Ptr cam = std::static_pointer_cast<AbstractCamera>(PinholeCamera::create(752, 480, 458.654, 457.296, 367.215, 248.375));
+    cv::Mat img = cv::Mat::zeros(cam->height(), cam->width(), CV_8UC1);
+
+    const int windows[] = {5, 10, 15, 20};
+    const int points_per_keyframe = 100;
+
+    typedef void (*LocalBA)(const KeyFrame::Ptr&, std::list<MapPoint::Ptr>&, int, int, bool, bool, const std::atomic<bool>*);
+    const std::vector<std::pair<std::string, LocalBA> > methods = {
+        {"ceres ", &Optimizer::localBundleAdjustmentCeres},
+        {"persist", &Optimizer::localBundleAdjustmentPersistent},
+        {"native", &Optimizer::localBundleAdjustmentNative},
+        {"invdep", &Optimizer::localBundleAdjustmentWithInvDepth}};
+
+    for(const int window : windows)
+    {
+        std::cout << "=== window size: " << window << " ===" << std::endl;
+        std::vector<std::vector<SE3d> > results;
+        for(const auto &method : methods)
+        {
+            //! the same scene for each method
+            Scene scene = createScene(cam, img, window, window * points_per_keyframe, 1.0);
+            const double rmse_before = reprojectRMSE(cam, scene);
+
+            std::list<MapPoint::Ptr> bad_mpts;
+            double t0 = (double)cv::getTickCount();
+            method.second(scene.keyframes.back(), bad_mpts, window, 0, false, false, nullptr);
+            double t1 = (double)cv::getTickCount();
+
+            const double rmse_after = reprojectRMSE(cam, scene);
+            LOG_ASSERT(rmse_after < rmse_before) << " [" << method.first << "] The rmse is not reduced: " << rmse_before << " -> " << rmse_after;
+
+            std::cout << "[" << method.first << "] rmse: " << rmse_before << " -> " << rmse_after
+                      << "px, mean pose error: " << poseError(scene)
+                      << ", bad mpts: " << bad_mpts.size()
+                      << ", iterations: " << Optimizer::lastSolveInfo().iterations
+                      << ", build: " << Optimizer::lastSolveInfo().build_ms << "ms"
+                      << ", time: " << (t1-t0)*1000/cv::getTickFrequency() << "ms" << std::endl;
+
+            std::vector<SE3d> poses;
+            for(const KeyFrame::Ptr &kf : scene.keyframes)
+                poses.push_back(kf->Tcw());
+            results.push_back(poses);
+
+            //! the same window again, only the persistent problem reuses the blocks built before
+            method.second(scene.keyframes.back(), bad_mpts, window, 0, false, false, nullptr);
+            std::cout << "[" << method.first << "] build again: " << Optimizer::lastSolveInfo().build_ms << "ms" << std::endl;
+        }
+
+        for(size_t m = 1; m < methods.size(); ++m)
+        {
+            double max_diff = 0;
+            for(size_t i = 0; i < results[0].size(); ++i)
+                max_diff = MAX(max_diff, (results[0][i] * results[m][i].inverse()).log().norm());
+            std::cout << "max pose difference between ceres and " << methods[m].first << ": " << max_diff << std::endl;
+
+            //! the same cost of the same scene, so all the solvers reach the optimum of ceres
+            LOG_ASSERT(max_diff < 1e-3) << " The poses of " << methods[m].first << " are different from ceres: " << max_diff;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <string>
+#include <random>
+#include <opencv2/opencv.hpp>
+#include "config.hpp"
+#include "map.hpp"
+#include "synthetic_map.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+//! what the tracker did for each frame: traverse the covisibility and the points of each keyframe,
+//! and read the poses of the frame and the points for the projection
+size_t projectLocked(const Frame::Ptr &frame, const KeyFrame::Ptr &reference, size_t max_kfs)
+{
+    const ssvo::Map::LocalMap::Ptr local_map = ssvo::Map::createLocalMap(reference, max_kfs);
+    size_t count = 0;
+    for(const MapPoint::Ptr &mpt : local_map->mpts)
+    {
+        const Vector3d pose(frame->Tcw() * mpt->pose());
+        if(pose[2] > 0)
+            count++;
+    }
+    return count;
+}
+
+//! what the tracker does with the snapshot published by the mapper
+size_t projectSnapshot(const Frame::Ptr &frame, const ssvo::Map::LocalMap::Ptr &local_map)
+{
+    const SE3d Tcw = frame->Tcw();
+    size_t count = 0;
+    for(const Vector3d &pose_world : local_map->poses)
+    {
+        const Vector3d pose(Tcw * pose_world);
+        if(pose[2] > 0)
+            count++;
+    }
+    return count;
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 2)
+    {
+        std::cout << "Usage: ./test_local_map config_file" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+    Config::file_name_ = std::string(argv[1]);
+
+    AbstractCamera::Ptr cam = std::static_pointer_cast<AbstractCamera>(PinholeCamera::create(752, 480, 458.654, 457.296, 367.215, 248.375));
+    cv::Mat img = cv::Mat::zeros(cam->height(), cam->width(), CV_8UC1);
+
+    //! each point is observed by 5 successive keyframes
+    const int num_keyframes = 10;
+    const int num_points = 2000;
+    std::mt19937 generator(0);
+    const SyntheticMap scene = createSyntheticMap(cam, img, generator, num_keyframes, num_points);
+    const std::vector<KeyFrame::Ptr> &keyframes = scene.keyframes;
+
+    Frame::Ptr frame = Frame::create(img, num_keyframes, cam);
+    KeyFrame::Ptr reference = keyframes[num_keyframes / 2];
+    const size_t max_kfs = num_keyframes;
+    const int frames = 100;
+
+    //! published once per keyframe by the mapper
+    const ssvo::Map::LocalMap::Ptr local_map = ssvo::Map::createLocalMap(reference, max_kfs);
+    LOG_ASSERT(projectLocked(frame, reference, max_kfs) == projectSnapshot(frame, local_map)) << " Different results!";
+
+    uint64_t locks_before = CountingMutex::acquisitions();
+    double t0 = (double)cv::getTickCount();
+    for(int n = 0; n < frames; ++n)
+        projectLocked(frame, reference, max_kfs);
+    double t1 = (double)cv::getTickCount();
+    std::cout << "[locked  ] map points: " << local_map->mpts.size()
+              << ", locks per frame: " << (double)(CountingMutex::acquisitions() - locks_before) / frames
+              << ", time per frame: " << (t1-t0)*1000/cv::getTickFrequency()/frames << "ms" << std::endl;
+
+    locks_before = CountingMutex::acquisitions();
+    t0 = (double)cv::getTickCount();
+    for(int n = 0; n < frames; ++n)
+        projectSnapshot(frame, local_map);
+    t1 = (double)cv::getTickCount();
+    std::cout << "[snapshot] map points: " << local_map->mpts.size()
+              << ", locks per frame: " << (double)(CountingMutex::acquisitions() - locks_before) / frames
+              << ", time per frame: " << (t1-t0)*1000/cv::getTickFrequency()/frames << "ms" << std::endl;
+
+    return 0;
+}
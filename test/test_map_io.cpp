@@ -0,0 +1,110 @@
+#include <iostream>
+#include <string>
+#include <random>
+#include <fstream>
+#include <cstdio>
+#include <opencv2/opencv.hpp>
+#include "config.hpp"
+#include "map.hpp"
+#include "synthetic_map.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+//! the synthetic map inserted into a map
+ssvo::Map::Ptr createMap(const AbstractCamera::Ptr &cam, const cv::Mat &img, std::mt19937 &generator, int num_keyframes, int num_points)
+{
+    const SyntheticMap scene = createSyntheticMap(cam, img, generator, num_keyframes, num_points);
+    ssvo::Map::Ptr map = ssvo::Map::create();
+    for(const KeyFrame::Ptr &kf : scene.keyframes)
+        map->insertKeyFrame(kf);
+    for(const MapPoint::Ptr &mpt : scene.mpts)
+        map->insertMapPoint(mpt);
+
+    return map;
+}
+
+void checkMap(const ssvo::Map::Ptr &map, const ssvo::Map::Ptr &loaded)
+{
+    LOG_ASSERT(map->KeyFramesInMap() == loaded->KeyFramesInMap()) << " Wrong keyframes: " << loaded->KeyFramesInMap();
+    LOG_ASSERT(map->MapPointsInMap() == loaded->MapPointsInMap()) << " Wrong map points: " << loaded->MapPointsInMap();
+
+    for(const KeyFrame::Ptr &kf : map->getAllKeyFrames())
+    {
+        const KeyFrame::Ptr kf_loaded = loaded->getKeyFrame(kf->id_);
+        LOG_ASSERT(kf_loaded) << " Keyframe " << kf->id_ << " is not loaded!";
+        LOG_ASSERT((kf->Tcw().matrix() - kf_loaded->Tcw().matrix()).norm() < 1e-9) << " Wrong pose of keyframe " << kf->id_;
+        LOG_ASSERT(kf->featureNumber() == kf_loaded->featureNumber()) << " Wrong features of keyframe " << kf->id_;
+
+        const std::vector<KeyFrame::Ptr> connected = kf->getConnectedKeyFrames();
+        const std::vector<KeyFrame::Ptr> connected_loaded = kf_loaded->getConnectedKeyFrames();
+        LOG_ASSERT(connected.size() == connected_loaded.size()) << " Wrong connections of keyframe " << kf->id_;
+        for(size_t i = 0; i < connected.size(); ++i)
+            LOG_ASSERT(connected[i]->id_ == connected_loaded[i]->id_) << " Wrong connections of keyframe " << kf->id_;
+    }
+
+    const KeyFrame::Ptr kf = map->getAllKeyFrames().front();
+    const ImgPyr images = kf->images();
+    const ImgPyr images_loaded = loaded->getKeyFrame(kf->id_)->images();
+    LOG_ASSERT(images.size() == images_loaded.size()) << " Wrong levels: " << images_loaded.size();
+    for(size_t i = 0; i < images.size(); ++i)
+        LOG_ASSERT(cv::norm(images[i], images_loaded[i], cv::NORM_INF) == 0) << " The image in level " << i << " is changed!";
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 2)
+    {
+        std::cout << "Usage: ./test_map_io config_file" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+    Config::file_name_ = std::string(argv[1]);
+
+    AbstractCamera::Ptr cam = std::static_pointer_cast<AbstractCamera>(PinholeCamera::create(752, 480, 458.654, 457.296, 367.215, 248.375));
+    cv::Mat img(cam->height(), cam->width(), CV_8UC1);
+    cv::randu(img, cv::Scalar(0), cv::Scalar(255));
+
+    const std::string file_name = "/tmp/ssvo_test_map.bin";
+    std::mt19937 generator(0);
+    const int sizes[] = {10, 20, 40, 80};
+    for(const int num_keyframes : sizes)
+    {
+        ssvo::Map::Ptr map = createMap(cam, img, generator, num_keyframes, num_keyframes * 200);
+
+        double t0 = (double)cv::getTickCount();
+        LOG_ASSERT(map->save(file_name)) << " Failed to save the map!";
+        double t1 = (double)cv::getTickCount();
+
+        ssvo::Map::Ptr loaded = ssvo::Map::create();
+        LOG_ASSERT(loaded->load(file_name, cam)) << " Failed to load the map!";
+        double t2 = (double)cv::getTickCount();
+
+        checkMap(map, loaded);
+
+        std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+        const double file_mb = file.tellg() / 1024.0 / 1024.0;
+        std::cout << "keyframes: " << map->KeyFramesInMap()
+                  << ", map points: " << map->MapPointsInMap()
+                  << ", file: " << file_mb << "MB"
+                  << ", save time: " << (t1-t0)*1000/cv::getTickFrequency() << "ms"
+                  << ", load time: " << (t2-t1)*1000/cv::getTickFrequency() << "ms" << std::endl;
+    }
+
+    //! files of other versions are refused
+    {
+        std::fstream file(file_name, std::ios::binary | std::ios::in | std::ios::out);
+        const uint32_t version = ssvo::Map::MAP_FILE_VERSION + 1;
+        file.seekp(8);
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    }
+    ssvo::Map::Ptr refused = ssvo::Map::create();
+    LOG_ASSERT(!refused->load(file_name, cam)) << " The map file of another version should be refused!";
+    LOG_ASSERT(refused->KeyFramesInMap() == 0) << " The map should be untouched!";
+
+    std::remove(file_name.c_str());
+
+    return 0;
+}
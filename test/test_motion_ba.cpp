@@ -0,0 +1,137 @@
+#include <iostream>
+#include <string>
+#include <random>
+#include <opencv2/opencv.hpp>
+#include "config.hpp"
+#include "optimizer.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+struct Scene
+{
+    std::vector<Vector3d> points;
+    std::vector<Vector2d> pxs;
+    std::vector<int> levels;
+};
+
+Scene createScene(const AbstractCamera::Ptr &cam, const SE3d &Tcw, int num, double pixel_noise, double outlier_ratio)
+{
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, pixel_noise);
+
+    Scene scene;
+    while((int)scene.points.size() < num)
+    {
+        const Vector2d px(uniform(generator)*cam->width(), uniform(generator)*cam->height());
+        const double depth = 2.0 + 8.0 * uniform(generator);
+        const Vector3d pc = cam->lift(px) * depth;
+        Vector2d px_obs = px + Vector2d(noise(generator), noise(generator));
+        if(uniform(generator) < outlier_ratio)
+            px_obs += Vector2d(20.0 + 20*uniform(generator), -20.0 - 20*uniform(generator));
+
+        if(!cam->isInFrame(px_obs.cast<int>()))
+            continue;
+
+        scene.points.push_back(Tcw.inverse() * pc);
+        scene.pxs.push_back(px_obs);
+        scene.levels.push_back((int)(uniform(generator) * Config::imageNLevel()));
+    }
+
+    return scene;
+}
+
+Frame::Ptr createFrame(const cv::Mat &img, const AbstractCamera::Ptr &cam, const Scene &scene, const SE3d &Tcw_init)
+{
+    Frame::Ptr frame = Frame::create(img, 0, cam);
+    frame->setTcw(Tcw_init);
+    for(size_t i = 0; i < scene.points.size(); ++i)
+    {
+        MapPoint::Ptr mpt = MapPoint::create(scene.points[i]);
+        Feature::Ptr ft = Feature::create(scene.pxs[i], cam->lift(scene.pxs[i]), scene.levels[i], mpt);
+        frame->addFeature(ft);
+    }
+    return frame;
+}
+
+//! the translation and the rotation in degree between the poses
+std::pair<double, double> poseError(const SE3d &Tcw, const SE3d &Tcw_ref)
+{
+    const SE3d T_err = Tcw * Tcw_ref.inverse();
+    return std::make_pair(T_err.translation().norm(), T_err.so3().log().norm() * 180 / M_PI);
+}
+
+void evaluate(const std::string &name, const SE3d &Tcw_true, const Frame::Ptr &frame, size_t num, double time)
+{
+    const std::pair<double, double> error = poseError(frame->Tcw(), Tcw_true);
+    std::cout << "[" << name << "] translation error: " << error.first
+              << ", rotation error: " << error.second << "deg"
+              << ", features: " << frame->featureNumber() << "/" << num
+              << ", time: " << time * 1000 << "ms" << std::endl;
+
+    //! 1 pixel noise, and the outliers are rejected
+    LOG_ASSERT(error.first < 0.05 && error.second < 0.5) << " [" << name << "] The pose is too far from the truth, translation: "
+                                                          << error.first << ", rotation: " << error.second << "deg";
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 2)
+    {
+        std::cout << "Usage: ./test_motion_ba config_file" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+    Config::file_name_ = std::string(argv[1]);
+
+    AbstractCamera::Ptr cam = std::static_pointer_cast<AbstractCamera>(PinholeCamera::create(752, 480, 458.654, 457.296, 367.215, 248.375));
+    cv::Mat img = cv::Mat::zeros(cam->height(), cam->width(), CV_8UC1);
+
+    const SE3d Tcw_true(Sophus::SO3d::exp(Vector3d(0.02, -0.1, 0.05)), Vector3d(0.3, -0.1, 0.5));
+    Sophus::Vector6d delta;
+    delta << 0.03, -0.02, 0.05, 0.01, 0.02, -0.015;
+    const SE3d Tcw_init = SE3d::exp(delta) * Tcw_true;
+
+    const int n_trials = 100;
+    const int sizes[] = {50, 150, 300, 600};
+    const double outlier_ratios[] = {0.0, 0.1};
+
+    typedef void (*MotionBA)(const Frame::Ptr&, bool, bool, bool, bool);
+    const std::vector<std::pair<std::string, MotionBA> > methods = {
+        {"ceres ", &Optimizer::motionOnlyBundleAdjustmentCeres},
+        {"native", &Optimizer::motionOnlyBundleAdjustmentNative}};
+
+    for(const double outlier_ratio : outlier_ratios)
+    {
+        for(const int size : sizes)
+        {
+            std::cout << "=== " << size << " points, outlier ratio " << outlier_ratio << " ===" << std::endl;
+            const Scene scene = createScene(cam, Tcw_true, size, 1.0, outlier_ratio);
+            std::vector<SE3d> results;
+            for(const auto &method : methods)
+            {
+                std::vector<Frame::Ptr> frames(n_trials);
+                for(int i = 0; i < n_trials; ++i)
+                    frames[i] = createFrame(img, cam, scene, Tcw_init);
+
+                double t0 = (double)cv::getTickCount();
+                for(int i = 0; i < n_trials; ++i)
+                    method.second(frames[i], false, true, false, false);
+                double t1 = (double)cv::getTickCount();
+
+                evaluate(method.first, Tcw_true, frames.back(), scene.points.size(), (t1-t0)/cv::getTickFrequency()/n_trials);
+                results.push_back(frames.back()->Tcw());
+            }
+
+            //! the same robust cost, so the native solver converges to the pose of ceres
+            const std::pair<double, double> difference = poseError(results[1], results[0]);
+            LOG_ASSERT(difference.first < 1e-3 && difference.second < 0.05) << " The native pose is different from ceres, translation: "
+                                                                              << difference.first << ", rotation: " << difference.second << "deg";
+        }
+    }
+
+    return 0;
+}
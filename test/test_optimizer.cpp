@@ -1,5 +1,6 @@
 #include <iostream>
 #include <string>
+#include <random>
 #include <opencv2/opencv.hpp>
 #include "config.hpp"
 #include "utils.hpp"
@@ -86,6 +87,85 @@ int main(int argc, char const *argv[])
     std::cout << "Reproject Error changed from " << rpj_err_pre << " to " << rpj_err_aft << " time: "
               << (t1-t0)*1000/cv::getTickFrequency() << "ms" << std::endl;
 
+    //! throughput of the per-point and the batched refinement on the same points
+    const int num_kfs = 5;
+    const int num_mpts = 5000;
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::normal_distribution<double> noise(0.0, 1.0);
+
+    std::vector<KeyFrame::Ptr> kfs;
+    for(int i = 0; i < num_kfs; ++i)
+    {
+        KeyFrame::Ptr kf = KeyFrame::create(Frame::create(img, i, cam));
+        kf->setPose(Eigen::Matrix3d::Identity(), Eigen::Vector3d(0.05*i, 0.01*uniform(generator), 0.0));
+        kfs.push_back(kf);
+    }
+
+    std::vector<Eigen::Vector3d> poses_true;
+    std::vector<Eigen::Vector3d> poses_init;
+    std::vector<MapPoint::Ptr> mpts_single;
+    std::vector<MapPoint::Ptr> mpts_batch;
+    for(int j = 0; j < num_mpts; ++j)
+    {
+        const Eigen::Vector3d pw(3.0*uniform(generator), 2.0*uniform(generator), 6.0+2.0*uniform(generator));
+        MapPoint::Ptr mpt_single = MapPoint::create(pw);
+        MapPoint::Ptr mpt_batch = MapPoint::create(pw);
+        for(const KeyFrame::Ptr &kf : kfs)
+        {
+            const Eigen::Vector2d px = cam->project(kf->Tcw() * pw) + Eigen::Vector2d(noise(generator), noise(generator));
+            const Eigen::Vector3d fn = cam->lift(px);
+            mpt_single->addObservation(kf, Feature::create(px, fn, 0, mpt_single));
+            mpt_batch->addObservation(kf, Feature::create(px, fn, 0, mpt_batch));
+        }
+        const Eigen::Vector3d pw_noise = pw + 0.05*Eigen::Vector3d(uniform(generator), uniform(generator), uniform(generator));
+        mpt_single->setPose(pw_noise);
+        mpt_batch->setPose(pw_noise);
+        poses_true.push_back(pw);
+        poses_init.push_back(pw_noise);
+        mpts_single.push_back(mpt_single);
+        mpts_batch.push_back(mpt_batch);
+    }
+
+    auto meanError = [&](const std::vector<MapPoint::Ptr> &mpts){
+        double error = 0;
+        for(int j = 0; j < num_mpts; ++j)
+            error += (mpts[j]->pose() - poses_true[j]).norm();
+        return error / num_mpts;
+    };
+
+    double t2 = (double)cv::getTickCount();
+    for(const MapPoint::Ptr &mpt_single : mpts_single)
+        Optimizer::refineMapPoint(mpt_single, 10);
+    double t3 = (double)cv::getTickCount();
+    std::vector<std::vector<KeyFrame::Ptr> > outliers;
+    Optimizer::refineMapPoints(mpts_batch, 10, &outliers, 2.0/480.0);
+    double t4 = (double)cv::getTickCount();
+
+    const double time_single = (t3-t2)*1000/cv::getTickFrequency();
+    const double time_batch = (t4-t3)*1000/cv::getTickFrequency();
+    size_t num_outliers = 0;
+    for(const auto &outliers_j : outliers)
+        num_outliers += outliers_j.size();
+
+    std::cout << "Refine " << num_mpts << " MapPoints with " << num_kfs << " observations each" << std::endl;
+    std::cout << "[single] mean error: " << meanError(mpts_single) << ", time: " << time_single << "ms, "
+              << num_mpts / time_single << " points/ms" << std::endl;
+    std::cout << "[batch ] mean error: " << meanError(mpts_batch) << ", time: " << time_batch << "ms, "
+              << num_mpts / time_batch << " points/ms, outliers: " << num_outliers << std::endl;
+
+    //! the same accuracy as the per-point refinement, and the pixel noise makes few outliers
+    const double error_single = meanError(mpts_single);
+    const double error_batch = meanError(mpts_batch);
+    double error_init = 0;
+    for(int j = 0; j < num_mpts; ++j)
+        error_init += (poses_init[j] - poses_true[j]).norm();
+    error_init /= num_mpts;
+    LOG_ASSERT(error_batch < error_init) << " The batch refinement does not reduce the error: " << error_batch << " >= " << error_init;
+    LOG_ASSERT(error_batch <= error_single * 1.05) << " The batch refinement is worse: " << error_batch << " > " << error_single;
+    LOG_ASSERT(outliers.size() == (size_t)num_mpts) << " Wrong outliers size: " << outliers.size();
+    LOG_ASSERT(num_outliers < (size_t)(num_mpts * num_kfs) / 100) << " Too many outliers: " << num_outliers;
+
     return 0;
 }
 
@@ -0,0 +1,98 @@
+#include <iostream>
+#include <string>
+#include <random>
+#include <opencv2/opencv.hpp>
+#include "config.hpp"
+#include "keyframe.hpp"
+#include "synthetic_map.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+void printLiveObjects(const std::string &title)
+{
+    std::cout << "[" << title << "] keyframes: " << KeyFrame::liveObjects()
+              << ", frames: " << Frame::liveObjects()
+              << ", features: " << Feature::liveObjects()
+              << ", seeds: " << Seed::liveObjects()
+              << ", map points: " << MapPoint::liveObjects() << std::endl;
+}
+
+//! what the mapper does over a long run: keyframes are inserted, observe points and seeds,
+//! reference each other, and then are culled with their points
+void runRound(const AbstractCamera::Ptr &cam, const cv::Mat &img, std::mt19937 &generator, int num_keyframes, int num_points)
+{
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    const SyntheticMap scene = createSyntheticMap(cam, img, generator, num_keyframes, num_points);
+
+    //! each keyframe references the previous one, and the seeds hold their keyframes
+    for(size_t i = 0; i < scene.keyframes.size(); ++i)
+    {
+        const KeyFrame::Ptr &kf = scene.keyframes[i];
+        if(i > 0)
+            kf->setRefKeyFrame(scene.keyframes[i - 1]);
+
+        for(int n = 0; n < 10; ++n)
+        {
+            const Vector2d px(uniform(generator) * cam->width(), uniform(generator) * cam->height());
+            Seed::Ptr seed = Seed::create(kf, px, cam->lift(px), 0, 5.0, 1.0);
+            kf->addSeed(Feature::create(px, 0, seed));
+        }
+        kf->getSubConnectedKeyFrames();
+    }
+
+    for(const MapPoint::Ptr &mpt : scene.mpts)
+        mpt->setBad();
+
+    for(const KeyFrame::Ptr &kf : scene.keyframes)
+        kf->setBad();
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 2)
+    {
+        std::cout << "Usage: ./test_ownership config_file" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+    Config::file_name_ = std::string(argv[1]);
+
+    AbstractCamera::Ptr cam = std::static_pointer_cast<AbstractCamera>(PinholeCamera::create(752, 480, 458.654, 457.296, 367.215, 248.375));
+    cv::Mat img = cv::Mat::zeros(cam->height(), cam->width(), CV_8UC1);
+
+    //! the first keyframe is never culled, keep it out of the rounds
+    KeyFrame::Ptr keyframe_first = KeyFrame::create(Frame::create(img, 0, cam));
+
+    std::mt19937 generator(0);
+    printLiveObjects("start");
+    const size_t kfs_before = KeyFrame::liveObjects();
+    const size_t frames_before = Frame::liveObjects();
+    const size_t fts_before = Feature::liveObjects();
+    const size_t seeds_before = Seed::liveObjects();
+    const size_t mpts_before = MapPoint::liveObjects();
+
+    const int rounds = 100;
+    double t0 = (double)cv::getTickCount();
+    for(int n = 0; n < rounds; ++n)
+    {
+        runRound(cam, img, generator, 10, 500);
+        if(n % 20 == 0)
+            printLiveObjects("round " + std::to_string(n));
+    }
+    double t1 = (double)cv::getTickCount();
+
+    printLiveObjects("end");
+    std::cout << "time per round: " << (t1-t0)*1000/cv::getTickFrequency()/rounds << "ms" << std::endl;
+
+    LOG_ASSERT(KeyFrame::liveObjects() == kfs_before) << " Keyframes leaked!";
+    LOG_ASSERT(Frame::liveObjects() == frames_before) << " Frames leaked!";
+    LOG_ASSERT(Feature::liveObjects() == fts_before) << " Features leaked!";
+    LOG_ASSERT(Seed::liveObjects() == seeds_before) << " Seeds leaked!";
+    LOG_ASSERT(MapPoint::liveObjects() == mpts_before) << " Map points leaked!";
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <numeric>
+#include "config.hpp"
+#include "thread_pool.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+int main(int argc, char const *argv[])
+{
+    if (argc != 2) {
+        std::cout << "Usage: ./test_thread_pool configflie" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+
+    Config::file_name_ = std::string(argv[1]);
+
+    ThreadPool &pool = ThreadPool::getInstance();
+    std::cout << "Thread pool size: " << pool.size() << std::endl;
+
+    //! parallelFor
+    const int N = 1000000;
+    std::vector<double> values(N, 0);
+    double t0 = (double)cv::getTickCount();
+    pool.parallelFor(ThreadPool::TASK_GENERAL, 0, N, [&](int i){ values[i] = std::sqrt((double)i); }, 1000);
+    double t1 = (double)cv::getTickCount();
+    for(int i = 0; i < N; i++)
+        values[i] -= std::sqrt((double)i);
+    double t2 = (double)cv::getTickCount();
+
+    double error = std::accumulate(values.begin(), values.end(), 0.0);
+    std::cout << "parallelFor error: " << error
+              << ", time: " << (t1-t0)/cv::getTickFrequency() << "s vs serial " << (t2-t1)/cv::getTickFrequency() << "s" << std::endl;
+    LOG_ASSERT(error == 0) << " Wrong results of parallelFor: " << error;
+
+    //! nested tasks
+    std::vector<std::future<int> > futures;
+    for(int n = 0; n < 16; n++)
+    {
+        futures.push_back(pool.submit(ThreadPool::TASK_GENERAL, [&pool, n](){
+            std::atomic<int> count(0);
+            pool.parallelFor(ThreadPool::TASK_GENERAL, 0, 100, [&count](int i){ count += i; });
+            return count.load() + n;
+        }));
+    }
+
+    int error_count = 0;
+    for(int n = 0; n < 16; n++)
+    {
+        if(futures[n].get() != 4950 + n)
+            error_count++;
+    }
+    std::cout << "Nested tasks error: " << error_count << std::endl;
+    LOG_ASSERT(error_count == 0) << " Wrong results of nested tasks: " << error_count;
+
+    pool.logStats();
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <string>
+#include <random>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <opencv2/opencv.hpp>
+#include "config.hpp"
+#include "keyframe.hpp"
+#include "synthetic_map.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+//! count all the heap allocations of this program
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = std::malloc(size);
+    if(p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+//! what the tracker and the mapper do with the local map for each frame:
+//! collect the points of the local keyframes, and the keyframes observing them
+size_t visitByCopy(const std::vector<KeyFrame::Ptr> &keyframes)
+{
+    size_t count = 0;
+    for(const KeyFrame::Ptr &kf : keyframes)
+    {
+        const std::vector<MapPoint::Ptr> mpts = kf->getMapPoints();
+        for(const MapPoint::Ptr &mpt : mpts)
+        {
+            const std::map<KeyFrame::Ptr, Feature::Ptr> obs = mpt->getObservations();
+            for(const auto &item : obs)
+                count += item.first->id_;
+        }
+    }
+    return count;
+}
+
+size_t visitByBuffer(const std::vector<KeyFrame::Ptr> &keyframes)
+{
+    static std::vector<MapPoint::Ptr> mpts;
+    static MapPoint::Observations obs;
+    size_t count = 0;
+    for(const KeyFrame::Ptr &kf : keyframes)
+    {
+        kf->getMapPoints(mpts);
+        for(const MapPoint::Ptr &mpt : mpts)
+        {
+            mpt->getObservations(obs);
+            for(const auto &item : obs)
+                count += item.first->id_;
+        }
+    }
+    return count;
+}
+
+size_t visitByVisitor(const std::vector<KeyFrame::Ptr> &keyframes)
+{
+    size_t count = 0;
+    for(const KeyFrame::Ptr &kf : keyframes)
+    {
+        kf->forEachFeature([&count](const MapPoint::Ptr &mpt, const Feature::Ptr &){
+            mpt->forEachObservation([&count](const KeyFrame::Ptr &kf_obs, const Feature::Ptr &){
+                count += kf_obs->id_;
+            });
+        });
+    }
+    return count;
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 2)
+    {
+        std::cout << "Usage: ./test_visitor config_file" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+    Config::file_name_ = std::string(argv[1]);
+
+    AbstractCamera::Ptr cam = std::static_pointer_cast<AbstractCamera>(PinholeCamera::create(752, 480, 458.654, 457.296, 367.215, 248.375));
+    cv::Mat img = cv::Mat::zeros(cam->height(), cam->width(), CV_8UC1);
+
+    //! each point is observed by 5 successive keyframes
+    const int num_keyframes = 10;
+    const int num_points = 1000;
+    std::mt19937 generator(0);
+    const SyntheticMap scene = createSyntheticMap(cam, img, generator, num_keyframes, num_points);
+    const std::vector<KeyFrame::Ptr> &keyframes = scene.keyframes;
+
+    const int frames = 100;
+    const std::vector<std::pair<std::string, size_t(*)(const std::vector<KeyFrame::Ptr>&)> > methods = {
+        {"copy   ", &visitByCopy},
+        {"buffer ", &visitByBuffer},
+        {"visitor", &visitByVisitor}};
+
+    for(const auto &method : methods)
+    {
+        //! warm up the buffers
+        const size_t checksum = method.second(keyframes);
+
+        const size_t allocations_before = allocations;
+        double t0 = (double)cv::getTickCount();
+        for(int n = 0; n < frames; ++n)
+            LOG_ASSERT(method.second(keyframes) == checksum) << " Different results!";
+        double t1 = (double)cv::getTickCount();
+        const size_t allocations_after = allocations;
+
+        std::cout << "[" << method.first << "] allocations per frame: " << (double)(allocations_after - allocations_before) / frames
+                  << ", time per frame: " << (t1-t0)*1000/cv::getTickFrequency()/frames << "ms" << std::endl;
+    }
+
+    //! the second-order neighbours are cached until the graph changes
+    KeyFrame::Ptr keyframe = keyframes[num_keyframes / 2];
+    keyframe->getSubConnectedKeyFrames();
+    size_t allocations_before = allocations;
+    for(int n = 0; n < frames; ++n)
+        keyframe->getSubConnectedKeyFrames();
+    std::cout << "[sub-connected] allocations per call: " << (double)(allocations - allocations_before) / frames << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <string>
+#include <random>
+#include <cstdio>
+#include <opencv2/opencv.hpp>
+#include "config.hpp"
+#include "vocabulary.hpp"
+
+using namespace ssvo;
+
+std::string Config::file_name_;
+
+//! the same descriptors with a few bits flipped, as the features seen again
+cv::Mat addNoise(const cv::Mat &descriptors, int bits, std::mt19937 &generator)
+{
+    std::uniform_int_distribution<int> uniform(0, Vocabulary::DESCRIPTOR_BYTES * 8 - 1);
+    cv::Mat noisy = descriptors.clone();
+    for(int i = 0; i < noisy.rows; ++i)
+    {
+        uchar *desc = noisy.ptr<uchar>(i);
+        for(int n = 0; n < bits; ++n)
+        {
+            const int bit = uniform(generator);
+            desc[bit / 8] ^= (uchar)(1 << (bit % 8));
+        }
+    }
+    return noisy;
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc != 1 && argc != 3)
+    {
+        std::cout << "Usage: ./test_vocabulary [k levels]" << std::endl;
+        return -1;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+
+    const int k = argc == 3 ? std::stoi(argv[1]) : 8;
+    const int levels = argc == 3 ? std::stoi(argv[2]) : 4;
+    const int num_features = 200;
+    const int noise_bits = 8;
+    const int num_queries = 100;
+
+    std::mt19937 generator(0);
+
+    const int sizes[] = {100, 500, 1000, 2000};
+    const int max_keyframes = sizes[3];
+    std::vector<cv::Mat> keyframes(max_keyframes);
+    for(cv::Mat &descriptors : keyframes)
+    {
+        descriptors = cv::Mat(num_features, Vocabulary::DESCRIPTOR_BYTES, CV_8UC1);
+        cv::randu(descriptors, cv::Scalar(0), cv::Scalar(256));
+    }
+
+    //! train by the first keyframes
+    std::vector<cv::Mat> training(keyframes.begin(), keyframes.begin() + 50);
+    double t0 = (double)cv::getTickCount();
+    Vocabulary::Ptr vocabulary = Vocabulary::create(k, levels);
+    vocabulary->train(training);
+    double t1 = (double)cv::getTickCount();
+    LOG_ASSERT(!vocabulary->empty()) << " The vocabulary is empty!";
+
+    const std::string file_name = "/tmp/ssvo_test_vocabulary.bin";
+    LOG_ASSERT(vocabulary->save(file_name)) << " Failed to save the vocabulary!";
+    Vocabulary::Ptr loaded = Vocabulary::load(file_name);
+    LOG_ASSERT(loaded && loaded->size() == vocabulary->size()) << " Failed to load the vocabulary!";
+    std::remove(file_name.c_str());
+
+    std::cout << "words: " << vocabulary->size()
+              << ", train time: " << (t1-t0)*1000/cv::getTickFrequency() << "ms" << std::endl;
+
+    std::vector<BowVector> bows(max_keyframes);
+    for(int i = 0; i < max_keyframes; ++i)
+    {
+        loaded->transform(keyframes[i], bows[i]);
+        BowVector bow;
+        vocabulary->transform(keyframes[i], bow);
+        LOG_ASSERT(bow == bows[i]) << " The loaded vocabulary is different at keyframe " << i;
+    }
+
+    std::uniform_int_distribution<int> uniform_id(0, max_keyframes - 1);
+    for(const int num_keyframes : sizes)
+    {
+        BowDatabase::Ptr database = BowDatabase::create(loaded);
+        for(int i = 0; i < num_keyframes; ++i)
+            database->add(i, bows[i]);
+        LOG_ASSERT(database->size() == (size_t)num_keyframes) << " Wrong entries: " << database->size();
+
+        std::vector<BowVector> queries(num_queries);
+        std::vector<int> expected(num_queries);
+        for(int n = 0; n < num_queries; ++n)
+        {
+            expected[n] = uniform_id(generator) % num_keyframes;
+            loaded->transform(addNoise(keyframes[expected[n]], noise_bits, generator), queries[n]);
+        }
+
+        int correct = 0;
+        std::vector<BowDatabase::Result> results;
+        t0 = (double)cv::getTickCount();
+        for(int n = 0; n < num_queries; ++n)
+        {
+            database->query(queries[n], results, 5);
+            if(!results.empty() && results[0].id == (uint64_t)expected[n])
+                correct++;
+        }
+        t1 = (double)cv::getTickCount();
+
+        LOG_ASSERT(correct > num_queries * 0.9) << " Too few correct queries: " << correct << "/" << num_queries;
+
+        std::cout << "keyframes: " << num_keyframes
+                  << ", correct: " << correct << "/" << num_queries
+                  << ", query time: " << (t1-t0)*1000/cv::getTickFrequency()/num_queries << "ms" << std::endl;
+    }
+
+    //! the erased keyframe is never retrieved
+    {
+        BowDatabase::Ptr database = BowDatabase::create(loaded);
+        for(int i = 0; i < sizes[0]; ++i)
+            database->add(i, bows[i]);
+        database->erase(0);
+        std::vector<BowDatabase::Result> results;
+        database->query(bows[0], results, sizes[0]);
+        for(const BowDatabase::Result &result : results)
+            LOG_ASSERT(result.id != 0) << " The erased keyframe is retrieved!";
+        LOG_ASSERT(database->size() == (size_t)sizes[0] - 1) << " Wrong entries: " << database->size();
+
+        //! nothing is retrieved after cleared, as a new map
+        database->clear();
+        database->query(bows[1], results, sizes[0]);
+        LOG_ASSERT(database->size() == 0 && results.empty()) << " The database is not cleared!";
+    }
+
+    return 0;
+}